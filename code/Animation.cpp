@@ -1,101 +1,348 @@
 #include "Animation.hpp"
 
 #include <iostream>
+#include <cmath>
+#include <algorithm>
+
+#define KEY_TIME_MAX 65535.0f
+#define KEY_VECTOR_MAX 65535.0f
+#define KEY_ROTATION_MAX 32767.0f
+
+// the three smallest components of a unit quaternion lie in [-1/sqrt(2), 1/sqrt(2)]
+#define SMALLEST_THREE_RANGE 0.70710678f
 
 Animation::Animation(
     double duration,
     double ticks_per_second,
     std::shared_ptr<Armature> armature,
-    GLuint channels_buffer,
-    GLuint channels_count
+    const AnimationCompressionSettings& compression
 ) noexcept :
     m_duration(duration),
     m_ticksPerSecond(ticks_per_second),
     m_armature(armature),
-    m_channels_buffer(channels_buffer),
-    m_channels_count(channels_count)
+    m_compression(compression),
+    m_channels_buffer(0),
+    m_keys_buffer(0),
+    m_channels(),
+    m_keys(),
+    m_source_keys_count(0),
+    m_uncompressed_size(0),
+    m_last_use_time(0.0)
 {
 
 }
 
+Animation::~Animation() noexcept {
+    evict();
+}
+
+void Animation::evict(void) noexcept {
+    if (m_channels_buffer) {
+        CHECK_GL_ERROR(glDeleteBuffers(1, &m_channels_buffer));
+        m_channels_buffer = 0;
+    }
+
+    if (m_keys_buffer) {
+        CHECK_GL_ERROR(glDeleteBuffers(1, &m_keys_buffer));
+        m_keys_buffer = 0;
+    }
+}
+
+float Animation::DecodeKeyTime(const AnimationGPUChannel& ch, const AnimationGPUKey& key) noexcept {
+    return static_cast<float>(key.x & 0xFFFFu) * ch.time_scale;
+}
+
+glm::vec3 Animation::DecodeVectorKey(const glm::vec4& range_min, const glm::vec4& range_extent, const AnimationGPUKey& key) noexcept {
+    const glm::vec3 q(
+        static_cast<float>(key.x >> 16u),
+        static_cast<float>(key.y & 0xFFFFu),
+        static_cast<float>(key.y >> 16u)
+    );
+
+    return glm::vec3(range_min) + glm::vec3(range_extent) * (q / KEY_VECTOR_MAX);
+}
+
+glm::vec4 Animation::DecodeRotationKey(const AnimationGPUKey& key) noexcept {
+    const uint32_t largest = (key.x >> 31u) | ((key.y >> 29u) & 2u);
+    const glm::vec3 abc = glm::vec3(
+        static_cast<float>((key.x >> 16u) & 0x7FFFu),
+        static_cast<float>(key.y & 0x7FFFu),
+        static_cast<float>((key.y >> 15u) & 0x7FFFu)
+    ) * (2.0f * SMALLEST_THREE_RANGE / KEY_ROTATION_MAX) - SMALLEST_THREE_RANGE;
+    const float w = std::sqrt(std::max(0.0f, 1.0f - glm::dot(abc, abc)));
+
+    switch (largest) {
+        case 0u: return glm::vec4(w, abc.x, abc.y, abc.z);
+        case 1u: return glm::vec4(abc.x, w, abc.y, abc.z);
+        case 2u: return glm::vec4(abc.x, abc.y, w, abc.z);
+        default: return glm::vec4(abc.x, abc.y, abc.z, w);
+    }
+}
+
+glm::vec4 Animation::SlerpRotation(const glm::vec4& a, glm::vec4 b, float t) noexcept {
+    float cosom = glm::dot(a, b);
+    if (cosom < 0.0f) { b = -b; cosom = -cosom; }
+    if (cosom > 0.9995f) {
+        // nearly the same rotation: linear interpolation avoids dividing by a vanishing sine
+        return glm::normalize(a + t * (b - a));
+    }
+    const float omega = std::acos(std::clamp(cosom, -1.0f, 1.0f));
+    const float sinom = std::sin(omega);
+    return a * (std::sin((1.0f - t) * omega) / sinom) + b * (std::sin(t * omega) / sinom);
+}
+
+/**
+ * Greedy removal of the keys that linear interpolation between their neighbours reproduces
+ * within the tolerance: returns the indices of the keys to keep.
+ * A track whose keys all match the first one collapses to that single key.
+ */
+template <typename T, typename Interpolate, typename Distance>
+static std::vector<size_t> reduce_keys(
+    const std::vector<double>& times,
+    const std::vector<T>& values,
+    float tolerance,
+    Interpolate interpolate,
+    Distance distance
+) noexcept {
+    std::vector<size_t> kept;
+    if (values.empty()) return kept;
+
+    kept.push_back(0);
+
+    const auto constant = std::all_of(values.begin(), values.end(), [&](const T& v) {
+        return distance(values[0], v) <= tolerance;
+    });
+    if (constant || (tolerance <= 0.0f)) {
+        if (!constant) {
+            for (size_t i = 1; i < values.size(); ++i) kept.push_back(i);
+        }
+        return kept;
+    }
+
+    size_t anchor = 0;
+    for (size_t i = 1; i + 1 < values.size(); ++i) {
+        // can the segment anchor -> i+1 replace every key in between?
+        const double span = times[i + 1] - times[anchor];
+        bool removable = span > 0.0;
+        for (size_t j = anchor + 1; removable && (j <= i); ++j) {
+            const auto a = static_cast<float>((times[j] - times[anchor]) / span);
+            removable = distance(interpolate(values[anchor], values[i + 1], a), values[j]) <= tolerance;
+        }
+
+        if (!removable) {
+            kept.push_back(i);
+            anchor = i;
+        }
+    }
+
+    kept.push_back(values.size() - 1);
+
+    return kept;
+}
+
+static uint32_t quantize(float value, float max) noexcept {
+    return static_cast<uint32_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * max));
+}
+
 bool Animation::addChannel(
     std::string armature_node_name,
     const std::vector<std::tuple<double, glm::vec3>>& position_keys,
     const std::vector<std::tuple<double, glm::quat>>& rotation_keys,
     const std::vector<std::tuple<double, glm::vec3>>& scaling_keys
 ) noexcept {
-    assert(position_keys.size() <= MAX_ANIMATION_KEYS_PER_CHANNEL && "Exceeded maximum number of position keys per channel");
-    assert(rotation_keys.size() <= MAX_ANIMATION_KEYS_PER_CHANNEL && "Exceeded maximum number of rotation keys per channel");
-    assert(scaling_keys.size() <= MAX_ANIMATION_KEYS_PER_CHANNEL && "Exceeded maximum number of scaling keys per channel");
-    assert(m_channels_count < MAX_ANIMATION_CHANNELS && "Exceeded maximum number of animation channels");
+    assert(m_channels.size() < MAX_ANIMATION_CHANNELS && "Exceeded maximum number of animation channels");
+    assert((m_channels_buffer == 0) && "Channels cannot be added after the animation has been uploaded");
 
     AnimationGPUChannel gpu_channel = {};
     const auto armature_node_index_opt = m_armature->findArmatureNodeByName(armature_node_name);
     assert(armature_node_index_opt.has_value() && "Armature node not found in armature");
 
     gpu_channel.armature_element_index = armature_node_index_opt.value();
-    gpu_channel.position_key_count = static_cast<uint32_t>(position_keys.size());
-    for (size_t i = 0; i < position_keys.size(); ++i) {
-        gpu_channel.position_key_times[i] = static_cast<float>(std::get<0>(position_keys[i]));
-        gpu_channel.position_key_value_x[i] = std::get<1>(position_keys[i]).x;
-        gpu_channel.position_key_value_y[i] = std::get<1>(position_keys[i]).y;
-        gpu_channel.position_key_value_z[i] = std::get<1>(position_keys[i]).z;
+
+    const float duration = static_cast<float>(std::max(m_duration, 0.0));
+    gpu_channel.time_scale = duration / KEY_TIME_MAX;
+
+    const auto quantize_time = [duration](double time) -> uint32_t {
+        return (duration > 0.0f) ? quantize(static_cast<float>(time) / duration, KEY_TIME_MAX) : 0u;
+    };
+
+    const float tolerance = m_compression.tolerance;
+    const float reference = m_compression.reference_distance;
+
+    const auto vector_mix = [](const glm::vec3& a, const glm::vec3& b, float t) { return glm::mix(a, b, t); };
+
+    // positions: error is the distance between the two translations
+    {
+        std::vector<double> times;
+        std::vector<glm::vec3> values;
+        for (const auto& [time, value] : position_keys) {
+            times.push_back(time);
+            values.push_back(value);
+        }
+
+        const auto kept = reduce_keys(times, values, tolerance, vector_mix, [](const glm::vec3& a, const glm::vec3& b) {
+            return glm::length(a - b);
+        });
+
+        glm::vec3 range_min(0.0f), range_max(0.0f);
+        if (!kept.empty()) {
+            range_min = range_max = values[kept[0]];
+            for (const auto k : kept) {
+                range_min = glm::min(range_min, values[k]);
+                range_max = glm::max(range_max, values[k]);
+            }
+        }
+        const glm::vec3 extent = range_max - range_min;
+
+        gpu_channel.position_key_count = static_cast<uint32_t>(kept.size());
+        gpu_channel.position_key_offset = static_cast<uint32_t>(m_keys.size());
+        gpu_channel.position_min = glm::vec4(range_min, 0.0f);
+        gpu_channel.position_extent = glm::vec4(extent, 0.0f);
+        for (const auto k : kept) {
+            const glm::vec3 n = glm::vec3(
+                (extent.x > 0.0f) ? (values[k].x - range_min.x) / extent.x : 0.0f,
+                (extent.y > 0.0f) ? (values[k].y - range_min.y) / extent.y : 0.0f,
+                (extent.z > 0.0f) ? (values[k].z - range_min.z) / extent.z : 0.0f
+            );
+            m_keys.push_back(AnimationGPUKey {
+                quantize_time(times[k]) | (quantize(n.x, KEY_VECTOR_MAX) << 16u),
+                quantize(n.y, KEY_VECTOR_MAX) | (quantize(n.z, KEY_VECTOR_MAX) << 16u),
+            });
+        }
     }
 
-    gpu_channel.rotation_key_count = static_cast<uint32_t>(rotation_keys.size());
-    for (size_t i = 0; i < rotation_keys.size(); ++i) {
-        gpu_channel.rotation_key_times[i] = static_cast<float>(std::get<0>(rotation_keys[i]));
-        gpu_channel.rotation_key_value_x[i] = std::get<1>(rotation_keys[i]).x;
-        gpu_channel.rotation_key_value_y[i] = std::get<1>(rotation_keys[i]).y;
-        gpu_channel.rotation_key_value_z[i] = std::get<1>(rotation_keys[i]).z;
-        gpu_channel.rotation_key_value_w[i] = std::get<1>(rotation_keys[i]).w;
+    // rotations: error is the displacement of a point at the reference distance from the joint
+    {
+        std::vector<double> times;
+        std::vector<glm::vec4> values;
+        for (const auto& [time, value] : rotation_keys) {
+            times.push_back(time);
+            values.push_back(glm::normalize(glm::vec4(value.x, value.y, value.z, value.w)));
+        }
+
+        const auto kept = reduce_keys(times, values, tolerance, Animation::SlerpRotation, [reference](const glm::vec4& a, const glm::vec4& b) {
+            // chord of the angle between the rotations: 2 * sin(angle / 2)
+            const float cos_half = std::min(std::abs(glm::dot(a, b)), 1.0f);
+            return 2.0f * reference * std::sqrt(1.0f - cos_half * cos_half);
+        });
+
+        gpu_channel.rotation_key_count = static_cast<uint32_t>(kept.size());
+        gpu_channel.rotation_key_offset = static_cast<uint32_t>(m_keys.size());
+        for (const auto k : kept) {
+            glm::vec4 q = values[k];
+
+            uint32_t largest = 0u;
+            for (uint32_t c = 1u; c < 4u; ++c) {
+                if (std::abs(q[c]) > std::abs(q[largest])) largest = c;
+            }
+
+            // q and -q are the same rotation: make the dropped component positive
+            if (q[largest] < 0.0f) q = -q;
+
+            uint32_t small[3];
+            for (uint32_t c = 0u, s = 0u; c < 4u; ++c) {
+                if (c == largest) continue;
+                small[s++] = quantize((q[c] + SMALLEST_THREE_RANGE) / (2.0f * SMALLEST_THREE_RANGE), KEY_ROTATION_MAX);
+            }
+
+            m_keys.push_back(AnimationGPUKey {
+                quantize_time(times[k]) | (small[0] << 16u) | ((largest & 1u) << 31u),
+                small[1] | (small[2] << 15u) | ((largest >> 1u) << 30u),
+            });
+        }
     }
 
-    gpu_channel.scaling_key_count = static_cast<uint32_t>(scaling_keys.size());
-    for (size_t i = 0; i < scaling_keys.size(); ++i) {
-        gpu_channel.scaling_key_times[i] = static_cast<float>(std::get<0>(scaling_keys[i]));
-        gpu_channel.scaling_key_value_x[i] = std::get<1>(scaling_keys[i]).x;
-        gpu_channel.scaling_key_value_y[i] = std::get<1>(scaling_keys[i]).y;
-        gpu_channel.scaling_key_value_z[i] = std::get<1>(scaling_keys[i]).z;
+    // scalings: error is the displacement of a point at the reference distance along each axis
+    {
+        std::vector<double> times;
+        std::vector<glm::vec3> values;
+        for (const auto& [time, value] : scaling_keys) {
+            times.push_back(time);
+            values.push_back(value);
+        }
+
+        const auto kept = reduce_keys(times, values, tolerance, vector_mix, [reference](const glm::vec3& a, const glm::vec3& b) {
+            return reference * glm::length(a - b);
+        });
+
+        glm::vec3 range_min(1.0f), range_max(1.0f);
+        if (!kept.empty()) {
+            range_min = range_max = values[kept[0]];
+            for (const auto k : kept) {
+                range_min = glm::min(range_min, values[k]);
+                range_max = glm::max(range_max, values[k]);
+            }
+        }
+        const glm::vec3 extent = range_max - range_min;
+
+        gpu_channel.scaling_key_count = static_cast<uint32_t>(kept.size());
+        gpu_channel.scaling_key_offset = static_cast<uint32_t>(m_keys.size());
+        gpu_channel.scaling_min = glm::vec4(range_min, 0.0f);
+        gpu_channel.scaling_extent = glm::vec4(extent, 0.0f);
+        for (const auto k : kept) {
+            const glm::vec3 n = glm::vec3(
+                (extent.x > 0.0f) ? (values[k].x - range_min.x) / extent.x : 0.0f,
+                (extent.y > 0.0f) ? (values[k].y - range_min.y) / extent.y : 0.0f,
+                (extent.z > 0.0f) ? (values[k].z - range_min.z) / extent.z : 0.0f
+            );
+            m_keys.push_back(AnimationGPUKey {
+                quantize_time(times[k]) | (quantize(n.x, KEY_VECTOR_MAX) << 16u),
+                quantize(n.y, KEY_VECTOR_MAX) | (quantize(n.z, KEY_VECTOR_MAX) << 16u),
+            });
+        }
     }
 
-    // Upload the channel data to the GPU buffer at the correct offset
-    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_channels_buffer));
-    CHECK_GL_ERROR(glBufferSubData(
-        GL_SHADER_STORAGE_BUFFER,
-        static_cast<GLsizeiptr>(m_channels_count * sizeof(AnimationGPUChannel)),
-        sizeof(AnimationGPUChannel),
-        &gpu_channel
-    ));
-    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
-    m_channels_count += 1;
+    m_source_keys_count += position_keys.size() + rotation_keys.size() + scaling_keys.size();
+    m_uncompressed_size +=
+        position_keys.size() * sizeof(float) * 4 +
+        rotation_keys.size() * sizeof(float) * 5 +
+        scaling_keys.size() * sizeof(float) * 4;
+
+    m_channels.push_back(gpu_channel);
 
     return true;
 }
 
+void Animation::upload(void) noexcept {
+    if (isResident()) return;
+
+    // Create the shader storage buffers (SSBO) to hold the channel headers and the keys:
+    // an empty animation still gets one (zeroed) element so that the buffers can be bound.
+    const auto create_buffer = [](const void* data, size_t size, size_t element_size) -> GLuint {
+        GLuint buffer = 0;
+        const std::vector<uint8_t> empty(element_size, 0u);
+
+        CHECK_GL_ERROR(glGenBuffers(1, &buffer));
+        CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer));
+        CHECK_GL_ERROR(glBufferData(
+            GL_SHADER_STORAGE_BUFFER,
+            static_cast<GLsizeiptr>(size ? size : element_size),
+            size ? data : empty.data(),
+            GL_STATIC_DRAW
+        ));
+        CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+        return buffer;
+    };
+
+    m_channels_buffer = create_buffer(m_channels.data(), m_channels.size() * sizeof(AnimationGPUChannel), sizeof(AnimationGPUChannel));
+    m_keys_buffer = create_buffer(m_keys.data(), m_keys.size() * sizeof(AnimationGPUKey), sizeof(AnimationGPUKey));
+}
+
+size_t Animation::getGPUSize() const noexcept {
+    return m_channels.size() * sizeof(AnimationGPUChannel) + m_keys.size() * sizeof(AnimationGPUKey);
+}
+
 Animation* Animation::CreateAnimation(
     double duration,
     double ticks_per_second,
-    std::shared_ptr<Armature> armature
+    std::shared_ptr<Armature> armature,
+    const AnimationCompressionSettings& compression
 ) noexcept {
-    GLuint channels_buffer = 0;
-
-    // Create a shader storage buffer (SSBO) to hold the animation channels data.
-    CHECK_GL_ERROR(glGenBuffers(1, &channels_buffer));
-    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, channels_buffer));
-    CHECK_GL_ERROR(glBufferData(
-        GL_SHADER_STORAGE_BUFFER,
-        static_cast<GLsizeiptr>(MAX_ANIMATION_CHANNELS * sizeof(AnimationGPUChannel)),
-        nullptr,
-        GL_STATIC_DRAW
-    ));
-    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
-
     return new Animation(
         duration,
         ticks_per_second,
         armature,
-        channels_buffer,
-        0u
+        compression
     );
 }
@@ -11,33 +11,52 @@
 
 #define MAX_ANIMATION_CHANNELS 128u
 
-#define MAX_ANIMATION_KEYS_PER_CHANNEL 64u
-
+/**
+ * Channel header: keys are stored compressed in the animation keys buffer.
+ *
+ * Every key is an uvec2 whose lower 16 bits hold the key time, quantized over the
+ * animation duration (time = q * time_scale).
+ * Positions and scalings are range-quantized to 16 bits per component
+ * (value = min + extent * q / 65535): x = time | qx << 16, y = qy | qz << 16.
+ * Rotations use the smallest-three encoding with 15 bits per component:
+ * x = time | qa << 16 | largest_lo << 31, y = qb | qc << 15 | largest_hi << 30.
+ */
 struct AnimationGPUChannel {
     // The index of a ArmatureGPUElement in the Armature's nodes buffer
     uint32_t armature_element_index;
 
     uint32_t position_key_count;
-    float position_key_times[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float position_key_value_x[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float position_key_value_y[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float position_key_value_z[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    
-    // TODO: type of interpolation (e.g., linear, cubic, etc.)
-    //glm::uint position_key_transform[MAX_ANIMATION_KEYS_PER_CHANNEL];
+    uint32_t position_key_offset;
 
     uint32_t rotation_key_count;
-    float rotation_key_times[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float rotation_key_value_x[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float rotation_key_value_y[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float rotation_key_value_z[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float rotation_key_value_w[MAX_ANIMATION_KEYS_PER_CHANNEL];
+    uint32_t rotation_key_offset;
 
     uint32_t scaling_key_count;
-    float scaling_key_times[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float scaling_key_value_x[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float scaling_key_value_y[MAX_ANIMATION_KEYS_PER_CHANNEL];
-    float scaling_key_value_z[MAX_ANIMATION_KEYS_PER_CHANNEL];
+    uint32_t scaling_key_offset;
+
+    float time_scale;
+
+    glm::vec4 position_min;
+    glm::vec4 position_extent;
+
+    glm::vec4 scaling_min;
+    glm::vec4 scaling_extent;
+};
+
+static_assert(sizeof(AnimationGPUChannel) == 96, "AnimationGPUChannel must match the std430 layout of animate.comp");
+
+struct AnimationGPUKey {
+    uint32_t x;
+    uint32_t y;
+};
+
+struct AnimationCompressionSettings {
+    // largest error a removed key may introduce, in bone space units
+    float tolerance;
+
+    // rotation errors are measured as the displacement of a point this far from the joint
+    // (and scaling errors as the displacement of a point this far along each axis)
+    float reference_distance;
 };
 
 class Animation {
@@ -46,11 +65,10 @@ public:
         double duration,
         double ticks_per_second,
         std::shared_ptr<Armature> armature,
-        GLuint channels_buffer,
-        GLuint channels_count
+        const AnimationCompressionSettings& compression
     ) noexcept;
 
-    ~Animation() = default;
+    ~Animation() noexcept;
 
     Animation(const Animation&) = delete;
 
@@ -59,7 +77,8 @@ public:
     static Animation* CreateAnimation(
         double duration,
         double ticks_per_second,
-        std::shared_ptr<Armature> armature
+        std::shared_ptr<Armature> armature,
+        const AnimationCompressionSettings& compression
     ) noexcept;
 
     double getDuration() const noexcept { return m_duration; }
@@ -73,9 +92,54 @@ public:
         const std::vector<std::tuple<double, glm::vec3>>& scaling_keys
     ) noexcept;
 
+    /**
+     * Upload the channel headers and the compressed keys to the GPU, after the last addChannel.
+     * Nothing is done while the clip is resident: clips are uploaded when first played.
+     */
+    void upload(void) noexcept;
+
+    /**
+     * Release the GPU buffers: the CPU copy is kept, so the clip can be uploaded again.
+     */
+    void evict(void) noexcept;
+
+    bool isResident() const noexcept { return m_channels_buffer != 0; }
+
+    // last time (in seconds, see Scene) the clip was needed on the GPU
+    double getLastUseTime() const noexcept { return m_last_use_time; }
+
+    void markUsed(double time) noexcept { m_last_use_time = time; }
+
     GLuint getChannelsBuffer() const noexcept { return m_channels_buffer; }
 
-    GLuint getChannelsCount() const noexcept { return m_channels_count; }
+    GLuint getKeysBuffer() const noexcept { return m_keys_buffer; }
+
+    GLuint getChannelsCount() const noexcept { return static_cast<GLuint>(m_channels.size()); }
+
+    // CPU copy of the channels buffer
+    const std::vector<AnimationGPUChannel>& getChannels() const noexcept { return m_channels; }
+
+    // CPU copy of the keys buffer
+    const std::vector<AnimationGPUKey>& getKeys() const noexcept { return m_keys; }
+
+    // number of keys received by addChannel, before the redundant ones were removed
+    size_t getSourceKeysCount() const noexcept { return m_source_keys_count; }
+
+    // bytes used on the GPU by the channels and keys buffers, once resident
+    size_t getGPUSize() const noexcept;
+
+    // bytes the uncompressed float keys would take (time + value per key)
+    size_t getUncompressedSize() const noexcept { return m_uncompressed_size; }
+
+    // Decoding helpers: same as the ones in animate.comp
+    static float DecodeKeyTime(const AnimationGPUChannel& ch, const AnimationGPUKey& key) noexcept;
+
+    static glm::vec3 DecodeVectorKey(const glm::vec4& range_min, const glm::vec4& range_extent, const AnimationGPUKey& key) noexcept;
+
+    static glm::vec4 DecodeRotationKey(const AnimationGPUKey& key) noexcept;
+
+    // Interpolation between two rotation keys (xyzw quaternions): same as the one in animate.comp
+    static glm::vec4 SlerpRotation(const glm::vec4& a, glm::vec4 b, float t) noexcept;
 
 private:
     double m_duration;
@@ -84,6 +148,18 @@ private:
 
     std::shared_ptr<Armature> m_armature;
 
+    AnimationCompressionSettings m_compression;
+
     GLuint m_channels_buffer;
-    GLuint m_channels_count;
+    GLuint m_keys_buffer;
+
+    std::vector<AnimationGPUChannel> m_channels;
+
+    std::vector<AnimationGPUKey> m_keys;
+
+    size_t m_source_keys_count;
+
+    size_t m_uncompressed_size;
+
+    double m_last_use_time;
 };
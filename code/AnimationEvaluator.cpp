@@ -0,0 +1,478 @@
+#include "AnimationEvaluator.hpp"
+
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <system_error>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 1))
+    #include <xmmintrin.h>
+    #define ANIMATION_EVALUATOR_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define ANIMATION_EVALUATOR_NEON 1
+#endif
+
+#define NO_ANIMATION_CHANNEL 0xFFFFFFFFu
+
+// 4-wide float lanes: a lane group holds the same element of 4 matrices (structure of arrays)
+#if defined(ANIMATION_EVALUATOR_SSE)
+typedef __m128 lane4;
+
+static inline lane4 lane4_load(const float* p) noexcept { return _mm_loadu_ps(p); }
+static inline void lane4_store(float* p, lane4 v) noexcept { _mm_storeu_ps(p, v); }
+static inline lane4 lane4_set1(float v) noexcept { return _mm_set1_ps(v); }
+static inline lane4 lane4_add(lane4 a, lane4 b) noexcept { return _mm_add_ps(a, b); }
+static inline lane4 lane4_sub(lane4 a, lane4 b) noexcept { return _mm_sub_ps(a, b); }
+static inline lane4 lane4_mul(lane4 a, lane4 b) noexcept { return _mm_mul_ps(a, b); }
+
+static inline void lane4_transpose(lane4& a, lane4& b, lane4& c, lane4& d) noexcept {
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+}
+#elif defined(ANIMATION_EVALUATOR_NEON)
+typedef float32x4_t lane4;
+
+static inline lane4 lane4_load(const float* p) noexcept { return vld1q_f32(p); }
+static inline void lane4_store(float* p, lane4 v) noexcept { vst1q_f32(p, v); }
+static inline lane4 lane4_set1(float v) noexcept { return vdupq_n_f32(v); }
+static inline lane4 lane4_add(lane4 a, lane4 b) noexcept { return vaddq_f32(a, b); }
+static inline lane4 lane4_sub(lane4 a, lane4 b) noexcept { return vsubq_f32(a, b); }
+static inline lane4 lane4_mul(lane4 a, lane4 b) noexcept { return vmulq_f32(a, b); }
+
+static inline void lane4_transpose(lane4& a, lane4& b, lane4& c, lane4& d) noexcept {
+    const float32x4x2_t ab = vtrnq_f32(a, b);
+    const float32x4x2_t cd = vtrnq_f32(c, d);
+    a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+#else
+struct lane4 { float v[4]; };
+
+static inline lane4 lane4_load(const float* p) noexcept { return lane4 { { p[0], p[1], p[2], p[3] } }; }
+static inline void lane4_store(float* p, lane4 v) noexcept { for (int i = 0; i < 4; ++i) p[i] = v.v[i]; }
+static inline lane4 lane4_set1(float v) noexcept { return lane4 { { v, v, v, v } }; }
+static inline lane4 lane4_add(lane4 a, lane4 b) noexcept { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+static inline lane4 lane4_sub(lane4 a, lane4 b) noexcept { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+static inline lane4 lane4_mul(lane4 a, lane4 b) noexcept { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+
+static inline void lane4_transpose(lane4& a, lane4& b, lane4& c, lane4& d) noexcept {
+    const lane4 r[4] = { a, b, c, d };
+    lane4* out[4] = { &a, &b, &c, &d };
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) out[i]->v[j] = r[j].v[i];
+    }
+}
+#endif
+
+// out = a * b (column-major, out can alias a or b): a column of a per lane group
+static inline void mat4_mul(const glm::mat4& a, const glm::mat4& b, glm::mat4& out) noexcept {
+    const float *const pa = &a[0][0];
+    const float *const pb = &b[0][0];
+    float *const po = &out[0][0];
+
+    const lane4 a0 = lane4_load(pa + 0);
+    const lane4 a1 = lane4_load(pa + 4);
+    const lane4 a2 = lane4_load(pa + 8);
+    const lane4 a3 = lane4_load(pa + 12);
+    lane4 columns[4];
+    for (int c = 0; c < 4; ++c) {
+        lane4 r = lane4_mul(a0, lane4_set1(pb[c * 4 + 0]));
+        r = lane4_add(r, lane4_mul(a1, lane4_set1(pb[c * 4 + 1])));
+        r = lane4_add(r, lane4_mul(a2, lane4_set1(pb[c * 4 + 2])));
+        r = lane4_add(r, lane4_mul(a3, lane4_set1(pb[c * 4 + 3])));
+        columns[c] = r;
+    }
+    for (int c = 0; c < 4; ++c) lane4_store(po + c * 4, columns[c]);
+}
+
+// m[c][r] = element r of column c of 4 matrices, one per lane
+typedef lane4 mat4x4_lanes[4][4];
+
+static inline void load_mat4_lanes(const glm::mat4 *const matrices[4], mat4x4_lanes& m) noexcept {
+    for (int c = 0; c < 4; ++c) {
+        m[c][0] = lane4_load(&(*matrices[0])[c][0]);
+        m[c][1] = lane4_load(&(*matrices[1])[c][0]);
+        m[c][2] = lane4_load(&(*matrices[2])[c][0]);
+        m[c][3] = lane4_load(&(*matrices[3])[c][0]);
+        lane4_transpose(m[c][0], m[c][1], m[c][2], m[c][3]);
+    }
+}
+
+static inline void store_mat4_lanes(mat4x4_lanes& m, glm::mat4 *const matrices[4]) noexcept {
+    for (int c = 0; c < 4; ++c) {
+        lane4_transpose(m[c][0], m[c][1], m[c][2], m[c][3]);
+        lane4_store(&(*matrices[0])[c][0], m[c][0]);
+        lane4_store(&(*matrices[1])[c][0], m[c][1]);
+        lane4_store(&(*matrices[2])[c][0], m[c][2]);
+        lane4_store(&(*matrices[3])[c][0], m[c][3]);
+    }
+}
+
+// out[i] = a[i] * b[i] for 4 pairs at once (out can alias a or b)
+static void mat4_mul_x4(const glm::mat4 *const a[4], const glm::mat4 *const b[4], glm::mat4 *const out[4]) noexcept {
+    mat4x4_lanes la;
+    mat4x4_lanes lb;
+    load_mat4_lanes(a, la);
+    load_mat4_lanes(b, lb);
+
+    mat4x4_lanes lo;
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 4; ++r) {
+            lane4 v = lane4_mul(la[0][r], lb[c][0]);
+            v = lane4_add(v, lane4_mul(la[1][r], lb[c][1]));
+            v = lane4_add(v, lane4_mul(la[2][r], lb[c][2]));
+            v = lane4_add(v, lane4_mul(la[3][r], lb[c][3]));
+            lo[c][r] = v;
+        }
+    }
+
+    store_mat4_lanes(lo, out);
+}
+
+// Everything below mirrors animate.comp: keep the two in sync.
+
+// Components of the sampled T, R, S of a node, for mat4_from_trs_x4
+enum TRSComponent : size_t {
+    TRS_TX, TRS_TY, TRS_TZ,
+    TRS_QX, TRS_QY, TRS_QZ, TRS_QW,
+    TRS_SX, TRS_SY, TRS_SZ,
+    TRS_COMPONENTS
+};
+
+// T * R * S of 4 nodes, trs[k] holding component k of each of them
+static void mat4_from_trs_x4(const float *const trs[TRS_COMPONENTS], glm::mat4 *const out[4]) noexcept {
+    const lane4 x = lane4_load(trs[TRS_QX]);
+    const lane4 y = lane4_load(trs[TRS_QY]);
+    const lane4 z = lane4_load(trs[TRS_QZ]);
+    const lane4 w = lane4_load(trs[TRS_QW]);
+    const lane4 x2 = lane4_add(x, x);
+    const lane4 y2 = lane4_add(y, y);
+    const lane4 z2 = lane4_add(z, z);
+
+    const lane4 xx = lane4_mul(x, x2);
+    const lane4 xy = lane4_mul(x, y2);
+    const lane4 xz = lane4_mul(x, z2);
+    const lane4 yy = lane4_mul(y, y2);
+    const lane4 yz = lane4_mul(y, z2);
+    const lane4 zz = lane4_mul(z, z2);
+    const lane4 wx = lane4_mul(w, x2);
+    const lane4 wy = lane4_mul(w, y2);
+    const lane4 wz = lane4_mul(w, z2);
+
+    const lane4 sx = lane4_load(trs[TRS_SX]);
+    const lane4 sy = lane4_load(trs[TRS_SY]);
+    const lane4 sz = lane4_load(trs[TRS_SZ]);
+    const lane4 zero = lane4_set1(0.0f);
+    const lane4 one = lane4_set1(1.0f);
+
+    mat4x4_lanes m = {
+        { lane4_mul(lane4_sub(one, lane4_add(yy, zz)), sx), lane4_mul(lane4_add(xy, wz), sx), lane4_mul(lane4_sub(xz, wy), sx), zero },
+        { lane4_mul(lane4_sub(xy, wz), sy), lane4_mul(lane4_sub(one, lane4_add(xx, zz)), sy), lane4_mul(lane4_add(yz, wx), sy), zero },
+        { lane4_mul(lane4_add(xz, wy), sz), lane4_mul(lane4_sub(yz, wx), sz), lane4_mul(lane4_sub(one, lane4_add(xx, yy)), sz), zero },
+        { lane4_load(trs[TRS_TX]), lane4_load(trs[TRS_TY]), lane4_load(trs[TRS_TZ]), one },
+    };
+
+    store_mat4_lanes(m, out);
+}
+
+static float find_key_interval(const AnimationGPUKey *const keys, uint32_t count, const AnimationGPUChannel& ch, float t, uint32_t& idx) noexcept {
+    if (count == 0u) { idx = 0u; return 0.0f; }
+    if (t <= Animation::DecodeKeyTime(ch, keys[0])) { idx = 0u; return 0.0f; }
+    const uint32_t last = count - 1u;
+    if (t >= Animation::DecodeKeyTime(ch, keys[last])) { idx = last; return 0.0f; }
+    // binary search, keeping time(lo) <= t < time(hi)
+    uint32_t lo = 0u;
+    uint32_t hi = last;
+    while (hi - lo > 1u) {
+        const uint32_t mid = (lo + hi) / 2u;
+        if (Animation::DecodeKeyTime(ch, keys[mid]) <= t) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    idx = lo;
+    const float t0 = Animation::DecodeKeyTime(ch, keys[lo]);
+    const float denom = Animation::DecodeKeyTime(ch, keys[hi]) - t0;
+    return (denom > 0.0f) ? ((t - t0) / denom) : 0.0f;
+}
+
+static glm::vec3 sample_position(const AnimationGPUChannel& ch, const AnimationGPUKey *const keys, float t) noexcept {
+    if (ch.position_key_count == 0u) return glm::vec3(0.0f);
+    const AnimationGPUKey *const track = keys + ch.position_key_offset;
+    uint32_t i = 0u;
+    const float a = find_key_interval(track, ch.position_key_count, ch, t, i);
+    const glm::vec3 v0 = Animation::DecodeVectorKey(ch.position_min, ch.position_extent, track[i]);
+    if (a == 0.0f && i == ch.position_key_count - 1u) return v0;
+    const glm::vec3 v1 = Animation::DecodeVectorKey(ch.position_min, ch.position_extent, track[i + 1u]);
+    return glm::mix(v0, v1, a);
+}
+
+static glm::vec3 sample_scaling(const AnimationGPUChannel& ch, const AnimationGPUKey *const keys, float t) noexcept {
+    if (ch.scaling_key_count == 0u) return glm::vec3(1.0f);
+    const AnimationGPUKey *const track = keys + ch.scaling_key_offset;
+    uint32_t i = 0u;
+    const float a = find_key_interval(track, ch.scaling_key_count, ch, t, i);
+    const glm::vec3 s0 = Animation::DecodeVectorKey(ch.scaling_min, ch.scaling_extent, track[i]);
+    if (a == 0.0f && i == ch.scaling_key_count - 1u) return s0;
+    const glm::vec3 s1 = Animation::DecodeVectorKey(ch.scaling_min, ch.scaling_extent, track[i + 1u]);
+    return glm::mix(s0, s1, a);
+}
+
+static glm::vec4 sample_rotation(const AnimationGPUChannel& ch, const AnimationGPUKey *const keys, float t) noexcept {
+    if (ch.rotation_key_count == 0u) return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    const AnimationGPUKey *const track = keys + ch.rotation_key_offset;
+    uint32_t i = 0u;
+    const float a = find_key_interval(track, ch.rotation_key_count, ch, t, i);
+    const glm::vec4 q0 = glm::normalize(Animation::DecodeRotationKey(track[i]));
+    if (a == 0.0f && i == ch.rotation_key_count - 1u) return q0;
+    const glm::vec4 q1 = glm::normalize(Animation::DecodeRotationKey(track[i + 1u]));
+    return Animation::SlerpRotation(q0, q1, a);
+}
+
+AnimationEvaluator::AnimationEvaluator(uint32_t threads_count) noexcept :
+    m_threads_count(1u)
+{
+    // the thread calling evaluate() is one of the workers
+    try {
+        for (uint32_t i = 1u; i < threads_count; ++i) {
+            m_workers.emplace_back(&AnimationEvaluator::workerLoop, this);
+        }
+    } catch (const std::system_error& e) {
+        std::cerr << "Animation evaluator: started " << m_workers.size() << " of " << (threads_count - 1u) << " worker threads: " << e.what() << std::endl;
+    }
+
+    m_threads_count = static_cast<uint32_t>(m_workers.size()) + 1u;
+}
+
+AnimationEvaluator::~AnimationEvaluator() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_work_ready.notify_all();
+
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+AnimationEvaluator* AnimationEvaluator::CreateAnimationEvaluator(uint32_t threads_count) noexcept {
+    if (threads_count == 0u) {
+        threads_count = std::max(1u, static_cast<uint32_t>(std::thread::hardware_concurrency()));
+    }
+
+    return new AnimationEvaluator(threads_count);
+}
+
+void AnimationEvaluator::evaluate(
+    const SkeletonTree& skeleton,
+    const Animation* animation,
+    float time_in_ticks,
+    std::vector<glm::mat4>& palette
+) noexcept {
+    const auto& bones = skeleton.getBones();
+    palette.resize(bones.size());
+    if (bones.empty()) return;
+
+    const auto armature = skeleton.getArmature();
+    assert(armature && "A skeleton with bones must reference an armature");
+    const auto& nodes = armature->getNodes();
+
+    // scratch storage reused across calls made by the same thread
+    thread_local std::vector<glm::mat4> globals;
+    thread_local std::vector<glm::mat4> locals;
+    thread_local std::vector<uint8_t> needed;
+    thread_local std::vector<uint32_t> node_channel;
+    thread_local std::vector<uint32_t> animated;
+    thread_local std::vector<float> trs;
+
+    globals.resize(nodes.size());
+    locals.resize(nodes.size());
+    needed.assign(nodes.size(), 0u);
+
+    // only the nodes on the path from a bone to the root take part in the palette
+    for (const auto& bone : bones) {
+        uint32_t node = bone.armature_node_index;
+        while (!needed[node]) {
+            needed[node] = 1u;
+            const uint32_t parent = nodes[node].parent_index;
+            if (parent == node) break;
+            node = parent;
+        }
+    }
+
+    // same lookup as find_channel_for_node(): the first channel with keys wins
+    node_channel.assign(nodes.size(), NO_ANIMATION_CHANNEL);
+    if (animation) {
+        const auto& channels = animation->getChannels();
+        const auto channels_count = std::min<size_t>(channels.size(), MAX_ANIMATION_CHANNELS);
+        for (size_t ci = channels_count; ci-- > 0;) {
+            const auto& ch = channels[ci];
+            if (ch.position_key_count == 0u && ch.rotation_key_count == 0u && ch.scaling_key_count == 0u) continue;
+            if (ch.armature_element_index < node_channel.size()) {
+                node_channel[ch.armature_element_index] = static_cast<uint32_t>(ci);
+            }
+        }
+    }
+
+    animated.clear();
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        if (needed[n] && (node_channel[n] != NO_ANIMATION_CHANNEL)) animated.push_back(static_cast<uint32_t>(n));
+    }
+
+    // sample the channels (a key search per node), padding the last lane group with identities
+    const size_t lanes = (animated.size() + 3u) & ~size_t(3u);
+    trs.resize(lanes * TRS_COMPONENTS);
+    for (size_t i = 0; i < lanes; ++i) {
+        glm::vec3 t(0.0f);
+        glm::vec4 q(0.0f, 0.0f, 0.0f, 1.0f);
+        glm::vec3 sc(1.0f);
+        if (i < animated.size()) {
+            const auto& ch = animation->getChannels()[node_channel[animated[i]]];
+            const auto keys = animation->getKeys().data();
+            t = sample_position(ch, keys, time_in_ticks);
+            q = sample_rotation(ch, keys, time_in_ticks);
+            sc = sample_scaling(ch, keys, time_in_ticks);
+        }
+
+        trs[TRS_TX * lanes + i] = t.x;
+        trs[TRS_TY * lanes + i] = t.y;
+        trs[TRS_TZ * lanes + i] = t.z;
+        trs[TRS_QX * lanes + i] = q.x;
+        trs[TRS_QY * lanes + i] = q.y;
+        trs[TRS_QZ * lanes + i] = q.z;
+        trs[TRS_QW * lanes + i] = q.w;
+        trs[TRS_SX * lanes + i] = sc.x;
+        trs[TRS_SY * lanes + i] = sc.y;
+        trs[TRS_SZ * lanes + i] = sc.z;
+    }
+
+    // local transforms of 4 animated nodes per lane group
+    glm::mat4 padding;
+    for (size_t i = 0; i < lanes; i += 4u) {
+        const float* components[TRS_COMPONENTS];
+        for (size_t k = 0; k < TRS_COMPONENTS; ++k) components[k] = trs.data() + k * lanes + i;
+
+        glm::mat4* out[4];
+        for (size_t l = 0; l < 4u; ++l) out[l] = (i + l < animated.size()) ? &locals[animated[i + l]] : &padding;
+
+        mat4_from_trs_x4(components, out);
+    }
+
+    // nodes are stored depth-first, so every parent is computed before its children
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        if (!needed[n]) continue;
+
+        const glm::mat4& local = (node_channel[n] != NO_ANIMATION_CHANNEL) ? locals[n] : nodes[n].transform;
+
+        const uint32_t parent = nodes[n].parent_index;
+        if (parent == n) {
+            globals[n] = local;
+        } else {
+            assert(parent < n && "Armature nodes must be stored parents first");
+            mat4_mul(globals[parent], local, globals[n]);
+        }
+    }
+
+    // Final skinning matrix: global transform * inverse-bind (original offset), 4 bones per lane group
+    for (size_t b = 0; b < bones.size(); b += 4u) {
+        const glm::mat4* a[4];
+        const glm::mat4* offsets[4];
+        glm::mat4* out[4];
+        for (size_t l = 0; l < 4u; ++l) {
+            // the last group repeats its final bone
+            const size_t bone = std::min(b + l, bones.size() - 1u);
+            a[l] = &globals[bones[bone].armature_node_index];
+            offsets[l] = &bones[bone].offset_matrix;
+            out[l] = (b + l < bones.size()) ? &palette[bone] : &padding;
+        }
+
+        mat4_mul_x4(a, offsets, out);
+    }
+}
+
+void AnimationEvaluator::runJobs(const std::vector<AnimationEvaluatorJob>& jobs) const noexcept {
+    for (size_t i = m_next_job.fetch_add(1); i < jobs.size(); i = m_next_job.fetch_add(1)) {
+        const auto& job = jobs[i];
+        assert(job.skeleton && job.palette && "Invalid animation evaluator job");
+        AnimationEvaluator::evaluate(*job.skeleton, job.animation, job.time_in_ticks, *job.palette);
+    }
+}
+
+void AnimationEvaluator::workerLoop() noexcept {
+    uint64_t batch = 0;
+    for (;;) {
+        const std::vector<AnimationEvaluatorJob>* jobs = nullptr;
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_work_ready.wait(lock, [&]() { return m_stopping || ((m_batch != batch) && m_jobs) || (!m_tasks.empty()); });
+            if (m_stopping) return;
+
+            // batches first: the frame is waiting for them
+            if ((m_batch != batch) && m_jobs) {
+                batch = m_batch;
+                jobs = m_jobs;
+                m_busy_workers++;
+            } else {
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+        }
+
+        if (!jobs) {
+            task();
+            continue;
+        }
+
+        runJobs(*jobs);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_busy_workers == 0u) m_work_done.notify_one();
+        }
+    }
+}
+
+void AnimationEvaluator::evaluate(const std::vector<AnimationEvaluatorJob>& jobs) const noexcept {
+    // one batch at a time: the workers share a single job list
+    std::lock_guard<std::mutex> batch_lock(m_batch_mutex);
+
+    m_next_job.store(0);
+    if (m_workers.empty() || (jobs.size() <= 1)) {
+        runJobs(jobs);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs = &jobs;
+        m_batch++;
+    }
+    m_work_ready.notify_all();
+
+    // workers busy with a background task do not join: the calling thread takes what they leave
+    runJobs(jobs);
+
+    // every worker that took the batch has left runJobs before the job list goes away
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_work_done.wait(lock, [&]() { return m_busy_workers == 0u; });
+    m_jobs = nullptr;
+}
+
+void AnimationEvaluator::enqueue(std::function<void()> task) const noexcept {
+    if (m_workers.empty()) {
+        task();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_work_ready.notify_one();
+}
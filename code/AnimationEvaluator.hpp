@@ -0,0 +1,117 @@
+#pragma once
+
+#include "SkeletonTree.hpp"
+#include "Animation.hpp"
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <glm/glm.hpp>
+
+/**
+ * A single palette to evaluate: the animation sampled at the given time (in ticks),
+ * or the bind pose of the skeleton when animation is nullptr.
+ */
+struct AnimationEvaluatorJob {
+    const SkeletonTree* skeleton;
+
+    const Animation* animation;
+
+    float time_in_ticks;
+
+    std::vector<glm::mat4>* palette;
+};
+
+/**
+ * CPU counterpart of animate.comp and animate_bind_pose.comp.
+ *
+ * It reads the same Armature/SkeletonTree/Animation data the compute shaders use and
+ * follows the same sampling rules, so the produced palettes match the GPU ones.
+ *
+ * Local transforms and skinning matrices are computed 4 bones at a time, a bone per SIMD lane
+ * (structure of arrays); only the parent-first hierarchy walk goes a node at a time. Batches of
+ * palettes are spread across a pool of worker threads that lives as long as the evaluator, which
+ * also runs longer tasks in the background (see enqueue).
+ */
+class AnimationEvaluator {
+public:
+    AnimationEvaluator() = delete;
+
+    AnimationEvaluator(const AnimationEvaluator&) = delete;
+
+    AnimationEvaluator& operator=(const AnimationEvaluator&) = delete;
+
+    ~AnimationEvaluator() noexcept;
+
+    /**
+     * @param threads_count number of worker threads; 0 means one per hardware thread.
+     */
+    static AnimationEvaluator* CreateAnimationEvaluator(uint32_t threads_count = 0) noexcept;
+
+    /**
+     * Evaluate one palette on the calling thread.
+     */
+    static void evaluate(
+        const SkeletonTree& skeleton,
+        const Animation* animation,
+        float time_in_ticks,
+        std::vector<glm::mat4>& palette
+    ) noexcept;
+
+    /**
+     * Evaluate all the jobs, in parallel over the jobs: the workers are woken for the batch and
+     * the call returns once all of them are done.
+     */
+    void evaluate(const std::vector<AnimationEvaluatorJob>& jobs) const noexcept;
+
+    /**
+     * Run the task in the background on one of the workers, in between batches: evaluate() never
+     * waits for it, and the task must not call evaluate() with jobs itself. Runs on the calling
+     * thread when there are no workers; tasks not started yet are dropped with the evaluator.
+     */
+    void enqueue(std::function<void()> task) const noexcept;
+
+    inline uint32_t getThreadsCount(void) const noexcept { return m_threads_count; }
+
+private:
+    AnimationEvaluator(uint32_t threads_count) noexcept;
+
+    // take jobs of the batch until none is left
+    void runJobs(const std::vector<AnimationEvaluatorJob>& jobs) const noexcept;
+
+    void workerLoop() noexcept;
+
+    // the calling thread plus the workers
+    uint32_t m_threads_count;
+
+    std::vector<std::thread> m_workers;
+
+    // the pool is not part of the observable state: evaluate() is const
+    mutable std::mutex m_batch_mutex;
+
+    mutable std::mutex m_mutex;
+
+    mutable std::condition_variable m_work_ready;
+
+    mutable std::condition_variable m_work_done;
+
+    // batch being evaluated, counted so that a worker runs each one once
+    mutable const std::vector<AnimationEvaluatorJob>* m_jobs = nullptr;
+
+    mutable uint64_t m_batch = 0;
+
+    // workers that took the current batch and did not leave runJobs yet
+    mutable uint32_t m_busy_workers = 0;
+
+    // background tasks, taken by the workers that have no batch to run
+    mutable std::deque<std::function<void()>> m_tasks;
+
+    mutable std::atomic<size_t> m_next_job = 0;
+
+    bool m_stopping = false;
+};
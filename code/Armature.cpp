@@ -62,11 +62,13 @@ ArmatureNode* ArmatureNode::findArmatureNodeByNameRecursive(
 Armature::Armature(
     ArmatureNodeRefToIndexMap&& nodes_ref_to_index,
     ArmatureNodeNameToIndexMap&& nodes_name_to_index,
+    std::vector<ArmatureGPUElement>&& nodes,
     GLuint nodes_buffer,
     GLuint nodes_count
 ) noexcept :
     m_NodesRefToIndex(std::move(nodes_ref_to_index)),
     m_NodesNameToIndex(std::move(nodes_name_to_index)),
+    m_Nodes(std::move(nodes)),
     m_NodesBuffer(nodes_buffer),
     m_NodesCount(nodes_count)
 {
@@ -93,6 +95,7 @@ uint32_t ArmatureNode::write_armature_data(
     ArmatureNodeRefToIndexMap& armature_node_to_index_map,
     ArmatureNodeNameToIndexMap& armature_node_name_to_index_map,
     std::unordered_map<uintptr_t, uint32_t>& armature_node_to_index,
+    std::vector<ArmatureGPUElement>& nodes,
     GLuint buffer,
     uint32_t parent_index,
     uint32_t& nodes_count
@@ -125,12 +128,16 @@ uint32_t ArmatureNode::write_armature_data(
             armature_node_to_index_map,
             armature_node_name_to_index_map,
             armature_node_to_index,
+            nodes,
             buffer,
             gpu_index,
             nodes_count
         );
     }
 
+    // keep a CPU copy for the CPU animation evaluator
+    nodes[gpu_index] = gpu_element;
+
     // TODO: update the GPU buffer with gpu_element data at the correct offset
     CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer));
     CHECK_GL_ERROR(glBufferSubData(
@@ -150,10 +157,11 @@ Armature* Armature::CreateArmature(
     GLuint buffer = 0;
     CHECK_GL_ERROR(glGenBuffers(1, &buffer));
     // Create a shader storage buffer (SSBO) to hold the skeleton data.
+    const uint32_t total_nodes_count = root_node->countNodes();
     CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer));
     CHECK_GL_ERROR(glBufferData(
         GL_SHADER_STORAGE_BUFFER,
-        static_cast<GLsizeiptr>(root_node->countNodes() * sizeof(ArmatureGPUElement)),
+        static_cast<GLsizeiptr>(total_nodes_count * sizeof(ArmatureGPUElement)),
         nullptr,
         GL_STATIC_DRAW
     ));
@@ -163,12 +171,14 @@ Armature* Armature::CreateArmature(
     std::unordered_map<uintptr_t, uint32_t> armature_node_to_index;
     ArmatureNodeRefToIndexMap armature_node_to_index_map;
     ArmatureNodeNameToIndexMap armature_node_name_to_index_map;
+    std::vector<ArmatureGPUElement> nodes(total_nodes_count);
 
     const uint32_t HARDCODED_ROOT_INDEX = 0u;
     uint32_t root_index = root_node->write_armature_data(
         armature_node_to_index_map,
         armature_node_name_to_index_map,
         armature_node_to_index,
+        nodes,
         buffer,
         HARDCODED_ROOT_INDEX,
         nodes_count
@@ -185,6 +195,7 @@ Armature* Armature::CreateArmature(
     return new Armature(
         std::move(armature_node_to_index_map),
         std::move(armature_node_name_to_index_map),
+        std::move(nodes),
         buffer,
         nodes_count
     );
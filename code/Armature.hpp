@@ -57,6 +57,7 @@ public:
         ArmatureNodeRefToIndexMap& armature_node_to_index_map,
         ArmatureNodeNameToIndexMap& armature_node_name_to_index_map,
         std::unordered_map<uintptr_t, uint32_t>& armature_node_to_index,
+        std::vector<ArmatureGPUElement>& nodes,
         GLuint buffer,
         uint32_t parent_index,
         uint32_t& nodes_count
@@ -83,6 +84,7 @@ public:
     Armature(
         ArmatureNodeRefToIndexMap&& nodes_ref_to_index,
         ArmatureNodeNameToIndexMap&& nodes_name_to_index,
+        std::vector<ArmatureGPUElement>&& nodes,
         GLuint nodes_buffer,
         GLuint nodes_count
     ) noexcept;
@@ -107,11 +109,16 @@ public:
     // Number of nodes stored in the nodes buffer
     GLuint getNodesCount() const noexcept { return m_NodesCount; }
 
+    // CPU copy of the nodes buffer (same content and order): parents always come before their children
+    const std::vector<ArmatureGPUElement>& getNodes() const noexcept { return m_Nodes; }
+
 private:
     ArmatureNodeRefToIndexMap m_NodesRefToIndex;
 
     ArmatureNodeNameToIndexMap m_NodesNameToIndex;
 
+    std::vector<ArmatureGPUElement> m_Nodes;
+
     GLuint m_NodesBuffer;
 
     GLuint m_NodesCount;
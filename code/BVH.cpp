@@ -0,0 +1,370 @@
+#include "BVH.hpp"
+
+#include "Mesh.hpp"
+#include "Light/ConeLight.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <array>
+
+#define BVH_NO_NODE 0xFFFFFFFFu
+
+static float surface_area(const glm::vec3& bounds_min, const glm::vec3& bounds_max) noexcept {
+    const glm::vec3 size = glm::max(bounds_max - bounds_min, glm::vec3(0.0f));
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// -1: outside of a plane, 0: crossing some planes, 1: inside every plane
+static int classify_box(const Frustum& frustum, const glm::vec3& bounds_min, const glm::vec3& bounds_max) noexcept {
+    const glm::vec3 center = (bounds_min + bounds_max) * 0.5f;
+    const glm::vec3 extent = (bounds_max - bounds_min) * 0.5f;
+
+    int result = 1;
+    for (const auto& plane : frustum.planes) {
+        const float d = glm::dot(glm::vec3(plane), center) + plane.w;
+        const float r = glm::dot(glm::abs(glm::vec3(plane)), extent);
+
+        if (d + r < 0.0f) return -1;
+        if (d - r < 0.0f) result = 0;
+    }
+
+    return result;
+}
+
+static bool box_intersects_sphere(
+    const glm::vec3& bounds_min,
+    const glm::vec3& bounds_max,
+    const glm::vec3& center,
+    float radius
+) noexcept {
+    const glm::vec3 delta = center - glm::clamp(center, bounds_min, bounds_max);
+    return glm::dot(delta, delta) <= radius * radius;
+}
+
+// tested with the sphere around the box: conservative, and cheap enough for the inner nodes
+static bool box_may_intersect_cone(
+    const glm::vec3& bounds_min,
+    const glm::vec3& bounds_max,
+    const glm::vec3& apex,
+    const glm::vec3& direction,
+    float half_angle,
+    float range
+) noexcept {
+    const glm::vec3 center = (bounds_min + bounds_max) * 0.5f;
+    const float radius = glm::length(bounds_max - bounds_min) * 0.5f;
+
+    const glm::vec3 v = center - apex;
+    const float along = glm::dot(v, direction);
+    if ((along > range + radius) || (along < -radius)) return false;
+
+    // wider cones are only bounded by their range
+    if (half_angle >= glm::radians(90.0f)) return glm::dot(v, v) <= (range + radius) * (range + radius);
+
+    const float across = std::sqrt(std::max(glm::dot(v, v) - along * along, 0.0f));
+    const float distance = std::cos(half_angle) * across - std::sin(half_angle) * along;
+    return distance <= radius;
+}
+
+void MeshBVH::clear() noexcept {
+    m_nodes.clear();
+    m_meshes.clear();
+    m_bounds_min.clear();
+    m_bounds_max.clear();
+    m_leaf.clear();
+    m_order.clear();
+    m_index.clear();
+}
+
+void MeshBVH::build(const std::vector<const Mesh*>& meshes) noexcept {
+    clear();
+    if (meshes.empty()) return;
+
+    const auto count = static_cast<uint32_t>(meshes.size());
+
+    m_meshes = meshes;
+    m_bounds_min.resize(count);
+    m_bounds_max.resize(count);
+    m_leaf.resize(count, BVH_NO_NODE);
+    m_order.resize(count);
+    m_index.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        m_meshes[i]->getWorldBounds(m_bounds_min[i], m_bounds_max[i]);
+        m_order[i] = i;
+        m_index[m_meshes[i]] = i;
+    }
+
+    // a binary tree with leaves of one mesh or more
+    m_nodes.reserve(2 * static_cast<size_t>(count) - 1);
+    m_nodes.push_back(Node { glm::vec3(0.0f), 0, glm::vec3(0.0f), count, BVH_NO_NODE });
+    updateNodeBounds(0);
+    subdivide(0);
+}
+
+void MeshBVH::subdivide(uint32_t root) noexcept {
+    std::vector<uint32_t> pending = { root };
+
+    while (!pending.empty()) {
+        const uint32_t index = pending.back();
+        pending.pop_back();
+
+        const uint32_t first = m_nodes[index].first;
+        const uint32_t count = m_nodes[index].count;
+
+        const auto make_leaf = [&]() {
+            for (uint32_t i = first; i < first + count; ++i) m_leaf[m_order[i]] = index;
+        };
+
+        if (count <= BVH_MAX_LEAF_SIZE) {
+            make_leaf();
+            continue;
+        }
+
+        glm::vec3 centroid_min(std::numeric_limits<float>::max());
+        glm::vec3 centroid_max(-std::numeric_limits<float>::max());
+        for (uint32_t i = first; i < first + count; ++i) {
+            const glm::vec3 centroid = (m_bounds_min[m_order[i]] + m_bounds_max[m_order[i]]) * 0.5f;
+            centroid_min = glm::min(centroid_min, centroid);
+            centroid_max = glm::max(centroid_max, centroid);
+        }
+
+        // cheapest split plane between the bins of any axis: surface area times meshes, on both sides
+        int best_axis = -1;
+        uint32_t best_split = 0;
+        float best_cost = std::numeric_limits<float>::max();
+        for (int axis = 0; axis < 3; ++axis) {
+            const float extent = centroid_max[axis] - centroid_min[axis];
+            if (extent <= 0.0f) continue;
+
+            const float scale = static_cast<float>(BVH_SAH_BINS) / extent;
+            const auto bin_of = [&](uint32_t mesh) {
+                const float centroid = (m_bounds_min[mesh][axis] + m_bounds_max[mesh][axis]) * 0.5f;
+                return std::min(static_cast<uint32_t>((centroid - centroid_min[axis]) * scale), BVH_SAH_BINS - 1u);
+            };
+
+            std::array<glm::vec3, BVH_SAH_BINS> bin_min, bin_max;
+            std::array<uint32_t, BVH_SAH_BINS> bin_count;
+            bin_min.fill(glm::vec3(std::numeric_limits<float>::max()));
+            bin_max.fill(glm::vec3(-std::numeric_limits<float>::max()));
+            bin_count.fill(0u);
+
+            for (uint32_t i = first; i < first + count; ++i) {
+                const uint32_t mesh = m_order[i];
+                const uint32_t bin = bin_of(mesh);
+                bin_min[bin] = glm::min(bin_min[bin], m_bounds_min[mesh]);
+                bin_max[bin] = glm::max(bin_max[bin], m_bounds_max[mesh]);
+                bin_count[bin]++;
+            }
+
+            // areas and counts left of each plane in a forward sweep, right of it in a backward one
+            std::array<float, BVH_SAH_BINS - 1u> left_cost;
+            glm::vec3 sweep_min(std::numeric_limits<float>::max());
+            glm::vec3 sweep_max(-std::numeric_limits<float>::max());
+            uint32_t sweep_count = 0;
+            for (uint32_t plane = 0; plane < BVH_SAH_BINS - 1u; ++plane) {
+                sweep_min = glm::min(sweep_min, bin_min[plane]);
+                sweep_max = glm::max(sweep_max, bin_max[plane]);
+                sweep_count += bin_count[plane];
+                left_cost[plane] = sweep_count ? surface_area(sweep_min, sweep_max) * static_cast<float>(sweep_count) : 0.0f;
+            }
+
+            sweep_min = glm::vec3(std::numeric_limits<float>::max());
+            sweep_max = glm::vec3(-std::numeric_limits<float>::max());
+            sweep_count = 0;
+            for (uint32_t plane = BVH_SAH_BINS - 1u; plane > 0; --plane) {
+                sweep_min = glm::min(sweep_min, bin_min[plane]);
+                sweep_max = glm::max(sweep_max, bin_max[plane]);
+                sweep_count += bin_count[plane];
+
+                // an empty side is no split
+                if ((sweep_count == 0) || (sweep_count == count)) continue;
+
+                const float cost = left_cost[plane - 1u] + surface_area(sweep_min, sweep_max) * static_cast<float>(sweep_count);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = plane;
+                }
+            }
+        }
+
+        uint32_t middle;
+        if (best_axis >= 0) {
+            const float scale = static_cast<float>(BVH_SAH_BINS) / (centroid_max[best_axis] - centroid_min[best_axis]);
+            const auto it = std::partition(m_order.begin() + first, m_order.begin() + first + count, [&](uint32_t mesh) {
+                const float centroid = (m_bounds_min[mesh][best_axis] + m_bounds_max[mesh][best_axis]) * 0.5f;
+                return std::min(static_cast<uint32_t>((centroid - centroid_min[best_axis]) * scale), BVH_SAH_BINS - 1u) < best_split;
+            });
+            middle = static_cast<uint32_t>(it - m_order.begin());
+        } else {
+            // every centroid in the same place: any split is as good
+            middle = first + count / 2u;
+        }
+
+        const auto left = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.push_back(Node { glm::vec3(0.0f), first, glm::vec3(0.0f), middle - first, index });
+        m_nodes.push_back(Node { glm::vec3(0.0f), middle, glm::vec3(0.0f), first + count - middle, index });
+        updateNodeBounds(left);
+        updateNodeBounds(left + 1u);
+
+        m_nodes[index].first = left;
+        m_nodes[index].count = 0;
+
+        pending.push_back(left);
+        pending.push_back(left + 1u);
+    }
+}
+
+void MeshBVH::updateNodeBounds(uint32_t index) noexcept {
+    Node& node = m_nodes[index];
+
+    if (node.count == 0) {
+        const Node& left = m_nodes[node.first];
+        const Node& right = m_nodes[node.first + 1u];
+        node.bounds_min = glm::min(left.bounds_min, right.bounds_min);
+        node.bounds_max = glm::max(left.bounds_max, right.bounds_max);
+        return;
+    }
+
+    node.bounds_min = glm::vec3(std::numeric_limits<float>::max());
+    node.bounds_max = glm::vec3(-std::numeric_limits<float>::max());
+    for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        node.bounds_min = glm::min(node.bounds_min, m_bounds_min[m_order[i]]);
+        node.bounds_max = glm::max(node.bounds_max, m_bounds_max[m_order[i]]);
+    }
+}
+
+void MeshBVH::refit(const Mesh& mesh) noexcept {
+    const auto it = m_index.find(&mesh);
+    if (it == m_index.end()) return;
+
+    const uint32_t index = it->second;
+
+    glm::vec3 bounds_min, bounds_max;
+    mesh.getWorldBounds(bounds_min, bounds_max);
+    if ((bounds_min == m_bounds_min[index]) && (bounds_max == m_bounds_max[index])) return;
+
+    m_bounds_min[index] = bounds_min;
+    m_bounds_max[index] = bounds_max;
+
+    // up to the first ancestor that already covered the change
+    for (uint32_t node = m_leaf[index]; node != BVH_NO_NODE; node = m_nodes[node].parent) {
+        const glm::vec3 previous_min = m_nodes[node].bounds_min;
+        const glm::vec3 previous_max = m_nodes[node].bounds_max;
+
+        updateNodeBounds(node);
+        if ((m_nodes[node].bounds_min == previous_min) && (m_nodes[node].bounds_max == previous_max)) break;
+    }
+}
+
+void MeshBVH::collect(uint32_t index, std::vector<const Mesh*>& result) const noexcept {
+    std::vector<uint32_t> pending = { index };
+
+    while (!pending.empty()) {
+        const Node& node = m_nodes[pending.back()];
+        pending.pop_back();
+
+        if (node.count == 0) {
+            pending.push_back(node.first);
+            pending.push_back(node.first + 1u);
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; ++i) result.push_back(m_meshes[m_order[i]]);
+    }
+}
+
+void MeshBVH::queryFrustum(const Frustum& frustum, std::vector<const Mesh*>& result) const noexcept {
+    if (m_nodes.empty()) return;
+
+    std::vector<uint32_t> pending = { 0u };
+    while (!pending.empty()) {
+        const uint32_t index = pending.back();
+        const Node& node = m_nodes[index];
+        pending.pop_back();
+
+        const int side = classify_box(frustum, node.bounds_min, node.bounds_max);
+        if (side < 0) continue;
+
+        // nothing below can be outside
+        if (side > 0) {
+            collect(index, result);
+            continue;
+        }
+
+        if (node.count == 0) {
+            pending.push_back(node.first);
+            pending.push_back(node.first + 1u);
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+            const uint32_t mesh = m_order[i];
+            if (classify_box(frustum, m_bounds_min[mesh], m_bounds_max[mesh]) >= 0) result.push_back(m_meshes[mesh]);
+        }
+    }
+}
+
+void MeshBVH::querySphere(const glm::vec3& center, float radius, std::vector<const Mesh*>& result) const noexcept {
+    if (m_nodes.empty()) return;
+
+    std::vector<uint32_t> pending = { 0u };
+    while (!pending.empty()) {
+        const Node& node = m_nodes[pending.back()];
+        pending.pop_back();
+
+        if (!box_intersects_sphere(node.bounds_min, node.bounds_max, center, radius)) continue;
+
+        if (node.count == 0) {
+            pending.push_back(node.first);
+            pending.push_back(node.first + 1u);
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+            const uint32_t mesh = m_order[i];
+            if (box_intersects_sphere(m_bounds_min[mesh], m_bounds_max[mesh], center, radius)) result.push_back(m_meshes[mesh]);
+        }
+    }
+}
+
+void MeshBVH::queryCone(
+    const glm::vec3& apex,
+    const glm::vec3& direction,
+    float half_angle,
+    float range,
+    std::vector<const Mesh*>& result
+) const noexcept {
+    if (m_nodes.empty()) return;
+
+    std::vector<uint32_t> pending = { 0u };
+    while (!pending.empty()) {
+        const Node& node = m_nodes[pending.back()];
+        pending.pop_back();
+
+        if (!box_may_intersect_cone(node.bounds_min, node.bounds_max, apex, direction, half_angle, range)) continue;
+
+        if (node.count == 0) {
+            pending.push_back(node.first);
+            pending.push_back(node.first + 1u);
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+            const uint32_t mesh = m_order[i];
+            if (box_may_intersect_cone(m_bounds_min[mesh], m_bounds_max[mesh], apex, direction, half_angle, range)) {
+                result.push_back(m_meshes[mesh]);
+            }
+        }
+    }
+}
+
+void MeshBVH::queryCone(const ConeLight& light, std::vector<const Mesh*>& result) const noexcept {
+    queryCone(
+        light.getPosition(),
+        glm::normalize(light.getDirection()),
+        light.getAngleRadians() * 0.5f,
+        light.getZFar(),
+        result
+    );
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Culling.hpp"
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+class Mesh;
+class ConeLight;
+
+// meshes a leaf holds at most
+#define BVH_MAX_LEAF_SIZE 4u
+
+// centroid bins per axis of the SAH build
+#define BVH_SAH_BINS 12u
+
+/**
+ * Bounding volume hierarchy over the world bounds of a set of meshes.
+ *
+ * It is built top-down with binned SAH splits, then kept up to date by refitting: a moved mesh
+ * only grows or shrinks the boxes of its ancestors, the tree itself is not changed. Queries do
+ * not modify the hierarchy, so several threads can run them at once as long as no build or refit
+ * happens in the meantime.
+ */
+class MeshBVH {
+
+public:
+    // rebuild the hierarchy over the given meshes, with their current world bounds
+    void build(const std::vector<const Mesh*>& meshes) noexcept;
+
+    void clear() noexcept;
+
+    /**
+     * Update the bounds of the mesh (its model matrix or skinned bounds changed) and refit its
+     * ancestors. Meshes the hierarchy was not built with are ignored.
+     */
+    void refit(const Mesh& mesh) noexcept;
+
+    inline size_t size() const noexcept { return m_meshes.size(); }
+
+    // meshes whose box may intersect the frustum
+    void queryFrustum(const Frustum& frustum, std::vector<const Mesh*>& result) const noexcept;
+
+    // meshes whose box intersects the sphere
+    void querySphere(const glm::vec3& center, float radius, std::vector<const Mesh*>& result) const noexcept;
+
+    /**
+     * Meshes whose box may intersect the cone from apex along direction (normalized), with the
+     * given half angle and range: the volume lit by a ConeLight.
+     */
+    void queryCone(
+        const glm::vec3& apex,
+        const glm::vec3& direction,
+        float half_angle,
+        float range,
+        std::vector<const Mesh*>& result
+    ) const noexcept;
+
+    // meshes the light may reach
+    void queryCone(const ConeLight& light, std::vector<const Mesh*>& result) const noexcept;
+
+private:
+    struct Node {
+        glm::vec3 bounds_min;
+
+        // leaves: first entry in m_order; inner nodes: left child (the right one follows it)
+        uint32_t first;
+
+        glm::vec3 bounds_max;
+
+        // meshes of a leaf, 0 for inner nodes
+        uint32_t count;
+
+        uint32_t parent;
+    };
+
+    // split nodes[index] (holding m_order[first, first + count)) until the leaves are small enough
+    void subdivide(uint32_t index) noexcept;
+
+    // box of the meshes of a leaf, or of the two children of an inner node
+    void updateNodeBounds(uint32_t index) noexcept;
+
+    // every mesh under nodes[index]
+    void collect(uint32_t index, std::vector<const Mesh*>& result) const noexcept;
+
+    std::vector<Node> m_nodes;
+
+    // meshes and their world bounds, in the order they were given to build
+    std::vector<const Mesh*> m_meshes;
+    std::vector<glm::vec3> m_bounds_min;
+    std::vector<glm::vec3> m_bounds_max;
+
+    // leaf holding each mesh
+    std::vector<uint32_t> m_leaf;
+
+    // mesh indices, grouped by leaf
+    std::vector<uint32_t> m_order;
+
+    std::unordered_map<const Mesh*, uint32_t> m_index;
+};
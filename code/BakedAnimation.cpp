@@ -0,0 +1,101 @@
+#include "BakedAnimation.hpp"
+
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+BakedAnimation::BakedAnimation(
+    std::vector<glm::vec4>&& texels,
+    uint32_t frame_count,
+    uint32_t bone_count,
+    float frames_per_second
+) noexcept :
+    m_texels(std::move(texels)),
+    m_texture(nullptr),
+    m_frame_count(frame_count),
+    m_bone_count(bone_count),
+    m_frames_per_second(frames_per_second)
+{
+
+}
+
+BakedAnimation* BakedAnimation::Bake(
+    const SkeletonTree& skeleton,
+    const Animation& animation,
+    GLint max_texture_size,
+    float frames_per_second
+) noexcept {
+    const auto bone_count = skeleton.getBoneCount();
+    if ((bone_count == 0u) || (!skeleton.getArmature()) || (frames_per_second <= 0.0f)) {
+        return nullptr;
+    }
+
+    if (static_cast<GLint>(bone_count * 3u) > max_texture_size) {
+        std::cerr << "BakedAnimation: " << bone_count << " bones do not fit in a texture row." << std::endl;
+        return nullptr;
+    }
+
+    const double ticks_per_second = animation.getTicksPerSecond() > 0.0 ? animation.getTicksPerSecond() : 1.0;
+    const double duration_seconds = animation.getDuration() / ticks_per_second;
+
+    // one frame at each end of the clip, so that the last pose is sampled exactly
+    auto frame_count = static_cast<uint32_t>(std::ceil(duration_seconds * frames_per_second)) + 1u;
+    if (frame_count > static_cast<uint32_t>(max_texture_size)) {
+        frame_count = static_cast<uint32_t>(max_texture_size);
+        frames_per_second = static_cast<float>((frame_count - 1u) / std::max(duration_seconds, 1e-6));
+    }
+
+    // a frame at a time on this thread: a whole clip is a background task, not a batch of the evaluator
+    std::vector<glm::mat4> palette;
+
+    // 3x4 layout: the last row of an affine matrix is always (0, 0, 0, 1)
+    const auto row_width = bone_count * 3u;
+    std::vector<glm::vec4> texels(static_cast<size_t>(frame_count) * row_width);
+    for (uint32_t f = 0; f < frame_count; ++f) {
+        const double time_in_seconds = std::min(static_cast<double>(f) / frames_per_second, duration_seconds);
+        AnimationEvaluator::evaluate(skeleton, &animation, static_cast<float>(time_in_seconds * ticks_per_second), palette);
+
+        for (uint32_t b = 0; b < bone_count; ++b) {
+            const auto& m = palette[b];
+            for (uint32_t r = 0; r < 3u; ++r) {
+                texels[static_cast<size_t>(f) * row_width + b * 3u + r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+            }
+        }
+    }
+
+    return new BakedAnimation(std::move(texels), frame_count, bone_count, frames_per_second);
+}
+
+bool BakedAnimation::upload(void) noexcept {
+    if (isResident()) return true;
+
+    m_texture.reset(Texture::Create2DTexture(
+        static_cast<GLsizei>(m_bone_count * 3u),
+        static_cast<GLsizei>(m_frame_count),
+        TextureFormat::TEXTURE_FORMAT_RGBA32F,
+        TextureDataType::TEXTURE_DATA_TYPE_FLOAT,
+        m_texels.data(),
+        TextureWrapMode::TEXTURE_WRAP_MODE_CLAMP_TO_EDGE,
+        TextureWrapMode::TEXTURE_WRAP_MODE_CLAMP_TO_EDGE,
+        TextureFilterMode::TEXTURE_FILTER_MODE_NEAREST,
+        TextureFilterMode::TEXTURE_FILTER_MODE_NEAREST
+    ));
+    if (!m_texture) {
+        std::cerr << "BakedAnimation: failed to create the palette texture." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void BakedAnimation::getFrames(float time_in_seconds, GLint frames[2], float& blend) const noexcept {
+    const auto last = static_cast<float>(m_frame_count - 1u);
+    const auto frame = std::clamp(time_in_seconds * m_frames_per_second, 0.0f, last);
+    const auto first = std::floor(frame);
+
+    frames[0] = static_cast<GLint>(first);
+    frames[1] = static_cast<GLint>(std::min(first + 1.0f, last));
+    blend = frame - first;
+}
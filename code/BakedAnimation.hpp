@@ -0,0 +1,97 @@
+#pragma once
+
+#include "OpenGL.hpp"
+#include "Texture.hpp"
+#include "Animation.hpp"
+#include "SkeletonTree.hpp"
+#include "AnimationEvaluator.hpp"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+// Palette sampling rate of the baked clips, in frames per second
+#define BAKED_ANIMATION_DEFAULT_FRAME_RATE 30.0f
+
+/**
+ * A clip sampled at a fixed rate into a texture of skinning palettes.
+ *
+ * Every bone matrix is affine, so it is stored as its first 3 rows: texel (3 * bone + row, frame)
+ * of an RGBA32F texture. mesh.vert with BAKED_PALETTE fetches and blends two frames, so playing
+ * a baked clip needs no compute dispatch at all.
+ */
+class BakedAnimation {
+public:
+    BakedAnimation() = delete;
+
+    BakedAnimation(const BakedAnimation&) = delete;
+
+    BakedAnimation& operator=(const BakedAnimation&) = delete;
+
+    ~BakedAnimation() = default;
+
+    /**
+     * Sample the animation with the CPU evaluator, on the calling thread and without any GL call:
+     * clips are baked in the background, then upload makes them playable. The rate is lowered
+     * when the clip would not fit in max_texture_size (GL_MAX_TEXTURE_SIZE) frames.
+     */
+    static BakedAnimation* Bake(
+        const SkeletonTree& skeleton,
+        const Animation& animation,
+        GLint max_texture_size,
+        float frames_per_second = BAKED_ANIMATION_DEFAULT_FRAME_RATE
+    ) noexcept;
+
+    // Create the texture from the baked palettes (on the GL thread): false if it cannot be created
+    bool upload(void) noexcept;
+
+    /**
+     * Frames to blend at the given time (in seconds, clamped to the clip): frames[0], frames[1]
+     * and the weight of frames[1].
+     */
+    void getFrames(float time_in_seconds, GLint frames[2], float& blend) const noexcept;
+
+    inline const Texture& getTexture(void) const noexcept { return *m_texture; }
+
+    inline uint32_t getFrameCount(void) const noexcept { return m_frame_count; }
+
+    inline uint32_t getBoneCount(void) const noexcept { return m_bone_count; }
+
+    inline float getFrameRate(void) const noexcept { return m_frames_per_second; }
+
+    inline size_t getSize(void) const noexcept {
+        return static_cast<size_t>(m_frame_count) * m_bone_count * 3u * sizeof(glm::vec4);
+    }
+
+    // Release the texture: the palettes are kept, upload makes the clip playable again
+    inline void evict(void) noexcept { m_texture.reset(); }
+
+    inline bool isResident(void) const noexcept { return m_texture != nullptr; }
+
+    // last time (in seconds, see Scene) an element was played from the texture
+    inline double getLastUseTime(void) const noexcept { return m_last_use_time; }
+
+    inline void markUsed(double time) noexcept { m_last_use_time = time; }
+
+private:
+    BakedAnimation(
+        std::vector<glm::vec4>&& texels,
+        uint32_t frame_count,
+        uint32_t bone_count,
+        float frames_per_second
+    ) noexcept;
+
+    // texels of the texture, a row per frame
+    std::vector<glm::vec4> m_texels;
+
+    // nullptr until uploaded, and once evicted
+    std::unique_ptr<Texture> m_texture;
+
+    uint32_t m_frame_count;
+
+    uint32_t m_bone_count;
+
+    float m_frames_per_second;
+
+    double m_last_use_time = 0.0;
+};
@@ -0,0 +1,204 @@
+#include "Crowd.hpp"
+
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+
+#define NO_ANIMATION_CHANNEL 0xFFFFFFFFu
+
+static GLuint create_storage_buffer(const void* data, size_t size, GLenum usage) noexcept {
+    GLuint buffer = 0;
+
+    CHECK_GL_ERROR(glGenBuffers(1, &buffer));
+    assert(buffer != 0 && "Failed to generate crowd buffer");
+
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer));
+    CHECK_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(size), data, usage));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    return buffer;
+}
+
+Crowd::Crowd(
+    std::vector<std::shared_ptr<Mesh>>&& meshes,
+    std::shared_ptr<SkeletonTree> skeleton,
+    std::vector<std::string>&& clip_names,
+    GLuint channels_buffer,
+    GLuint keys_buffer,
+    GLuint clips_buffer,
+    GLuint node_channels_buffer
+) noexcept :
+    m_meshes(std::move(meshes)),
+    m_skeleton(skeleton),
+    m_clip_names(std::move(clip_names)),
+    m_channels_buffer(channels_buffer),
+    m_keys_buffer(keys_buffer),
+    m_clips_buffer(clips_buffer),
+    m_node_channels_buffer(node_channels_buffer),
+    m_instance_buffer(0),
+    m_palette_buffer(0),
+    m_instance_count(0),
+    m_instance_capacity(0),
+    m_time(0.0f)
+{
+
+}
+
+Crowd::~Crowd() noexcept {
+    const GLuint buffers[] = {
+        m_channels_buffer,
+        m_keys_buffer,
+        m_clips_buffer,
+        m_node_channels_buffer,
+        m_instance_buffer,
+        m_palette_buffer,
+    };
+
+    for (const auto buffer : buffers) {
+        if (buffer) {
+            CHECK_GL_ERROR(glDeleteBuffers(1, &buffer));
+        }
+    }
+}
+
+Crowd* Crowd::CreateCrowd(
+    std::vector<std::shared_ptr<Mesh>>&& meshes,
+    std::shared_ptr<SkeletonTree> skeleton,
+    const std::vector<std::pair<std::string, std::shared_ptr<Animation>>>& clips,
+    const std::vector<CrowdInstance>& instances
+) noexcept {
+    if ((!skeleton) || (!skeleton->getArmature()) || (skeleton->getBoneCount() == 0u)) {
+        std::cerr << "Crowd: the asset has no skeleton to animate." << std::endl;
+        return nullptr;
+    }
+
+    if (clips.empty()) {
+        std::cerr << "Crowd: the asset has no animations." << std::endl;
+        return nullptr;
+    }
+
+    const auto nodes_count = static_cast<uint32_t>(skeleton->getArmature()->getNodes().size());
+
+    // merge the clips: key offsets are rebased on the merged keys stream and every clip gets
+    // its own node -> channel table (first channel with keys wins, as in animate.comp)
+    std::vector<AnimationGPUChannel> channels;
+    std::vector<AnimationGPUKey> keys;
+    std::vector<CrowdGPUClip> gpu_clips;
+    std::vector<uint32_t> node_channels(clips.size() * nodes_count, NO_ANIMATION_CHANNEL);
+    std::vector<std::string> clip_names;
+
+    for (size_t c = 0; c < clips.size(); ++c) {
+        const auto& [name, animation] = clips[c];
+        assert(animation && "Crowd clips must be valid animations");
+
+        const auto channels_base = static_cast<uint32_t>(channels.size());
+        const auto keys_base = static_cast<uint32_t>(keys.size());
+
+        const auto& clip_channels = animation->getChannels();
+        const auto channels_count = std::min<size_t>(clip_channels.size(), MAX_ANIMATION_CHANNELS);
+        for (size_t ci = 0; ci < channels_count; ++ci) {
+            auto channel = clip_channels[ci];
+            channel.position_key_offset += keys_base;
+            channel.rotation_key_offset += keys_base;
+            channel.scaling_key_offset += keys_base;
+            channels.push_back(channel);
+        }
+        keys.insert(keys.end(), animation->getKeys().begin(), animation->getKeys().end());
+
+        for (size_t ci = channels_count; ci-- > 0;) {
+            const auto& ch = clip_channels[ci];
+            if (ch.position_key_count == 0u && ch.rotation_key_count == 0u && ch.scaling_key_count == 0u) continue;
+            if (ch.armature_element_index >= nodes_count) continue;
+            node_channels[c * nodes_count + ch.armature_element_index] = channels_base + static_cast<uint32_t>(ci);
+        }
+
+        gpu_clips.push_back(CrowdGPUClip {
+            .node_channel_offset = static_cast<uint32_t>(c * nodes_count),
+            .ticks_per_second = static_cast<float>(animation->getTicksPerSecond() > 0.0 ? animation->getTicksPerSecond() : 1.0),
+            .duration = static_cast<float>(animation->getDuration()),
+            .padding_1 = 0u,
+        });
+
+        clip_names.push_back(name);
+    }
+
+    // buffers are never empty, so that they can always be bound
+    if (channels.empty()) channels.push_back(AnimationGPUChannel {});
+    if (keys.empty()) keys.push_back(AnimationGPUKey {});
+
+    const auto channels_buffer = create_storage_buffer(channels.data(), channels.size() * sizeof(AnimationGPUChannel), GL_STATIC_DRAW);
+    const auto keys_buffer = create_storage_buffer(keys.data(), keys.size() * sizeof(AnimationGPUKey), GL_STATIC_DRAW);
+    const auto clips_buffer = create_storage_buffer(gpu_clips.data(), gpu_clips.size() * sizeof(CrowdGPUClip), GL_STATIC_DRAW);
+    const auto node_channels_buffer = create_storage_buffer(node_channels.data(), node_channels.size() * sizeof(uint32_t), GL_STATIC_DRAW);
+
+    auto crowd = new Crowd(
+        std::move(meshes),
+        skeleton,
+        std::move(clip_names),
+        channels_buffer,
+        keys_buffer,
+        clips_buffer,
+        node_channels_buffer
+    );
+
+    crowd->setInstances(instances);
+
+    return crowd;
+}
+
+void Crowd::setInstances(const std::vector<CrowdInstance>& instances) noexcept {
+    std::vector<CrowdGPUInstance> gpu_instances;
+    gpu_instances.reserve(instances.size());
+    for (const auto& instance : instances) {
+        gpu_instances.push_back(CrowdGPUInstance {
+            .model = instance.model,
+            .normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(instance.model)))),
+            .clip_index = std::min<uint32_t>(instance.clip, static_cast<uint32_t>(m_clip_names.size()) - 1u),
+            .time_offset = instance.time_offset,
+            .padding_1 = { 0u, 0u },
+        });
+    }
+
+    m_instance_count = static_cast<uint32_t>(gpu_instances.size());
+
+    // grow only: shrinking the crowd keeps the buffers
+    if (m_instance_count > m_instance_capacity) {
+        if (m_instance_buffer) CHECK_GL_ERROR(glDeleteBuffers(1, &m_instance_buffer));
+        if (m_palette_buffer) CHECK_GL_ERROR(glDeleteBuffers(1, &m_palette_buffer));
+
+        m_instance_capacity = m_instance_count;
+        m_instance_buffer = create_storage_buffer(nullptr, m_instance_capacity * sizeof(CrowdGPUInstance), GL_DYNAMIC_DRAW);
+        m_palette_buffer = create_storage_buffer(nullptr, static_cast<size_t>(m_instance_capacity) * getBoneCount() * sizeof(glm::mat4), GL_DYNAMIC_COPY);
+    }
+
+    if (m_instance_count > 0) {
+        CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instance_buffer));
+        CHECK_GL_ERROR(glBufferSubData(
+            GL_SHADER_STORAGE_BUFFER,
+            0,
+            static_cast<GLsizeiptr>(gpu_instances.size() * sizeof(CrowdGPUInstance)),
+            gpu_instances.data()
+        ));
+        CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+    }
+}
+
+void Crowd::advanceTime(float delta_time) noexcept {
+    m_time += delta_time;
+}
+
+void Crowd::foreachMesh(std::function<void(const Mesh&)> fn) const noexcept {
+    for (const auto& mesh : m_meshes) {
+        fn(*mesh);
+    }
+}
+
+void Crowd::bind(GLint palette_binding, GLint instance_binding) const noexcept {
+    if (palette_binding >= 0) {
+        CHECK_GL_ERROR(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(palette_binding), m_palette_buffer));
+    }
+
+    if (instance_binding >= 0) {
+        CHECK_GL_ERROR(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(instance_binding), m_instance_buffer));
+    }
+}
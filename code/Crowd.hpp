@@ -0,0 +1,146 @@
+#pragma once
+
+#include "Mesh.hpp"
+#include "Animation.hpp"
+#include "SkeletonTree.hpp"
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <functional>
+#include <glm/glm.hpp>
+
+struct CrowdInstance {
+    glm::mat4 model;
+
+    // index in the crowd's clips (see Crowd::getClipNames)
+    uint32_t clip;
+
+    // seconds added to the crowd time, so that instances playing the same clip are not in sync
+    float time_offset;
+};
+
+struct CrowdGPUInstance {
+    glm::mat4 model;
+
+    glm::mat4 normal_matrix;
+
+    uint32_t clip_index;
+
+    float time_offset;
+
+    uint32_t padding_1[2];
+};
+
+static_assert(sizeof(CrowdGPUInstance) == 144, "CrowdGPUInstance must match the std430 layout of animate.comp with CROWD_INSTANCES");
+
+struct CrowdGPUClip {
+    // first entry of this clip in the node channels buffer
+    uint32_t node_channel_offset;
+
+    float ticks_per_second;
+
+    float duration;
+
+    uint32_t padding_1;
+};
+
+/**
+ * Many copies of the same skinned asset, each one looping its own clip.
+ *
+ * The palettes of all the instances are computed by a single dispatch of animate.comp (built
+ * with CROWD_INSTANCES) into one palette buffer, and every mesh is drawn with one instanced call.
+ */
+class Crowd {
+public:
+    Crowd() = delete;
+
+    Crowd(const Crowd&) = delete;
+
+    Crowd& operator=(const Crowd&) = delete;
+
+    ~Crowd() noexcept;
+
+    /**
+     * @param clips the animations the instances can play, indexed by CrowdInstance::clip.
+     */
+    static Crowd* CreateCrowd(
+        std::vector<std::shared_ptr<Mesh>>&& meshes,
+        std::shared_ptr<SkeletonTree> skeleton,
+        const std::vector<std::pair<std::string, std::shared_ptr<Animation>>>& clips,
+        const std::vector<CrowdInstance>& instances
+    ) noexcept;
+
+    /**
+     * Replace all the instances: the instance and palette buffers are resized as needed.
+     */
+    void setInstances(const std::vector<CrowdInstance>& instances) noexcept;
+
+    void advanceTime(float delta_time) noexcept;
+
+    inline float getTime(void) const noexcept { return m_time; }
+
+    inline uint32_t getInstanceCount(void) const noexcept { return m_instance_count; }
+
+    inline uint32_t getBoneCount(void) const noexcept { return m_skeleton->getBoneCount(); }
+
+    inline const std::vector<std::string>& getClipNames(void) const noexcept { return m_clip_names; }
+
+    inline std::shared_ptr<SkeletonTree> getSkeleton(void) const noexcept { return m_skeleton; }
+
+    inline GLuint getInstanceBuffer(void) const noexcept { return m_instance_buffer; }
+
+    inline GLuint getPaletteBuffer(void) const noexcept { return m_palette_buffer; }
+
+    inline GLuint getChannelsBuffer(void) const noexcept { return m_channels_buffer; }
+
+    inline GLuint getKeysBuffer(void) const noexcept { return m_keys_buffer; }
+
+    inline GLuint getClipsBuffer(void) const noexcept { return m_clips_buffer; }
+
+    inline GLuint getNodeChannelsBuffer(void) const noexcept { return m_node_channels_buffer; }
+
+    void foreachMesh(std::function<void(const Mesh&)> fn) const noexcept;
+
+    /**
+     * Bind the palette and instance buffers for the instanced draws of the crowd meshes
+     * (see Mesh::drawInstanced); -1 skips a binding.
+     *
+     * @param palette_binding binding point of CrowdPaletteBuffer in the bound program
+     * @param instance_binding binding point of CrowdInstanceBuffer in the bound program
+     */
+    void bind(GLint palette_binding, GLint instance_binding) const noexcept;
+
+private:
+    Crowd(
+        std::vector<std::shared_ptr<Mesh>>&& meshes,
+        std::shared_ptr<SkeletonTree> skeleton,
+        std::vector<std::string>&& clip_names,
+        GLuint channels_buffer,
+        GLuint keys_buffer,
+        GLuint clips_buffer,
+        GLuint node_channels_buffer
+    ) noexcept;
+
+    std::vector<std::shared_ptr<Mesh>> m_meshes;
+
+    std::shared_ptr<SkeletonTree> m_skeleton;
+
+    std::vector<std::string> m_clip_names;
+
+    // clip library: channels and keys of every clip merged in a single pair of buffers
+    GLuint m_channels_buffer;
+    GLuint m_keys_buffer;
+    GLuint m_clips_buffer;
+    GLuint m_node_channels_buffer;
+
+    GLuint m_instance_buffer;
+    GLuint m_palette_buffer;
+
+    uint32_t m_instance_count;
+
+    // capacity (in instances) of the instance and palette buffers
+    uint32_t m_instance_capacity;
+
+    float m_time;
+};
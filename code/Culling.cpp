@@ -0,0 +1,166 @@
+#include "Culling.hpp"
+
+#include "Mesh.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 1))
+    #include <xmmintrin.h>
+    #define CULLING_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define CULLING_NEON 1
+#endif
+
+Frustum Frustum::FromMatrix(const glm::mat4& view_projection) noexcept {
+    const auto row = [&](int i) {
+        return glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+    };
+
+    const glm::vec4 r0 = row(0);
+    const glm::vec4 r1 = row(1);
+    const glm::vec4 r2 = row(2);
+    const glm::vec4 r3 = row(3);
+
+    Frustum frustum;
+    frustum.planes = {
+        r3 + r0, // left
+        r3 - r0, // right
+        r3 + r1, // bottom
+        r3 - r1, // top
+        r3 + r2, // near
+        r3 - r2  // far
+    };
+
+    // normalized, so that distances can be compared with radii
+    for (auto& plane : frustum.planes) {
+        const float length = glm::length(glm::vec3(plane));
+        if (length > 0.0f) plane /= length;
+    }
+
+    return frustum;
+}
+
+void CullingBounds::clear() noexcept {
+    m_center_x.clear();
+    m_center_y.clear();
+    m_center_z.clear();
+    m_extent_x.clear();
+    m_extent_y.clear();
+    m_extent_z.clear();
+    m_radius.clear();
+}
+
+void CullingBounds::add(const Mesh& mesh) noexcept {
+    glm::vec3 bounds_min, bounds_max;
+    mesh.getWorldBounds(bounds_min, bounds_max);
+
+    const glm::vec3 center = (bounds_min + bounds_max) * 0.5f;
+    const glm::vec3 extent = (bounds_max - bounds_min) * 0.5f;
+
+    // moved to the box center: grown by the distance between the two centers
+    const glm::vec4 sphere = mesh.getWorldBoundingSphere();
+    const float radius = sphere.w + glm::length(glm::vec3(sphere) - center);
+
+    m_center_x.push_back(center.x);
+    m_center_y.push_back(center.y);
+    m_center_z.push_back(center.z);
+    m_extent_x.push_back(extent.x);
+    m_extent_y.push_back(extent.y);
+    m_extent_z.push_back(extent.z);
+    m_radius.push_back(radius);
+}
+
+size_t CullingBounds::cull(const Frustum& frustum, std::vector<uint8_t>& visible) const noexcept {
+    const size_t count = size();
+    visible.resize(count);
+
+    size_t visible_count = 0;
+    size_t i = 0;
+
+#if defined(CULLING_SSE)
+    for (; i + 4 <= count; i += 4) {
+        const __m128 cx = _mm_loadu_ps(m_center_x.data() + i);
+        const __m128 cy = _mm_loadu_ps(m_center_y.data() + i);
+        const __m128 cz = _mm_loadu_ps(m_center_z.data() + i);
+        const __m128 ex = _mm_loadu_ps(m_extent_x.data() + i);
+        const __m128 ey = _mm_loadu_ps(m_extent_y.data() + i);
+        const __m128 ez = _mm_loadu_ps(m_extent_z.data() + i);
+        const __m128 radius = _mm_loadu_ps(m_radius.data() + i);
+
+        __m128 outside = _mm_setzero_ps();
+        for (const auto& plane : frustum.planes) {
+            __m128 d = _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_set1_ps(plane.w));
+            d = _mm_add_ps(d, _mm_mul_ps(cy, _mm_set1_ps(plane.y)));
+            d = _mm_add_ps(d, _mm_mul_ps(cz, _mm_set1_ps(plane.z)));
+
+            __m128 r = _mm_mul_ps(ex, _mm_set1_ps(std::abs(plane.x)));
+            r = _mm_add_ps(r, _mm_mul_ps(ey, _mm_set1_ps(std::abs(plane.y))));
+            r = _mm_add_ps(r, _mm_mul_ps(ez, _mm_set1_ps(std::abs(plane.z))));
+            r = _mm_min_ps(r, radius);
+
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+        }
+
+        const int mask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4; ++lane) {
+            visible[i + lane] = ((mask >> lane) & 1) ? 0 : 1;
+            visible_count += visible[i + lane];
+        }
+    }
+#elif defined(CULLING_NEON)
+    for (; i + 4 <= count; i += 4) {
+        const float32x4_t cx = vld1q_f32(m_center_x.data() + i);
+        const float32x4_t cy = vld1q_f32(m_center_y.data() + i);
+        const float32x4_t cz = vld1q_f32(m_center_z.data() + i);
+        const float32x4_t ex = vld1q_f32(m_extent_x.data() + i);
+        const float32x4_t ey = vld1q_f32(m_extent_y.data() + i);
+        const float32x4_t ez = vld1q_f32(m_extent_z.data() + i);
+        const float32x4_t radius = vld1q_f32(m_radius.data() + i);
+
+        uint32x4_t outside = vdupq_n_u32(0);
+        for (const auto& plane : frustum.planes) {
+            float32x4_t d = vmlaq_n_f32(vdupq_n_f32(plane.w), cx, plane.x);
+            d = vmlaq_n_f32(d, cy, plane.y);
+            d = vmlaq_n_f32(d, cz, plane.z);
+
+            float32x4_t r = vmulq_n_f32(ex, std::abs(plane.x));
+            r = vmlaq_n_f32(r, ey, std::abs(plane.y));
+            r = vmlaq_n_f32(r, ez, std::abs(plane.z));
+            r = vminq_f32(r, radius);
+
+            outside = vorrq_u32(outside, vcltq_f32(vaddq_f32(d, r), vdupq_n_f32(0.0f)));
+        }
+
+        uint32_t lanes[4];
+        vst1q_u32(lanes, outside);
+        for (int lane = 0; lane < 4; ++lane) {
+            visible[i + lane] = lanes[lane] ? 0 : 1;
+            visible_count += visible[i + lane];
+        }
+    }
+#endif
+
+    // whatever does not fill a SIMD register (or everything, without SIMD)
+    for (; i < count; ++i) {
+        bool outside = false;
+        for (const auto& plane : frustum.planes) {
+            const float d = m_center_x[i] * plane.x + m_center_y[i] * plane.y + m_center_z[i] * plane.z + plane.w;
+            const float r = std::min(
+                m_extent_x[i] * std::abs(plane.x) + m_extent_y[i] * std::abs(plane.y) + m_extent_z[i] * std::abs(plane.z),
+                m_radius[i]
+            );
+
+            if (d + r < 0.0f) {
+                outside = true;
+                break;
+            }
+        }
+
+        visible[i] = outside ? 0 : 1;
+        visible_count += visible[i];
+    }
+
+    return visible_count;
+}
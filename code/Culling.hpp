@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+class Mesh;
+
+/**
+ * The six planes of a view frustum (xyz: normal pointing inside, w: distance),
+ * extracted from a view-projection matrix with OpenGL clip space conventions.
+ */
+struct Frustum {
+    std::array<glm::vec4, 6> planes;
+
+    static Frustum FromMatrix(const glm::mat4& view_projection) noexcept;
+};
+
+/**
+ * World-space bounds of a list of meshes, kept as flat arrays (one per component) so that
+ * they can be tested against a frustum four at a time with SIMD.
+ *
+ * Each entry is tested with both its box and its sphere: it is culled when either one is
+ * fully outside one of the planes.
+ */
+class CullingBounds {
+
+public:
+    void clear() noexcept;
+
+    // appends the world bounds of the mesh, its index is size() - 1
+    void add(const Mesh& mesh) noexcept;
+
+    inline size_t size() const noexcept { return m_radius.size(); }
+
+    /**
+     * visible[i] is set to 1 if the entry i may intersect the frustum, to 0 otherwise.
+     * Returns the number of visible entries.
+     */
+    size_t cull(const Frustum& frustum, std::vector<uint8_t>& visible) const noexcept;
+
+private:
+    // box center and half extent
+    std::vector<float> m_center_x;
+    std::vector<float> m_center_y;
+    std::vector<float> m_center_z;
+    std::vector<float> m_extent_x;
+    std::vector<float> m_extent_y;
+    std::vector<float> m_extent_z;
+
+    // sphere around the same center (the box center is closer to the mesh than the sphere one)
+    std::vector<float> m_radius;
+};
@@ -13,6 +13,12 @@ static std::tuple<GLint, GLenum, GLenum> get_native_format(const FramebufferColo
             return { GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE };
         case FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA8:
             return { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE };
+        case FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RG16F:
+            return { GL_RG16F, GL_RG, GL_HALF_FLOAT };
+        case FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA16F:
+            return { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT };
+        case FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_R11F_G11F_B10F:
+            return { GL_R11F_G11F_B10F, GL_RGB, GL_HALF_FLOAT };
         case FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_R32F:
             return { GL_R32F, GL_RED, GL_FLOAT };
         case FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RG32F:
@@ -68,7 +74,8 @@ Framebuffer* Framebuffer::CreateFramebuffer(
     GLsizei height,
     const std::vector<FramebufferColorFormat>& color,
     bool depth,
-    bool stencil
+    bool stencil,
+    FramebufferDepthFormat depth_format
 ) noexcept {
     Framebuffer* framebuffer = nullptr;
 
@@ -132,7 +139,11 @@ Framebuffer* Framebuffer::CreateFramebuffer(
             CHECK_GL_ERROR(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_tex, 0));
         } else {
             // Create depth-only texture (better for sampling as a sampler2D in shaders)
-            CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL));
+            if (depth_format == FramebufferDepthFormat::FRAMEBUFFER_DEPTH_FORMAT_DEPTH16) {
+                CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL));
+            } else {
+                CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL));
+            }
             CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
             CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
             CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
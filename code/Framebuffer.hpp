@@ -14,12 +14,24 @@ enum class FramebufferColorFormat {
     FRAMEBUFFER_COLOR_FORMAT_RG8,
     FRAMEBUFFER_COLOR_FORMAT_RGB8,
     FRAMEBUFFER_COLOR_FORMAT_RGBA8,
+    FRAMEBUFFER_COLOR_FORMAT_RG16F,
+    FRAMEBUFFER_COLOR_FORMAT_RGBA16F,
+    FRAMEBUFFER_COLOR_FORMAT_R11F_G11F_B10F,
     FRAMEBUFFER_COLOR_FORMAT_R32F,
     FRAMEBUFFER_COLOR_FORMAT_RG32F,
     FRAMEBUFFER_COLOR_FORMAT_RGB32F,
     FRAMEBUFFER_COLOR_FORMAT_RGBA32F,
 };
 
+/*
+ * Depth-only attachments: 16 bits are enough for short depth ranges (and halve the memory).
+ * A depth-stencil attachment is always DEPTH24_STENCIL8.
+ */
+enum class FramebufferDepthFormat {
+    FRAMEBUFFER_DEPTH_FORMAT_DEPTH24,
+    FRAMEBUFFER_DEPTH_FORMAT_DEPTH16,
+};
+
 class Framebuffer {
 public:
     Framebuffer() = delete;
@@ -45,7 +57,8 @@ public:
         GLsizei height,
         const std::vector<FramebufferColorFormat>& color,
         bool depth,
-        bool stencil
+        bool stencil,
+        FramebufferDepthFormat depth_format = FramebufferDepthFormat::FRAMEBUFFER_DEPTH_FORMAT_DEPTH24
     ) noexcept;
 
     inline bool hasDepthStencilAttachment() const noexcept {
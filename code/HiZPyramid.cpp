@@ -0,0 +1,93 @@
+#include "HiZPyramid.hpp"
+
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+#include <bit>
+
+HiZPyramid::HiZPyramid(GLuint texture, GLsizei width, GLsizei height, GLint level_count) noexcept :
+    m_texture(texture),
+    m_width(width),
+    m_height(height),
+    m_level_count(level_count)
+{
+
+}
+
+HiZPyramid::~HiZPyramid() noexcept {
+    if (m_texture) {
+        CHECK_GL_ERROR(glDeleteTextures(1, &m_texture));
+    }
+}
+
+HiZPyramid* HiZPyramid::Create(GLsizei width, GLsizei height) noexcept {
+    if ((width <= 0) || (height <= 0)) return nullptr;
+
+    // down to a single texel: each level halves the previous one, rounding down
+    const auto level_count = static_cast<GLint>(std::bit_width(static_cast<glm::uint32>(std::max(width, height))));
+
+    GLuint texture = 0;
+    CHECK_GL_ERROR(glGenTextures(1, &texture));
+    if (texture == 0) {
+        std::cerr << "Failed to generate the Hi-Z texture" << std::endl;
+        return nullptr;
+    }
+
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, texture));
+    CHECK_GL_ERROR(glTexStorage2D(GL_TEXTURE_2D, level_count, GL_R32F, width, height));
+
+    // R32F is not filterable: any linear filter would leave the texture incomplete
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, 0));
+
+    return new HiZPyramid(texture, width, height, level_count);
+}
+
+void HiZPyramid::build(Program& build_program, const Framebuffer& source, const glm::mat4& view_projection) noexcept {
+    assert((source.getWidth() == m_width) && (source.getHeight() == m_height) && "The depth must match the size of the pyramid");
+
+    const GLuint local_size = 8u; // must match compute shader local size
+
+    build_program.bind();
+
+    GLsizei source_width = m_width;
+    GLsizei source_height = m_height;
+    for (GLint level = 0; level < m_level_count; ++level) {
+        const GLsizei width = std::max(m_width >> level, 1);
+        const GLsizei height = std::max(m_height >> level, 1);
+
+        if (level == 0) {
+            build_program.framebufferDepthAttachment("u_Source", GL_TEXTURE0, source);
+        } else {
+            CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
+            CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, m_texture));
+        }
+
+        build_program.uniformInt("u_SourceWidth", source_width);
+        build_program.uniformInt("u_SourceHeight", source_height);
+        build_program.uniformInt("u_SourceLevel", std::max(level - 1, 0));
+        build_program.uniformInt("u_CopyDepth", (level == 0) ? 1 : 0);
+
+        CHECK_GL_ERROR(glBindImageTexture(0, m_texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F));
+
+        build_program.dispatchCompute(
+            (static_cast<GLuint>(width) + local_size - 1u) / local_size,
+            (static_cast<GLuint>(height) + local_size - 1u) / local_size,
+            1
+        );
+
+        // the next level reads this one through the sampler
+        CHECK_GL_ERROR(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+
+        source_width = width;
+        source_height = height;
+    }
+
+    CHECK_GL_ERROR(glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F));
+
+    m_view_projection = view_projection;
+    m_valid = true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "OpenGL.hpp"
+#include "Program.hpp"
+#include "Framebuffer.hpp"
+
+#include <glm/glm.hpp>
+
+/**
+ * Hierarchical depth: level 0 is a copy of a depth attachment, every following level holds the
+ * farthest depth of the 2x2 texels below it (R32F, with the full mip chain).
+ *
+ * A box whose nearest depth is farther than the texels of the pyramid covering its screen
+ * rectangle is hidden behind what was drawn into the depth. The pyramid keeps the
+ * view-projection the depth was rendered with, so that later frames can reproject their
+ * bounds into it.
+ */
+class HiZPyramid {
+public:
+    HiZPyramid() = delete;
+
+    HiZPyramid(const HiZPyramid&) = delete;
+
+    HiZPyramid& operator=(const HiZPyramid&) = delete;
+
+    ~HiZPyramid() noexcept;
+
+    // pyramid over a depth attachment of the given size, invalid until the first build
+    static HiZPyramid* Create(GLsizei width, GLsizei height) noexcept;
+
+    /**
+     * Rebuild every level from the depth attachment of source (the same size as the pyramid),
+     * rendered with view_projection (hiz_build.comp).
+     */
+    void build(Program& build_program, const Framebuffer& source, const glm::mat4& view_projection) noexcept;
+
+    // forget the depth: the next tests must not rely on it
+    inline void invalidate() noexcept { m_valid = false; }
+
+    inline bool isValid() const noexcept { return m_valid; }
+
+    inline GLuint getTexture() const noexcept { return m_texture; }
+
+    inline GLsizei getWidth() const noexcept { return m_width; }
+
+    inline GLsizei getHeight() const noexcept { return m_height; }
+
+    inline GLint getLevelCount() const noexcept { return m_level_count; }
+
+    inline const glm::mat4& getViewProjection() const noexcept { return m_view_projection; }
+
+private:
+    HiZPyramid(GLuint texture, GLsizei width, GLsizei height, GLint level_count) noexcept;
+
+    GLuint m_texture;
+
+    GLsizei m_width;
+
+    GLsizei m_height;
+
+    GLint m_level_count;
+
+    glm::mat4 m_view_projection = glm::mat4(1.0f);
+
+    bool m_valid = false;
+};
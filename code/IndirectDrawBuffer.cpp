@@ -0,0 +1,382 @@
+#include "IndirectDrawBuffer.hpp"
+
+#include <iostream>
+#include <cassert>
+#include <map>
+#include <tuple>
+#include <numeric>
+
+static GLuint create_buffer(GLenum target, const void* data, size_t size, GLenum usage) noexcept {
+    GLuint buffer = 0;
+
+    CHECK_GL_ERROR(glGenBuffers(1, &buffer));
+    assert(buffer != 0 && "Failed to generate indirect draw buffer");
+
+    CHECK_GL_ERROR(glBindBuffer(target, buffer));
+    CHECK_GL_ERROR(glBufferData(target, static_cast<GLsizeiptr>(size), data, usage));
+    CHECK_GL_ERROR(glBindBuffer(target, 0));
+
+    return buffer;
+}
+
+static GLuint texture_id(const std::shared_ptr<Texture>& texture) noexcept {
+    return texture ? texture->getTextureId() : 0u;
+}
+
+// model matrix and world bounds of the record of the mesh
+static void fill_record_transform(IndirectDrawRecord& record, const Mesh& mesh) noexcept {
+    const glm::mat4 model_matrix = mesh.getModelMatrix();
+
+    glm::vec3 bounds_min, bounds_max;
+    mesh.getWorldBounds(bounds_min, bounds_max);
+
+    record.model = model_matrix;
+    record.normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model_matrix))));
+    record.bounds_center = glm::vec4((bounds_min + bounds_max) * 0.5f, 0.0f);
+    record.bounds_extent = glm::vec4((bounds_max - bounds_min) * 0.5f, 0.0f);
+}
+
+IndirectDrawBuffer::IndirectDrawBuffer(
+    std::vector<const Mesh*>&& source_meshes,
+    std::vector<const Mesh*>&& meshes,
+    std::vector<IndirectDrawRecord>&& records,
+    std::vector<Batch>&& batches,
+    GLuint vao,
+    GLuint vertex_buffer,
+    GLuint index_buffer,
+    GLuint draw_index_buffer,
+    GLuint record_buffer,
+    GLuint command_template_buffer,
+    GLuint command_buffer,
+    GLuint batch_counter_buffer,
+    GLuint batch_counter_reset_buffer,
+    GLuint visibility_buffer
+) noexcept :
+    m_meshes(std::move(meshes)),
+    m_source_meshes(std::move(source_meshes)),
+    m_records(std::move(records)),
+    m_batches(std::move(batches)),
+    m_vao(vao),
+    m_vertex_buffer(vertex_buffer),
+    m_index_buffer(index_buffer),
+    m_draw_index_buffer(draw_index_buffer),
+    m_record_buffer(record_buffer),
+    m_command_template_buffer(command_template_buffer),
+    m_command_buffer(command_buffer),
+    m_batch_counter_buffer(batch_counter_buffer),
+    m_batch_counter_reset_buffer(batch_counter_reset_buffer),
+    m_visibility_buffer(visibility_buffer)
+{
+
+}
+
+IndirectDrawBuffer::~IndirectDrawBuffer() noexcept {
+    if (m_vao) {
+        CHECK_GL_ERROR(glDeleteVertexArrays(1, &m_vao));
+    }
+
+    const GLuint buffers[] = {
+        m_vertex_buffer,
+        m_index_buffer,
+        m_draw_index_buffer,
+        m_record_buffer,
+        m_command_template_buffer,
+        m_command_buffer,
+        m_batch_counter_buffer,
+        m_batch_counter_reset_buffer,
+        m_visibility_buffer,
+    };
+
+    for (const auto buffer : buffers) {
+        if (buffer) {
+            CHECK_GL_ERROR(glDeleteBuffers(1, &buffer));
+        }
+    }
+}
+
+bool IndirectDrawBuffer::IsSupported() noexcept {
+#if !defined(ANDROID) && !defined(__ANDROID__)
+    return GLAD_GL_EXT_multi_draw_indirect && GLAD_GL_EXT_base_instance;
+#else
+    // the EXT entry points are not loaded on Android
+    return false;
+#endif
+}
+
+IndirectDrawBuffer* IndirectDrawBuffer::Create(const std::vector<const Mesh*>& meshes) noexcept {
+    if (meshes.empty()) return nullptr;
+
+    if (!IsSupported()) {
+        std::cerr << "Indirect draws need GL_EXT_multi_draw_indirect and GL_EXT_base_instance." << std::endl;
+        return nullptr;
+    }
+
+    // meshes with the same textures go in the same batch: one multi-draw each
+    std::map<std::tuple<GLuint, GLuint, GLuint>, std::vector<const Mesh*>> by_textures;
+    for (const auto mesh : meshes) {
+        assert(!mesh->isSkinned() && "Skinned meshes are drawn from their own vertex buffers");
+
+        const auto material = mesh->getMaterial();
+        const auto key = std::make_tuple(
+            texture_id(material->getDiffuseTexture()),
+            texture_id(material->getSpecularTexture()),
+            texture_id(material->getDisplacementTexture())
+        );
+        by_textures[key].push_back(mesh);
+    }
+
+    std::vector<const Mesh*> sorted_meshes;
+    std::vector<IndirectDrawRecord> records;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<Batch> batches;
+    sorted_meshes.reserve(meshes.size());
+    records.reserve(meshes.size());
+    commands.reserve(meshes.size());
+
+    GLuint vertex_count = 0;
+    GLuint index_count = 0;
+    for (const auto& group : by_textures) {
+        const auto batch = static_cast<glm::uint>(batches.size());
+        const auto batch_first = static_cast<glm::uint>(records.size());
+        batches.push_back(Batch { group.second.front()->getMaterial(), batch_first, static_cast<glm::uint>(group.second.size()) });
+
+        for (const auto mesh : group.second) {
+            const auto material = mesh->getMaterial();
+
+            IndirectDrawRecord record = {};
+            fill_record_transform(record, *mesh);
+            record.diffuse_color_shininess = glm::vec4(material->getDiffuseColor(), material->getShininess());
+            record.specular_color = glm::vec4(material->getSpecularColor(), 0.0f);
+            record.material_flags = material->getMaterialFlags();
+            record.index_count = mesh->getIndexCount();
+            record.first_index = index_count;
+            record.base_vertex = static_cast<glm::int32>(vertex_count);
+            record.batch = batch;
+            record.batch_first = batch_first;
+
+            commands.push_back(DrawElementsIndirectCommand {
+                record.index_count,
+                0u,
+                record.first_index,
+                record.base_vertex,
+                static_cast<glm::uint>(records.size())
+            });
+
+            records.push_back(record);
+            sorted_meshes.push_back(mesh);
+
+            vertex_count += mesh->getVertexCount();
+            index_count += mesh->getIndexCount();
+        }
+    }
+
+    // the shared buffers, filled by GPU copies of the buffers of every mesh
+    const GLuint vertex_buffer = create_buffer(GL_ARRAY_BUFFER, nullptr, vertex_count * sizeof(VertexData), GL_STATIC_DRAW);
+    const GLuint index_buffer = create_buffer(GL_ARRAY_BUFFER, nullptr, index_count * sizeof(GLuint), GL_STATIC_DRAW);
+
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, vertex_buffer));
+    for (size_t i = 0; i < sorted_meshes.size(); ++i) {
+        CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, sorted_meshes[i]->getVertexBuffer()));
+        CHECK_GL_ERROR(glCopyBufferSubData(
+            GL_COPY_READ_BUFFER,
+            GL_COPY_WRITE_BUFFER,
+            0,
+            static_cast<GLintptr>(records[i].base_vertex) * sizeof(VertexData),
+            static_cast<GLsizeiptr>(sorted_meshes[i]->getVertexCount()) * sizeof(VertexData)
+        ));
+    }
+
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer));
+    for (size_t i = 0; i < sorted_meshes.size(); ++i) {
+        CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, sorted_meshes[i]->getIndexBuffer()));
+        CHECK_GL_ERROR(glCopyBufferSubData(
+            GL_COPY_READ_BUFFER,
+            GL_COPY_WRITE_BUFFER,
+            0,
+            static_cast<GLintptr>(records[i].first_index) * sizeof(GLuint),
+            static_cast<GLsizeiptr>(records[i].index_count) * sizeof(GLuint)
+        ));
+    }
+
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+
+    std::vector<GLuint> draw_indices(records.size());
+    std::iota(draw_indices.begin(), draw_indices.end(), 0u);
+    const GLuint draw_index_buffer = create_buffer(GL_ARRAY_BUFFER, draw_indices.data(), draw_indices.size() * sizeof(GLuint), GL_STATIC_DRAW);
+
+    // same vertex layout as Mesh for the attributes mesh.vert reads without skinning
+    GLuint vao = 0;
+    CHECK_GL_ERROR(glGenVertexArrays(1, &vao));
+    assert(vao != 0 && "Failed to generate vao");
+
+    CHECK_GL_ERROR(glBindVertexArray(vao));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer));
+    CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer));
+
+    constexpr GLsizei stride = sizeof(VertexData);
+
+    // position
+    CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+    CHECK_GL_ERROR(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (const void*)((uintptr_t)(offsetof(VertexData, position_x)))));
+
+    // normal
+    CHECK_GL_ERROR(glEnableVertexAttribArray(2));
+    CHECK_GL_ERROR(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (const void*)((uintptr_t)(offsetof(VertexData, normal_x)))));
+
+    // texcoord
+    CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+    CHECK_GL_ERROR(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (const void*)((uintptr_t)(offsetof(VertexData, texcoord_u)))));
+
+    // draw index: one per instance, starting from the base instance of the command
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, draw_index_buffer));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(11));
+    CHECK_GL_ERROR(glVertexAttribIPointer(11, 1, GL_UNSIGNED_INT, sizeof(GLuint), nullptr));
+    CHECK_GL_ERROR(glVertexAttribDivisor(11, 1));
+
+    CHECK_GL_ERROR(glBindVertexArray(0));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+
+    const GLuint record_buffer = create_buffer(GL_SHADER_STORAGE_BUFFER, records.data(), records.size() * sizeof(IndirectDrawRecord), GL_DYNAMIC_DRAW);
+
+    const size_t commands_size = commands.size() * sizeof(DrawElementsIndirectCommand);
+    const GLuint command_template_buffer = create_buffer(GL_SHADER_STORAGE_BUFFER, commands.data(), commands_size, GL_STATIC_DRAW);
+    const GLuint command_buffer = create_buffer(GL_SHADER_STORAGE_BUFFER, commands.data(), commands_size, GL_DYNAMIC_COPY);
+
+    const std::vector<GLuint> zeros(batches.size(), 0u);
+    const GLuint batch_counter_buffer = create_buffer(GL_SHADER_STORAGE_BUFFER, zeros.data(), zeros.size() * sizeof(GLuint), GL_DYNAMIC_COPY);
+    const GLuint batch_counter_reset_buffer = create_buffer(GL_SHADER_STORAGE_BUFFER, zeros.data(), zeros.size() * sizeof(GLuint), GL_STATIC_DRAW);
+
+    const std::vector<GLuint> states(records.size(), 0u);
+    const GLuint visibility_buffer = create_buffer(GL_SHADER_STORAGE_BUFFER, states.data(), states.size() * sizeof(GLuint), GL_DYNAMIC_COPY);
+
+    std::cout << "Indirect draws: " << records.size() << " meshes in " << batches.size() << " batches, "
+        << vertex_count << " vertices and " << index_count << " indices." << std::endl;
+
+    return new IndirectDrawBuffer(
+        std::vector<const Mesh*>(meshes),
+        std::move(sorted_meshes),
+        std::move(records),
+        std::move(batches),
+        vao,
+        vertex_buffer,
+        index_buffer,
+        draw_index_buffer,
+        record_buffer,
+        command_template_buffer,
+        command_buffer,
+        batch_counter_buffer,
+        batch_counter_reset_buffer,
+        visibility_buffer
+    );
+}
+
+bool IndirectDrawBuffer::holds(const std::vector<const Mesh*>& meshes) const noexcept {
+    return meshes == m_source_meshes;
+}
+
+void IndirectDrawBuffer::updateRecords() noexcept {
+    for (size_t i = 0; i < m_meshes.size(); ++i) {
+        fill_record_transform(m_records[i], *m_meshes[i]);
+    }
+
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_record_buffer));
+    CHECK_GL_ERROR(glBufferSubData(
+        GL_SHADER_STORAGE_BUFFER,
+        0,
+        static_cast<GLsizeiptr>(m_records.size() * sizeof(IndirectDrawRecord)),
+        m_records.data()
+    ));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+void IndirectDrawBuffer::cull(
+    Program& cull_program,
+    const Frustum& frustum,
+    IndirectCullPass pass,
+    const HiZPyramid* hiz
+) noexcept {
+    assert(((pass != IndirectCullPass::OCCLUSION_SECOND) || (hiz && hiz->isValid())) && "The second occlusion pass needs a depth pyramid");
+
+    // start from commands with no instances and empty batches: the commands past the visible
+    // ones of a batch are then skipped by the multi-draw
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, m_command_template_buffer));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, m_command_buffer));
+    CHECK_GL_ERROR(glCopyBufferSubData(
+        GL_COPY_READ_BUFFER,
+        GL_COPY_WRITE_BUFFER,
+        0,
+        0,
+        static_cast<GLsizeiptr>(m_records.size() * sizeof(DrawElementsIndirectCommand))
+    ));
+
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, m_batch_counter_reset_buffer));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, m_batch_counter_buffer));
+    CHECK_GL_ERROR(glCopyBufferSubData(
+        GL_COPY_READ_BUFFER,
+        GL_COPY_WRITE_BUFFER,
+        0,
+        0,
+        static_cast<GLsizeiptr>(m_batches.size() * sizeof(GLuint))
+    ));
+
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    CHECK_GL_ERROR(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+
+    cull_program.bind();
+    cull_program.uniformUint("u_DrawCount", static_cast<glm::uint>(m_records.size()));
+    for (size_t i = 0; i < frustum.planes.size(); ++i) {
+        cull_program.uniformVec4("u_FrustumPlanes[" + std::to_string(i) + "]", frustum.planes[i]);
+    }
+
+    cull_program.uniformStorageBufferBinding("IndirectDrawBuffer", m_record_buffer);
+    cull_program.uniformStorageBufferBinding("IndirectCommandBuffer", m_command_buffer);
+    cull_program.uniformStorageBufferBinding("IndirectBatchCounterBuffer", m_batch_counter_buffer);
+    cull_program.uniformStorageBufferBinding("IndirectVisibilityBuffer", m_visibility_buffer);
+
+    cull_program.uniformUint("u_CullPass", static_cast<glm::uint>(pass));
+    if ((pass != IndirectCullPass::FRUSTUM) && hiz && hiz->isValid()) {
+        CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
+        CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, hiz->getTexture()));
+        cull_program.uniformInt("u_HiZLevelCount", hiz->getLevelCount());
+        cull_program.uniformMat4x4("u_HiZViewProjection", hiz->getViewProjection());
+    } else {
+        cull_program.uniformInt("u_HiZLevelCount", 0);
+    }
+
+    const GLuint local_size_x = 64u; // must match compute shader local size
+    cull_program.dispatchCompute((static_cast<GLuint>(m_records.size()) + local_size_x - 1u) / local_size_x, 1, 1);
+
+    // the commands are read by the following draws
+    CHECK_GL_ERROR(glMemoryBarrier(GL_COMMAND_BARRIER_BIT));
+}
+
+void IndirectDrawBuffer::draw(GLint record_binding, bool bind_materials) const noexcept {
+    if (record_binding >= 0) {
+        CHECK_GL_ERROR(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(record_binding), m_record_buffer));
+    }
+
+    glBindVertexArray(m_vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_command_buffer);
+
+    if (bind_materials) {
+        for (const auto& batch : m_batches) {
+            // the colors and flags come from the records: only the textures are bound here
+            batch.material->bindRenderState(-1, -1, -1, -1);
+
+            glMultiDrawElementsIndirectEXT(
+                GL_TRIANGLES,
+                GL_UNSIGNED_INT,
+                (const void*)((uintptr_t)(batch.first * sizeof(DrawElementsIndirectCommand))),
+                static_cast<GLsizei>(batch.count),
+                0
+            );
+        }
+    } else {
+        glMultiDrawElementsIndirectEXT(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(m_records.size()), 0);
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
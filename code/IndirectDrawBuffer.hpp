@@ -0,0 +1,192 @@
+#pragma once
+
+#include "OpenGL.hpp"
+#include "Mesh.hpp"
+#include "Material.hpp"
+#include "Program.hpp"
+#include "Culling.hpp"
+#include "HiZPyramid.hpp"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Must match the IndirectDrawRecord of cull_draws.comp and mesh.vert (INDIRECT_DRAW)
+struct IndirectDrawRecord {
+    glm::mat4 model;
+
+    // mat3 in the upper-left corner
+    glm::mat4 normal_matrix;
+
+    // world-space box: center and half extent (xyz)
+    glm::vec4 bounds_center;
+
+    glm::vec4 bounds_extent;
+
+    // rgb: diffuse color, a: shininess
+    glm::vec4 diffuse_color_shininess;
+
+    glm::vec4 specular_color;
+
+    glm::uint material_flags;
+
+    glm::uint index_count;
+
+    glm::uint first_index;
+
+    glm::int32 base_vertex;
+
+    // batch of the draw, and its first command
+    glm::uint batch;
+
+    glm::uint batch_first;
+
+    glm::uint padding_1[2];
+};
+
+static_assert(sizeof(IndirectDrawRecord) == 224, "IndirectDrawRecord must match its std430 layout");
+
+// Same layout as the commands read by glDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    glm::uint count;
+
+    glm::uint instance_count;
+
+    glm::uint first_index;
+
+    glm::int32 base_vertex;
+
+    glm::uint base_instance;
+};
+
+static_assert(sizeof(DrawElementsIndirectCommand) == 20, "DrawElementsIndirectCommand must be tightly packed");
+
+// Must match the CULL_PASS_ defines of cull_draws.comp
+enum class IndirectCullPass {
+    // frustum only
+    FRUSTUM,
+    // frustum, then the depth of a previous frame (reprojected): the draws it hides are kept for the second pass
+    OCCLUSION_FIRST,
+    // the draws hidden in the first pass, against the depth drawn by it
+    OCCLUSION_SECOND,
+};
+
+/**
+ * Static meshes merged into a single vertex and index buffer, drawn by GPU-culled indirect commands.
+ *
+ * Every mesh is a draw record (model matrix, world bounds and material). cull_draws.comp tests the
+ * records against a frustum and writes the commands of the visible ones, packed at the start of the
+ * range of their batch: meshes sharing the same textures. Each batch is then a single multi-draw,
+ * so the CPU cost does not depend on the number of meshes.
+ *
+ * Needs GL_EXT_multi_draw_indirect and GL_EXT_base_instance: the draw index reaches the vertex
+ * shader as the base instance of the command, through an instanced attribute (location 11).
+ */
+class IndirectDrawBuffer {
+public:
+    IndirectDrawBuffer() = delete;
+
+    IndirectDrawBuffer(const IndirectDrawBuffer&) = delete;
+
+    IndirectDrawBuffer& operator=(const IndirectDrawBuffer&) = delete;
+
+    ~IndirectDrawBuffer() noexcept;
+
+    // whether the extensions the indirect draws need are available
+    static bool IsSupported() noexcept;
+
+    /**
+     * Copy the vertices and indices of the meshes (drawn from their static vertices) into the
+     * shared buffers. Returns nullptr if there are no meshes or the extensions are missing.
+     */
+    static IndirectDrawBuffer* Create(const std::vector<const Mesh*>& meshes) noexcept;
+
+    // whether the buffer holds exactly these meshes, in this order
+    bool holds(const std::vector<const Mesh*>& meshes) const noexcept;
+
+    // upload the model matrices and bounds of the meshes again (they moved)
+    void updateRecords() noexcept;
+
+    /**
+     * Write the commands of the draws that may intersect the frustum (cull_draws.comp).
+     * The commands are valid until the next cull.
+     *
+     * The occlusion passes also test the draws against hiz: OCCLUSION_FIRST skips the test when it
+     * is null or invalid, OCCLUSION_SECOND needs a valid one and must follow an OCCLUSION_FIRST.
+     */
+    void cull(
+        Program& cull_program,
+        const Frustum& frustum,
+        IndirectCullPass pass = IndirectCullPass::FRUSTUM,
+        const HiZPyramid* hiz = nullptr
+    ) noexcept;
+
+    /**
+     * Draw the commands of the last cull with the bound program (mesh.vert with INDIRECT_DRAW).
+     * With bind_materials the textures of every batch are bound first (units 0 to 2), otherwise
+     * all the batches are drawn at once (depth-only passes).
+     *
+     * @param record_binding binding point of IndirectDrawBuffer in the bound program
+     */
+    void draw(GLint record_binding, bool bind_materials) const noexcept;
+
+    inline size_t getDrawCount() const noexcept { return m_meshes.size(); }
+
+    inline size_t getBatchCount() const noexcept { return m_batches.size(); }
+
+private:
+    // draws sharing the textures of material, commands [first, first + count)
+    struct Batch {
+        std::shared_ptr<Material> material;
+
+        glm::uint first;
+
+        glm::uint count;
+    };
+
+    IndirectDrawBuffer(
+        std::vector<const Mesh*>&& source_meshes,
+        std::vector<const Mesh*>&& meshes,
+        std::vector<IndirectDrawRecord>&& records,
+        std::vector<Batch>&& batches,
+        GLuint vao,
+        GLuint vertex_buffer,
+        GLuint index_buffer,
+        GLuint draw_index_buffer,
+        GLuint record_buffer,
+        GLuint command_template_buffer,
+        GLuint command_buffer,
+        GLuint batch_counter_buffer,
+        GLuint batch_counter_reset_buffer,
+        GLuint visibility_buffer
+    ) noexcept;
+
+    // the meshes in the order of their records (sorted by batch)
+    std::vector<const Mesh*> m_meshes;
+
+    // the meshes in the order they were given to Create
+    std::vector<const Mesh*> m_source_meshes;
+
+    std::vector<IndirectDrawRecord> m_records;
+
+    std::vector<Batch> m_batches;
+
+    // merged static vertices and indices, with the draw index as an instanced attribute
+    GLuint m_vao;
+    GLuint m_vertex_buffer;
+    GLuint m_index_buffer;
+    GLuint m_draw_index_buffer;
+
+    GLuint m_record_buffer;
+
+    // every command with no instances: copied over the commands before each cull
+    GLuint m_command_template_buffer;
+    GLuint m_command_buffer;
+
+    GLuint m_batch_counter_buffer;
+    GLuint m_batch_counter_reset_buffer;
+
+    // per draw: what the first occlusion pass did with it
+    GLuint m_visibility_buffer;
+};
@@ -17,21 +17,29 @@ Material::Material(
 
 }
 
+glm::uint Material::getMaterialFlags() const noexcept {
+    glm::uint material_flags = 0x00000000;
+    if (m_diffuse_texture) material_flags |= 0x00000001;
+    if (m_specular_texture) material_flags |= 0x00000002;
+    if (m_displacement_texture) material_flags |= 0x00000004;
+    return material_flags;
+}
+
 void Material::bindRenderState(
     GLint diffuse_color_location,
     GLint specular_color_location,
     GLint material_uniform_location,
     GLint shininess_location
 ) const noexcept {
-    const auto diffuse_texture = getDiffuseTexture();
-
-    glm::uint material_flags = 0x00000000;
+    bindTextures();
+    bindUniforms(diffuse_color_location, specular_color_location, material_uniform_location, shininess_location);
+}
 
+void Material::bindTextures() const noexcept {
+    const auto diffuse_texture = getDiffuseTexture();
     if (diffuse_texture) {
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, diffuse_texture->getTextureId());
-
-        material_flags |= 0x00000001;
     } else {
         // ensure unit 0 has no texture bound
         glActiveTexture(GL_TEXTURE0);
@@ -42,8 +50,6 @@ void Material::bindRenderState(
     if (specular_texture) {
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D, specular_texture->getTextureId());
-
-        material_flags |= 0x00000002;
     } else {
         // ensure unit 1 has no texture bound
         glActiveTexture(GL_TEXTURE1);
@@ -54,14 +60,19 @@ void Material::bindRenderState(
     if (displacement_texture) {
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_2D, displacement_texture->getTextureId());
-
-        material_flags |= 0x00000004;
     } else {
         // ensure unit 2 has no texture bound
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_2D, 0);
     }
+}
 
+void Material::bindUniforms(
+    GLint diffuse_color_location,
+    GLint specular_color_location,
+    GLint material_uniform_location,
+    GLint shininess_location
+) const noexcept {
     if (diffuse_color_location >= 0) {
         glUniform3fv(diffuse_color_location, 1, glm::value_ptr(m_diffuse_color));
     }
@@ -71,7 +82,7 @@ void Material::bindRenderState(
     }
 
     if (material_uniform_location >= 0) {
-        glUniform1ui(material_uniform_location, material_flags);
+        glUniform1ui(material_uniform_location, getMaterialFlags());
     }
 
     if (shininess_location >= 0) {
@@ -43,6 +43,22 @@ public:
         return m_displacement_texture;
     }
 
+    inline const glm::vec3& getDiffuseColor() const noexcept {
+        return m_diffuse_color;
+    }
+
+    inline const glm::vec3& getSpecularColor() const noexcept {
+        return m_specular_color;
+    }
+
+    inline float getShininess() const noexcept {
+        return m_shininess;
+    }
+
+    // the u_material_flags bindRenderState sets: 0x1 diffuse, 0x2 specular, 0x4 displacement texture
+    glm::uint getMaterialFlags() const noexcept;
+
+    // bindTextures then bindUniforms
     void bindRenderState(
         GLint diffuse_color_location,
         GLint specular_color_location,
@@ -50,6 +66,17 @@ public:
         GLint shininess_location
     ) const noexcept;
 
+    // diffuse, specular and displacement textures to units 0, 1 and 2 (0 for the missing ones)
+    void bindTextures() const noexcept;
+
+    // colors, shininess and flags, to the given uniforms of the bound program (-1 to skip one)
+    void bindUniforms(
+        GLint diffuse_color_location,
+        GLint specular_color_location,
+        GLint material_uniform_location,
+        GLint shininess_location
+    ) const noexcept;
+
 private:
     glm::vec3 m_diffuse_color;
 
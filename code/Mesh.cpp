@@ -1,19 +1,35 @@
 #include "Mesh.hpp"
 
 #include <cassert>
+#include <limits>
+#include <algorithm>
 
 Mesh::Mesh(
     GLuint vbo,
     GLuint vbi,
     GLuint ibo_count,
+    GLuint vertex_count,
     std::shared_ptr<Material> material,
     std::shared_ptr<SkeletonTree> m_skeleton_tree,
-    const glm::mat4& model
+    const glm::mat4& model,
+    uint32_t influence_count
 ) noexcept :
     m_vao(0),
     m_vbo(vbo),
     m_ibo(vbi),
     m_ibo_count(ibo_count),
+    m_vertex_count(vertex_count),
+    m_influence_count(m_skeleton_tree ? ClassifyInfluenceCount(influence_count) : 0u),
+    m_skinned_vbo(0),
+    m_skinned_vao(0),
+    m_skinned_palette_revision(0),
+    m_bounds_min(0.0f),
+    m_bounds_max(0.0f),
+    m_bounding_sphere(0.0f),
+    m_bone_bounds_buffer(0),
+    m_bone_bounds_count(0),
+    m_unskinned_bounds_min(std::numeric_limits<float>::max()),
+    m_unskinned_bounds_max(std::numeric_limits<float>::lowest()),
     m_material(material),
     m_model_matrix(model),
     m_skeleton_tree(m_skeleton_tree)
@@ -70,6 +86,35 @@ Mesh::Mesh(
 
     // Unbind VAO to avoid accidental modifications
     CHECK_GL_ERROR(glBindVertexArray(0));
+
+    if (m_skeleton_tree && (m_vertex_count > 0)) {
+        CHECK_GL_ERROR(glGenBuffers(1, &m_skinned_vbo));
+        assert(m_skinned_vbo != 0 && "Failed to generate skinned vbo");
+
+        CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, m_skinned_vbo));
+        CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(m_vertex_count * sizeof(SkinnedVertexData)), nullptr, GL_DYNAMIC_COPY));
+
+        CHECK_GL_ERROR(glGenVertexArrays(1, &m_skinned_vao));
+        assert(m_skinned_vao != 0 && "Failed to generate skinned vao");
+
+        CHECK_GL_ERROR(glBindVertexArray(m_skinned_vao));
+        CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo));
+
+        // skinned position and normal
+        constexpr GLsizei skinned_stride = sizeof(SkinnedVertexData);
+        CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, m_skinned_vbo));
+        CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+        CHECK_GL_ERROR(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, skinned_stride, (const void*)((uintptr_t)(offsetof(SkinnedVertexData, position_x)))));
+        CHECK_GL_ERROR(glEnableVertexAttribArray(2));
+        CHECK_GL_ERROR(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, skinned_stride, (const void*)((uintptr_t)(offsetof(SkinnedVertexData, normal_x)))));
+
+        // texcoord from the original vertex buffer
+        CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, m_vbo));
+        CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+        CHECK_GL_ERROR(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (const void*)((uintptr_t)(offsetof(VertexData, texcoord_u)))));
+
+        CHECK_GL_ERROR(glBindVertexArray(0));
+    }
 }
 
 std::shared_ptr<Material> Mesh::getMaterial() const noexcept {
@@ -89,6 +134,77 @@ Mesh::~Mesh() noexcept {
         glDeleteBuffers(1, &m_ibo);
         m_ibo = 0;
     }
+    if (m_skinned_vao) {
+        glDeleteVertexArrays(1, &m_skinned_vao);
+        m_skinned_vao = 0;
+    }
+    if (m_skinned_vbo) {
+        glDeleteBuffers(1, &m_skinned_vbo);
+        m_skinned_vbo = 0;
+    }
+    if (m_bone_bounds_buffer) {
+        glDeleteBuffers(1, &m_bone_bounds_buffer);
+        m_bone_bounds_buffer = 0;
+    }
+}
+
+void Mesh::getWorldBounds(glm::vec3& bounds_min, glm::vec3& bounds_max) const noexcept {
+    // center and extent of the box, the extent moved by the absolute value of the linear part
+    const glm::vec3 center = (m_bounds_min + m_bounds_max) * 0.5f;
+    const glm::vec3 extent = (m_bounds_max - m_bounds_min) * 0.5f;
+
+    const glm::vec3 world_center = glm::vec3(m_model_matrix * glm::vec4(center, 1.0f));
+    const glm::vec3 world_extent =
+        glm::abs(glm::vec3(m_model_matrix[0])) * extent.x +
+        glm::abs(glm::vec3(m_model_matrix[1])) * extent.y +
+        glm::abs(glm::vec3(m_model_matrix[2])) * extent.z;
+
+    bounds_min = world_center - world_extent;
+    bounds_max = world_center + world_extent;
+}
+
+glm::vec4 Mesh::getWorldBoundingSphere() const noexcept {
+    const float scale = std::max({
+        glm::length(glm::vec3(m_model_matrix[0])),
+        glm::length(glm::vec3(m_model_matrix[1])),
+        glm::length(glm::vec3(m_model_matrix[2]))
+    });
+
+    const glm::vec3 center = glm::vec3(m_model_matrix * glm::vec4(glm::vec3(m_bounding_sphere), 1.0f));
+    return glm::vec4(center, m_bounding_sphere.w * scale);
+}
+
+void Mesh::setBoneBounds(
+    const std::vector<BoneBounds>& bone_bounds,
+    const glm::vec3& unskinned_min,
+    const glm::vec3& unskinned_max
+) noexcept {
+    m_unskinned_bounds_min = unskinned_min;
+    m_unskinned_bounds_max = unskinned_max;
+    m_bone_bounds_count = static_cast<uint32_t>(bone_bounds.size());
+
+    if (bone_bounds.empty()) return;
+
+    if (!m_bone_bounds_buffer) {
+        CHECK_GL_ERROR(glGenBuffers(1, &m_bone_bounds_buffer));
+        assert(m_bone_bounds_buffer != 0 && "Failed to generate bone bounds buffer");
+    }
+
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_bone_bounds_buffer));
+    CHECK_GL_ERROR(glBufferData(
+        GL_SHADER_STORAGE_BUFFER,
+        static_cast<GLsizeiptr>(bone_bounds.size() * sizeof(BoneBounds)),
+        bone_bounds.data(),
+        GL_STATIC_DRAW
+    ));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+void Mesh::setSkinnedBounds(const glm::vec3& bounds_min, const glm::vec3& bounds_max) noexcept {
+    m_bounds_min = glm::min(bounds_min, m_unskinned_bounds_min);
+    m_bounds_max = glm::max(bounds_max, m_unskinned_bounds_max);
+
+    m_bounding_sphere = glm::vec4((m_bounds_min + m_bounds_max) * 0.5f, glm::length(m_bounds_max - m_bounds_min) * 0.5f);
 }
 
 void Mesh::draw(
@@ -108,7 +224,7 @@ void Mesh::draw(
         m_skeleton_tree->bind(static_cast<GLuint>(skeleton_binding));
     }
 
-    glBindVertexArray(m_vao);
+    glBindVertexArray(isSkinned() ? m_skinned_vao : m_vao);
     glDrawElements(GL_TRIANGLES, m_ibo_count, GL_UNSIGNED_INT, nullptr);
     glBindVertexArray(0);
 
@@ -118,6 +234,28 @@ void Mesh::draw(
     }
 }
 
+void Mesh::drawInstanced(
+    GLint diffuse_color_location,
+    GLint specular_color_location,
+    GLint material_uniform_location,
+    GLint shininess_location,
+    GLsizei instance_count
+) const noexcept {
+    if (instance_count <= 0) return;
+
+    getMaterial()->bindRenderState(diffuse_color_location, specular_color_location, material_uniform_location, shininess_location);
+
+    glBindVertexArray(m_vao);
+    glDrawElementsInstanced(GL_TRIANGLES, m_ibo_count, GL_UNSIGNED_INT, nullptr, instance_count);
+    glBindVertexArray(0);
+}
+
+uint32_t Mesh::ClassifyInfluenceCount(uint32_t max_influences) noexcept {
+    if (max_influences == 0u) return 0u;
+    if (max_influences <= 2u) return max_influences;
+    return MESH_MAX_BONE_INFLUENCES;
+}
+
 GLuint Mesh::CreateVertexBuffer(const void *const data, GLsizeiptr size) noexcept {
     GLuint vbo = 0;
     glGenBuffers(1, &vbo);
@@ -5,8 +5,16 @@
 #include "OpenGL.hpp"
 
 #include <memory>
+#include <vector>
+#include <cstdint>
 #include <glm/glm.hpp>
 
+// Bone slots of VertexData
+#define MESH_MAX_BONE_INFLUENCES 4u
+
+// skin.comp is specialised for vertices influenced by at most 1, 2 or 4 bones
+#define SKINNING_INFLUENCE_CLASSES 3
+
 struct VertexData {
     float position_x;
     float position_y;
@@ -32,6 +40,25 @@ struct VertexData {
     float bone_weight_3;
 };
 
+// Bind-pose box of the vertices influenced by a bone (w unused): min > max when there are none
+struct BoneBounds {
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+static_assert(sizeof(BoneBounds) == 32, "BoneBounds must match the std430 layout of bounds.comp");
+
+// Output of skin.comp: texture coordinates are still read from the original VertexData
+struct SkinnedVertexData {
+    float position_x;
+    float position_y;
+    float position_z;
+
+    float normal_x;
+    float normal_y;
+    float normal_z;
+};
+
 class Mesh {
 
 public:
@@ -43,9 +70,11 @@ public:
         GLuint vbo,
         GLuint vbi,
         GLuint ibo_count,
+        GLuint vertex_count,
         std::shared_ptr<Material> material,
         std::shared_ptr<SkeletonTree> m_skeleton_tree = nullptr,
-        const glm::mat4& model = glm::mat4(1.0f)
+        const glm::mat4& model = glm::mat4(1.0f),
+        uint32_t influence_count = MESH_MAX_BONE_INFLUENCES
     ) noexcept;
 
     virtual ~Mesh() noexcept;
@@ -58,12 +87,115 @@ public:
         GLint skeleton_binding = -1
     ) const noexcept;
 
+    /**
+     * Draw instance_count copies of the original (unskinned) vertices: the vertex shader is
+     * expected to skin and place every instance (mesh.vert with CROWD_INSTANCING or BAKED_PALETTE).
+     */
+    void drawInstanced(
+        GLint diffuse_color_location,
+        GLint specular_color_location,
+        GLint material_uniform_location,
+        GLint shininess_location,
+        GLsizei instance_count
+    ) const noexcept;
+
     std::shared_ptr<Material> getMaterial() const noexcept;
 
     inline const glm::mat4& getModelMatrix() const noexcept { return m_model_matrix; }
 
     inline void setModelMatrix(const glm::mat4& m) noexcept { m_model_matrix = m; }
 
+    /**
+     * A mesh with a skeleton is skinned once per palette change by skin.comp into its own
+     * vertex buffer, which every pass then draws from.
+     */
+    inline bool isSkinned() const noexcept { return m_skinned_vbo != 0; }
+
+    inline std::shared_ptr<SkeletonTree> getSkeleton() const noexcept { return m_skeleton_tree; }
+
+    inline GLuint getVertexBuffer() const noexcept { return m_vbo; }
+
+    inline GLuint getSkinnedVertexBuffer() const noexcept { return m_skinned_vbo; }
+
+    inline GLuint getVertexCount() const noexcept { return m_vertex_count; }
+
+    inline GLuint getIndexBuffer() const noexcept { return m_ibo; }
+
+    inline GLuint getIndexCount() const noexcept { return m_ibo_count; }
+
+    // the VAO draw binds: the skinned vertices once the mesh is skinned
+    inline GLuint getVertexArray() const noexcept { return isSkinned() ? m_skinned_vao : m_vao; }
+
+    /**
+     * Bone slots that skin.comp has to read for every vertex: 1, 2 or 4, or 0 for a static mesh.
+     * Vertices fill their slots in order, so a mesh of class N never uses slots past N - 1.
+     */
+    inline uint32_t getInfluenceCount() const noexcept { return m_influence_count; }
+
+    // index of the skin.comp variant for this mesh, in [0, SKINNING_INFLUENCE_CLASSES)
+    inline size_t getInfluenceClass() const noexcept {
+        return (m_influence_count <= 1u) ? 0u : ((m_influence_count == 2u) ? 1u : 2u);
+    }
+
+    /**
+     * Round the largest number of bones influencing a vertex of a mesh up to a class of
+     * skin.comp: 0, 1, 2 or MESH_MAX_BONE_INFLUENCES.
+     */
+    static uint32_t ClassifyInfluenceCount(uint32_t max_influences) noexcept;
+
+    /**
+     * Model-space bounding box: the bind pose one until the mesh is skinned, then the one of the
+     * last palette read back from bounds.comp (see Scene::skinMeshes).
+     */
+    inline const glm::vec3& getBoundsMin() const noexcept { return m_bounds_min; }
+
+    inline const glm::vec3& getBoundsMax() const noexcept { return m_bounds_max; }
+
+    inline void setBounds(const glm::vec3& bounds_min, const glm::vec3& bounds_max) noexcept {
+        m_bounds_min = bounds_min;
+        m_bounds_max = bounds_max;
+    }
+
+    // getBoundsMin/getBoundsMax transformed by the model matrix
+    void getWorldBounds(glm::vec3& bounds_min, glm::vec3& bounds_max) const noexcept;
+
+    /**
+     * Model-space bounding sphere (xyz: center, w: radius): through the farthest vertex at load
+     * time, around the bounding box once the mesh is skinned.
+     */
+    inline const glm::vec4& getBoundingSphere() const noexcept { return m_bounding_sphere; }
+
+    inline void setBoundingSphere(const glm::vec3& center, float radius) noexcept {
+        m_bounding_sphere = glm::vec4(center, radius);
+    }
+
+    // getBoundingSphere transformed by the model matrix (the radius by its largest scale)
+    glm::vec4 getWorldBoundingSphere() const noexcept;
+
+    /**
+     * Bind-pose boxes of the vertices of every bone (indexed by palette index) and of the vertices
+     * no bone influences: the skinned bounds are the union of the bone boxes moved by the palette.
+     */
+    void setBoneBounds(
+        const std::vector<BoneBounds>& bone_bounds,
+        const glm::vec3& unskinned_min,
+        const glm::vec3& unskinned_max
+    ) noexcept;
+
+    inline GLuint getBoneBoundsBuffer() const noexcept { return m_bone_bounds_buffer; }
+
+    inline uint32_t getBoneBoundsCount() const noexcept { return m_bone_bounds_count; }
+
+    // skinned bounds read back from the GPU: the unskinned vertices are added here
+    void setSkinnedBounds(const glm::vec3& bounds_min, const glm::vec3& bounds_max) noexcept;
+
+    // true when the skinned vertex buffer was written with an older palette than the current one
+    inline bool isSkinningOutdated() const noexcept {
+        return isSkinned() && (m_skinned_palette_revision != m_skeleton_tree->getPaletteRevision());
+    }
+
+    inline void markSkinned() noexcept { m_skinned_palette_revision = m_skeleton_tree->getPaletteRevision(); }
+
     static GLuint CreateVertexBuffer(const void *const data, GLsizeiptr size) noexcept;
 
     static GLuint CreateElementBuffer(const void *const data, GLsizeiptr size) noexcept;
@@ -78,6 +210,28 @@ private:
 
     GLuint m_ibo_count;
 
+    GLuint m_vertex_count;
+
+    uint32_t m_influence_count;
+
+    // skin.comp output (0 = not skinned) and the VAO that draws from it
+    GLuint m_skinned_vbo;
+    GLuint m_skinned_vao;
+
+    uint64_t m_skinned_palette_revision;
+
+    glm::vec3 m_bounds_min;
+    glm::vec3 m_bounds_max;
+
+    glm::vec4 m_bounding_sphere;
+
+    // bone boxes for bounds.comp (0 = not skinned)
+    GLuint m_bone_bounds_buffer;
+    uint32_t m_bone_bounds_count;
+
+    glm::vec3 m_unskinned_bounds_min;
+    glm::vec3 m_unskinned_bounds_max;
+
     // Optional GL texture attached to mesh (0 = none)
     std::shared_ptr<Material> m_material;
 
@@ -50,7 +50,11 @@ protected:
         CHECK_GL_ERROR(glDisable(GL_DEPTH_TEST));
     }
 
-    inline void withFramebuffer(const Framebuffer *const fbo, std::function<void()> fn) const noexcept {
+    /**
+     * Bind fbo for the duration of fn. The attachments are cleared first unless clear is false,
+     * which lets several passes accumulate into the same target.
+     */
+    inline void withFramebuffer(const Framebuffer *const fbo, std::function<void()> fn, bool clear = true) const noexcept {
         GLint prev_fbo = 0;
         CHECK_GL_ERROR(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo));
 
@@ -78,7 +82,9 @@ protected:
         if (fbo->hasDepthStencilAttachment())
             clear_flags |= GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
 
-        CHECK_GL_ERROR(glClear(clear_flags));
+        if (clear) {
+            CHECK_GL_ERROR(glClear(clear_flags));
+        }
 
         fn();
 
@@ -97,6 +103,25 @@ protected:
         CHECK_GL_ERROR(glDisable(GL_CULL_FACE));
     }
 
+    inline void withAdditiveBlending(std::function<void()> fn) const noexcept {
+        CHECK_GL_ERROR(glEnable(GL_BLEND));
+        CHECK_GL_ERROR(glBlendEquation(GL_FUNC_ADD));
+        CHECK_GL_ERROR(glBlendFunc(GL_ONE, GL_ONE));
+
+        fn();
+
+        CHECK_GL_ERROR(glDisable(GL_BLEND));
+    }
+
+    inline void withScissor(GLint x, GLint y, GLsizei width, GLsizei height, std::function<void()> fn) const noexcept {
+        CHECK_GL_ERROR(glEnable(GL_SCISSOR_TEST));
+        CHECK_GL_ERROR(glScissor(x, y, width, height));
+
+        fn();
+
+        CHECK_GL_ERROR(glDisable(GL_SCISSOR_TEST));
+    }
+
     void bindViewport(GLint x, GLint y, GLsizei width, GLsizei height) const noexcept {
         CHECK_GL_ERROR(glViewport(x, y, width, height));
     }
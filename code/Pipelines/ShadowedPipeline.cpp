@@ -6,6 +6,11 @@
 #include <cassert>
 #include <string>
 #include <random>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <bit>
 
 #include "Scene.hpp"
 
@@ -20,6 +25,233 @@ static GLint find_ssbo_binding(GLuint program, const char* block_name) {
     return binding;
 }
 
+// Depth of the center of the mesh in the view of view_projection, for the render queue
+static float sort_depth(const glm::mat4& view_projection, const Mesh& mesh) noexcept {
+    const glm::vec4 center = glm::vec4(glm::vec3(mesh.getWorldBoundingSphere()), 1.0f);
+    const glm::vec4 clip = view_projection * center;
+
+    // behind the eye: first anyway
+    if (clip.w <= 0.0f) return 0.0f;
+
+    return glm::clamp((clip.z / clip.w) * 0.5f + 0.5f, 0.0f, 1.0f);
+}
+
+static GLuint create_storage_buffer(size_t size, GLenum usage) noexcept {
+    GLuint buffer = 0;
+
+    CHECK_GL_ERROR(glGenBuffers(1, &buffer));
+    assert(buffer != 0 && "Failed to generate storage buffer");
+
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer));
+    CHECK_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(size), nullptr, usage));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    return buffer;
+}
+
+static glm::mat4 cone_light_space_matrix(const ConeLight& cone, glm::float32 aspect) noexcept {
+    const glm::vec3 light_pos = cone.getPosition();
+    const glm::vec3 light_dir = cone.getDirection();
+    const glm::mat4 light_view = glm::lookAt(
+        light_pos,
+        light_pos + light_dir,
+        glm::vec3(0.0f, 1.0f, 0.0f)
+    );
+
+    const auto light_proj = glm::perspective(
+        cone.getAngleRadians(),
+        aspect,
+        cone.getZNear(),
+        cone.getZFar()
+    );
+
+    return light_proj * light_view;
+}
+
+/**
+ * Screen rectangle (x, y, width, height in pixels) and window-space depth range covered by the
+ * lit volume of a cone light: a pyramid around the cone of the light range.
+ * Returns false when the light cannot reach any visible pixel.
+ */
+static bool cone_light_screen_bounds(
+    const ConeLight& cone,
+    const glm::mat4& view_projection,
+    GLsizei width,
+    GLsizei height,
+    glm::ivec4& scissor,
+    glm::vec2& depth_bounds
+) noexcept {
+    scissor = glm::ivec4(0, 0, width, height);
+    depth_bounds = glm::vec2(0.0f, 1.0f);
+
+    const auto half_angle = cone.getAngleRadians() * 0.5f;
+    if (half_angle >= glm::radians(90.0f)) {
+        return true;
+    }
+
+    const auto range = cone.getZFar();
+    const auto position = cone.getPosition();
+    const auto direction = glm::normalize(cone.getDirection());
+    const auto up = (std::abs(direction.y) < 0.99f) ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    const auto u = glm::normalize(glm::cross(direction, up));
+    const auto v = glm::cross(direction, u);
+    // the lit volume ends at `range` along the axis, where the cone is range * tan(half_angle) wide
+    const auto base_radius = range * std::tan(half_angle);
+
+    glm::vec3 lo(std::numeric_limits<glm::float32>::max());
+    glm::vec3 hi(-std::numeric_limits<glm::float32>::max());
+    for (int corner = 0; corner < 8; ++corner) {
+        // a pyramid: the square around the base disc, and the apex itself
+        const auto radius = (corner & 1) ? base_radius : 0.0f;
+        const glm::vec3 p = position +
+            direction * ((corner & 1) ? range : 0.0f) +
+            u * ((corner & 2) ? radius : -radius) +
+            v * ((corner & 4) ? radius : -radius);
+
+        const auto clip = view_projection * glm::vec4(p, 1.0f);
+
+        // the volume crosses the camera plane: keep the whole screen
+        if (clip.w <= 0.0f) {
+            return true;
+        }
+
+        const auto ndc = glm::vec3(clip) / clip.w;
+        lo = glm::min(lo, ndc);
+        hi = glm::max(hi, ndc);
+    }
+
+    if ((hi.x < -1.0f) || (lo.x > 1.0f) || (hi.y < -1.0f) || (lo.y > 1.0f) || (hi.z < -1.0f) || (lo.z > 1.0f)) {
+        return false;
+    }
+
+    lo = glm::clamp(lo, glm::vec3(-1.0f), glm::vec3(1.0f));
+    hi = glm::clamp(hi, glm::vec3(-1.0f), glm::vec3(1.0f));
+
+    const auto x0 = static_cast<GLint>(std::floor((lo.x * 0.5f + 0.5f) * static_cast<glm::float32>(width)));
+    const auto y0 = static_cast<GLint>(std::floor((lo.y * 0.5f + 0.5f) * static_cast<glm::float32>(height)));
+    const auto x1 = static_cast<GLint>(std::ceil((hi.x * 0.5f + 0.5f) * static_cast<glm::float32>(width)));
+    const auto y1 = static_cast<GLint>(std::ceil((hi.y * 0.5f + 0.5f) * static_cast<glm::float32>(height)));
+    if ((x1 <= x0) || (y1 <= y0)) {
+        return false;
+    }
+
+    scissor = glm::ivec4(x0, y0, x1 - x0, y1 - y0);
+    depth_bounds = glm::vec2(lo.z, hi.z) * 0.5f + 0.5f;
+
+    return true;
+}
+
+/**
+ * Halve the largest of the requested power of two sides until all the tiles fit in the atlas
+ * (largest first, they then always find room: see ShadowAtlasAllocator).
+ */
+static void fit_shadow_tiles(std::vector<GLsizei>& sizes, GLsizei atlas_size, GLsizei min_tile) noexcept {
+    const auto atlas_area = static_cast<glm::uint64>(atlas_size) * static_cast<glm::uint64>(atlas_size);
+
+    glm::uint64 area = 0;
+    for (const auto size : sizes) area += static_cast<glm::uint64>(size) * static_cast<glm::uint64>(size);
+
+    while (area > atlas_area) {
+        const auto largest = std::max_element(sizes.begin(), sizes.end());
+        if (*largest <= min_tile) break;
+
+        const auto size = static_cast<glm::uint64>(*largest);
+        area -= size * size - (size / 2u) * (size / 2u);
+        *largest /= 2;
+    }
+}
+
+/**
+ * World-space box around the shadow casters.
+ * Returns false when some casters have no bounds: crowds place their instances on the GPU.
+ */
+static bool shadow_caster_bounds(const Scene *const scene, glm::vec3& bounds_min, glm::vec3& bounds_max) noexcept {
+    bounds_min = glm::vec3(std::numeric_limits<glm::float32>::max());
+    bounds_max = glm::vec3(-std::numeric_limits<glm::float32>::max());
+
+    const auto add_mesh = [&](const Mesh& mesh) {
+        glm::vec3 mesh_min, mesh_max;
+        mesh.getWorldBounds(mesh_min, mesh_max);
+        bounds_min = glm::min(bounds_min, mesh_min);
+        bounds_max = glm::max(bounds_max, mesh_max);
+    };
+
+    scene->foreachMesh(add_mesh);
+    scene->foreachBakedMesh([&](const Mesh& mesh, const BakedAnimation&, float) {
+        add_mesh(mesh);
+    });
+
+    bool bounded = true;
+    scene->foreachCrowd([&](const Crowd& crowd) {
+        if (crowd.getInstanceCount() > 0) bounded = false;
+    });
+
+    return bounded;
+}
+
+/**
+ * Light space matrix of a cascade of a directional light: an ortho projection around the bounding
+ * sphere of the slice of the view frustum, so that its size does not change as the camera turns,
+ * moved by whole texels only so that the shadows do not shimmer as the camera moves.
+ * The near plane is pulled back to the closest caster (or by fallback_distance if they are not bounded).
+ */
+static glm::mat4 cascade_light_space_matrix(
+    const glm::vec3& direction,
+    const std::array<glm::vec3, 8>& slice_corners,
+    GLsizei resolution,
+    bool casters_bounded,
+    const glm::vec3& casters_min,
+    const glm::vec3& casters_max,
+    glm::float32 fallback_distance
+) noexcept {
+    glm::vec3 center(0.0f);
+    for (const auto& corner : slice_corners) center += corner;
+    center /= static_cast<glm::float32>(slice_corners.size());
+
+    glm::float32 radius = 0.0f;
+    for (const auto& corner : slice_corners) radius = std::max(radius, glm::length(corner - center));
+
+    // rounded up so that float noise does not change the texel size
+    radius = std::ceil(radius * 16.0f) / 16.0f;
+
+    const auto light_dir = glm::normalize(direction);
+    const auto up = (std::abs(light_dir.y) < 0.99f) ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    const glm::mat4 light_view = glm::lookAt(glm::vec3(0.0f), light_dir, up);
+
+    glm::vec3 center_lightspace = glm::vec3(light_view * glm::vec4(center, 1.0f));
+    const auto texel = (2.0f * radius) / static_cast<glm::float32>(resolution);
+    center_lightspace.x = std::floor(center_lightspace.x / texel) * texel;
+    center_lightspace.y = std::floor(center_lightspace.y / texel) * texel;
+
+    // the light looks down -z
+    auto z_near = -center_lightspace.z - radius;
+    const auto z_far = -center_lightspace.z + radius;
+    if (casters_bounded) {
+        for (int corner = 0; corner < 8; ++corner) {
+            const glm::vec3 p(
+                (corner & 1) ? casters_max.x : casters_min.x,
+                (corner & 2) ? casters_max.y : casters_min.y,
+                (corner & 4) ? casters_max.z : casters_min.z
+            );
+
+            z_near = std::min(z_near, -(light_view * glm::vec4(p, 1.0f)).z);
+        }
+    } else {
+        z_near = std::min(z_near, -center_lightspace.z - fallback_distance);
+    }
+
+    const glm::mat4 light_proj = glm::ortho(
+        center_lightspace.x - radius,
+        center_lightspace.x + radius,
+        center_lightspace.y - radius,
+        center_lightspace.y + radius,
+        z_near,
+        z_far
+    );
+
+    return light_proj * light_view;
+}
+
 static std::string vertex_shader_source_str(reinterpret_cast<const char*>(mesh_vert_glsl), mesh_vert_glsl_len);
 static const GLchar *const vertex_shader_source = vertex_shader_source_str.c_str();
 
@@ -47,6 +279,21 @@ static const GLchar *const directional_lighting_fragment_shader = directional_li
 static std::string cone_lighting_fragment_shader_str(reinterpret_cast<const char*>(cone_lighting_frag_glsl), cone_lighting_frag_glsl_len);
 static const GLchar *const cone_lighting_fragment_shader = cone_lighting_fragment_shader_str.c_str();
 
+// Clustered cone lights: light binning compute shader and the single shading pass
+static std::string cluster_cone_lights_compute_shader_str(reinterpret_cast<const char*>(cluster_cone_lights_comp_glsl), cluster_cone_lights_comp_glsl_len);
+static const GLchar *const cluster_cone_lights_compute_shader = cluster_cone_lights_compute_shader_str.c_str();
+
+// GPU-driven draws: culls the draws of the indirect draw buffer and writes their commands, and
+// builds the depth pyramid of the occlusion culling
+static std::string cull_draws_compute_shader_str(reinterpret_cast<const char*>(cull_draws_comp_glsl), cull_draws_comp_glsl_len);
+static const GLchar *const cull_draws_compute_shader = cull_draws_compute_shader_str.c_str();
+
+static std::string hiz_build_compute_shader_str(reinterpret_cast<const char*>(hiz_build_comp_glsl), hiz_build_comp_glsl_len);
+static const GLchar *const hiz_build_compute_shader = hiz_build_compute_shader_str.c_str();
+
+static std::string clustered_cone_lighting_fragment_shader_str(reinterpret_cast<const char*>(clustered_cone_lighting_frag_glsl), clustered_cone_lighting_frag_glsl_len);
+static const GLchar *const clustered_cone_lighting_fragment_shader = clustered_cone_lighting_fragment_shader_str.c_str();
+
 // SSAO fragment shader: samples gbuffer and construct the SSAO framebuffer
 static std::string ssao_fragment_shader_str(reinterpret_cast<const char*>(ssao_frag_glsl), ssao_frag_glsl_len);
 static const GLchar *const ssao_fragment_shader = ssao_fragment_shader_str.c_str();
@@ -69,20 +316,19 @@ static const GLchar *const post_fragment_shader = post_fragment_shader_str.c_str
 
 static const auto gbuffer_attachments = std::vector<FramebufferColorFormat>{
     FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA8, // diffuse
-    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA8, // specular
+    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA8, // specular, shininess (log2-encoded) in alpha
     FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA8, // normal tangentspace
-    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA32F, // position (worldspace)
-    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA32F, // normal (worldspace)
-    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA32F, // tangent (worldspace)
-    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_R32F // shininess
+    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RG16F, // normal (worldspace, octahedral)
+    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RG16F // tangent (worldspace, octahedral)
+    // position (worldspace) is reconstructed from the depth attachment
 };
 
 static const auto ssao_attachments = std::vector<FramebufferColorFormat>{
     FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_R32F
 };
 
-static const auto lightbuffer_attachments = std::vector<FramebufferColorFormat>{
-    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA32F
+static const auto tonemapped_attachments = std::vector<FramebufferColorFormat>{
+    FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA8
 };
 
 static const GLsizei ssao_samples_count = 64;
@@ -91,7 +337,9 @@ ShadowedPipeline::ShadowedPipeline(
     std::unique_ptr<Framebuffer>&& gbuffer,
     std::unique_ptr<Framebuffer>&& ssaobuffer,
     std::unique_ptr<Framebuffer>&& ssao_blur_buffer,
-    std::array<std::unique_ptr<Framebuffer>, 2>&& lightbuffer,
+    std::unique_ptr<Framebuffer>&& lightbuffer,
+    FramebufferColorFormat lightbuffer_format,
+    std::unique_ptr<Framebuffer>&& tonemapped_buffer,
     std::unique_ptr<Framebuffer>&& shadowbuffer,
     std::unique_ptr<Buffer>&& ssao_sample_buffer,
     std::unique_ptr<Texture>&& ssao_noise_texture,
@@ -104,6 +352,18 @@ ShadowedPipeline::ShadowedPipeline(
     std::shared_ptr<Program> cone_lighting_program,
     std::shared_ptr<Program> tone_mapping_program,
     std::shared_ptr<Program> post_program,
+    std::shared_ptr<Program> crowd_mesh_program,
+    std::shared_ptr<Program> crowd_depth_only_program,
+    std::shared_ptr<Program> baked_mesh_program,
+    std::shared_ptr<Program> baked_depth_only_program,
+    std::shared_ptr<Program> cluster_cull_program,
+    std::shared_ptr<Program> clustered_cone_lighting_program,
+    std::shared_ptr<Program> indirect_mesh_program,
+    std::shared_ptr<Program> indirect_depth_only_program,
+    std::shared_ptr<Program> indirect_cull_program,
+    std::shared_ptr<Program> hiz_build_program,
+    std::unique_ptr<Framebuffer>&& shadow_atlas,
+    GLuint cone_light_buffer,
     std::shared_ptr<RenderQuad> m_render_quad,
     GLsizei width,
     GLsizei height
@@ -113,6 +373,8 @@ ShadowedPipeline::ShadowedPipeline(
     m_ssaobuffer(std::move(ssaobuffer)),
     m_ssao_blur_buffer(std::move(ssao_blur_buffer)),
     m_lightbuffer(std::move(lightbuffer)),
+    m_lightbuffer_format(lightbuffer_format),
+    m_tonemapped_buffer(std::move(tonemapped_buffer)),
     m_shadowbuffer(std::move(shadowbuffer)),
     m_ssao_sample_buffer(std::move(ssao_sample_buffer)),
     m_ssao_noise_texture(std::move(ssao_noise_texture)),
@@ -125,6 +387,18 @@ ShadowedPipeline::ShadowedPipeline(
     m_cone_lighting_program(cone_lighting_program),
     m_tone_mapping_program(tone_mapping_program),
     m_post_program(post_program),
+    m_crowd_mesh_program(crowd_mesh_program),
+    m_crowd_depth_only_program(crowd_depth_only_program),
+    m_baked_mesh_program(baked_mesh_program),
+    m_baked_depth_only_program(baked_depth_only_program),
+    m_cluster_cull_program(cluster_cull_program),
+    m_clustered_cone_lighting_program(clustered_cone_lighting_program),
+    m_indirect_mesh_program(indirect_mesh_program),
+    m_indirect_depth_only_program(indirect_depth_only_program),
+    m_indirect_cull_program(indirect_cull_program),
+    m_hiz_build_program(hiz_build_program),
+    m_shadow_atlas(std::move(shadow_atlas)),
+    m_cone_light_buffer(cone_light_buffer),
     m_render_quad(m_render_quad)
 {
 
@@ -134,9 +408,397 @@ ShadowedPipeline::~ShadowedPipeline() noexcept {
     // `m_gbuffer` and `m_lightbuffer` are managed by unique_ptr and will be
     // destroyed automatically.
     // `m_render_quad` will clean up its own VAO/VBO in its destructor.
+    if (m_cone_light_buffer != 0) {
+        CHECK_GL_ERROR(glDeleteBuffers(1, &m_cone_light_buffer));
+    }
+
+    if (m_cluster_buffer != 0) {
+        CHECK_GL_ERROR(glDeleteBuffers(1, &m_cluster_buffer));
+    }
+
+    for (size_t i = 0; i < CLUSTER_OVERFLOW_READBACK_FRAMES; ++i) {
+        if (m_cluster_overflow_fences[i]) {
+            glDeleteSync(m_cluster_overflow_fences[i]);
+        }
+
+        if (m_cluster_overflow_buffers[i] != 0) {
+            CHECK_GL_ERROR(glDeleteBuffers(1, &m_cluster_overflow_buffers[i]));
+        }
+    }
+}
+
+void ShadowedPipeline::cullMeshes(
+    const Scene *const scene,
+    const glm::mat4& view_projection,
+    const std::string& view,
+    ShadowCasters casters
+) noexcept {
+    if (!m_frustum_culling) {
+        m_cull_visible.assign(m_cull_meshes.size(), 1);
+    } else if (m_cull_meshes.size() < CULLING_BVH_MIN_MESHES) {
+        m_cull_bounds.cull(Frustum::FromMatrix(view_projection), m_cull_visible);
+    } else {
+        m_cull_hits.clear();
+        scene->getMeshBVH().queryFrustum(Frustum::FromMatrix(view_projection), m_cull_hits);
+
+        // the BVH also holds the meshes drawn from baked palettes: they are not in m_cull_meshes
+        m_cull_visible.assign(m_cull_meshes.size(), 0);
+        for (const auto mesh : m_cull_hits) {
+            const auto it = m_cull_mesh_index.find(mesh);
+            if (it != m_cull_mesh_index.end()) m_cull_visible[it->second] = 1;
+        }
+    }
+
+    CullingStats stats = { view, 0, 0 };
+    for (size_t i = 0; i < m_cull_meshes.size(); ++i) {
+        if ((casters == ShadowCasters::STATIC) && m_cull_meshes[i]->isSkinned()) continue;
+        if ((casters == ShadowCasters::DYNAMIC) && !m_cull_meshes[i]->isSkinned()) continue;
+
+        if (m_cull_visible[i]) {
+            stats.drawn++;
+        } else {
+            stats.culled++;
+        }
+    }
+
+    m_culling_stats.push_back(std::move(stats));
+}
+
+void ShadowedPipeline::bindViewUniforms(const glm::mat4& view_projection) noexcept {
+    const ViewUniforms uniforms = { view_projection };
+
+    const GLintptr offset = m_uniform_ring->upload(&uniforms, sizeof(ViewUniforms));
+    if (offset < 0) {
+        std::cerr << "Failed to allocate the view uniforms from the uniform ring" << std::endl;
+        return;
+    }
+
+    m_uniform_ring->bind(VIEW_UNIFORMS_BINDING, offset, sizeof(ViewUniforms));
+}
+
+void ShadowedPipeline::drawShadowCasters(
+    const Scene *const scene,
+    const glm::mat4& light_space_matrix,
+    const std::string& view,
+    ShadowCasters casters
+) noexcept {
+    m_depth_only_program->bind();
+
+    // Depth-only pass program bound; try to find skeleton binding for depth program (likely -1)
+    const GLint depth_skeleton_binding = find_ssbo_binding(m_depth_only_program->getProgram(), "SkeletonBuffer");
+
+    const std::string casters_suffix = (casters == ShadowCasters::STATIC) ? " static" :
+        ((casters == ShadowCasters::DYNAMIC) ? " dynamic" : "");
+    cullMeshes(scene, light_space_matrix, view + casters_suffix, casters);
+
+    m_render_queue.clear();
+
+    RenderQueueProgram depth_only;
+    depth_only.program = m_depth_only_program.get();
+    depth_only.skeleton_binding = depth_skeleton_binding;
+    depth_only.bind_materials = false;
+    depth_only.draw_uniform_blocks = true;
+    const auto depth_only_field = m_render_queue.addProgram(std::move(depth_only));
+
+    for (size_t i = 0; i < m_cull_meshes.size(); ++i) {
+        const Mesh& mesh = *m_cull_meshes[i];
+        if ((casters == ShadowCasters::STATIC) && mesh.isSkinned()) continue;
+        if ((casters == ShadowCasters::DYNAMIC) && !mesh.isSkinned()) continue;
+        if (!m_cull_visible[i]) continue;
+
+        m_render_queue.add(RENDER_PASS_SHADOW, depth_only_field, mesh, sort_depth(light_space_matrix, mesh));
+    }
+
+    m_render_queue.sort();
+    bindViewUniforms(light_space_matrix);
+    m_render_state_changes += m_render_queue.submit(m_uniform_ring.get());
+
+    if (m_indirect_draws_active && (casters != ShadowCasters::DYNAMIC)) {
+        m_indirect_depth_only_program->bind();
+        m_indirect_depth_only_program->uniformMat4x4("u_MVP", light_space_matrix);
+        m_indirect_depth_only_program->uniformMat4x4("u_CustomGLPositionMatrix", glm::mat4(1.0f));
+        drawIndirect(*m_indirect_depth_only_program, light_space_matrix, false);
+    }
+
+    if (casters == ShadowCasters::STATIC) return;
+
+    m_baked_depth_only_program->bind();
+    m_baked_depth_only_program->uniformMat4x4("u_MVP", glm::mat4(1.0f));
+
+    scene->foreachBakedMesh([&](const Mesh& mesh, const BakedAnimation& baked, float time) {
+        GLint frames[2];
+        float blend;
+        baked.getFrames(time, frames, blend);
+
+        m_baked_depth_only_program->uniformMat4x4("u_CustomGLPositionMatrix", light_space_matrix * mesh.getModelMatrix());
+        m_baked_depth_only_program->texture("u_BakedPalette", GL_TEXTURE3, baked.getTexture());
+        m_baked_depth_only_program->uniformInt("u_BakedFrame0", frames[0]);
+        m_baked_depth_only_program->uniformInt("u_BakedFrame1", frames[1]);
+        m_baked_depth_only_program->uniformFloat("u_BakedFrameBlend", blend);
+        mesh.drawInstanced(-1, -1, -1, -1, 1);
+    });
+
+    m_crowd_depth_only_program->bind();
+    m_crowd_depth_only_program->uniformMat4x4("u_MVP", glm::mat4(1.0f));
+    m_crowd_depth_only_program->uniformMat4x4("u_CustomGLPositionMatrix", light_space_matrix);
+
+    const GLint depth_crowd_palette_binding = find_ssbo_binding(m_crowd_depth_only_program->getProgram(), "CrowdPaletteBuffer");
+    const GLint depth_crowd_instance_binding = find_ssbo_binding(m_crowd_depth_only_program->getProgram(), "CrowdInstanceBuffer");
+
+    scene->foreachCrowd([&](const Crowd& crowd) {
+        if (crowd.getInstanceCount() == 0) return;
+
+        crowd.bind(depth_crowd_palette_binding, depth_crowd_instance_binding);
+        m_crowd_depth_only_program->uniformUint("u_BoneCount", crowd.getBoneCount());
+
+        crowd.foreachMesh([&](const Mesh& mesh) {
+            m_crowd_depth_only_program->uniformMat4x4("u_ModelMatrix", mesh.getModelMatrix());
+            mesh.drawInstanced(-1, -1, -1, -1, static_cast<GLsizei>(crowd.getInstanceCount()));
+        });
+    });
+}
+
+bool ShadowedPipeline::updateIndirectDraws(const Scene *const scene) noexcept {
+    if ((!m_gpu_driven_draws) || (!m_indirect_cull_program)) return false;
+
+    const auto static_geometry_version = scene->getStaticGeometryVersion();
+    if ((!m_indirect_draws_valid) || (m_indirect_geometry_version != static_geometry_version)) {
+        std::vector<const Mesh*> static_meshes;
+        scene->foreachMesh([&](const Mesh& mesh) {
+            if (!mesh.isSkinned()) static_meshes.push_back(&mesh);
+        });
+
+        if ((m_indirect_draws) && (m_indirect_draws->holds(static_meshes))) {
+            // same meshes, some of them moved
+            m_indirect_draws->updateRecords();
+        } else {
+            m_indirect_draws.reset(IndirectDrawBuffer::Create(static_meshes));
+        }
+
+        m_indirect_geometry_version = static_geometry_version;
+        m_indirect_draws_valid = true;
+    }
+
+    return m_indirect_draws != nullptr;
+}
+
+void ShadowedPipeline::drawIndirect(
+    const Program& program,
+    const glm::mat4& view_projection,
+    bool bind_materials,
+    IndirectCullPass pass
+) noexcept {
+    // with culling disabled every plane keeps everything (w > 0 for any point)
+    Frustum frustum = Frustum::FromMatrix(view_projection);
+    if (!m_frustum_culling) frustum.planes.fill(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+    m_indirect_draws->cull(*m_indirect_cull_program, frustum, pass, m_hiz_pyramid.get());
+
+    // the cull left its compute program bound
+    program.bind();
+    m_indirect_draws->draw(find_ssbo_binding(program.getProgram(), "IndirectDrawBuffer"), bind_materials);
+}
+
+void ShadowedPipeline::setGPUDrivenDraws(bool enabled) noexcept {
+    m_gpu_driven_draws = enabled;
+
+    // release the merged buffers right away, they are rebuilt on demand
+    if (!enabled) {
+        m_indirect_draws.reset();
+        m_indirect_draws_valid = false;
+    }
+}
+
+void ShadowedPipeline::setOcclusionCulling(bool enabled) noexcept {
+    m_occlusion_culling = enabled;
+
+    // the pyramid is not kept up to date meanwhile
+    if (!enabled) {
+        m_hiz_pyramid.reset();
+    }
+}
+
+bool ShadowedPipeline::updateStaticShadowLayer(
+    const Scene *const scene,
+    StaticShadowLayer& layer,
+    const Framebuffer& target,
+    const glm::mat4& light_space_matrix,
+    const glm::ivec4& rect,
+    const std::string& view
+) noexcept {
+    layer.last_used_frame = m_shadow_frame;
+
+    const auto static_geometry_version = scene->getStaticGeometryVersion();
+    const bool changed = (layer.light_space_matrix != light_space_matrix) ||
+        (layer.rect != rect) ||
+        (layer.static_geometry_version != static_geometry_version);
+
+    if (changed) {
+        const bool moving = (layer.last_changed_frame + 1u == m_shadow_frame);
+
+        layer.light_space_matrix = light_space_matrix;
+        layer.rect = rect;
+        layer.static_geometry_version = static_geometry_version;
+        layer.last_changed_frame = m_shadow_frame;
+        layer.valid = false;
+
+        // rendering the layer would only add a copy to the frame
+        if (moving) return false;
+    }
+
+    if (layer.valid) return true;
+
+    withFramebuffer(&target, [&]() {
+        withFaceCulling([&]() {
+            withEnabledDepthTest([&]() {
+                // the target may hold other layers: clear this one only
+                withScissor(rect.x, rect.y, rect.z, rect.w, [&]() {
+                    CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT));
+                });
+
+                bindViewport(rect.x, rect.y, rect.z, rect.w);
+                drawShadowCasters(scene, light_space_matrix, view, ShadowCasters::STATIC);
+            });
+        });
+    }, false);
+
+    layer.valid = true;
+    return true;
+}
+
+void ShadowedPipeline::copyShadowDepth(
+    const Framebuffer& src,
+    const glm::ivec4& src_rect,
+    const glm::ivec4& dst_rect
+) const noexcept {
+    GLint dst_fbo = 0;
+    CHECK_GL_ERROR(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &dst_fbo));
+
+    CHECK_GL_ERROR(glBindFramebuffer(GL_READ_FRAMEBUFFER, src.getFramebuffer()));
+    CHECK_GL_ERROR(glBlitFramebuffer(
+        src_rect.x, src_rect.y, src_rect.x + src_rect.z, src_rect.y + src_rect.w,
+        dst_rect.x, dst_rect.y, dst_rect.x + dst_rect.z, dst_rect.y + dst_rect.w,
+        GL_DEPTH_BUFFER_BIT,
+        GL_NEAREST
+    ));
+    CHECK_GL_ERROR(glBindFramebuffer(GL_READ_FRAMEBUFFER, static_cast<GLuint>(dst_fbo)));
+}
+
+void ShadowedPipeline::renderShadowMap(
+    const Scene *const scene,
+    const void *const light,
+    size_t index,
+    const glm::mat4& light_space_matrix,
+    const glm::ivec4& rect,
+    const std::string& view
+) noexcept {
+    const glm::ivec4 layer_rect(0, 0, rect.z, rect.w);
+
+    StaticShadowLayer *layer = nullptr;
+    if (m_shadow_caching) {
+        layer = &m_static_shadow_layers[std::make_pair(light, index)];
+        if ((!layer->depth) || (layer->depth->getWidth() != rect.z) || (layer->depth->getHeight() != rect.w)) {
+            layer->depth = std::unique_ptr<Framebuffer>(
+                Framebuffer::CreateFramebuffer(rect.z, rect.w, {}, true, false)
+            );
+            layer->valid = false;
+
+            if (!layer->depth) {
+                std::cerr << "Failed to create a static shadow layer, drawing every caster" << std::endl;
+            }
+        }
+
+        if ((!layer->depth) || (!updateStaticShadowLayer(scene, *layer, *layer->depth, light_space_matrix, layer_rect, view))) {
+            layer = nullptr;
+        }
+    }
+
+    // m_shadowbuffer may hold other maps: only the rect is cleared, or covered by the static layer
+    withFramebuffer(m_shadowbuffer.get(), [&]() {
+        withFaceCulling([&]() {
+            withEnabledDepthTest([&]() {
+                if (layer) {
+                    copyShadowDepth(*layer->depth, layer_rect, rect);
+                } else {
+                    withScissor(rect.x, rect.y, rect.z, rect.w, [&]() {
+                        CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT));
+                    });
+                }
+
+                bindViewport(rect.x, rect.y, rect.z, rect.w);
+                drawShadowCasters(scene, light_space_matrix, view, layer ? ShadowCasters::DYNAMIC : ShadowCasters::ALL);
+            });
+        });
+    }, false);
+}
+
+bool ShadowedPipeline::setShadowAtlasDepthFormat(FramebufferDepthFormat format) noexcept {
+    if (format == m_shadow_atlas_depth_format) return true;
+
+    auto shadow_atlas = std::unique_ptr<Framebuffer>(
+        Framebuffer::CreateFramebuffer(SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, {}, true, false, format)
+    );
+    if (!shadow_atlas) {
+        std::cerr << "Failed to recreate the shadow atlas" << std::endl;
+        return false;
+    }
+
+    m_shadow_atlas = std::move(shadow_atlas);
+    m_shadow_atlas_depth_format = format;
+
+    // depth copies need the same format on both sides: the static atlas is rebuilt on demand
+    m_static_shadow_atlas.reset();
+    for (auto& tile : m_cone_shadow_tiles) {
+        tile.second.layer = StaticShadowLayer();
+    }
+
+    return true;
+}
+
+void ShadowedPipeline::setShadowCaching(bool enabled) noexcept {
+    m_shadow_caching = enabled;
+
+    // release the layers right away, they are rebuilt on demand
+    if (!enabled) {
+        m_static_shadow_layers.clear();
+        m_static_shadow_atlas.reset();
+        for (auto& tile : m_cone_shadow_tiles) {
+            tile.second.layer = StaticShadowLayer();
+        }
+    }
 }
 
 void ShadowedPipeline::render(const Scene *const scene) noexcept {
+    m_shadow_frame++;
+
+    // bounds of the meshes for every view of the frame
+    m_culling_stats.clear();
+    m_render_state_changes = RenderStateChanges();
+
+    if (!m_uniform_ring) {
+        m_uniform_ring.reset(UniformRing::Create(UNIFORM_RING_REGION_SIZE));
+        assert(m_uniform_ring && "Failed to create the uniform ring");
+    }
+    m_uniform_ring->beginFrame();
+
+    m_cull_meshes.clear();
+    m_cull_bounds.clear();
+    m_cull_mesh_index.clear();
+
+    m_indirect_draws_active = updateIndirectDraws(scene);
+    scene->foreachMesh([&](const Mesh& mesh) {
+        // static meshes are culled and drawn by the indirect draw buffer
+        if (m_indirect_draws_active && !mesh.isSkinned()) return;
+
+        m_cull_meshes.push_back(&mesh);
+    });
+
+    if (m_cull_meshes.size() < CULLING_BVH_MIN_MESHES) {
+        for (const auto mesh : m_cull_meshes) m_cull_bounds.add(*mesh);
+    } else {
+        for (size_t i = 0; i < m_cull_meshes.size(); ++i) m_cull_mesh_index[m_cull_meshes[i]] = i;
+    }
+
     const auto camera = scene->getCamera();
 
     const GLint width = m_gbuffer->getWidth();
@@ -147,6 +809,7 @@ void ShadowedPipeline::render(const Scene *const scene) noexcept {
         static_cast<glm::uint32>(height)
     );
     const auto view = camera->getViewMatrix();
+    const auto inverse_view_projection = glm::inverse(proj * view);
 
     // 1) Geometry pass -> fill G-buffer (albedo, specular, normal) + depth
     if (m_gbuffer) {
@@ -161,16 +824,10 @@ void ShadowedPipeline::render(const Scene *const scene) noexcept {
 
                     // Draw each mesh using its own model matrix
                     m_mesh_program->bind();
-                    m_mesh_program->uniformMat4x4("u_CustomGLPositionMatrix", glm::mat4(1.0f));
                     m_mesh_program->uniformInt("u_DiffuseTex", 0);
                     m_mesh_program->uniformInt("u_SpecularTex", 1);
                     m_mesh_program->uniformInt("u_DisplacementTex", 2);
 
-                    const auto diffuse_color_location = glGetUniformLocation(m_mesh_program->getProgram(), "u_DiffuseColor");
-                    const auto specular_color_location = glGetUniformLocation(m_mesh_program->getProgram(), "u_SpecularColor");
-                    const auto material_flags_location = glGetUniformLocation(m_mesh_program->getProgram(), "u_material_flags");
-                    const auto shininess_location = glGetUniformLocation(m_mesh_program->getProgram(), "u_Shininess");
-
                     // Find SSBO binding for `SkeletonBuffer` (if present) in the currently bound program
                     auto find_ssbo_binding = [](GLuint program, const char* block_name) -> GLint {
                         const GLuint index = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, block_name);
@@ -183,30 +840,136 @@ void ShadowedPipeline::render(const Scene *const scene) noexcept {
 
                     const GLint skeleton_binding = find_ssbo_binding(m_mesh_program->getProgram(), "SkeletonBuffer");
 
-                    scene->foreachMesh([&](const Mesh& mesh) {
+                    cullMeshes(scene, proj * view, "camera", ShadowCasters::ALL);
+
+                    // front to back within each texture set and material
+                    m_render_queue.clear();
+
+                    RenderQueueProgram gbuffer;
+                    gbuffer.program = m_mesh_program.get();
+                    gbuffer.skeleton_binding = skeleton_binding;
+                    gbuffer.draw_uniform_blocks = true;
+                    const auto gbuffer_field = m_render_queue.addProgram(std::move(gbuffer));
+
+                    for (size_t i = 0; i < m_cull_meshes.size(); ++i) {
+                        if (!m_cull_visible[i]) continue;
+
+                        const Mesh& mesh = *m_cull_meshes[i];
+                        m_render_queue.add(RENDER_PASS_GBUFFER, gbuffer_field, mesh, sort_depth(proj * view, mesh));
+                    }
+
+                    m_render_queue.sort();
+                    bindViewUniforms(proj * view);
+                    m_render_state_changes += m_render_queue.submit(m_uniform_ring.get());
+
+                    // Static meshes: a multi-draw per batch of textures, colors come from the draw records
+                    if (m_indirect_draws_active) {
+                        m_indirect_mesh_program->bind();
+                        m_indirect_mesh_program->uniformMat4x4("u_MVP", proj * view);
+                        m_indirect_mesh_program->uniformMat4x4("u_CustomGLPositionMatrix", glm::mat4(1.0f));
+                        m_indirect_mesh_program->uniformInt("u_DiffuseTex", 0);
+                        m_indirect_mesh_program->uniformInt("u_SpecularTex", 1);
+                        m_indirect_mesh_program->uniformInt("u_DisplacementTex", 2);
+
+                        if (m_occlusion_culling && m_frustum_culling && m_hiz_build_program) {
+                            if (!m_hiz_pyramid) {
+                                m_hiz_pyramid = std::unique_ptr<HiZPyramid>(HiZPyramid::Create(width, height));
+                            }
+                        } else {
+                            m_hiz_pyramid.reset();
+                        }
+
+                        if (m_hiz_pyramid) {
+                            // what the previous depth does not hide, then what the depth drawn so far does not
+                            drawIndirect(*m_indirect_mesh_program, proj * view, true, IndirectCullPass::OCCLUSION_FIRST);
+                            m_hiz_pyramid->build(*m_hiz_build_program, *m_gbuffer, proj * view);
+                            drawIndirect(*m_indirect_mesh_program, proj * view, true, IndirectCullPass::OCCLUSION_SECOND);
+                        } else {
+                            drawIndirect(*m_indirect_mesh_program, proj * view, true);
+                        }
+                    }
+
+                    // Distant animated meshes: skinned in the vertex shader from their baked palettes
+                    m_baked_mesh_program->bind();
+                    m_baked_mesh_program->uniformMat4x4("u_CustomGLPositionMatrix", glm::mat4(1.0f));
+                    m_baked_mesh_program->uniformInt("u_DiffuseTex", 0);
+                    m_baked_mesh_program->uniformInt("u_SpecularTex", 1);
+                    m_baked_mesh_program->uniformInt("u_DisplacementTex", 2);
+
+                    const auto baked_diffuse_color_location = glGetUniformLocation(m_baked_mesh_program->getProgram(), "u_DiffuseColor");
+                    const auto baked_specular_color_location = glGetUniformLocation(m_baked_mesh_program->getProgram(), "u_SpecularColor");
+                    const auto baked_material_flags_location = glGetUniformLocation(m_baked_mesh_program->getProgram(), "u_material_flags");
+                    const auto baked_shininess_location = glGetUniformLocation(m_baked_mesh_program->getProgram(), "u_Shininess");
+
+                    scene->foreachBakedMesh([&](const Mesh& mesh, const BakedAnimation& baked, float time) {
                         const glm::mat4 model_matrix = mesh.getModelMatrix();
                         const glm::mat4 mvp = proj * view * model_matrix;
                         const glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model_matrix)));
 
-                        m_mesh_program->uniformMat4x4("u_MVP", mvp);
-                        m_mesh_program->uniformMat4x4("u_ModelMatrix", model_matrix);
-                        m_mesh_program->uniformMat3x3("u_NormalMatrix", normal_matrix);
-
-                        mesh.draw(
-                            diffuse_color_location,
-                            specular_color_location,
-                            material_flags_location,
-                            shininess_location,
-                            skeleton_binding
+                        GLint frames[2];
+                        float blend;
+                        baked.getFrames(time, frames, blend);
+
+                        m_baked_mesh_program->uniformMat4x4("u_MVP", mvp);
+                        m_baked_mesh_program->uniformMat4x4("u_ModelMatrix", model_matrix);
+                        m_baked_mesh_program->uniformMat3x3("u_NormalMatrix", normal_matrix);
+                        m_baked_mesh_program->texture("u_BakedPalette", GL_TEXTURE3, baked.getTexture());
+                        m_baked_mesh_program->uniformInt("u_BakedFrame0", frames[0]);
+                        m_baked_mesh_program->uniformInt("u_BakedFrame1", frames[1]);
+                        m_baked_mesh_program->uniformFloat("u_BakedFrameBlend", blend);
+
+                        mesh.drawInstanced(
+                            baked_diffuse_color_location,
+                            baked_specular_color_location,
+                            baked_material_flags_location,
+                            baked_shininess_location,
+                            1
                         );
                     });
+
+                    // Crowds: one instanced draw per mesh, skinned and placed per instance in the vertex shader
+                    m_crowd_mesh_program->bind();
+                    m_crowd_mesh_program->uniformMat4x4("u_MVP", proj * view);
+                    m_crowd_mesh_program->uniformMat4x4("u_CustomGLPositionMatrix", glm::mat4(1.0f));
+                    m_crowd_mesh_program->uniformInt("u_DiffuseTex", 0);
+                    m_crowd_mesh_program->uniformInt("u_SpecularTex", 1);
+                    m_crowd_mesh_program->uniformInt("u_DisplacementTex", 2);
+
+                    const auto crowd_diffuse_color_location = glGetUniformLocation(m_crowd_mesh_program->getProgram(), "u_DiffuseColor");
+                    const auto crowd_specular_color_location = glGetUniformLocation(m_crowd_mesh_program->getProgram(), "u_SpecularColor");
+                    const auto crowd_material_flags_location = glGetUniformLocation(m_crowd_mesh_program->getProgram(), "u_material_flags");
+                    const auto crowd_shininess_location = glGetUniformLocation(m_crowd_mesh_program->getProgram(), "u_Shininess");
+
+                    const GLint crowd_palette_binding = find_ssbo_binding(m_crowd_mesh_program->getProgram(), "CrowdPaletteBuffer");
+                    const GLint crowd_instance_binding = find_ssbo_binding(m_crowd_mesh_program->getProgram(), "CrowdInstanceBuffer");
+
+                    scene->foreachCrowd([&](const Crowd& crowd) {
+                        if (crowd.getInstanceCount() == 0) return;
+
+                        crowd.bind(crowd_palette_binding, crowd_instance_binding);
+                        m_crowd_mesh_program->uniformUint("u_BoneCount", crowd.getBoneCount());
+
+                        crowd.foreachMesh([&](const Mesh& mesh) {
+                            const glm::mat4 model_matrix = mesh.getModelMatrix();
+                            const glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model_matrix)));
+
+                            m_crowd_mesh_program->uniformMat4x4("u_ModelMatrix", model_matrix);
+                            m_crowd_mesh_program->uniformMat3x3("u_NormalMatrix", normal_matrix);
+
+                            mesh.drawInstanced(
+                                crowd_diffuse_color_location,
+                                crowd_specular_color_location,
+                                crowd_material_flags_location,
+                                crowd_shininess_location,
+                                static_cast<GLsizei>(crowd.getInstanceCount())
+                            );
+                        });
+                    });
                 });
             });
         });
     }
 
-    size_t last_used_lightbuffer_index = 0;
-
     const auto ambient_light = scene->getAmbientLight();
     const auto ambient_light_intensity = ambient_light ? ambient_light->getColorWithIntensity() : glm::vec3(0.0f);
 
@@ -216,10 +979,10 @@ void ShadowedPipeline::render(const Scene *const scene) noexcept {
             // bind unshadowed program
             m_ssao_program->bind();
 
-            // bind gbuffer position and world-space normal textures
-            // gNormal is at color attachment 4 (world-space normal)
-            //m_ssao_program->framebufferColorAttachment("u_GNormal", GL_TEXTURE0, *m_gbuffer, 4);
-            m_ssao_program->framebufferColorAttachment("u_GPosition", GL_TEXTURE1, *m_gbuffer, 3);
+            // bind gbuffer depth (positions are rebuilt from it) and world-space normal textures
+            // gNormal is at color attachment 3 (world-space normal)
+            //m_ssao_program->framebufferColorAttachment("u_GNormal", GL_TEXTURE0, *m_gbuffer, 3);
+            m_ssao_program->framebufferDepthAttachment("u_GDepth", GL_TEXTURE1, *m_gbuffer);
 
             // bind SSAO noise texture
             if (m_ssao_noise_texture) {
@@ -230,6 +993,7 @@ void ShadowedPipeline::render(const Scene *const scene) noexcept {
             m_ssao_program->uniformUint("u_SSAOSampleCount", static_cast<glm::uint32>(ssao_samples_count));
             m_ssao_program->uniformMat4x4("u_ViewMatrix", view);
             m_ssao_program->uniformMat4x4("u_ProjectionMatrix", proj);
+            m_ssao_program->uniformMat4x4("u_InverseViewProjection", inverse_view_projection);
             m_ssao_program->uniformFloat("u_radius", 15.0f);
             m_ssao_program->uniformUint("u_noise_dimensions", m_ssao_noise_texture ? m_ssao_noise_texture->getWidth() : 0u);
 
@@ -254,8 +1018,8 @@ void ShadowedPipeline::render(const Scene *const scene) noexcept {
         });
     });
 
-    // 3) Ambient light pass: copy ambient light to ambient lightbuffer
-    withFramebuffer(m_lightbuffer[last_used_lightbuffer_index].get(), [&]() {
+    // 3) Ambient light pass: clears the lightbuffer and writes the ambient light
+    withFramebuffer(m_lightbuffer.get(), [&]() {
         withFaceCulling([&]() {
             // bind unshadowed program
             m_ambient_lighting_program->bind();
@@ -271,211 +1035,203 @@ void ShadowedPipeline::render(const Scene *const scene) noexcept {
         });
     });
 
-    // 4.a) Directional lights pass: sample G-buffer and output lit color to lightbuffer
-    scene->foreachDirectionalLight([&](const DirectionalLight& dir_light) {
+    // 4.a) Directional lights pass: sample G-buffer and add the lit color to the lightbuffer
+    const auto camera_pos = camera->getCameraPosition();
+    const auto z_near = camera->getNearPlane();
+    const auto z_far = camera->getFarPlane();
 
-        // set up light view/proj matrices (use minus sign to position the light "backwards" along its direction)
-        const auto camera_pos = camera->getCameraPosition();
-        const auto light_distance = camera->getFarPlane();
-        const glm::vec3 light_pos = camera_pos - (
-            dir_light.getDirection() * light_distance
-        );
-        const glm::mat4 light_view = glm::lookAt(
-            light_pos,
-            camera_pos,
-            glm::vec3(0.0f, 1.0f, 0.0f)
-        );
+    // cascades: view depth ranges blending the logarithmic and the uniform split
+    const auto cascade_count = m_shadow_cascade_count;
+    glm::vec4 cascade_splits(z_far);
+    {
+        const auto log_near = std::max(z_near, 0.001f);
+        for (glm::uint32 i = 0; i < cascade_count; ++i) {
+            const auto p = static_cast<glm::float32>(i + 1u) / static_cast<glm::float32>(cascade_count);
+            const auto log_split = log_near * std::pow(z_far / log_near, p);
+            const auto uniform_split = z_near + (z_far - z_near) * p;
+            cascade_splits[static_cast<int>(i)] = SHADOW_CASCADE_SPLIT_LAMBDA * log_split + (1.0f - SHADOW_CASCADE_SPLIT_LAMBDA) * uniform_split;
+        }
+    }
 
-        const auto sqrt_3 = static_cast<glm::float32>(1.73205080757);
-        const glm::float32 aspect = 1.0f;
-        // const glm::float32 top = camera->getFarPlane();
-        const glm::float32 top = camera->getFarPlane() / 2.0f;
-        const glm::float32 bottom = -top;
-        const glm::float32 right = top * aspect;
-        const glm::float32 left = -right;
-
-        const glm::mat4 light_proj = glm::ortho(
-            left,
-            right,
-            bottom,
-            top,
-            camera->getNearPlane(),
-            camera->getFarPlane() * sqrt_3
-        );
-        const glm::mat4 light_space_matrix = light_proj * light_view;
+    // corners of the view frustum on the near and far planes
+    std::array<glm::vec3, 4> frustum_near, frustum_far;
+    for (int corner = 0; corner < 4; ++corner) {
+        const auto x = (corner & 1) ? 1.0f : -1.0f;
+        const auto y = (corner & 2) ? 1.0f : -1.0f;
 
-        withFramebuffer(m_shadowbuffer.get(), [&]() {
-            withFaceCulling([&]() {
-                withEnabledDepthTest([&]() {
-                    m_depth_only_program->bind();
-                    m_depth_only_program->uniformMat4x4("u_MVP", glm::mat4(1.0f));
+        const auto near_point = inverse_view_projection * glm::vec4(x, y, -1.0f, 1.0f);
+        const auto far_point = inverse_view_projection * glm::vec4(x, y, 1.0f, 1.0f);
+        frustum_near[corner] = glm::vec3(near_point) / near_point.w;
+        frustum_far[corner] = glm::vec3(far_point) / far_point.w;
+    }
 
-                    // Depth-only pass program bound; try to find skeleton binding for depth program (likely -1)
-                    const GLint depth_skeleton_binding = find_ssbo_binding(m_depth_only_program->getProgram(), "SkeletonBuffer");
+    glm::vec3 casters_min, casters_max;
+    const bool casters_bounded = shadow_caster_bounds(scene, casters_min, casters_max);
 
-                    scene->foreachMesh([&](const Mesh& mesh) {
-                        const glm::mat4 model_matrix = mesh.getModelMatrix();
-                        const glm::mat4 ls = light_space_matrix * model_matrix;
-                        m_depth_only_program->uniformMat4x4("u_CustomGLPositionMatrix", ls);
-                        mesh.draw(
-                            -1,
-                            -1,
-                            -1,
-                            -1,
-                            depth_skeleton_binding
-                        );
-                    });
-                });
-            });
-        });
+    size_t directional_index = 0;
+    scene->foreachDirectionalLight([&](const DirectionalLight& dir_light) {
+        std::array<glm::mat4, SHADOW_CASCADE_COUNT> cascade_matrices;
+        std::array<glm::vec4, SHADOW_CASCADE_COUNT> cascade_rects;
+        cascade_matrices.fill(glm::mat4(1.0f));
+        cascade_rects.fill(glm::vec4(0.0f));
+
+        for (glm::uint32 i = 0; i < cascade_count; ++i) {
+            const auto slice_begin = (i == 0u) ? z_near : cascade_splits[static_cast<int>(i - 1u)];
+            const auto slice_end = cascade_splits[static_cast<int>(i)];
+
+            // the view depth is linear along the edges of the frustum, for both projections
+            std::array<glm::vec3, 8> slice_corners;
+            for (int corner = 0; corner < 4; ++corner) {
+                const auto edge = frustum_far[corner] - frustum_near[corner];
+                slice_corners[corner] = frustum_near[corner] + edge * ((slice_begin - z_near) / (z_far - z_near));
+                slice_corners[corner + 4] = frustum_near[corner] + edge * ((slice_end - z_near) / (z_far - z_near));
+            }
 
-        const auto lightbuffer_index = (last_used_lightbuffer_index + 1) % 2;
+            cascade_matrices[i] = cascade_light_space_matrix(
+                dir_light.getDirection(),
+                slice_corners,
+                SHADOW_CASCADE_SIZE,
+                casters_bounded,
+                casters_min,
+                casters_max,
+                z_far
+            );
+
+            const glm::ivec4 rect(
+                static_cast<GLint>(i % 2u) * SHADOW_CASCADE_SIZE,
+                static_cast<GLint>(i / 2u) * SHADOW_CASCADE_SIZE,
+                SHADOW_CASCADE_SIZE,
+                SHADOW_CASCADE_SIZE
+            );
+            cascade_rects[i] = glm::vec4(rect.x, rect.y, rect.z, rect.w);
+
+            const std::string view_name = "directional " + std::to_string(directional_index) + " cascade " + std::to_string(i);
+            renderShadowMap(scene, &dir_light, i, cascade_matrices[i], rect, view_name);
+        }
 
-        withFramebuffer(m_lightbuffer[lightbuffer_index].get(), [&]() {
+        // accumulate: the lightbuffer must not be cleared between lights
+        withFramebuffer(m_lightbuffer.get(), [&]() {
             withFaceCulling([&]() {
-                // bind lighting program
-                m_directional_lighting_program->bind();
-
-                // bind gbuffer textures (diffuse, specular, normal, position)
-                m_directional_lighting_program->framebufferColorAttachment("u_GDiffuse", GL_TEXTURE0, *m_gbuffer, 0);
-                m_directional_lighting_program->framebufferColorAttachment("u_GSpecular", GL_TEXTURE1, *m_gbuffer, 1);
-                m_directional_lighting_program->framebufferColorAttachment("u_GNormalTangentSpace", GL_TEXTURE2, *m_gbuffer, 2);
-                m_directional_lighting_program->framebufferColorAttachment("u_GPosition", GL_TEXTURE3, *m_gbuffer, 3);
-                m_directional_lighting_program->framebufferColorAttachment("u_GNormal", GL_TEXTURE4, *m_gbuffer, 4);
-                m_directional_lighting_program->framebufferColorAttachment("u_GTangent", GL_TEXTURE5, *m_gbuffer, 5);
-                m_directional_lighting_program->framebufferColorAttachment("u_GShininess", GL_TEXTURE8, *m_gbuffer, 6);
-                m_directional_lighting_program->framebufferColorAttachment("u_LightpassInput", GL_TEXTURE6, *m_lightbuffer[last_used_lightbuffer_index], 0);
-                m_directional_lighting_program->framebufferDepthAttachment("u_LDepthTexture", GL_TEXTURE7, *m_shadowbuffer);
-
-                // bind directional light uniforms
-                {
-                    m_directional_lighting_program->uniformVec3("u_LightDir", dir_light.getDirection());
-                    m_directional_lighting_program->uniformVec3("u_LightColor", dir_light.getColorWithIntensity());
-                    m_directional_lighting_program->uniformMat4x4("u_LightSpaceMatrix", light_space_matrix);
-                    m_directional_lighting_program->uniformVec3("u_CameraPosition", camera_pos);
-                }
+                withAdditiveBlending([&]() {
+                    // bind lighting program
+                    m_directional_lighting_program->bind();
+
+                    // bind gbuffer textures (diffuse, specular, normal, depth)
+                    m_directional_lighting_program->framebufferColorAttachment("u_GDiffuse", GL_TEXTURE0, *m_gbuffer, 0);
+                    m_directional_lighting_program->framebufferColorAttachment("u_GSpecular", GL_TEXTURE1, *m_gbuffer, 1);
+                    m_directional_lighting_program->framebufferColorAttachment("u_GNormalTangentSpace", GL_TEXTURE2, *m_gbuffer, 2);
+                    m_directional_lighting_program->framebufferDepthAttachment("u_GDepth", GL_TEXTURE3, *m_gbuffer);
+                    m_directional_lighting_program->framebufferColorAttachment("u_GNormal", GL_TEXTURE4, *m_gbuffer, 3);
+                    m_directional_lighting_program->framebufferColorAttachment("u_GTangent", GL_TEXTURE5, *m_gbuffer, 4);
+                    m_directional_lighting_program->framebufferDepthAttachment("u_LDepthTexture", GL_TEXTURE7, *m_shadowbuffer);
+
+                    // bind directional light uniforms
+                    {
+                        m_directional_lighting_program->uniformVec3("u_LightDir", dir_light.getDirection());
+                        m_directional_lighting_program->uniformVec3("u_LightColor", dir_light.getColorWithIntensity());
+                        m_directional_lighting_program->uniformVec3("u_CameraPosition", camera_pos);
+                        m_directional_lighting_program->uniformMat4x4("u_InverseViewProjection", inverse_view_projection);
+                        m_directional_lighting_program->uniformMat4x4("u_ViewMatrix", view);
+
+                        m_directional_lighting_program->uniformInt("u_CascadeCount", static_cast<glm::int32>(cascade_count));
+                        m_directional_lighting_program->uniformVec4("u_CascadeSplits", cascade_splits);
+                        for (glm::uint32 i = 0; i < cascade_count; ++i) {
+                            const auto index = "[" + std::to_string(i) + "]";
+                            m_directional_lighting_program->uniformMat4x4("u_CascadeMatrices" + index, cascade_matrices[i]);
+                            m_directional_lighting_program->uniformVec4("u_CascadeRects" + index, cascade_rects[i]);
+                        }
+                    }
 
-                // draw fullscreen quad
-                if (m_render_quad) m_render_quad->draw();
+                    // draw fullscreen quad
+                    if (m_render_quad) m_render_quad->draw();
+                });
             });
-        });
+        }, false);
 
-        last_used_lightbuffer_index = lightbuffer_index;
+        directional_index++;
     });
 
-    // 4.b) Cone (spot) lights: unshadowed cone lights applied additively
-    scene->foreachConeLight([&](const ConeLight& cone) {
-        const auto lightbuffer_index = (last_used_lightbuffer_index + 1) % 2;
-
-        const auto light_znear = cone.getZNear();
-        const auto light_zfar = cone.getZFar();
-        const auto light_angle = cone.getAngleRadians();
-        const auto aspect = static_cast<glm::float32>(m_shadowbuffer->getWidth()) /
-            static_cast<glm::float32>(m_shadowbuffer->getHeight());
-        const glm::vec3 light_pos = cone.getPosition();
-        const glm::vec3 light_dir = cone.getDirection();
-        const glm::mat4 light_view = glm::lookAt(
-            light_pos,
-            light_pos + light_dir,
-            glm::vec3(0.0f, 1.0f, 0.0f)
-        );
-
-        const auto light_proj = glm::perspective(
-            light_angle,
-            aspect,
-            light_znear,
-            light_zfar
-        );
-
-        const glm::mat4 light_space_matrix = light_proj * light_view;
+    // 4.b) Cone (spot) lights: every shadow map first, into the atlas; then all the lights at once in the
+    // clustered path, otherwise one full-screen pass each
+    std::vector<ClusteredConeLight> cone_lights;
+    std::vector<const void*> cone_sources;
+    std::vector<glm::ivec4> cone_scissors;
+    std::vector<glm::vec2> cone_depth_bounds;
+    gatherConeLights(scene, view, proj, cone_lights, cone_sources, cone_scissors, cone_depth_bounds);
 
-        // TODO: if this light has no chances of affecting any portion of visible scene, skip it
+    if (!cone_lights.empty()) {
+        renderShadowAtlas(scene, cone_lights, cone_sources);
+    }
 
-        withFramebuffer(m_shadowbuffer.get(), [&]() {
+    if (!cone_lights.empty() && m_clustered_cone_lights) {
+        renderClusteredConeLights(scene, cone_lights, view, proj, inverse_view_projection);
+    } else if (!cone_lights.empty()) {
+        withFramebuffer(m_lightbuffer.get(), [&]() {
             withFaceCulling([&]() {
-                withEnabledDepthTest([&]() {
-                    m_depth_only_program->bind();
-                    m_depth_only_program->uniformMat4x4("u_MVP", glm::mat4(1.0f));
+                withAdditiveBlending([&]() {
+                    // bind cone lighting program
+                    m_cone_lighting_program->bind();
+
+                    m_cone_lighting_program->framebufferColorAttachment("u_GDiffuse", GL_TEXTURE0, *m_gbuffer, 0);
+                    m_cone_lighting_program->framebufferColorAttachment("u_GSpecular", GL_TEXTURE1, *m_gbuffer, 1);
+                    m_cone_lighting_program->framebufferColorAttachment("u_GNormalTangentSpace", GL_TEXTURE2, *m_gbuffer, 2);
+                    m_cone_lighting_program->framebufferDepthAttachment("u_GDepth", GL_TEXTURE3, *m_gbuffer);
+                    m_cone_lighting_program->framebufferColorAttachment("u_GNormal", GL_TEXTURE4, *m_gbuffer, 3);
+                    m_cone_lighting_program->framebufferColorAttachment("u_GTangent", GL_TEXTURE5, *m_gbuffer, 4);
+                    m_cone_lighting_program->framebufferDepthAttachment("u_LDepthTexture", GL_TEXTURE7, *m_shadow_atlas);
 
-                    // Depth-only pass for cone light
-                    const GLint depth_skeleton_binding = find_ssbo_binding(m_depth_only_program->getProgram(), "SkeletonBuffer");
-
-                    scene->foreachMesh([&](const Mesh& mesh) {
-                        const glm::mat4 model_matrix = mesh.getModelMatrix();
-                        const glm::mat4 ls = light_space_matrix * model_matrix;
-                        m_depth_only_program->uniformMat4x4("u_CustomGLPositionMatrix", ls);
-                        mesh.draw(
-                            -1,
-                            -1,
-                            -1,
-                            -1,
-                            depth_skeleton_binding
-                        );
-                    });
-                });
-            });
-        });
-
-        withFramebuffer(m_lightbuffer[lightbuffer_index].get(), [&]() {
-            withFaceCulling([&]() {
-                // bind cone lighting program
-                m_cone_lighting_program->bind();
-
-                m_cone_lighting_program->framebufferColorAttachment("u_GDiffuse", GL_TEXTURE0, *m_gbuffer, 0);
-                m_cone_lighting_program->framebufferColorAttachment("u_GSpecular", GL_TEXTURE1, *m_gbuffer, 1);
-                m_cone_lighting_program->framebufferColorAttachment("u_GNormalTangentSpace", GL_TEXTURE2, *m_gbuffer, 2);
-                m_cone_lighting_program->framebufferColorAttachment("u_GPosition", GL_TEXTURE3, *m_gbuffer, 3);
-                m_cone_lighting_program->framebufferColorAttachment("u_GNormal", GL_TEXTURE4, *m_gbuffer, 4);
-                m_cone_lighting_program->framebufferColorAttachment("u_GTangent", GL_TEXTURE5, *m_gbuffer, 5);
-                m_cone_lighting_program->framebufferColorAttachment("u_GShininess", GL_TEXTURE8, *m_gbuffer, 6);
-                m_cone_lighting_program->framebufferColorAttachment("u_LightpassInput", GL_TEXTURE6, *m_lightbuffer[last_used_lightbuffer_index], 0);
-                m_cone_lighting_program->framebufferDepthAttachment("u_LDepthTexture", GL_TEXTURE7, *m_shadowbuffer);
-
-                // bind cone light uniforms
-                {
-                    m_cone_lighting_program->uniformVec3("u_LightColor", cone.getColorWithIntensity());
-                    m_cone_lighting_program->uniformVec3("u_LightPosition", cone.getPosition());
-                    m_cone_lighting_program->uniformVec3("u_LightDirection", cone.getDirection());
-                    m_cone_lighting_program->uniformMat4x4("u_LightSpaceMatrix", light_space_matrix);
                     m_cone_lighting_program->uniformVec3("u_CameraPosition", camera->getCameraPosition());
-
-                    // compute inner/outer cone cutoffs from the light angle and cone properties
-                    const float outerHalf = static_cast<float>(light_angle * 0.5f);
-                    const float innerHalf = outerHalf * cone.getInnerRatio();
-                    const float cutOff = std::cos(innerHalf);
-                    const float outerCutOff = std::cos(outerHalf);
-
-                    m_cone_lighting_program->uniformFloat("u_LightCutOff", cutOff);
-                    m_cone_lighting_program->uniformFloat("u_LightOuterCutOff", outerCutOff);
-
-                    // distance attenuation constants from cone light
-                    m_cone_lighting_program->uniformFloat("u_LightConstant", cone.getConstant());
-                    m_cone_lighting_program->uniformFloat("u_LightLinear", cone.getLinear());
-                    m_cone_lighting_program->uniformFloat("u_LightQuadratic", cone.getQuadratic());
-                }
-
-                // draw fullscreen quad
-                if (m_render_quad) m_render_quad->draw();
+                    m_cone_lighting_program->uniformMat4x4("u_InverseViewProjection", inverse_view_projection);
+
+                    for (size_t i = 0; i < cone_lights.size(); ++i) {
+                        const auto& light = cone_lights[i];
+
+                        // bind cone light uniforms
+                        m_cone_lighting_program->uniformVec3("u_LightColor", glm::vec3(light.color_outer_cutoff));
+                        m_cone_lighting_program->uniformVec3("u_LightPosition", glm::vec3(light.position_range));
+                        m_cone_lighting_program->uniformVec3("u_LightDirection", glm::vec3(light.direction_cutoff));
+                        m_cone_lighting_program->uniformMat4x4("u_LightSpaceMatrix", light.light_space_matrix);
+                        m_cone_lighting_program->uniformVec4("u_ShadowRect", light.shadow_rect);
+
+                        // inner/outer cone cutoffs
+                        m_cone_lighting_program->uniformFloat("u_LightCutOff", light.direction_cutoff.w);
+                        m_cone_lighting_program->uniformFloat("u_LightOuterCutOff", light.color_outer_cutoff.w);
+
+                        // distance attenuation constants from cone light
+                        m_cone_lighting_program->uniformFloat("u_LightConstant", light.attenuation.x);
+                        m_cone_lighting_program->uniformFloat("u_LightLinear", light.attenuation.y);
+                        m_cone_lighting_program->uniformFloat("u_LightQuadratic", light.attenuation.z);
+
+                        // depth range of the light volume, tested in the shader (no depth bounds test on ES)
+                        m_cone_lighting_program->uniformFloat("u_DepthBoundsMin", cone_depth_bounds[i].x);
+                        m_cone_lighting_program->uniformFloat("u_DepthBoundsMax", cone_depth_bounds[i].y);
+
+                        // draw fullscreen quad, limited to the screen rectangle of the light volume
+                        const auto& scissor = cone_scissors[i];
+                        withScissor(scissor.x, scissor.y, scissor.z, scissor.w, [&]() {
+                            if (m_render_quad) m_render_quad->draw();
+                        });
+                    }
+                });
             });
-        });
+        }, false);
+    }
 
-        last_used_lightbuffer_index = lightbuffer_index;
+    // drop the static layers of the lights that are gone
+    std::erase_if(m_static_shadow_layers, [&](const auto& entry) {
+        return entry.second.last_used_frame != m_shadow_frame;
     });
 
-    // 5) Tone mapping pass: apply tone mapping to the last used lightbuffer
-    {
-        const auto lightbuffer_index = (last_used_lightbuffer_index + 1) % 2;
-        withFramebuffer(m_lightbuffer[lightbuffer_index].get(), [&]() {
-            withFaceCulling([&]() {
-                m_tone_mapping_program->bind();
+    // 5) Tone mapping pass: apply tone mapping to the lightbuffer
+    withFramebuffer(m_tonemapped_buffer.get(), [&]() {
+        withFaceCulling([&]() {
+            m_tone_mapping_program->bind();
 
-                auto lightbuffer_color_attachment = m_lightbuffer[last_used_lightbuffer_index]->getColorAttachment(0);
+            auto lightbuffer_color_attachment = m_lightbuffer->getColorAttachment(0);
 
-                m_render_quad->drawWithTexture(*m_tone_mapping_program, "u_SrcTex", lightbuffer_color_attachment, 0);
-            });
+            m_render_quad->drawWithTexture(*m_tone_mapping_program, "u_SrcTex", lightbuffer_color_attachment, 0);
         });
-        last_used_lightbuffer_index = lightbuffer_index;
-    }
+    });
 
     // 6) Final pass: blit/lightbuffer -> default framebuffer using fullscreen quad (renderquad)
     withFaceCulling([&]() {
@@ -485,16 +1241,389 @@ void ShadowedPipeline::render(const Scene *const scene) noexcept {
         CHECK_GL_ERROR(glGetIntegerv(GL_VIEWPORT, viewport));
         CHECK_GL_ERROR(glViewport(0, 0, viewport[2], viewport[3]));
 
-        auto lightbuffer_color_attachment = m_lightbuffer[last_used_lightbuffer_index]->getColorAttachment(0);
+        auto tonemapped_color_attachment = m_tonemapped_buffer->getColorAttachment(0);
         if (m_post_program && m_render_quad) {
             // convenience draw: program/sampler/texture handled by RenderQuad helper
-            m_render_quad->drawWithTexture(*m_post_program, "u_SrcTex", lightbuffer_color_attachment, 0);
+            m_render_quad->drawWithTexture(*m_post_program, "u_SrcTex", tonemapped_color_attachment, 0);
         }
     });
+
+    m_uniform_ring->endFrame();
+}
+
+void ShadowedPipeline::gatherConeLights(
+    const Scene *const scene,
+    const glm::mat4& view,
+    const glm::mat4& proj,
+    std::vector<ClusteredConeLight>& lights,
+    std::vector<const void*>& sources,
+    std::vector<glm::ivec4>& scissors,
+    std::vector<glm::vec2>& depth_bounds
+) noexcept {
+    const auto view_projection = proj * view;
+
+    // side of the tile each light asks for, in texels
+    std::vector<glm::float32> tile_requests;
+
+    scene->foreachConeLight([&](const ConeLight& cone) {
+        if (lights.size() >= CLUSTERED_MAX_CONE_LIGHTS) return;
+
+        // lights that cannot reach a visible pixel need neither a shadow map nor shading
+        glm::ivec4 scissor;
+        glm::vec2 light_depth_bounds;
+        if (!cone_light_screen_bounds(cone, view_projection, m_gbuffer->getWidth(), m_gbuffer->getHeight(), scissor, light_depth_bounds)) {
+            return;
+        }
+
+        const auto position = cone.getPosition();
+        const auto direction = glm::normalize(cone.getDirection());
+        const auto range = cone.getZFar();
+        const auto outer_half = cone.getAngleRadians() * 0.5f;
+        const auto inner_half = outer_half * cone.getInnerRatio();
+
+        // Smallest sphere around the lit cone: the shaders light up to `range` along the axis (the far
+        // plane of the light projection), where the base disc is range * tan(half) wide. Past 45 degrees
+        // it is the sphere of the base disc, otherwise the one through the apex and the base circle.
+        const auto bound_half = std::min(outer_half, glm::radians(89.0f));
+        const auto base_radius = range * std::tan(bound_half);
+        glm::vec4 bounds;
+        if (bound_half > glm::radians(45.0f)) {
+            bounds = glm::vec4(position + direction * range, base_radius);
+        } else {
+            const auto radius = (range * range + base_radius * base_radius) / (2.0f * range);
+            bounds = glm::vec4(position + direction * radius, radius);
+        }
+
+        // screen coverage of the bounding sphere, as a fraction of the half screen: it shrinks with the distance
+        const auto center_viewspace = glm::vec3(view * glm::vec4(glm::vec3(bounds), 1.0f));
+        glm::float32 coverage = 1.0f;
+        if (glm::length(center_viewspace) > bounds.w) {
+            const auto w = proj[2][3] * center_viewspace.z + proj[3][3];
+            if (w > 0.0f) {
+                coverage = std::min(1.0f, bounds.w * std::max(proj[0][0], proj[1][1]) / w);
+            }
+        }
+
+        tile_requests.push_back(coverage * static_cast<glm::float32>(SHADOW_ATLAS_MAX_TILE));
+        sources.push_back(&cone);
+
+        lights.push_back(ClusteredConeLight {
+            .light_space_matrix = cone_light_space_matrix(cone, 1.0f),
+            .position_range = glm::vec4(position, range),
+            .direction_cutoff = glm::vec4(cone.getDirection(), std::cos(inner_half)),
+            .color_outer_cutoff = glm::vec4(cone.getColorWithIntensity(), std::cos(outer_half)),
+            .attenuation = glm::vec4(cone.getConstant(), cone.getLinear(), cone.getQuadratic(), 0.0f),
+            .bounds = bounds,
+            .shadow_rect = glm::vec4(0.0f),
+        });
+        scissors.push_back(scissor);
+        depth_bounds.push_back(light_depth_bounds);
+    });
+
+    std::vector<glm::ivec4> tiles;
+    assignConeShadowTiles(sources, tile_requests, tiles);
+    for (size_t i = 0; i < lights.size(); ++i) {
+        lights[i].shadow_rect = glm::vec4(tiles[i].x, tiles[i].y, tiles[i].z, tiles[i].w);
+    }
+}
+
+void ShadowedPipeline::assignConeShadowTiles(
+    const std::vector<const void*>& sources,
+    const std::vector<glm::float32>& requests,
+    std::vector<glm::ivec4>& tiles
+) noexcept {
+    // the static layer of a tile that is given back is gone: another light may draw over it
+    const auto release = [this](ConeShadowTile& tile) {
+        if (tile.rect.z == 0) return;
+
+        m_shadow_atlas_allocator.release(tile.rect);
+        tile.rect = glm::ivec4(0);
+        tile.layer.valid = false;
+    };
+
+    // sides: the power of two of the request, but a tile only shrinks well below half of it
+    std::vector<GLsizei> sizes(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i) {
+        const auto wanted = static_cast<GLsizei>(std::clamp(
+            std::bit_ceil(static_cast<glm::uint32>(std::ceil(requests[i]))),
+            static_cast<glm::uint32>(SHADOW_ATLAS_MIN_TILE),
+            static_cast<glm::uint32>(SHADOW_ATLAS_MAX_TILE)
+        ));
+
+        const auto current = m_cone_shadow_tiles.find(sources[i]);
+        const auto current_size = (current != m_cone_shadow_tiles.end()) ? current->second.rect.z : 0;
+        const bool keep = (wanted < current_size) &&
+            (requests[i] > static_cast<glm::float32>(current_size / 2) * SHADOW_ATLAS_TILE_SHRINK_MARGIN);
+
+        sizes[i] = keep ? current_size : wanted;
+    }
+
+    fit_shadow_tiles(sizes, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_MIN_TILE);
+
+    // the lights whose side changed give their tile back, the others keep it
+    for (size_t i = 0; i < sources.size(); ++i) {
+        auto& tile = m_cone_shadow_tiles[sources[i]];
+        tile.last_visible_frame = m_shadow_frame;
+        if (tile.rect.z != sizes[i]) release(tile);
+    }
+
+    // and so do the lights out of view for a while (or gone)
+    for (auto it = m_cone_shadow_tiles.begin(); it != m_cone_shadow_tiles.end();) {
+        if (it->second.last_visible_frame + SHADOW_ATLAS_TILE_KEEP_FRAMES >= m_shadow_frame) {
+            ++it;
+            continue;
+        }
+
+        release(it->second);
+        it = m_cone_shadow_tiles.erase(it);
+    }
+
+    // new tiles, largest first
+    std::vector<size_t> order;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (m_cone_shadow_tiles[sources[i]].rect.z == 0) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return sizes[a] > sizes[b];
+    });
+
+    for (size_t n = 0; n < order.size(); ++n) {
+        const auto i = order[n];
+        auto rect = m_shadow_atlas_allocator.allocate(sizes[i]);
+
+        // no room: first take back the tiles of the lights out of view
+        if (!rect.has_value()) {
+            for (auto& entry : m_cone_shadow_tiles) {
+                if (entry.second.last_visible_frame != m_shadow_frame) release(entry.second);
+            }
+            rect = m_shadow_atlas_allocator.allocate(sizes[i]);
+        }
+
+        // still none: the free space is fragmented, repack every tile, largest first (they all fit)
+        if (!rect.has_value()) {
+            std::cout << "Shadow atlas fragmented, repacking " << sources.size() << " cone light tiles" << std::endl;
+
+            for (auto& entry : m_cone_shadow_tiles) release(entry.second);
+            m_shadow_atlas_allocator.clear();
+
+            order.resize(sources.size());
+            std::iota(order.begin(), order.end(), size_t(0));
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return sizes[a] > sizes[b];
+            });
+
+            for (const auto j : order) {
+                const auto repacked = m_shadow_atlas_allocator.allocate(sizes[j]);
+                assert(repacked.has_value() && "Tiles fitting the atlas area must fit once packed largest first");
+                if (repacked.has_value()) m_cone_shadow_tiles[sources[j]].rect = repacked.value();
+            }
+            break;
+        }
+
+        m_cone_shadow_tiles[sources[i]].rect = rect.value();
+    }
+
+    tiles.resize(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i) {
+        tiles[i] = m_cone_shadow_tiles[sources[i]].rect;
+    }
+}
+
+void ShadowedPipeline::renderShadowAtlas(
+    const Scene *const scene,
+    const std::vector<ClusteredConeLight>& lights,
+    const std::vector<const void*>& sources
+) noexcept {
+    // tiles whose static casters come from m_static_shadow_atlas
+    std::vector<bool> cached(lights.size(), false);
+    if (m_shadow_caching) {
+        if (!m_static_shadow_atlas) {
+            m_static_shadow_atlas = std::unique_ptr<Framebuffer>(
+                Framebuffer::CreateFramebuffer(SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, {}, true, false, m_shadow_atlas_depth_format)
+            );
+
+            if (!m_static_shadow_atlas) {
+                std::cerr << "Failed to create the static shadow atlas, drawing every caster" << std::endl;
+            }
+        }
+
+        if (m_static_shadow_atlas) {
+            for (size_t i = 0; i < lights.size(); ++i) {
+                const glm::ivec4 rect(lights[i].shadow_rect);
+
+                // the layer of the light itself: other lights coming and going do not move it
+                cached[i] = updateStaticShadowLayer(
+                    scene,
+                    m_cone_shadow_tiles[sources[i]].layer,
+                    *m_static_shadow_atlas,
+                    lights[i].light_space_matrix,
+                    rect,
+                    "cone " + std::to_string(i)
+                );
+            }
+        }
+    }
+
+    const bool any_cached = std::find(cached.begin(), cached.end(), true) != cached.end();
+
+    // with cached tiles the whole static atlas is copied over: no need to clear
+    withFramebuffer(m_shadow_atlas.get(), [&]() {
+        if (any_cached) {
+            const glm::ivec4 atlas_rect(0, 0, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE);
+            copyShadowDepth(*m_static_shadow_atlas, atlas_rect, atlas_rect);
+        }
+
+        withFaceCulling([&]() {
+            withEnabledDepthTest([&]() {
+                for (size_t i = 0; i < lights.size(); ++i) {
+                    const glm::ivec4 rect(lights[i].shadow_rect);
+
+                    // the copy left a stale tile for the lights drawn from scratch
+                    if (any_cached && !cached[i]) {
+                        withScissor(rect.x, rect.y, rect.z, rect.w, [&]() {
+                            CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT));
+                        });
+                    }
+
+                    bindViewport(rect.x, rect.y, rect.z, rect.w);
+                    drawShadowCasters(
+                        scene,
+                        lights[i].light_space_matrix,
+                        "cone " + std::to_string(i),
+                        cached[i] ? ShadowCasters::DYNAMIC : ShadowCasters::ALL
+                    );
+                }
+            });
+        });
+    }, !any_cached);
+}
+
+void ShadowedPipeline::renderClusteredConeLights(
+    const Scene *const scene,
+    const std::vector<ClusteredConeLight>& lights,
+    const glm::mat4& view,
+    const glm::mat4& proj,
+    const glm::mat4& inverse_view_projection
+) noexcept {
+    const auto camera = scene->getCamera();
+
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_cone_light_buffer));
+    CHECK_GL_ERROR(glBufferSubData(
+        GL_SHADER_STORAGE_BUFFER,
+        0,
+        static_cast<GLsizeiptr>(lights.size() * sizeof(ClusteredConeLight)),
+        lights.data()
+    ));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    // Binning: one invocation per cluster tests every light's bounding sphere against the cluster box
+    const auto cluster_count_x = (static_cast<glm::uint32>(m_gbuffer->getWidth()) + CLUSTER_TILE_SIZE - 1u) / CLUSTER_TILE_SIZE;
+    const auto cluster_count_y = (static_cast<glm::uint32>(m_gbuffer->getHeight()) + CLUSTER_TILE_SIZE - 1u) / CLUSTER_TILE_SIZE;
+    const auto cluster_count = cluster_count_x * cluster_count_y * CLUSTER_DEPTH_SLICES;
+
+    if (cluster_count > m_cluster_buffer_capacity) {
+        if (m_cluster_buffer != 0) {
+            CHECK_GL_ERROR(glDeleteBuffers(1, &m_cluster_buffer));
+        }
+
+        m_cluster_buffer_capacity = cluster_count;
+        m_cluster_buffer = create_storage_buffer(
+            m_cluster_buffer_capacity * (CLUSTER_MAX_LIGHTS + 1u) * sizeof(GLuint),
+            GL_DYNAMIC_COPY
+        );
+    }
+
+    // overflow counters of the previous frames, oldest first, as soon as the GPU is done with them
+    for (size_t i = 0; i < CLUSTER_OVERFLOW_READBACK_FRAMES; ++i) {
+        const auto slot = (m_cluster_overflow_frame + i) % CLUSTER_OVERFLOW_READBACK_FRAMES;
+        auto& fence = m_cluster_overflow_fences[slot];
+        if (!fence) continue;
+
+        const auto status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) continue;
+
+        if (status != GL_WAIT_FAILED) {
+            CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_cluster_overflow_buffers[slot]));
+            const void *const mapped = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 2 * sizeof(GLuint), GL_MAP_READ_BIT);
+            if (mapped) {
+                const auto *const counters = static_cast<const GLuint*>(mapped);
+                m_cluster_overflow = ClusterOverflowStats { counters[0], counters[1] };
+                glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+            }
+            CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+        }
+
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    // the counters of this frame: a slot the GPU is still behind on loses its results
+    const auto overflow_slot = m_cluster_overflow_frame;
+    if (m_cluster_overflow_fences[overflow_slot]) {
+        glDeleteSync(m_cluster_overflow_fences[overflow_slot]);
+        m_cluster_overflow_fences[overflow_slot] = 0;
+    }
+
+    if (m_cluster_overflow_buffers[overflow_slot] == 0) {
+        m_cluster_overflow_buffers[overflow_slot] = create_storage_buffer(2 * sizeof(GLuint), GL_DYNAMIC_READ);
+    }
+
+    const GLuint zero_counters[2] = { 0u, 0u };
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_cluster_overflow_buffers[overflow_slot]));
+    CHECK_GL_ERROR(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero_counters), zero_counters));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    m_cluster_cull_program->bind();
+    m_cluster_cull_program->uniformStorageBufferBinding("ConeLightBuffer", m_cone_light_buffer);
+    m_cluster_cull_program->uniformStorageBufferBinding("ClusterBuffer", m_cluster_buffer);
+    m_cluster_cull_program->uniformStorageBufferBinding("ClusterOverflowBuffer", m_cluster_overflow_buffers[overflow_slot]);
+    m_cluster_cull_program->uniformUint("u_LightCount", static_cast<glm::uint32>(lights.size()));
+    m_cluster_cull_program->uniformUint("u_ClusterCountX", cluster_count_x);
+    m_cluster_cull_program->uniformUint("u_ClusterCountY", cluster_count_y);
+    m_cluster_cull_program->uniformUint("u_ScreenWidth", static_cast<glm::uint32>(m_gbuffer->getWidth()));
+    m_cluster_cull_program->uniformUint("u_ScreenHeight", static_cast<glm::uint32>(m_gbuffer->getHeight()));
+    m_cluster_cull_program->uniformFloat("u_ZNear", camera->getNearPlane());
+    m_cluster_cull_program->uniformFloat("u_ZFar", camera->getFarPlane());
+    m_cluster_cull_program->uniformMat4x4("u_InverseProjection", glm::inverse(proj));
+    m_cluster_cull_program->uniformMat4x4("u_ViewMatrix", view);
+    m_cluster_cull_program->dispatchCompute((cluster_count + 63u) / 64u, 1, 1);
+
+    m_cluster_overflow_fences[overflow_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_cluster_overflow_frame = (overflow_slot + 1u) % CLUSTER_OVERFLOW_READBACK_FRAMES;
+
+    // Shading: a single full-screen pass reads the G-buffer once per pixel
+    withFramebuffer(m_lightbuffer.get(), [&]() {
+        withFaceCulling([&]() {
+            withAdditiveBlending([&]() {
+                m_clustered_cone_lighting_program->bind();
+
+                m_clustered_cone_lighting_program->framebufferColorAttachment("u_GDiffuse", GL_TEXTURE0, *m_gbuffer, 0);
+                m_clustered_cone_lighting_program->framebufferColorAttachment("u_GSpecular", GL_TEXTURE1, *m_gbuffer, 1);
+                m_clustered_cone_lighting_program->framebufferColorAttachment("u_GNormalTangentSpace", GL_TEXTURE2, *m_gbuffer, 2);
+                m_clustered_cone_lighting_program->framebufferDepthAttachment("u_GDepth", GL_TEXTURE3, *m_gbuffer);
+                m_clustered_cone_lighting_program->framebufferColorAttachment("u_GNormal", GL_TEXTURE4, *m_gbuffer, 3);
+                m_clustered_cone_lighting_program->framebufferColorAttachment("u_GTangent", GL_TEXTURE5, *m_gbuffer, 4);
+                m_clustered_cone_lighting_program->framebufferDepthAttachment("u_ShadowAtlas", GL_TEXTURE7, *m_shadow_atlas);
+
+                m_clustered_cone_lighting_program->uniformStorageBufferBinding("ConeLightBuffer", m_cone_light_buffer);
+                m_clustered_cone_lighting_program->uniformStorageBufferBinding("ClusterBuffer", m_cluster_buffer);
+
+                m_clustered_cone_lighting_program->uniformMat4x4("u_InverseViewProjection", inverse_view_projection);
+                m_clustered_cone_lighting_program->uniformMat4x4("u_ViewMatrix", view);
+                m_clustered_cone_lighting_program->uniformVec3("u_CameraPosition", camera->getCameraPosition());
+                m_clustered_cone_lighting_program->uniformUint("u_ClusterCountX", cluster_count_x);
+                m_clustered_cone_lighting_program->uniformUint("u_ClusterCountY", cluster_count_y);
+                m_clustered_cone_lighting_program->uniformFloat("u_ZNear", camera->getNearPlane());
+                m_clustered_cone_lighting_program->uniformFloat("u_ZFar", camera->getFarPlane());
+
+                if (m_render_quad) m_render_quad->draw();
+            });
+        });
+    }, false);
 }
 
 bool ShadowedPipeline::resize(GLsizei width, GLsizei height) noexcept {
-    // create new gbuffer: albedo(RGBA8), spec(RGBA8), normal(RGB32F), position(RGBA32F) + depth
+    // create new gbuffer: albedo(RGBA8), spec + shininess(RGBA8), normal tangentspace(RGBA8), normal and tangent(RG16F) + depth
     auto resized_gbuffer = std::unique_ptr<Framebuffer>(
         Framebuffer::CreateFramebuffer(
             width,
@@ -523,59 +1652,93 @@ bool ShadowedPipeline::resize(GLsizei width, GLsizei height) noexcept {
         return false;
     }
 
-    // lightbuffer(s): single RGBA32F target
-    auto resized_lightbuffer_0 = std::unique_ptr<Framebuffer>(
+    // lightbuffer: single HDR target in the chosen format
+    auto resized_lightbuffer = std::unique_ptr<Framebuffer>(
         Framebuffer::CreateFramebuffer(
             width,
             height,
-            lightbuffer_attachments,
+            { m_lightbuffer_format },
             false,
             false
         )
     );
-    if (!resized_lightbuffer_0) {
-        std::cerr << "ShadowedPipeline::resize: Failed to resize lightbuffer 0 framebuffer!" << std::endl;
+    if (!resized_lightbuffer) {
+        std::cerr << "ShadowedPipeline::resize: Failed to resize lightbuffer framebuffer!" << std::endl;
         return false;
     }
 
-    auto resized_lightbuffer_1 = std::unique_ptr<Framebuffer>(
+    auto resized_tonemapped_buffer = std::unique_ptr<Framebuffer>(
         Framebuffer::CreateFramebuffer(
             width,
             height,
-            lightbuffer_attachments,
+            tonemapped_attachments,
             false,
             false
         )
     );
-    if (!resized_lightbuffer_1) {
-        std::cerr << "ShadowedPipeline::resize: Failed to resize lightbuffer 1 framebuffer!" << std::endl;
+    if (!resized_tonemapped_buffer) {
+        std::cerr << "ShadowedPipeline::resize: Failed to resize tone mapping framebuffer!" << std::endl;
         return false;
     }
 
-    auto resized_lightbuffer = std::array<std::unique_ptr<Framebuffer>, 2>{
-        std::move(resized_lightbuffer_0),
-        std::move(resized_lightbuffer_1)
-    };
-
     // recreate framebuffers at new size
     m_gbuffer.swap(resized_gbuffer);
+
+    // recreated at the new size by the next frame
+    m_hiz_pyramid.reset();
     m_lightbuffer.swap(resized_lightbuffer);
+    m_tonemapped_buffer.swap(resized_tonemapped_buffer);
 
     return Pipeline::resize(width, height);
 }
 
-ShadowedPipeline* ShadowedPipeline::Create(GLsizei width, GLsizei height) noexcept {
-    const auto vertex_shader = std::unique_ptr<VertexShader>(VertexShader::CompileShader(vertex_shader_source));
-    assert(vertex_shader != nullptr && "Failed to create vertex shader");
+bool ShadowedPipeline::setLightbufferFormat(FramebufferColorFormat format) noexcept {
+    auto lightbuffer = std::unique_ptr<Framebuffer>(
+        Framebuffer::CreateFramebuffer(
+            m_lightbuffer->getWidth(),
+            m_lightbuffer->getHeight(),
+            { format },
+            false,
+            false
+        )
+    );
+    if (!lightbuffer) {
+        std::cerr << "ShadowedPipeline::setLightbufferFormat: Failed to create lightbuffer framebuffer!" << std::endl;
+        return false;
+    }
+
+    m_lightbuffer.swap(lightbuffer);
+    m_lightbuffer_format = format;
+
+    return true;
+}
 
+ShadowedPipeline* ShadowedPipeline::Create(
+    GLsizei width,
+    GLsizei height,
+    FramebufferColorFormat lightbuffer_format
+) noexcept {
     const auto geometry_shader = std::unique_ptr<GeometryShader>(GeometryShader::CompileShader(geometry_shader_source));
     assert(geometry_shader != nullptr && "Failed to create geometry shader");
 
     const auto fragment_shader = std::unique_ptr<FragmentShader>(FragmentShader::CompileShader(fragment_shader_source));
     assert(fragment_shader != nullptr && "Failed to create fragment shader");
 
+    // G-buffer program of the render queue: matrices and material come from uniform ring ranges
+    const auto block_vertex_shader_source = Shader::InjectDefines(vertex_shader_source, {"DRAW_UNIFORM_BLOCKS"});
+    const auto vertex_shader = std::unique_ptr<VertexShader>(VertexShader::CompileShader(block_vertex_shader_source.c_str()));
+    assert(vertex_shader != nullptr && "Failed to create vertex shader");
+
+    const auto block_geometry_shader_source = Shader::InjectDefines(geometry_shader_source, {"DRAW_UNIFORM_BLOCKS"});
+    const auto block_geometry_shader = std::unique_ptr<GeometryShader>(GeometryShader::CompileShader(block_geometry_shader_source.c_str()));
+    assert(block_geometry_shader != nullptr && "Failed to create geometry shader");
+
+    const auto block_fragment_shader_source = Shader::InjectDefines(fragment_shader_source, {"DRAW_UNIFORM_BLOCKS"});
+    const auto block_fragment_shader = std::unique_ptr<FragmentShader>(FragmentShader::CompileShader(block_fragment_shader_source.c_str()));
+    assert(block_fragment_shader != nullptr && "Failed to create fragment shader");
+
     const auto unshadowed_program = std::shared_ptr<Program>(
-        Program::LinkProgram(vertex_shader.get(), geometry_shader.get(), fragment_shader.get())
+        Program::LinkProgram(vertex_shader.get(), block_geometry_shader.get(), block_fragment_shader.get())
     );
     assert(unshadowed_program != nullptr && "Failed to create shader program");
 
@@ -651,9 +1814,10 @@ ShadowedPipeline* ShadowedPipeline::Create(GLsizei width, GLsizei height) noexce
     );
     assert(tone_mapping_program != nullptr && "Failed to create tone mapping program");
 
-    // shadowmap program
+    // shadowmap program, fed by the render queue like the G-buffer one
+    const auto block_depth_only_vertex_shader_source = Shader::InjectDefines(depth_only_vertex_shader_source, {"DRAW_UNIFORM_BLOCKS"});
     const auto depth_only_vert = std::unique_ptr<VertexShader>(
-        VertexShader::CompileShader(depth_only_vertex_shader_source)
+        VertexShader::CompileShader(block_depth_only_vertex_shader_source.c_str())
     );
     const auto depth_only_frag = std::unique_ptr<FragmentShader>(
         FragmentShader::CompileShader(depth_only_fragment_shader_source)
@@ -662,6 +1826,95 @@ ShadowedPipeline* ShadowedPipeline::Create(GLsizei width, GLsizei height) noexce
         Program::LinkProgram(depth_only_vert.get(), nullptr, depth_only_frag.get())
     );
 
+    // crowd programs: same shaders, with the vertex shader skinning every instance
+    const auto crowd_vertex_shader_source = Shader::InjectDefines(vertex_shader_source, {"CROWD_INSTANCING"});
+    const auto crowd_vert = std::unique_ptr<VertexShader>(
+        VertexShader::CompileShader(crowd_vertex_shader_source.c_str())
+    );
+    assert(crowd_vert != nullptr && "Failed to compile crowd vertex shader");
+
+    auto crowd_mesh_program = std::shared_ptr<Program>(
+        Program::LinkProgram(crowd_vert.get(), geometry_shader.get(), fragment_shader.get())
+    );
+    assert(crowd_mesh_program != nullptr && "Failed to create crowd shader program");
+
+    auto crowd_depth_only_program = std::shared_ptr<Program>(
+        Program::LinkProgram(crowd_vert.get(), nullptr, depth_only_frag.get())
+    );
+    assert(crowd_depth_only_program != nullptr && "Failed to create crowd depth only program");
+
+    // baked clip programs: the vertex shader skins from the baked palette texture
+    const auto baked_vertex_shader_source = Shader::InjectDefines(vertex_shader_source, {"BAKED_PALETTE"});
+    const auto baked_vert = std::unique_ptr<VertexShader>(
+        VertexShader::CompileShader(baked_vertex_shader_source.c_str())
+    );
+    assert(baked_vert != nullptr && "Failed to compile baked palette vertex shader");
+
+    auto baked_mesh_program = std::shared_ptr<Program>(
+        Program::LinkProgram(baked_vert.get(), geometry_shader.get(), fragment_shader.get())
+    );
+    assert(baked_mesh_program != nullptr && "Failed to create baked palette shader program");
+
+    auto baked_depth_only_program = std::shared_ptr<Program>(
+        Program::LinkProgram(baked_vert.get(), nullptr, depth_only_frag.get())
+    );
+    assert(baked_depth_only_program != nullptr && "Failed to create baked palette depth only program");
+
+    // GPU-driven draw programs: only where indirect multi-draws are available
+    std::shared_ptr<Program> indirect_mesh_program;
+    std::shared_ptr<Program> indirect_depth_only_program;
+    std::shared_ptr<Program> indirect_cull_program;
+    std::shared_ptr<Program> hiz_build_program;
+    if (IndirectDrawBuffer::IsSupported()) {
+        const auto indirect_vertex_shader_source = Shader::InjectDefines(vertex_shader_source, {"INDIRECT_DRAW"});
+        const auto indirect_vert = std::unique_ptr<VertexShader>(
+            VertexShader::CompileShader(indirect_vertex_shader_source.c_str())
+        );
+        assert(indirect_vert != nullptr && "Failed to compile indirect draw vertex shader");
+
+        const auto indirect_geometry_shader_source = Shader::InjectDefines(geometry_shader_source, {"INDIRECT_DRAW"});
+        const auto indirect_geom = std::unique_ptr<GeometryShader>(
+            GeometryShader::CompileShader(indirect_geometry_shader_source.c_str())
+        );
+        assert(indirect_geom != nullptr && "Failed to compile indirect draw geometry shader");
+
+        const auto indirect_fragment_shader_source = Shader::InjectDefines(fragment_shader_source, {"INDIRECT_DRAW"});
+        const auto indirect_frag = std::unique_ptr<FragmentShader>(
+            FragmentShader::CompileShader(indirect_fragment_shader_source.c_str())
+        );
+        assert(indirect_frag != nullptr && "Failed to compile indirect draw fragment shader");
+
+        indirect_mesh_program = std::shared_ptr<Program>(
+            Program::LinkProgram(indirect_vert.get(), indirect_geom.get(), indirect_frag.get())
+        );
+        assert(indirect_mesh_program != nullptr && "Failed to create indirect draw shader program");
+
+        indirect_depth_only_program = std::shared_ptr<Program>(
+            Program::LinkProgram(indirect_vert.get(), nullptr, depth_only_frag.get())
+        );
+        assert(indirect_depth_only_program != nullptr && "Failed to create indirect draw depth only program");
+
+        const auto cull_draws_comp = std::unique_ptr<ComputeShader>(
+            ComputeShader::CompileShader(cull_draws_compute_shader)
+        );
+        assert(cull_draws_comp != nullptr && "Failed to compile draw culling compute shader");
+
+        indirect_cull_program = std::shared_ptr<Program>(
+            Program::LinkProgram(cull_draws_comp.get())
+        );
+        assert(indirect_cull_program != nullptr && "Failed to create draw culling program");
+
+        const auto hiz_build_comp = std::unique_ptr<ComputeShader>(
+            ComputeShader::CompileShader(hiz_build_compute_shader)
+        );
+        assert(hiz_build_comp != nullptr && "Failed to compile Hi-Z build compute shader");
+
+        hiz_build_program = std::shared_ptr<Program>(
+            Program::LinkProgram(hiz_build_comp.get())
+        );
+        assert(hiz_build_program != nullptr && "Failed to create Hi-Z build program");
+    }
+
     // Create post (blit) program
     const auto post_frag = std::unique_ptr<FragmentShader>(
         FragmentShader::CompileShader(post_fragment_shader)
@@ -701,32 +1954,27 @@ ShadowedPipeline* ShadowedPipeline::Create(GLsizei width, GLsizei height) noexce
     ));
     assert(ssao_blur_buffer != nullptr && "Failed to create SSAO blur framebuffer");
 
-    auto lightbuffer_0 = std::unique_ptr<Framebuffer>(
+    auto lightbuffer = std::unique_ptr<Framebuffer>(
         Framebuffer::CreateFramebuffer(
             width,
             height,
-            lightbuffer_attachments,
+            { lightbuffer_format },
             false,
             false
         )
     );
-    assert(lightbuffer_0 != nullptr && "Failed to create lightbuffer 0");
+    assert(lightbuffer != nullptr && "Failed to create lightbuffer");
 
-    auto lightbuffer_1 = std::unique_ptr<Framebuffer>(
+    auto tonemapped_buffer = std::unique_ptr<Framebuffer>(
         Framebuffer::CreateFramebuffer(
             width,
             height,
-            lightbuffer_attachments,
+            tonemapped_attachments,
             false,
             false
         )
     );
-    assert(lightbuffer_1 != nullptr && "Failed to create lightbuffer 0");
-
-    auto lightbuffer = std::array<std::unique_ptr<Framebuffer>, 2>{
-        std::move(lightbuffer_0),
-        std::move(lightbuffer_1)
-    };
+    assert(tonemapped_buffer != nullptr && "Failed to create tone mapping framebuffer");
 
     auto shadowbuffer = std::unique_ptr<Framebuffer>(
         Framebuffer::CreateFramebuffer(
@@ -748,6 +1996,51 @@ ShadowedPipeline* ShadowedPipeline::Create(GLsizei width, GLsizei height) noexce
     );
     assert(ssao_sample_buffer != nullptr && "Failed to create SSAO sample buffer");
 
+    // Clustered cone lights
+    const std::vector<std::string> cluster_defines = {
+        "CLUSTER_TILE_SIZE " + std::to_string(CLUSTER_TILE_SIZE) + "u",
+        "CLUSTER_DEPTH_SLICES " + std::to_string(CLUSTER_DEPTH_SLICES) + "u",
+        "CLUSTER_MAX_LIGHTS " + std::to_string(CLUSTER_MAX_LIGHTS) + "u",
+    };
+
+    const auto cluster_cull_source = Shader::InjectDefines(cluster_cone_lights_compute_shader, cluster_defines);
+    const auto cluster_cull_comp = std::unique_ptr<ComputeShader>(
+        ComputeShader::CompileShader(cluster_cull_source.c_str())
+    );
+    assert(cluster_cull_comp != nullptr && "Failed to compile cone light clustering compute shader");
+
+    auto cluster_cull_program = std::shared_ptr<Program>(
+        Program::LinkProgram(cluster_cull_comp.get())
+    );
+    assert(cluster_cull_program != nullptr && "Failed to create cone light clustering program");
+
+    const auto clustered_cone_lighting_source = Shader::InjectDefines(clustered_cone_lighting_fragment_shader, cluster_defines);
+    const auto clustered_cone_lighting_frag = std::unique_ptr<FragmentShader>(
+        FragmentShader::CompileShader(clustered_cone_lighting_source.c_str())
+    );
+    assert(clustered_cone_lighting_frag != nullptr && "Failed to compile clustered cone lighting fragment shader");
+
+    auto clustered_cone_lighting_program = std::shared_ptr<Program>(
+        Program::LinkProgram(quad_vert.get(), nullptr, clustered_cone_lighting_frag.get())
+    );
+    assert(clustered_cone_lighting_program != nullptr && "Failed to create clustered cone lighting program");
+
+    auto shadow_atlas = std::unique_ptr<Framebuffer>(
+        Framebuffer::CreateFramebuffer(
+            SHADOW_ATLAS_SIZE,
+            SHADOW_ATLAS_SIZE,
+            {},
+            true,
+            false
+        )
+    );
+    assert(shadow_atlas != nullptr && "Failed to create shadow atlas");
+
+    const auto cone_light_buffer = create_storage_buffer(
+        CLUSTERED_MAX_CONE_LIGHTS * sizeof(ClusteredConeLight),
+        GL_DYNAMIC_DRAW
+    );
+
     // Create reusable fullscreen quad
     auto render_quad = std::shared_ptr<RenderQuad>(RenderQuad::Create());
 
@@ -780,6 +2073,8 @@ ShadowedPipeline* ShadowedPipeline::Create(GLsizei width, GLsizei height) noexce
         std::move(ssaobuffer),
         std::move(ssao_blur_buffer),
         std::move(lightbuffer),
+        lightbuffer_format,
+        std::move(tonemapped_buffer),
         std::move(shadowbuffer),
         std::move(ssao_sample_buffer),
         std::move(ssao_noise_texture),
@@ -792,6 +2087,18 @@ ShadowedPipeline* ShadowedPipeline::Create(GLsizei width, GLsizei height) noexce
         cone_lighting_program,
         tone_mapping_program,
         post_program,
+        crowd_mesh_program,
+        crowd_depth_only_program,
+        baked_mesh_program,
+        baked_depth_only_program,
+        cluster_cull_program,
+        clustered_cone_lighting_program,
+        indirect_mesh_program,
+        indirect_depth_only_program,
+        indirect_cull_program,
+        hiz_build_program,
+        std::move(shadow_atlas),
+        cone_light_buffer,
         render_quad,
         width,
         height
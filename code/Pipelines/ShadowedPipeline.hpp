@@ -4,13 +4,124 @@
 #include "../Buffer.hpp"
 #include "../Framebuffer.hpp"
 #include "../RenderQuad.hpp"
+#include "../Culling.hpp"
+#include "../IndirectDrawBuffer.hpp"
+#include "../HiZPyramid.hpp"
+#include "../RenderQueue.hpp"
+#include "../ShadowAtlasAllocator.hpp"
 
 #include <memory>
 #include <array>
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <utility>
+#include <cstdint>
 
 #include <glm/glm.hpp>
 
+// Clustered cone lights: screen tiles of CLUSTER_TILE_SIZE pixels, split in CLUSTER_DEPTH_SLICES
+// exponential slices of view depth. Keep in sync with cluster_cone_lights.comp and clustered_cone_lighting.frag
+#define CLUSTER_TILE_SIZE 64u
+#define CLUSTER_DEPTH_SLICES 16u
+#define CLUSTER_MAX_LIGHTS 63u
+
+// frames of cluster overflow counters in flight (see ShadowedPipeline::getClusterOverflow)
+#define CLUSTER_OVERFLOW_READBACK_FRAMES 3u
+
+// Cone lights past this count are ignored
+#define CLUSTERED_MAX_CONE_LIGHTS 256u
+
+// Side of the depth texture holding the shadow maps of the cone lights
+#define SHADOW_ATLAS_SIZE 4096
+
+// Power of two sides of the atlas tiles, picked per light from its screen coverage
+#define SHADOW_ATLAS_MIN_TILE 128
+#define SHADOW_ATLAS_MAX_TILE 2048
+
+// A tile only shrinks once its light fits in half of it with this margin: lights at the boundary
+// between two sides do not switch (and lose their static layer) every frame
+#define SHADOW_ATLAS_TILE_SHRINK_MARGIN 0.75f
+
+// Frames a cone light out of view keeps its tile of the atlas, and the static layer in it
+#define SHADOW_ATLAS_TILE_KEEP_FRAMES 120u
+
+static_assert(
+    CLUSTERED_MAX_CONE_LIGHTS * SHADOW_ATLAS_MIN_TILE * SHADOW_ATLAS_MIN_TILE <= SHADOW_ATLAS_SIZE * SHADOW_ATLAS_SIZE,
+    "every cone light must get at least the smallest tile of the shadow atlas"
+);
+
+// Directional lights: at most SHADOW_CASCADE_COUNT cascades, tiles of SHADOW_CASCADE_SIZE texels in
+// a 2x2 grid of the shadowbuffer. Keep in sync with directional_lighting.frag
+#define SHADOW_CASCADE_COUNT 4
+#define SHADOW_CASCADE_SIZE 2048
+
+// Cascade splits: 0 is uniform, 1 logarithmic
+#define SHADOW_CASCADE_SPLIT_LAMBDA 0.8f
+
+// Views are culled through the scene BVH from this many meshes on: below it the flat scan is faster
+#define CULLING_BVH_MIN_MESHES 256u
+
+// Passes of the render queue: the draws of the CPU-culled meshes, sorted within each view
+#define RENDER_PASS_GBUFFER 0u
+#define RENDER_PASS_SHADOW 1u
+
+// Bytes of the uniform ring per frame in flight (it grows when a frame runs out)
+#define UNIFORM_RING_REGION_SIZE (4u * 1024u * 1024u)
+
+class ConeLight;
+
+// Must match the ClusteredConeLight of cluster_cone_lights.comp and clustered_cone_lighting.frag
+struct ClusteredConeLight {
+    glm::mat4 light_space_matrix;
+
+    // xyz: world-space position, w: range (the shadow far plane)
+    glm::vec4 position_range;
+
+    // xyz: direction, w: cosine of the inner half-angle
+    glm::vec4 direction_cutoff;
+
+    // xyz: color times intensity, w: cosine of the outer half-angle
+    glm::vec4 color_outer_cutoff;
+
+    // constant, linear and quadratic attenuation
+    glm::vec4 attenuation;
+
+    // world-space bounding sphere of the lit volume: center, radius
+    glm::vec4 bounds;
+
+    // tile of the shadow atlas, in texels: x, y, width, height
+    glm::vec4 shadow_rect;
+};
+
+static_assert(sizeof(ClusteredConeLight) == 160, "ClusteredConeLight must match its std430 layout");
+
+// Shadow casters drawn by a shadow pass
+enum class ShadowCasters {
+    ALL,
+    // meshes drawn from their static vertices: they only change with Scene::getStaticGeometryVersion
+    STATIC,
+    // skinned, baked and crowd meshes: they change every frame
+    DYNAMIC,
+};
+
+// Meshes a view (the camera or a shadow map) drew and culled in a frame
+struct CullingStats {
+    std::string view;
+
+    size_t drawn;
+
+    size_t culled;
+};
+
+// Clusters that overlapped more than CLUSTER_MAX_LIGHTS cone lights, and the lights they dropped
+struct ClusterOverflowStats {
+    size_t clusters;
+
+    size_t lights;
+};
+
 class ShadowedPipeline : public Pipeline {
 public:
     ~ShadowedPipeline() noexcept override;
@@ -19,14 +130,142 @@ public:
 
     bool resize(GLsizei width, GLsizei height) noexcept override;
 
-    static ShadowedPipeline* Create(GLsizei width, GLsizei height) noexcept;
+    /**
+     * Lights are accumulated by additive blending into a single HDR target of the given format:
+     * FRAMEBUFFER_COLOR_FORMAT_RGBA16F or FRAMEBUFFER_COLOR_FORMAT_R11F_G11F_B10F (half the size, no alpha).
+     */
+    static ShadowedPipeline* Create(
+        GLsizei width,
+        GLsizei height,
+        FramebufferColorFormat lightbuffer_format = FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA16F
+    ) noexcept;
+
+    /**
+     * Recreate the lightbuffer with the given format (see Create).
+     */
+    bool setLightbufferFormat(FramebufferColorFormat format) noexcept;
+
+    inline FramebufferColorFormat getLightbufferFormat() const noexcept {
+        return m_lightbuffer_format;
+    }
+
+    /**
+     * When enabled (the default) cone lights are shaded in a single pass: a compute pass bins them
+     * into clusters and every pixel is shaded against the lights of its own cluster only.
+     * Otherwise each cone light gets its own full-screen pass. Either way all their shadow maps
+     * are rendered first, into the shadow atlas.
+     */
+    inline void setClusteredConeLights(bool enabled) noexcept {
+        m_clustered_cone_lights = enabled;
+    }
+
+    inline bool getClusteredConeLights() const noexcept {
+        return m_clustered_cone_lights;
+    }
+
+    /**
+     * Recreate the shadow atlas of the cone lights with the given depth format:
+     * FRAMEBUFFER_DEPTH_FORMAT_DEPTH16 halves its memory, and is enough when the cone lights are short.
+     */
+    bool setShadowAtlasDepthFormat(FramebufferDepthFormat format) noexcept;
+
+    inline FramebufferDepthFormat getShadowAtlasDepthFormat() const noexcept {
+        return m_shadow_atlas_depth_format;
+    }
+
+    /**
+     * When enabled (the default) the static casters of every shadow map are rendered into a cached
+     * layer, redrawn only when the light or the static geometry changes; each frame the layer is
+     * copied into the shadow map and the dynamic casters are drawn on top.
+     */
+    void setShadowCaching(bool enabled) noexcept;
+
+    inline bool getShadowCaching() const noexcept {
+        return m_shadow_caching;
+    }
+
+    /**
+     * Directional shadows are split in count cascades (1 to SHADOW_CASCADE_COUNT) over the view
+     * frustum, each fitted to its slice of the frustum and to the shadow casters.
+     */
+    inline void setShadowCascadeCount(glm::uint32 count) noexcept {
+        m_shadow_cascade_count = glm::clamp(count, 1u, static_cast<glm::uint32>(SHADOW_CASCADE_COUNT));
+    }
+
+    inline glm::uint32 getShadowCascadeCount() const noexcept {
+        return m_shadow_cascade_count;
+    }
+
+    /**
+     * When enabled (the default) meshes are tested against the frustum of the camera and of every
+     * shadow map before being drawn there. Baked and crowd meshes are always drawn: the former keep
+     * the bounds of their last skinned pose, the latter place their instances on the GPU.
+     */
+    inline void setFrustumCulling(bool enabled) noexcept {
+        m_frustum_culling = enabled;
+    }
+
+    inline bool getFrustumCulling() const noexcept {
+        return m_frustum_culling;
+    }
+
+    // Meshes drawn and culled by every view of the last frame, in the order they were rendered
+    inline const std::vector<CullingStats>& getCullingStats() const noexcept {
+        return m_culling_stats;
+    }
+
+    // Cone lights the clusters had no room for, a few frames late (read back without waiting for the GPU)
+    inline const ClusterOverflowStats& getClusterOverflow() const noexcept {
+        return m_cluster_overflow;
+    }
+
+    // Bindings of the render queues of the last frame, all views together
+    inline const RenderStateChanges& getRenderStateChanges() const noexcept {
+        return m_render_state_changes;
+    }
+
+    /**
+     * When enabled (the default where GL_EXT_multi_draw_indirect is available) the meshes drawn from
+     * their static vertices are merged into an IndirectDrawBuffer: every view culls them in a compute
+     * pass and draws them with a multi-draw per batch of textures. Their counts are then not part of
+     * getCullingStats, that only holds the meshes culled on the CPU.
+     */
+    void setGPUDrivenDraws(bool enabled) noexcept;
+
+    inline bool getGPUDrivenDraws() const noexcept {
+        return m_gpu_driven_draws;
+    }
+
+    /**
+     * When enabled (the default) the camera also culls the GPU-driven draws hidden behind the depth
+     * of the previous frame: their bounds are reprojected into its Hi-Z pyramid. A second pass
+     * tests them again against the depth drawn by the first one, catching what the camera or the
+     * occluders uncovered meanwhile, and that depth becomes the pyramid of the next frame.
+     * Needs the GPU-driven draws and frustum culling.
+     */
+    void setOcclusionCulling(bool enabled) noexcept;
+
+    inline bool getOcclusionCulling() const noexcept {
+        return m_occlusion_culling;
+    }
+
+    // Meshes and batches of the indirect draw buffer, 0 when the GPU-driven draws are not in use
+    inline size_t getIndirectDrawCount() const noexcept {
+        return m_indirect_draws ? m_indirect_draws->getDrawCount() : 0;
+    }
+
+    inline size_t getIndirectBatchCount() const noexcept {
+        return m_indirect_draws ? m_indirect_draws->getBatchCount() : 0;
+    }
 
 protected:
     ShadowedPipeline(
         std::unique_ptr<Framebuffer>&& gbuffer,
         std::unique_ptr<Framebuffer>&& ssaobuffer,
         std::unique_ptr<Framebuffer>&& ssao_blur_buffer,
-        std::array<std::unique_ptr<Framebuffer>, 2>&& lightbuffer,
+        std::unique_ptr<Framebuffer>&& lightbuffer,
+        FramebufferColorFormat lightbuffer_format,
+        std::unique_ptr<Framebuffer>&& tonemapped_buffer,
         std::unique_ptr<Framebuffer>&& shadowbuffer,
         std::unique_ptr<Buffer>&& ssao_sample_buffer,
         std::unique_ptr<Texture>&& ssao_noise_texture,
@@ -39,12 +278,151 @@ protected:
         std::shared_ptr<Program> cone_lighting_program,
         std::shared_ptr<Program> tone_mapping_program,
         std::shared_ptr<Program> post_program,
+        std::shared_ptr<Program> crowd_mesh_program,
+        std::shared_ptr<Program> crowd_depth_only_program,
+        std::shared_ptr<Program> baked_mesh_program,
+        std::shared_ptr<Program> baked_depth_only_program,
+        std::shared_ptr<Program> cluster_cull_program,
+        std::shared_ptr<Program> clustered_cone_lighting_program,
+        std::shared_ptr<Program> indirect_mesh_program,
+        std::shared_ptr<Program> indirect_depth_only_program,
+        std::shared_ptr<Program> indirect_cull_program,
+        std::shared_ptr<Program> hiz_build_program,
+        std::unique_ptr<Framebuffer>&& shadow_atlas,
+        GLuint cone_light_buffer,
         std::shared_ptr<RenderQuad> m_render_quad,
         GLsizei width,
         GLsizei height
     ) noexcept;
 
     static std::vector<glm::vec4> GenerateSSAOSampleKernel(size_t sample_count) noexcept;
+
+    // Static casters of a shadow map, kept between frames (see setShadowCaching)
+    struct StaticShadowLayer {
+        glm::mat4 light_space_matrix = glm::mat4(0.0f);
+
+        // region of the target holding the layer, in texels: x, y, width, height
+        glm::ivec4 rect = glm::ivec4(0);
+
+        uint64_t static_geometry_version = 0;
+
+        uint64_t last_changed_frame = 0;
+
+        // layers not used in a frame belong to lights that are gone
+        uint64_t last_used_frame = 0;
+
+        bool valid = false;
+
+        // depth map of the layer, the size of its rect; unused by the tiles of the atlas (they live in m_static_shadow_atlas)
+        std::unique_ptr<Framebuffer> depth;
+    };
+
+    /**
+     * Fill m_cull_visible for the meshes of m_cull_meshes among casters, against the frustum of
+     * view_projection, and record the counts of the view.
+     */
+    void cullMeshes(
+        const Scene *const scene,
+        const glm::mat4& view_projection,
+        const std::string& view,
+        ShadowCasters casters
+    ) noexcept;
+
+    /**
+     * Bring the indirect draw buffer up to date with the static meshes of the scene, recreating it
+     * when they changed. Returns whether the static meshes are drawn through it this frame.
+     */
+    bool updateIndirectDraws(const Scene *const scene) noexcept;
+
+    // GPU culling and draw of the indirect draw buffer against view_projection, with the program already bound
+    void drawIndirect(
+        const Program& program,
+        const glm::mat4& view_projection,
+        bool bind_materials,
+        IndirectCullPass pass = IndirectCullPass::FRUSTUM
+    ) noexcept;
+
+    // ViewUniforms of the programs of the render queue, from the uniform ring
+    void bindViewUniforms(const glm::mat4& view_projection) noexcept;
+
+    // Depth-only draw of the given shadow casters, with the framebuffer and viewport already set
+    void drawShadowCasters(
+        const Scene *const scene,
+        const glm::mat4& light_space_matrix,
+        const std::string& view,
+        ShadowCasters casters = ShadowCasters::ALL
+    ) noexcept;
+
+    /**
+     * Bring a static layer up to date, drawing the static casters into the rect of target when the
+     * light or the static geometry changed. Returns false for a light that also changed in the
+     * previous frame: it is moving, the layer is not used and every caster must be drawn instead.
+     */
+    bool updateStaticShadowLayer(
+        const Scene *const scene,
+        StaticShadowLayer& layer,
+        const Framebuffer& target,
+        const glm::mat4& light_space_matrix,
+        const glm::ivec4& rect,
+        const std::string& view
+    ) noexcept;
+
+    // Copy the depth of src_rect of src into dst_rect (same size) of the bound framebuffer
+    void copyShadowDepth(const Framebuffer& src, const glm::ivec4& src_rect, const glm::ivec4& dst_rect) const noexcept;
+
+    /**
+     * Shadow map of a light into the rect of m_shadowbuffer, from its cached static layer when possible.
+     * A light with several maps (the cascades) tells them apart by index.
+     */
+    void renderShadowMap(
+        const Scene *const scene,
+        const void *const light,
+        size_t index,
+        const glm::mat4& light_space_matrix,
+        const glm::ivec4& rect,
+        const std::string& view
+    ) noexcept;
+
+    /**
+     * Cone lights reaching a visible pixel (and the ConeLight of each, the key of its tile), with
+     * their tile of the shadow atlas (sized by their screen coverage) and the screen rectangle and
+     * depth range of their lit volume.
+     */
+    void gatherConeLights(
+        const Scene *const scene,
+        const glm::mat4& view,
+        const glm::mat4& proj,
+        std::vector<ClusteredConeLight>& lights,
+        std::vector<const void*>& sources,
+        std::vector<glm::ivec4>& scissors,
+        std::vector<glm::vec2>& depth_bounds
+    ) noexcept;
+
+    /**
+     * Tiles of the shadow atlas for the lights, that asked for the given sides in texels. A light
+     * keeps its tile while its side does not change (see SHADOW_ATLAS_TILE_SHRINK_MARGIN); the
+     * atlas is only repacked when the new tiles do not fit otherwise.
+     */
+    void assignConeShadowTiles(
+        const std::vector<const void*>& sources,
+        const std::vector<glm::float32>& requests,
+        std::vector<glm::ivec4>& tiles
+    ) noexcept;
+
+    // Shadow maps of all the cone lights into their tiles of m_shadow_atlas, before any is shaded
+    void renderShadowAtlas(
+        const Scene *const scene,
+        const std::vector<ClusteredConeLight>& lights,
+        const std::vector<const void*>& sources
+    ) noexcept;
+
+    void renderClusteredConeLights(
+        const Scene *const scene,
+        const std::vector<ClusteredConeLight>& lights,
+        const glm::mat4& view,
+        const glm::mat4& proj,
+        const glm::mat4& inverse_view_projection
+    ) noexcept;
  
 private:
     // G-buffer and intermediate framebuffers (owned)
@@ -56,12 +434,16 @@ private:
     // SSAO framebuffer after blur
     std::unique_ptr<Framebuffer> m_ssao_blur_buffer;
 
-    // lightbuffers: these get used alternatively as targets when applying
-    // lights: this way one is the source and the other is the destination
-    // where the destination is the source + new light contribution
-    std::array<std::unique_ptr<Framebuffer>, 2> m_lightbuffer;
+    // lightbuffer: HDR target where the ambient pass writes and every light
+    // pass adds its own contribution with GL_ONE, GL_ONE blending
+    std::unique_ptr<Framebuffer> m_lightbuffer;
 
-    // shadow map framebuffer: this holds the depth map(s) for shadowed lights
+    FramebufferColorFormat m_lightbuffer_format;
+
+    // tone mapping output, blitted to the default framebuffer
+    std::unique_ptr<Framebuffer> m_tonemapped_buffer;
+
+    // shadow map framebuffer: this holds the cascades of the directional lights
     std::unique_ptr<Framebuffer> m_shadowbuffer;
 
     // SSAO random samples
@@ -97,6 +479,129 @@ private:
     // post-process program
     std::shared_ptr<Program> m_post_program;
 
+    // G-buffer program for crowds (mesh.vert with CROWD_INSTANCING)
+    std::shared_ptr<Program> m_crowd_mesh_program;
+
+    // shadow map(s) generation for crowds
+    std::shared_ptr<Program> m_crowd_depth_only_program;
+
+    // G-buffer program for meshes playing a baked clip (mesh.vert with BAKED_PALETTE)
+    std::shared_ptr<Program> m_baked_mesh_program;
+
+    // shadow map(s) generation for meshes playing a baked clip
+    std::shared_ptr<Program> m_baked_depth_only_program;
+
+    // bins cone lights into clusters (cluster_cone_lights.comp)
+    std::shared_ptr<Program> m_cluster_cull_program;
+
+    // shades every pixel against the cone lights of its cluster
+    std::shared_ptr<Program> m_clustered_cone_lighting_program;
+
+    // G-buffer and shadow map programs for the indirect draw buffer (mesh.vert with INDIRECT_DRAW)
+    std::shared_ptr<Program> m_indirect_mesh_program;
+
+    std::shared_ptr<Program> m_indirect_depth_only_program;
+
+    // writes the commands of the visible draws (cull_draws.comp), nullptr without indirect draws
+    std::shared_ptr<Program> m_indirect_cull_program;
+
+    // reduces the G-buffer depth into m_hiz_pyramid (hiz_build.comp), nullptr without indirect draws
+    std::shared_ptr<Program> m_hiz_build_program;
+
+    // shadow maps of the cone lights, a tile each (see ClusteredConeLight::shadow_rect)
+    std::unique_ptr<Framebuffer> m_shadow_atlas;
+
+    FramebufferDepthFormat m_shadow_atlas_depth_format = FramebufferDepthFormat::FRAMEBUFFER_DEPTH_FORMAT_DEPTH24;
+
+    // ClusteredConeLight array, CLUSTERED_MAX_CONE_LIGHTS entries
+    GLuint m_cone_light_buffer;
+
+    // per cluster: light count followed by CLUSTER_MAX_LIGHTS light indices (grow-only)
+    GLuint m_cluster_buffer = 0;
+
+    size_t m_cluster_buffer_capacity = 0;
+
+    // overflow counters written by cluster_cone_lights.comp, read back once their fence is signaled
+    std::array<GLuint, CLUSTER_OVERFLOW_READBACK_FRAMES> m_cluster_overflow_buffers = {};
+
+    std::array<GLsync, CLUSTER_OVERFLOW_READBACK_FRAMES> m_cluster_overflow_fences = {};
+
+    size_t m_cluster_overflow_frame = 0;
+
+    ClusterOverflowStats m_cluster_overflow = {};
+
+    bool m_clustered_cone_lights = true;
+
+    bool m_shadow_caching = true;
+
+    glm::uint32 m_shadow_cascade_count = SHADOW_CASCADE_COUNT;
+
+    // static layers of the maps rendered into m_shadowbuffer, by light and index
+    std::map<std::pair<const void*, size_t>, StaticShadowLayer> m_static_shadow_layers;
+
+    // Tile of a cone light in the shadow atlas, and its static layer at the same place in m_static_shadow_atlas
+    struct ConeShadowTile {
+        // nothing allocated while the width is 0
+        glm::ivec4 rect = glm::ivec4(0);
+
+        uint64_t last_visible_frame = 0;
+
+        StaticShadowLayer layer;
+    };
+
+    // by ConeLight, kept between frames so that the static layers stay where they were rendered
+    std::unordered_map<const void*, ConeShadowTile> m_cone_shadow_tiles;
+
+    ShadowAtlasAllocator m_shadow_atlas_allocator = ShadowAtlasAllocator(SHADOW_ATLAS_SIZE, SHADOW_ATLAS_MIN_TILE);
+
+    std::unique_ptr<Framebuffer> m_static_shadow_atlas;
+
+    // frames rendered so far, the clock of the static layers
+    uint64_t m_shadow_frame = 0;
+
+    bool m_frustum_culling = true;
+
+    // meshes of Scene::foreachMesh this frame
+    std::vector<const Mesh*> m_cull_meshes;
+
+    // world bounds of m_cull_meshes at the same index, below CULLING_BVH_MIN_MESHES
+    CullingBounds m_cull_bounds;
+
+    // index in m_cull_meshes of every mesh, for the results of the BVH (see CULLING_BVH_MIN_MESHES)
+    std::unordered_map<const Mesh*, size_t> m_cull_mesh_index;
+
+    std::vector<const Mesh*> m_cull_hits;
+
+    // result of the last cullMeshes
+    std::vector<uint8_t> m_cull_visible;
+
+    std::vector<CullingStats> m_culling_stats;
+
+    // visible meshes of a view, sorted to share bindings (refilled by every view)
+    RenderQueue m_render_queue;
+
+    RenderStateChanges m_render_state_changes;
+
+    // per-view and per-draw uniforms of the render queue (created by the first render)
+    std::unique_ptr<UniformRing> m_uniform_ring;
+
+    bool m_gpu_driven_draws = true;
+
+    // static meshes of the scene, rebuilt when the static geometry version changes
+    std::unique_ptr<IndirectDrawBuffer> m_indirect_draws;
+
+    uint64_t m_indirect_geometry_version = 0;
+
+    bool m_indirect_draws_valid = false;
+
+    // whether the static meshes are drawn by m_indirect_draws this frame (see updateIndirectDraws)
+    bool m_indirect_draws_active = false;
+
+    bool m_occlusion_culling = true;
+
+    // G-buffer depth of the previous frame, the size of m_gbuffer (created on demand)
+    std::unique_ptr<HiZPyramid> m_hiz_pyramid;
+
     // Fullscreen quad (reusable)
     std::shared_ptr<RenderQuad> m_render_quad;
 
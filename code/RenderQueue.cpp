@@ -0,0 +1,236 @@
+#include "RenderQueue.hpp"
+
+#include "Mesh.hpp"
+#include "Material.hpp"
+#include "SkeletonTree.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <algorithm>
+
+static GLuint texture_id(const std::shared_ptr<Texture>& texture) noexcept {
+    return texture ? texture->getTextureId() : 0u;
+}
+
+static std::tuple<GLuint, GLuint, GLuint> texture_set(const Material& material) noexcept {
+    return std::make_tuple(
+        texture_id(material.getDiffuseTexture()),
+        texture_id(material.getSpecularTexture()),
+        texture_id(material.getDisplacementTexture())
+    );
+}
+
+RenderStateChanges& RenderStateChanges::operator+=(const RenderStateChanges& other) noexcept {
+    draws += other.draws;
+    programs += other.programs;
+    texture_sets += other.texture_sets;
+    materials += other.materials;
+    vertex_arrays += other.vertex_arrays;
+    skeletons += other.skeletons;
+    uniform_ranges += other.uniform_ranges;
+    return *this;
+}
+
+void RenderQueue::clear() noexcept {
+    m_entries.clear();
+    m_programs.clear();
+}
+
+glm::uint RenderQueue::addProgram(RenderQueueProgram&& program) noexcept {
+    assert((m_programs.size() < (1u << RENDER_QUEUE_PROGRAM_BITS)) && "Too many programs in the render queue");
+
+    m_programs.push_back(std::move(program));
+    return static_cast<glm::uint>(m_programs.size() - 1);
+}
+
+glm::uint RenderQueue::textureSetId(const Material& material) noexcept {
+    const auto [it, inserted] = m_texture_set_ids.try_emplace(
+        texture_set(material),
+        static_cast<glm::uint>(m_texture_set_ids.size())
+    );
+    return it->second & ((1u << RENDER_QUEUE_TEXTURE_SET_BITS) - 1u);
+}
+
+glm::uint RenderQueue::materialId(const Material& material) noexcept {
+    const auto [it, inserted] = m_material_ids.try_emplace(
+        &material,
+        static_cast<glm::uint>(m_material_ids.size())
+    );
+    return it->second & ((1u << RENDER_QUEUE_MATERIAL_BITS) - 1u);
+}
+
+void RenderQueue::add(glm::uint pass, glm::uint program, const Mesh& mesh, float depth) noexcept {
+    assert((pass < (1u << RENDER_QUEUE_PASS_BITS)) && "Render queue pass out of range");
+    assert((program < m_programs.size()) && "Render queue program not added");
+
+    const auto material = mesh.getMaterial();
+
+    // the bits of a non-negative float grow with its value
+    const uint64_t depth_bits = std::bit_cast<uint32_t>(std::max(depth, 0.0f));
+
+    uint64_t key = pass;
+    key = (key << RENDER_QUEUE_PROGRAM_BITS) | program;
+    key = (key << RENDER_QUEUE_TEXTURE_SET_BITS) | textureSetId(*material);
+    key = (key << RENDER_QUEUE_MATERIAL_BITS) | materialId(*material);
+    key = (key << RENDER_QUEUE_DEPTH_BITS) | depth_bits;
+
+    m_entries.push_back(Entry { key, &mesh });
+}
+
+void RenderQueue::sort() noexcept {
+    const size_t count = m_entries.size();
+    if (count < 2) return;
+
+    // the histograms of the 8 bytes in a single read of the keys
+    std::array<std::array<size_t, 256>, 8> histograms = {};
+    for (const auto& entry : m_entries) {
+        for (size_t byte = 0; byte < 8; ++byte) {
+            histograms[byte][(entry.key >> (byte * 8u)) & 0xFFu]++;
+        }
+    }
+
+    m_sorted.resize(count);
+
+    for (size_t byte = 0; byte < 8; ++byte) {
+        auto& histogram = histograms[byte];
+
+        // every key has the same byte here: this pass would not move anything
+        if (histogram[(m_entries.front().key >> (byte * 8u)) & 0xFFu] == count) continue;
+
+        size_t offset = 0;
+        for (auto& bucket : histogram) {
+            const size_t bucket_count = bucket;
+            bucket = offset;
+            offset += bucket_count;
+        }
+
+        for (const auto& entry : m_entries) {
+            m_sorted[histogram[(entry.key >> (byte * 8u)) & 0xFFu]++] = entry;
+        }
+
+        m_entries.swap(m_sorted);
+    }
+}
+
+RenderStateChanges RenderQueue::submit(UniformRing* ring) const noexcept {
+    RenderStateChanges changes;
+
+    // per-draw constants of the whole queue, in submission order
+    const size_t draw_stride = ring ? ring->alignedSize(sizeof(DrawUniforms)) : 0;
+    GLintptr draw_offset = -1;
+    if (ring && (!m_entries.empty()) && std::any_of(m_programs.begin(), m_programs.end(), [](const RenderQueueProgram& program) { return program.draw_uniform_blocks; })) {
+        auto mapped = static_cast<uint8_t*>(ring->map(m_entries.size(), draw_stride, draw_offset));
+        if (!mapped) {
+            std::cerr << "Failed to allocate the draw uniforms, skipping " << m_entries.size() << " draws" << std::endl;
+            return changes;
+        }
+
+        for (const auto& entry : m_entries) {
+            const Mesh& mesh = *entry.mesh;
+            const auto material = mesh.getMaterial();
+            const glm::mat4& model_matrix = mesh.getModelMatrix();
+            const glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model_matrix)));
+
+            DrawUniforms uniforms;
+            uniforms.model = model_matrix;
+            uniforms.normal_matrix[0] = glm::vec4(normal_matrix[0], 0.0f);
+            uniforms.normal_matrix[1] = glm::vec4(normal_matrix[1], 0.0f);
+            uniforms.normal_matrix[2] = glm::vec4(normal_matrix[2], 0.0f);
+            uniforms.diffuse_color_shininess = glm::vec4(material->getDiffuseColor(), material->getShininess());
+            uniforms.specular_color = material->getSpecularColor();
+            uniforms.material_flags = material->getMaterialFlags();
+
+            std::memcpy(mapped, &uniforms, sizeof(DrawUniforms));
+            mapped += draw_stride;
+        }
+
+        ring->unmap();
+    }
+
+    const RenderQueueProgram* program = nullptr;
+    glm::uint program_field = ~0u;
+    std::tuple<GLuint, GLuint, GLuint> textures;
+    bool textures_bound = false;
+    const Material* material = nullptr;
+    GLuint vao = 0;
+    const SkeletonTree* skeleton = nullptr;
+
+    for (const auto& entry : m_entries) {
+        const Mesh& mesh = *entry.mesh;
+
+        const auto field = static_cast<glm::uint>(
+            (entry.key >> (RENDER_QUEUE_DEPTH_BITS + RENDER_QUEUE_MATERIAL_BITS + RENDER_QUEUE_TEXTURE_SET_BITS)) &
+            ((1u << RENDER_QUEUE_PROGRAM_BITS) - 1u)
+        );
+        if (field != program_field) {
+            const auto next = &m_programs[field];
+            if ((!program) || (next->program != program->program)) {
+                next->program->bind();
+                changes.programs++;
+            }
+
+            // the material uniforms and the skeleton binding belong to the program
+            program = next;
+            program_field = field;
+            material = nullptr;
+            skeleton = nullptr;
+        }
+
+        if (program->bind_materials) {
+            const auto mesh_material = mesh.getMaterial();
+
+            const auto mesh_textures = texture_set(*mesh_material);
+            if ((!textures_bound) || (mesh_textures != textures)) {
+                mesh_material->bindTextures();
+                textures = mesh_textures;
+                textures_bound = true;
+                changes.texture_sets++;
+            }
+
+            if ((!program->draw_uniform_blocks) && (mesh_material.get() != material)) {
+                mesh_material->bindUniforms(
+                    program->diffuse_color_location,
+                    program->specular_color_location,
+                    program->material_flags_location,
+                    program->shininess_location
+                );
+                material = mesh_material.get();
+                changes.materials++;
+            }
+        }
+
+        if ((program->skeleton_binding >= 0) && (mesh.getSkeleton().get() != skeleton)) {
+            skeleton = mesh.getSkeleton().get();
+            if (skeleton) {
+                skeleton->bind(program->skeleton_binding);
+                changes.skeletons++;
+            }
+        }
+
+        if (mesh.getVertexArray() != vao) {
+            vao = mesh.getVertexArray();
+            glBindVertexArray(vao);
+            changes.vertex_arrays++;
+        }
+
+        if (program->draw_uniform_blocks) {
+            assert((draw_offset >= 0) && "Draw uniform blocks need a uniform ring");
+
+            const auto index = static_cast<GLintptr>(&entry - m_entries.data());
+            ring->bind(DRAW_UNIFORMS_BINDING, draw_offset + index * static_cast<GLintptr>(draw_stride), sizeof(DrawUniforms));
+            changes.uniform_ranges++;
+        } else if (program->bind_draw) {
+            program->bind_draw(mesh);
+        }
+
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(mesh.getIndexCount()), GL_UNSIGNED_INT, nullptr);
+        changes.draws++;
+    }
+
+    if (vao != 0) glBindVertexArray(0);
+
+    return changes;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "OpenGL.hpp"
+#include "Program.hpp"
+#include "UniformRing.hpp"
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <tuple>
+#include <functional>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+class Mesh;
+class Material;
+class SkeletonTree;
+
+// Bits of a sort key, from the most significant: pass, program, texture set, material, depth
+#define RENDER_QUEUE_PASS_BITS 4u
+#define RENDER_QUEUE_PROGRAM_BITS 4u
+#define RENDER_QUEUE_TEXTURE_SET_BITS 12u
+#define RENDER_QUEUE_MATERIAL_BITS 12u
+#define RENDER_QUEUE_DEPTH_BITS 32u
+
+static_assert(
+    RENDER_QUEUE_PASS_BITS + RENDER_QUEUE_PROGRAM_BITS + RENDER_QUEUE_TEXTURE_SET_BITS + RENDER_QUEUE_MATERIAL_BITS + RENDER_QUEUE_DEPTH_BITS == 64,
+    "the fields of a sort key must fill 64 bits"
+);
+
+// Uniform block bindings of mesh.vert and mesh.frag with DRAW_UNIFORM_BLOCKS
+#define VIEW_UNIFORMS_BINDING 0u
+#define DRAW_UNIFORMS_BINDING 1u
+
+// Must match the ViewUniforms block of mesh.vert (std140)
+struct ViewUniforms {
+    glm::mat4 view_projection;
+};
+
+// Must match the DrawUniforms block of mesh.vert and mesh.frag (std140)
+struct DrawUniforms {
+    glm::mat4 model;
+
+    // mat3: a column per vec4
+    glm::vec4 normal_matrix[3];
+
+    // rgb: diffuse color, a: shininess
+    glm::vec4 diffuse_color_shininess;
+
+    glm::vec3 specular_color;
+
+    glm::uint material_flags;
+};
+
+static_assert(sizeof(DrawUniforms) == 144, "DrawUniforms must match its std140 layout");
+
+// How the draws of a program are submitted
+struct RenderQueueProgram {
+    const Program* program;
+
+    // uniforms of the material, -1 for the ones the program does not have
+    GLint diffuse_color_location = -1;
+    GLint specular_color_location = -1;
+    GLint material_flags_location = -1;
+    GLint shininess_location = -1;
+
+    // SkeletonBuffer of the program, -1 if it reads none
+    GLint skeleton_binding = -1;
+
+    // false for depth-only programs: no texture nor material uniform is bound
+    bool bind_materials = true;
+
+    // per-draw uniforms of a mesh (its matrices), with the program bound
+    std::function<void(const Mesh&)> bind_draw;
+
+    /**
+     * Programs with DRAW_UNIFORM_BLOCKS read the matrices and the material of a draw from a
+     * DrawUniforms range of the ring instead: the material uniforms and bind_draw are unused.
+     */
+    bool draw_uniform_blocks = false;
+};
+
+// Bindings a submission made, and the draws they served
+struct RenderStateChanges {
+    size_t draws = 0;
+
+    size_t programs = 0;
+
+    size_t texture_sets = 0;
+
+    size_t materials = 0;
+
+    size_t vertex_arrays = 0;
+
+    size_t skeletons = 0;
+
+    // uniform buffer ranges bound for DrawUniforms
+    size_t uniform_ranges = 0;
+
+    RenderStateChanges& operator+=(const RenderStateChanges& other) noexcept;
+};
+
+/**
+ * Draws of a view, sorted by a 64-bit key so that the draws sharing a program, textures and
+ * material are submitted one after the other, front to back within them. Submitting skips every
+ * binding the previous draw already made.
+ *
+ * The keys are sorted with an LSD radix sort, a byte at a time: the bytes every key shares are
+ * skipped, so the depth and the few programs and materials of a view cost a handful of passes.
+ */
+class RenderQueue {
+
+public:
+    // drop the draws and programs of the last view (the ids of textures and materials are kept)
+    void clear() noexcept;
+
+    // program of the following draws: returns its field of the sort keys
+    glm::uint addProgram(RenderQueueProgram&& program) noexcept;
+
+    /**
+     * Queue a draw of the mesh in the given pass (a small integer, passes are submitted in
+     * increasing order) with a program of addProgram. depth is the distance of the mesh from
+     * the view: any non-negative value growing with it.
+     */
+    void add(glm::uint pass, glm::uint program, const Mesh& mesh, float depth) noexcept;
+
+    inline size_t size() const noexcept { return m_entries.size(); }
+
+    void sort() noexcept;
+
+    /**
+     * Draw everything in key order, binding the state that changes only. The DrawUniforms of the
+     * programs with draw_uniform_blocks are written to ring first, in a single mapping.
+     */
+    RenderStateChanges submit(UniformRing* ring = nullptr) const noexcept;
+
+private:
+    struct Entry {
+        uint64_t key;
+
+        const Mesh* mesh;
+    };
+
+    // small ids for the sort keys, wrapping past their bits: sharing an id only costs a binding
+    glm::uint textureSetId(const Material& material) noexcept;
+
+    glm::uint materialId(const Material& material) noexcept;
+
+    std::vector<Entry> m_entries;
+
+    // ping-pong buffer of the radix sort
+    std::vector<Entry> m_sorted;
+
+    std::vector<RenderQueueProgram> m_programs;
+
+    std::map<std::tuple<GLuint, GLuint, GLuint>, glm::uint> m_texture_set_ids;
+
+    std::unordered_map<const Material*, glm::uint> m_material_ids;
+};
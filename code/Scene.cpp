@@ -16,6 +16,12 @@
 #include <vector>
 #include <cstdint>
 #include <algorithm>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <future>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -52,6 +58,10 @@ void SceneElement::foreachMesh(std::function<void(const Mesh&)> fn) const noexce
     }
 }
 
+const std::vector<std::shared_ptr<Mesh>>& SceneElement::getMeshes() const noexcept {
+    return m_meshes;
+}
+
 void SceneElement::setModelMatrix(const glm::mat4& model) noexcept {
     for (auto& mesh : m_meshes) {
         if (mesh) mesh->setModelMatrix(model);
@@ -113,6 +123,27 @@ std::optional<double> SceneElement::getAnimationTime(void) const noexcept {
     return std::nullopt;
 }
 
+glm::vec3 SceneElement::getPosition(void) const noexcept {
+    if (m_meshes.empty()) return glm::vec3(0.0f);
+    return glm::vec3(m_meshes.front()->getModelMatrix()[3]);
+}
+
+glm::vec4 SceneElement::getBoundingSphere(void) const noexcept {
+    const glm::mat4 model = m_meshes.empty() ? glm::mat4(1.0f) : m_meshes.front()->getModelMatrix();
+    const float scale = std::max({
+        glm::length(glm::vec3(model[0])),
+        glm::length(glm::vec3(model[1])),
+        glm::length(glm::vec3(model[2]))
+    });
+
+    return glm::vec4(glm::vec3(model * glm::vec4(m_bounding_sphere_center, 1.0f)), m_bounding_sphere_radius * scale);
+}
+
+void SceneElement::setBoundingSphere(const glm::vec3& center, float radius) noexcept {
+    m_bounding_sphere_center = center;
+    m_bounding_sphere_radius = radius;
+}
+
 void SceneElement::advanceTime(float delta_time) noexcept {
     if (m_animation_status.has_value()) {
         m_animation_status->advanceTime(delta_time);
@@ -135,16 +166,57 @@ void SceneElement::advanceTime(float delta_time) noexcept {
 }
 
 Scene::Scene(
-    std::unique_ptr<Program>&& animation_compute_program,
-    std::unique_ptr<Program>&& bind_pose_compute_program
+    PaletteProgramVariants&& animation_compute_programs,
+    PaletteProgramVariants&& bind_pose_compute_programs,
+    SkinningProgramVariants&& skinning_compute_programs,
+    PaletteProgramVariants&& bounds_compute_programs,
+    std::unique_ptr<Program>&& crowd_animation_compute_program
 ) noexcept :
     m_elements(),
     m_ambient_light(),
     m_camera(nullptr),
-    m_animation_compute_program(std::move(animation_compute_program)),
-    m_bind_pose_compute_program(std::move(bind_pose_compute_program))
+    m_animation_compute_programs(std::move(animation_compute_programs)),
+    m_bind_pose_compute_programs(std::move(bind_pose_compute_programs)),
+    m_skinning_compute_programs(std::move(skinning_compute_programs)),
+    m_bounds_compute_programs(std::move(bounds_compute_programs)),
+    m_crowd_animation_compute_program(std::move(crowd_animation_compute_program)),
+    m_animation_backend(AnimationBackend::GPU),
+    m_animation_evaluator(AnimationEvaluator::CreateAnimationEvaluator()),
+    m_cpu_palettes(),
+    m_animation_compression({ 0.0005f, 1.0f }),
+    m_baked_animation_distance(50.0f),
+    m_animation_lod({ 0.25f, 8u, 64u }),
+    m_palette_format(PaletteFormat::AFFINE_3X4),
+    m_pose_cache_time_step(POSE_CACHE_DEFAULT_TIME_STEP),
+    m_animation_residency({ 8u * 1024u * 1024u, 10.0f }),
+    m_resident_animations(),
+    m_resident_baked_animations(),
+    m_baked_animations(),
+    m_animation_clock(0.0),
+    m_shared_palettes(),
+    m_frame_index(0),
+    m_skinned_bounds(),
+    m_skinned_bounds_frame(0),
+    m_skinned_bounds_pending(),
+    m_static_geometry_version(0)
 {
+    for (auto& readback : m_skinned_bounds) {
+        readback.buffer = 0;
+        readback.capacity = 0;
+        readback.fence = 0;
+    }
+}
 
+Scene::~Scene() noexcept {
+    for (auto& readback : m_skinned_bounds) {
+        if (readback.fence) {
+            glDeleteSync(readback.fence);
+        }
+
+        if (readback.buffer) {
+            glDeleteBuffers(1, &readback.buffer);
+        }
+    }
 }
 
 void Scene::render(Pipeline *const pipeline) const noexcept {
@@ -211,13 +283,15 @@ VertexBoneDataMap load_bones_for_mesh(
 static std::shared_ptr<Animation> process_animation(
     const aiScene *const scene,
     const aiAnimation *const assimp_animation,
-    const std::shared_ptr<Armature>& meshes_armature
+    const std::shared_ptr<Armature>& meshes_armature,
+    const AnimationCompressionSettings& compression
 ) {
     const auto animation_shared_ptr = std::shared_ptr<Animation>(
         Animation::CreateAnimation(
             assimp_animation->mDuration,
             assimp_animation->mTicksPerSecond,
-            meshes_armature
+            meshes_armature,
+            compression
         )
     );
 
@@ -276,6 +350,12 @@ static std::shared_ptr<Animation> process_animation(
         );
     }
 
+    // uploaded to the GPU only when played (see Scene::makeAnimationResident)
+
+    std::cout << "Animation " << assimp_animation->mName.C_Str() << " compressed: "
+        << animation_shared_ptr->getSourceKeysCount() << " -> " << animation_shared_ptr->getKeys().size() << " keys, "
+        << animation_shared_ptr->getUncompressedSize() << " -> " << animation_shared_ptr->getGPUSize() << " bytes." << std::endl;
+
     return animation_shared_ptr;
 }
 
@@ -351,13 +431,17 @@ std::optional<SceneElementReference> Scene::load_asset(
 
     // usato per tenere traccia delle ossa visitate
     auto skeleton_tree = std::shared_ptr<SkeletonTree>(
-        SkeletonTree::CreateSkeletonTree(meshes_armature)
+        SkeletonTree::CreateSkeletonTree(meshes_armature, m_palette_format)
     );
 
     assert(skeleton_tree != nullptr && "Failed to create SkeletonTree");
 
     std::vector<std::shared_ptr<Mesh>> meshes;
 
+    // bounds of the vertices (bind pose) of every mesh, used for the animation LOD
+    glm::vec3 bounds_min(std::numeric_limits<float>::max());
+    glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+
     // Process the scene's root node recursively
     for (unsigned int j = 0; j < scene->mNumMeshes; j++) {
         const auto *const mesh = scene->mMeshes[j];
@@ -371,6 +455,19 @@ std::optional<SceneElementReference> Scene::load_asset(
             vertex_bone_data = load_bones_for_mesh(scene, mesh, skeleton_tree);
         }
 
+        // bounds of the mesh, of the vertices of every bone and of the vertices without bones (see Mesh::setBoneBounds)
+        glm::vec3 mesh_bounds_min(std::numeric_limits<float>::max());
+        glm::vec3 mesh_bounds_max(std::numeric_limits<float>::lowest());
+        glm::vec3 unskinned_bounds_min(std::numeric_limits<float>::max());
+        glm::vec3 unskinned_bounds_max(std::numeric_limits<float>::lowest());
+        std::vector<BoneBounds> bone_bounds;
+
+        // selects the skin.comp variant: most of the meshes never need all the 4 bone slots
+        uint32_t max_influences = 0;
+        for (const auto& [vi, bone_data] : vertex_bone_data) {
+            max_influences = std::max(max_influences, static_cast<uint32_t>(bone_data.size()));
+        }
+
         const GLuint vbo = Mesh::CreateVertexBuffer(nullptr, vertex_buffer_size);
 
         // Determine whether the mesh provides normals; if not we'll compute per-vertex normals
@@ -415,6 +512,31 @@ std::optional<SceneElementReference> Scene::load_asset(
                 dest->position_y = pos.y;
                 dest->position_z = pos.z;
 
+                const glm::vec3 position(pos.x, pos.y, pos.z);
+                mesh_bounds_min = glm::min(mesh_bounds_min, position);
+                mesh_bounds_max = glm::max(mesh_bounds_max, position);
+
+                // skin.comp leaves the vertices without any weight where they are
+                bool skinned_vertex = false;
+                if (vertex_bone_data.contains(vi)) {
+                    for (const auto& [bone_index, weight] : vertex_bone_data[vi]) {
+                        if (weight <= 0.0f) continue;
+                        if (bone_index >= bone_bounds.size()) {
+                            bone_bounds.resize(bone_index + 1u, BoneBounds {
+                                .min = glm::vec4(std::numeric_limits<float>::max()),
+                                .max = glm::vec4(std::numeric_limits<float>::lowest()),
+                            });
+                        }
+                        bone_bounds[bone_index].min = glm::min(bone_bounds[bone_index].min, glm::vec4(position, 0.0f));
+                        bone_bounds[bone_index].max = glm::max(bone_bounds[bone_index].max, glm::vec4(position, 0.0f));
+                        skinned_vertex = true;
+                    }
+                }
+                if (!skinned_vertex) {
+                    unskinned_bounds_min = glm::min(unskinned_bounds_min, position);
+                    unskinned_bounds_max = glm::max(unskinned_bounds_max, position);
+                }
+
                 // normal
                 if (hasNormals) {
                     const aiVector3D &n = mesh->mNormals[vi];
@@ -559,11 +681,34 @@ std::optional<SceneElementReference> Scene::load_asset(
                 vbo,
                 ibo,
                 static_cast<GLuint>(total_indices),
+                vertex_count,
                 material,
-                skeleton_tree,
-                model
+                // only meshes with bone weights are skinned
+                vertex_bone_data.empty() ? nullptr : skeleton_tree,
+                model,
+                max_influences
             )
         );
+
+        if (mesh_bounds_min.x <= mesh_bounds_max.x) {
+            meshes.back()->setBounds(mesh_bounds_min, mesh_bounds_max);
+
+            // through the farthest vertex from the center of the box: tighter than through its corners
+            const glm::vec3 sphere_center = (mesh_bounds_min + mesh_bounds_max) * 0.5f;
+            float sphere_radius2 = 0.0f;
+            for (unsigned int vi = 0; vi < mesh->mNumVertices; ++vi) {
+                const glm::vec3 offset = glm::vec3(mesh->mVertices[vi].x, mesh->mVertices[vi].y, mesh->mVertices[vi].z) - sphere_center;
+                sphere_radius2 = std::max(sphere_radius2, glm::dot(offset, offset));
+            }
+            meshes.back()->setBoundingSphere(sphere_center, std::sqrt(sphere_radius2));
+
+            bounds_min = glm::min(bounds_min, mesh_bounds_min);
+            bounds_max = glm::max(bounds_max, mesh_bounds_max);
+        }
+
+        if (meshes.back()->isSkinned()) {
+            meshes.back()->setBoneBounds(bone_bounds, unskinned_bounds_min, unskinned_bounds_max);
+        }
     }
 
     std::unordered_map<std::string, std::shared_ptr<Animation>> animations_map;
@@ -576,7 +721,7 @@ std::optional<SceneElementReference> Scene::load_asset(
         std::cout << "Animation " << animation_name << " has duration " << animation->mDuration << " ticks at " << animation->mTicksPerSecond << " ticks/second." << std::endl;
     
         const auto animation_shared_ptr = std::shared_ptr<Animation>(
-            process_animation(scene, animation, meshes_armature)
+            process_animation(scene, animation, meshes_armature, m_animation_compression)
         );
 
         // store the animation
@@ -589,13 +734,23 @@ std::optional<SceneElementReference> Scene::load_asset(
         std::cout << "Loaded element '" << name << "' with " << meshes.size() << " meshes, " << bone_count << " bones, " << animations_map.size() << " animations." << std::endl;
     }
 
-    m_elements[name] = std::move(
-        std::make_unique<SceneElement>(
-            std::move(meshes),
-            std::move(skeleton_tree),
-            std::move(animations_map)
-        )
+    // the bind pose is computed once here and then only when the skeleton changes
+    computeBindPose(*skeleton_tree);
+
+    auto element = std::make_unique<SceneElement>(
+        std::move(meshes),
+        std::move(skeleton_tree),
+        std::move(animations_map)
     );
+    element->setAssetPath(std::filesystem::weakly_canonical(asset_path).string());
+    element->setAnimationUpdatePhase(static_cast<uint32_t>(m_elements.size()));
+    if (bounds_min.x <= bounds_max.x) {
+        element->setBoundingSphere((bounds_min + bounds_max) * 0.5f, glm::length(bounds_max - bounds_min) * 0.5f);
+    }
+
+    m_elements[name] = std::move(element);
+    m_static_geometry_version++;
+    rebuildMeshBVH();
 
     return name;
 }
@@ -701,7 +856,30 @@ std::shared_ptr<Camera> Scene::getCamera() const noexcept {
 
 void Scene::foreachMesh(std::function<void(const Mesh&)> fn) const noexcept {
     for (const auto& element : m_elements) {
-        element.second->foreachMesh(fn);
+        if (!element.second->isBakedPlayback()) {
+            element.second->foreachMesh(fn);
+            continue;
+        }
+
+        element.second->foreachMesh([&](const Mesh& mesh) {
+            if (!mesh.isSkinned()) fn(mesh);
+        });
+    }
+}
+
+void Scene::foreachBakedMesh(
+    const std::function<void(const Mesh&, const BakedAnimation&, float)>& fn
+) const noexcept {
+    for (const auto& element : m_elements) {
+        if (!element.second->isBakedPlayback()) continue;
+
+        const auto baked = findBakedAnimation(*element.second);
+        const auto time = element.second->getAnimationTime();
+        if ((!baked) || (!time.has_value())) continue;
+
+        element.second->foreachMesh([&](const Mesh& mesh) {
+            if (mesh.isSkinned()) fn(mesh, *baked, static_cast<float>(time.value()));
+        });
     }
 }
 
@@ -772,6 +950,45 @@ void Scene::foreachConeLight(
 }
 
 void Scene::update(double deltaTime) noexcept {
+    const bool cpu_backend = m_animation_backend == AnimationBackend::CPU;
+    std::vector<AnimationEvaluatorJob> cpu_jobs;
+
+    m_animation_clock += deltaTime;
+
+    const auto camera_position = m_camera ? std::optional<glm::vec3>(m_camera->getCameraPosition()) : std::nullopt;
+
+    // screen coverage of an element is its projected radius over the screen half-height: proj[1][1]
+    // does not depend on the aspect ratio, so any viewport size will do here
+    const auto projection = m_camera ? std::optional<glm::mat4>(m_camera->getProjectionMatrix(1u, 1u)) : std::nullopt;
+    const auto view_projection = projection.has_value() ?
+        std::optional<glm::mat4>(projection.value() * m_camera->getViewMatrix()) : std::nullopt;
+    const float projection_scale = projection.has_value() ? projection.value()[1][1] : 1.0f;
+
+    // pose cache key: (asset, clip, palette format, quantized time), none when poses are not shared
+    typedef std::tuple<std::string, std::string, PaletteFormat, int64_t> PoseKey;
+    const auto pose_key = [this](const SceneElement& element) -> std::optional<PoseKey> {
+        if ((m_pose_cache_time_step <= 0.0f) || (element.getAssetPath().empty())) return std::nullopt;
+        const auto time_step = static_cast<int64_t>(std::llround(element.getAnimationTime().value() / m_pose_cache_time_step));
+        return std::make_tuple(
+            element.getAssetPath(),
+            element.getCurrentAnimationName().value(),
+            element.getSkeleton()->getPaletteFormat(),
+            time_step
+        );
+    };
+
+    // update phase of each pose this frame: elements sharing a pose are staggered together
+    std::map<PoseKey, uint32_t> pose_phases;
+
+    // animated elements due for a new palette this frame
+    struct AnimationUpdate {
+        SceneElement* element;
+
+        // how late the element is, in update intervals
+        float priority;
+    };
+    std::vector<AnimationUpdate> animation_updates;
+
     for (auto& element : m_elements) {
         // Update animations
         element.second->advanceTime(static_cast<float>(deltaTime));
@@ -784,41 +1001,435 @@ void Scene::update(double deltaTime) noexcept {
         const auto armature = skeleton->getArmature();
         if (!armature) continue;
 
+        // Static geometry (e.g. environment assets): there is no palette to compute at all
         const GLuint bones = static_cast<GLuint>(skeleton->getBoneCount());
-        const GLuint local_size_x = 32u; // must match compute shader local size
-        const GLuint groups_x = (bones == 0u) ? 1u : ((bones + local_size_x - 1u) / local_size_x);
-
-        if (anim_time.has_value()) {
-            // Use the animation compute shader when an animation is active
-            m_animation_compute_program->bind();
-
-            // Provide time to the animation compute shader in the same units as the animation keys (ticks)
-            const auto anim = element.second->getCurrentAnimation();
-            assert(anim && "Current animation must be available when animation time is valid");
-            const float ticks_per_second = static_cast<float>(anim->getTicksPerSecond() > 0.0 ? anim->getTicksPerSecond() : 1.0);
-            const float time_in_ticks = static_cast<float>(anim_time.value()) * ticks_per_second;
-            m_animation_compute_program->uniformFloat("u_DeltaTime", time_in_ticks);
-
-            // Provide number of valid animation channels to the compute shader
-            m_animation_compute_program->uniformUint("u_AnimationChannelCount", anim->getChannelsCount());
-
-            // Bind SSBOs (animate.comp expects OriginalSkeletonBuffer, PerFrameSkeletonBuffer, ArmatureBuffer, AnimationBuffer)
-            m_animation_compute_program->uniformStorageBufferBinding("OriginalSkeletonBuffer", skeleton->getOriginalBuffer());
-            m_animation_compute_program->uniformStorageBufferBinding("PerFrameSkeletonBuffer", skeleton->getPerFrameBuffer());
-            m_animation_compute_program->uniformStorageBufferBinding("ArmatureBuffer", armature->getNodesBuffer());
-            m_animation_compute_program->uniformStorageBufferBinding("AnimationBuffer", anim->getChannelsBuffer());
-
-            m_animation_compute_program->dispatchCompute(groups_x, 1, 1);
+        if (bones == 0u) continue;
+
+        // Far from the camera the running clip is played from its baked palettes: nothing to evaluate nor skin.
+        // The clip is baked the first time that happens. The threshold is lowered while baked, so that
+        // elements at the boundary do not switch every frame.
+        const float baked_distance = m_baked_animation_distance * (element.second->isBakedPlayback() ? 0.9f : 1.0f);
+        const bool far_away = anim_time.has_value() && camera_position.has_value() &&
+            (glm::distance(camera_position.value(), element.second->getPosition()) > baked_distance);
+        const bool baked_playback = far_away && (makeBakedAnimationResident(*element.second) != nullptr);
+        element.second->setBakedPlayback(baked_playback);
+
+        element.second->tickAnimationUpdate();
+
+        if (baked_playback) {
+            // the palette is stale: recompute it when the element gets back to live evaluation
+            skeleton->markBindPoseDirty();
+        } else if (anim_time.has_value()) {
+            // Update-rate LOD: the interval doubles every time the screen coverage halves
+            uint32_t interval = 1u;
+            if (view_projection.has_value()) {
+                const auto sphere = element.second->getBoundingSphere();
+                const auto clip = view_projection.value() * glm::vec4(glm::vec3(sphere), 1.0f);
+                if (clip.w <= 0.0f) {
+                    // behind the camera: the lowest rate
+                    interval = m_animation_lod.max_interval;
+                } else {
+                    const float coverage = sphere.w * projection_scale / clip.w;
+                    while ((interval < m_animation_lod.max_interval) && (coverage * static_cast<float>(interval) < m_animation_lod.full_rate_coverage)) {
+                        interval = std::min(interval * 2u, m_animation_lod.max_interval);
+                    }
+                }
+            }
+            element.second->setAnimationUpdateInterval(interval);
+
+            // Elements on the same pose this frame follow the phase of the first of them, so they are due
+            // on the same frames and the pose cache below evaluates it once (the intervals are powers of
+            // two: the frames of a longer interval are a subset of the ones of a shorter one). Their own
+            // phase is left alone: once the pose differs they are spread again.
+            auto phase = element.second->getAnimationUpdatePhase();
+            if (const auto key = pose_key(*element.second)) {
+                phase = pose_phases.try_emplace(key.value(), phase).first->second;
+            }
+
+            // staggered: each element is due on its phase, or as soon as it is late (just started or deferred)
+            const auto frames_since_update = element.second->getFramesSinceAnimationUpdate();
+            const bool on_phase = ((m_frame_index + phase) % interval) == 0u;
+            if (on_phase || (frames_since_update > interval)) {
+                animation_updates.push_back({
+                    element.second.get(),
+                    static_cast<float>(frames_since_update) / static_cast<float>(interval)
+                });
+            }
+        } else if (skeleton->isBindPoseDirty()) {
+            // No animation active -> compute bind-pose per-frame skeleton, only when it changed
+            if (cpu_backend) {
+                cpu_jobs.push_back({ skeleton.get(), nullptr, 0.0f, nullptr });
+                skeleton->clearBindPoseDirty();
+                skeleton->markPaletteChanged();
+            } else {
+                computeBindPose(*skeleton);
+            }
+        }
+    }
+
+    // bounded per-frame cost: the most overdue elements first, the others keep their last palette
+    const auto budget = (m_animation_lod.max_updates_per_frame > 0u) ?
+        std::min<size_t>(animation_updates.size(), m_animation_lod.max_updates_per_frame) :
+        animation_updates.size();
+    std::partial_sort(
+        animation_updates.begin(),
+        animation_updates.begin() + budget,
+        animation_updates.end(),
+        [](const AnimationUpdate& a, const AnimationUpdate& b) { return a.priority > b.priority; }
+    );
+    animation_updates.resize(budget);
+
+    // pose cache: pose key -> the skeleton evaluated for that pose
+    std::map<PoseKey, const SkeletonTree*> pose_cache;
+    m_shared_palettes.clear();
+
+    for (const auto& update : animation_updates) {
+        const auto skeleton = update.element->getSkeleton();
+
+        // Provide time to the animation evaluation in the same units as the animation keys (ticks)
+        const auto anim = update.element->getCurrentAnimation();
+        assert(anim && "Current animation must be available when animation time is valid");
+        const float ticks_per_second = static_cast<float>(anim->getTicksPerSecond() > 0.0 ? anim->getTicksPerSecond() : 1.0);
+        double time_in_seconds = update.element->getAnimationTime().value();
+
+        bool shared_pose = false;
+        if (const auto key = pose_key(*update.element)) {
+            const auto [cached, inserted] = pose_cache.try_emplace(key.value(), skeleton.get());
+
+            // the same time for every element of the group, whichever of them is evaluated
+            time_in_seconds = static_cast<double>(std::get<3>(key.value())) * m_pose_cache_time_step;
+
+            if (!inserted) {
+                m_shared_palettes[skeleton.get()] = cached->second;
+                shared_pose = true;
+            }
+        }
+
+        const float time_in_ticks = static_cast<float>(time_in_seconds) * ticks_per_second;
+
+        if (shared_pose) {
+            // nothing to evaluate: skinMeshes reads the palette of the cached skeleton
+        } else if (cpu_backend) {
+            cpu_jobs.push_back({ skeleton.get(), anim.get(), time_in_ticks, nullptr });
         } else {
-            // No animation active -> compute bind-pose per-frame skeleton
-            m_bind_pose_compute_program->bind();
-            m_bind_pose_compute_program->uniformStorageBufferBinding("OriginalSkeletonBuffer", skeleton->getOriginalBuffer());
-            m_bind_pose_compute_program->uniformStorageBufferBinding("PerFrameSkeletonBuffer", skeleton->getPerFrameBuffer());
-            m_bind_pose_compute_program->uniformStorageBufferBinding("ArmatureBuffer", armature->getNodesBuffer());
+            makeAnimationResident(anim);
+            dispatchAnimation(*skeleton, *anim, time_in_ticks);
+        }
+        skeleton->markPaletteChanged();
+
+        // the palette now holds an animated pose: restore the bind pose once the animation ends
+        skeleton->markBindPoseDirty();
+
+        update.element->markAnimationUpdated();
+    }
+
+    m_frame_index++;
+
+    evictAnimations();
+
+    if (!cpu_jobs.empty()) {
+        // palettes are evaluated in parallel, then uploaded from this (GL) thread
+        if (m_cpu_palettes.size() < cpu_jobs.size()) m_cpu_palettes.resize(cpu_jobs.size());
+        for (size_t i = 0; i < cpu_jobs.size(); ++i) cpu_jobs[i].palette = &m_cpu_palettes[i];
 
-            m_bind_pose_compute_program->dispatchCompute(groups_x, 1, 1);
+        m_animation_evaluator->evaluate(cpu_jobs);
+
+        for (const auto& job : cpu_jobs) {
+            job.skeleton->uploadPalette(*job.palette);
+        }
+    }
+
+    // skin once here: the G-buffer and every shadow pass then draw the skinned vertices
+    skinMeshes();
+
+    for (auto& crowd : m_crowds) {
+        crowd.second->advanceTime(static_cast<float>(deltaTime));
+        dispatchCrowd(*crowd.second);
+    }
+}
+
+void Scene::dispatchCrowd(const Crowd& crowd) noexcept {
+    const GLuint bones = static_cast<GLuint>(crowd.getBoneCount());
+    const GLuint instances = static_cast<GLuint>(crowd.getInstanceCount());
+    const auto skeleton = crowd.getSkeleton();
+    if ((bones == 0u) || (instances == 0u) || (!skeleton->getArmature())) return;
+
+    const GLuint local_size_x = 32u; // must match compute shader local size
+    const GLuint groups_x = (bones + local_size_x - 1u) / local_size_x;
+
+    m_crowd_animation_compute_program->bind();
+    m_crowd_animation_compute_program->uniformFloat("u_Time", crowd.getTime());
+    m_crowd_animation_compute_program->uniformUint("u_InstanceCount", instances);
+
+    m_crowd_animation_compute_program->uniformStorageBufferBinding("OriginalSkeletonBuffer", skeleton->getOriginalBuffer());
+    m_crowd_animation_compute_program->uniformStorageBufferBinding("CrowdPaletteBuffer", crowd.getPaletteBuffer());
+    m_crowd_animation_compute_program->uniformStorageBufferBinding("ArmatureBuffer", skeleton->getArmature()->getNodesBuffer());
+    m_crowd_animation_compute_program->uniformStorageBufferBinding("AnimationBuffer", crowd.getChannelsBuffer());
+    m_crowd_animation_compute_program->uniformStorageBufferBinding("AnimationKeysBuffer", crowd.getKeysBuffer());
+    m_crowd_animation_compute_program->uniformStorageBufferBinding("CrowdInstanceBuffer", crowd.getInstanceBuffer());
+    m_crowd_animation_compute_program->uniformStorageBufferBinding("CrowdClipBuffer", crowd.getClipsBuffer());
+    m_crowd_animation_compute_program->uniformStorageBufferBinding("CrowdNodeChannelBuffer", crowd.getNodeChannelsBuffer());
+
+    // one row of groups per instance
+    m_crowd_animation_compute_program->dispatchCompute(groups_x, instances, 1);
+}
+
+bool Scene::createCrowd(
+    const std::string& name,
+    const SceneElementReference& element_ref,
+    const std::vector<CrowdInstance>& instances
+) noexcept {
+    const auto it = m_elements.find(element_ref);
+    if (it == m_elements.end()) {
+        std::cerr << "Scene element " << element_ref << " not found." << std::endl;
+        return false;
+    }
+
+    // same order as getAnimationName()
+    std::vector<std::pair<std::string, std::shared_ptr<Animation>>> clips;
+    for (const auto& animation : it->second->getAnimations()) {
+        clips.emplace_back(animation.first, animation.second);
+    }
+
+    auto meshes = it->second->getMeshes();
+    auto crowd = std::unique_ptr<Crowd>(
+        Crowd::CreateCrowd(std::move(meshes), it->second->getSkeleton(), clips, instances)
+    );
+    if (!crowd) {
+        std::cerr << "Failed to create crowd " << name << " from element " << element_ref << "." << std::endl;
+        return false;
+    }
+
+    std::cout << "Crowd '" << name << "': " << crowd->getInstanceCount() << " instances of " << element_ref
+        << " (" << crowd->getBoneCount() << " bones, " << clips.size() << " clips)." << std::endl;
+
+    m_elements.erase(it);
+    m_crowds[name] = std::move(crowd);
+    m_static_geometry_version++;
+    rebuildMeshBVH();
+
+    return true;
+}
+
+Crowd* Scene::getCrowd(const std::string& name) noexcept {
+    const auto it = m_crowds.find(name);
+    return (it != m_crowds.end()) ? it->second.get() : nullptr;
+}
+
+void Scene::removeCrowd(const std::string& name) noexcept {
+    m_crowds.erase(name);
+}
+
+void Scene::foreachCrowd(const std::function<void(const Crowd&)>& fn) const noexcept {
+    for (const auto& crowd : m_crowds) {
+        fn(*crowd.second);
+    }
+}
+
+void Scene::skinMeshes(void) noexcept {
+    const GLuint local_size_x = 64u; // must match compute shader local size
+
+    // bounds of the previous frames, as soon as the GPU is done with them
+    for (auto& readback : m_skinned_bounds) {
+        readSkinnedBounds(readback);
+    }
+
+    std::vector<std::shared_ptr<Mesh>> outdated_meshes;
+    for (const auto& element : m_elements) {
+        for (const auto& mesh : element.second->getMeshes()) {
+            if (mesh->isSkinningOutdated()) outdated_meshes.push_back(mesh);
+        }
+    }
+
+    if (outdated_meshes.empty() && m_skinned_bounds_pending.empty()) return;
+
+    // skeletons sharing a cached pose this frame are skinned with the palette that was evaluated
+    const auto palette_buffer = [this](const SkeletonTree& skeleton) {
+        const auto shared = m_shared_palettes.find(&skeleton);
+        return (shared != m_shared_palettes.end()) ? shared->second->getPerFrameBuffer() : skeleton.getPerFrameBuffer();
+    };
+
+    // skin.comp is compiled once per influence class and palette format: switch program only when either changes
+    Program* program = nullptr;
+
+    for (const auto& mesh : outdated_meshes) {
+        const auto skeleton = mesh->getSkeleton();
+        Program *const mesh_program = m_skinning_compute_programs[mesh->getInfluenceClass()][static_cast<size_t>(skeleton->getPaletteFormat())].get();
+        if (mesh_program != program) {
+            program = mesh_program;
+            program->bind();
+        }
+
+        const GLuint groups_x = (mesh->getVertexCount() + local_size_x - 1u) / local_size_x;
+
+        program->uniformUint("u_VertexCount", mesh->getVertexCount());
+        program->uniformStorageBufferBinding("SkeletonBuffer", palette_buffer(*skeleton));
+        program->uniformStorageBufferBinding("SourceVertexBuffer", mesh->getVertexBuffer());
+        program->uniformStorageBufferBinding("SkinnedVertexBuffer", mesh->getSkinnedVertexBuffer());
+
+        program->dispatchCompute(groups_x, 1, 1);
+
+        mesh->markSkinned();
+    }
+
+    // the skinned buffers are read as vertex attributes by the following draws
+    if (!outdated_meshes.empty()) {
+        CHECK_GL_ERROR(glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT));
+    }
+
+    // bounds of the meshes skinned now and of the ones left over by previous frames
+    for (const auto& pending : m_skinned_bounds_pending) {
+        const auto mesh = pending.lock();
+        if ((mesh) && (std::find(outdated_meshes.cbegin(), outdated_meshes.cend(), mesh) == outdated_meshes.cend())) {
+            outdated_meshes.push_back(mesh);
+        }
+    }
+    m_skinned_bounds_pending.clear();
+
+    // Bounds of the same palettes: one slot per mesh in a readback buffer the GPU is done with.
+    // When all of them are still in flight the meshes keep their previous bounds for another frame.
+    size_t free_slot = SKINNED_BOUNDS_READBACK_FRAMES;
+    for (size_t i = 0; i < SKINNED_BOUNDS_READBACK_FRAMES; ++i) {
+        const auto slot = (m_skinned_bounds_frame + i) % SKINNED_BOUNDS_READBACK_FRAMES;
+        if (!m_skinned_bounds[slot].fence) {
+            free_slot = slot;
+            break;
+        }
+    }
+
+    if (free_slot == SKINNED_BOUNDS_READBACK_FRAMES) {
+        for (const auto& mesh : outdated_meshes) {
+            m_skinned_bounds_pending.push_back(mesh);
+        }
+        return;
+    }
+
+    auto& readback = m_skinned_bounds[free_slot];
+
+    if (readback.capacity < outdated_meshes.size()) {
+        if (!readback.buffer) {
+            CHECK_GL_ERROR(glGenBuffers(1, &readback.buffer));
+            assert(readback.buffer != 0 && "Failed to generate skinned bounds buffer");
         }
+
+        readback.capacity = outdated_meshes.size();
+        CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, readback.buffer));
+        CHECK_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(readback.capacity * sizeof(BoneBounds)), nullptr, GL_DYNAMIC_READ));
+        CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
     }
+
+    program = nullptr;
+
+    for (const auto& mesh : outdated_meshes) {
+        if (!mesh->getBoneBoundsBuffer()) continue;
+
+        const auto skeleton = mesh->getSkeleton();
+        Program *const mesh_program = m_bounds_compute_programs[static_cast<size_t>(skeleton->getPaletteFormat())].get();
+        if (mesh_program != program) {
+            program = mesh_program;
+            program->bind();
+        }
+
+        program->uniformUint("u_BoneCount", mesh->getBoneBoundsCount());
+        program->uniformUint("u_BoundsSlot", static_cast<GLuint>(readback.meshes.size()));
+        program->uniformStorageBufferBinding("SkeletonBuffer", palette_buffer(*skeleton));
+        program->uniformStorageBufferBinding("BoneBoundsBuffer", mesh->getBoneBoundsBuffer());
+        program->uniformStorageBufferBinding("SkinnedBoundsBuffer", readback.buffer);
+
+        // a single group reduces all the bones
+        program->dispatchCompute(1, 1, 1);
+
+        readback.meshes.push_back(mesh);
+    }
+
+    if (!readback.meshes.empty()) {
+        readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    m_skinned_bounds_frame = (free_slot + 1u) % SKINNED_BOUNDS_READBACK_FRAMES;
+}
+
+void Scene::readSkinnedBounds(SkinnedBoundsReadback& readback) noexcept {
+    if (!readback.fence) return;
+
+    // poll only: a readback the GPU is not done with is retried next frame
+    const auto status = glClientWaitSync(readback.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) return;
+
+    if (status == GL_WAIT_FAILED) {
+        std::cerr << "Skinned bounds readback failed: the meshes keep their previous bounds" << std::endl;
+    } else {
+        const auto size = static_cast<GLsizeiptr>(readback.meshes.size() * sizeof(BoneBounds));
+        CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, readback.buffer));
+        const void *const mapped = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (mapped) {
+            const auto *const bounds = static_cast<const BoneBounds*>(mapped);
+            for (size_t i = 0; i < readback.meshes.size(); ++i) {
+                // the mesh may have been removed in the meantime
+                if (const auto mesh = readback.meshes[i].lock()) {
+                    mesh->setSkinnedBounds(glm::vec3(bounds[i].min), glm::vec3(bounds[i].max));
+                    m_mesh_bvh.refit(*mesh);
+                }
+            }
+            glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        } else {
+            std::cerr << "Failed to map skinned bounds buffer for readback" << std::endl;
+        }
+        CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+    }
+
+    glDeleteSync(readback.fence);
+    readback.fence = 0;
+    readback.meshes.clear();
+}
+
+void Scene::dispatchAnimation(const SkeletonTree& skeleton, const Animation& animation, float time_in_ticks) noexcept {
+    const GLuint bones = static_cast<GLuint>(skeleton.getBoneCount());
+    const auto armature = skeleton.getArmature();
+    if ((bones == 0u) || (!armature)) return;
+
+    const GLuint local_size_x = 32u; // must match compute shader local size
+    const GLuint groups_x = (bones + local_size_x - 1u) / local_size_x;
+
+    // Use the animation compute shader when an animation is active (the variant writing the skeleton's palette format)
+    auto& animation_compute_program = m_animation_compute_programs[static_cast<size_t>(skeleton.getPaletteFormat())];
+    animation_compute_program->bind();
+    animation_compute_program->uniformFloat("u_DeltaTime", time_in_ticks);
+
+    // Provide number of valid animation channels to the compute shader
+    animation_compute_program->uniformUint("u_AnimationChannelCount", animation.getChannelsCount());
+
+    // Bind SSBOs (animate.comp expects OriginalSkeletonBuffer, PerFrameSkeletonBuffer, ArmatureBuffer, AnimationBuffer, AnimationKeysBuffer)
+    animation_compute_program->uniformStorageBufferBinding("OriginalSkeletonBuffer", skeleton.getOriginalBuffer());
+    animation_compute_program->uniformStorageBufferBinding("PerFrameSkeletonBuffer", skeleton.getPerFrameBuffer());
+    animation_compute_program->uniformStorageBufferBinding("ArmatureBuffer", armature->getNodesBuffer());
+    animation_compute_program->uniformStorageBufferBinding("AnimationBuffer", animation.getChannelsBuffer());
+    animation_compute_program->uniformStorageBufferBinding("AnimationKeysBuffer", animation.getKeysBuffer());
+
+    animation_compute_program->dispatchCompute(groups_x, 1, 1);
+}
+
+void Scene::computeBindPose(SkeletonTree& skeleton) noexcept {
+    const GLuint bones = static_cast<GLuint>(skeleton.getBoneCount());
+    const auto armature = skeleton.getArmature();
+    if ((bones == 0u) || (!armature)) {
+        skeleton.clearBindPoseDirty();
+        return;
+    }
+
+    const GLuint local_size_x = 32u; // must match compute shader local size
+    const GLuint groups_x = (bones + local_size_x - 1u) / local_size_x;
+
+    auto& bind_pose_compute_program = m_bind_pose_compute_programs[static_cast<size_t>(skeleton.getPaletteFormat())];
+    bind_pose_compute_program->bind();
+    bind_pose_compute_program->uniformStorageBufferBinding("OriginalSkeletonBuffer", skeleton.getOriginalBuffer());
+    bind_pose_compute_program->uniformStorageBufferBinding("PerFrameSkeletonBuffer", skeleton.getPerFrameBuffer());
+    bind_pose_compute_program->uniformStorageBufferBinding("ArmatureBuffer", armature->getNodesBuffer());
+
+    bind_pose_compute_program->dispatchCompute(groups_x, 1, 1);
+
+    skeleton.clearBindPoseDirty();
+    skeleton.markPaletteChanged();
 }
 
 void Scene::setElementTranslation(const SceneElementReference& element_ref, const glm::vec3& translation) noexcept {
@@ -830,6 +1441,339 @@ void Scene::setElementTranslation(const SceneElementReference& element_ref, cons
 
     SceneElement *const element = it->second.get();
     element->translateMeshes(translation);
+    m_static_geometry_version++;
+    refitMeshBVH(*element);
+}
+
+void Scene::setElementModelMatrix(const SceneElementReference& element_ref, const glm::mat4& model) noexcept {
+    auto it = m_elements.find(element_ref);
+    if (it == m_elements.end()) {
+        std::cerr << "Scene element " << element_ref << " not found." << std::endl;
+        return;
+    }
+
+    SceneElement *const element = it->second.get();
+    element->setModelMatrix(model);
+    m_static_geometry_version++;
+    refitMeshBVH(*element);
+}
+
+void Scene::rebuildMeshBVH(void) noexcept {
+    std::vector<const Mesh*> meshes;
+    for (const auto& element : m_elements) {
+        for (const auto& mesh : element.second->getMeshes()) {
+            if (mesh) meshes.push_back(mesh.get());
+        }
+    }
+
+    m_mesh_bvh.build(meshes);
+}
+
+void Scene::refitMeshBVH(const SceneElement& element) noexcept {
+    for (const auto& mesh : element.getMeshes()) {
+        if (mesh) m_mesh_bvh.refit(*mesh);
+    }
+}
+
+void Scene::setAnimationBackend(AnimationBackend backend) noexcept {
+    if (m_animation_backend == backend) return;
+
+    m_animation_backend = backend;
+
+    // recompute idle palettes with the new backend as well
+    for (auto& element : m_elements) {
+        const auto skeleton = element.second->getSkeleton();
+        if (skeleton) skeleton->markBindPoseDirty();
+    }
+}
+
+AnimationBackend Scene::getAnimationBackend(void) const noexcept {
+    return m_animation_backend;
+}
+
+void Scene::setAnimationCompressionSettings(const AnimationCompressionSettings& settings) noexcept {
+    m_animation_compression = settings;
+}
+
+const AnimationCompressionSettings& Scene::getAnimationCompressionSettings(void) const noexcept {
+    return m_animation_compression;
+}
+
+void Scene::setPaletteFormat(PaletteFormat format) noexcept {
+    m_palette_format = format;
+}
+
+PaletteFormat Scene::getPaletteFormat(void) const noexcept {
+    return m_palette_format;
+}
+
+void Scene::setBakedAnimationDistance(float distance) noexcept {
+    m_baked_animation_distance = distance;
+}
+
+float Scene::getBakedAnimationDistance(void) const noexcept {
+    return m_baked_animation_distance;
+}
+
+void Scene::setAnimationLODSettings(const AnimationLODSettings& settings) noexcept {
+    m_animation_lod = settings;
+    m_animation_lod.max_interval = std::max(m_animation_lod.max_interval, 1u);
+}
+
+const AnimationLODSettings& Scene::getAnimationLODSettings(void) const noexcept {
+    return m_animation_lod;
+}
+
+void Scene::setPoseCacheTimeStep(float time_step) noexcept {
+    m_pose_cache_time_step = std::max(time_step, 0.0f);
+}
+
+float Scene::getPoseCacheTimeStep(void) const noexcept {
+    return m_pose_cache_time_step;
+}
+
+void Scene::setAnimationResidencySettings(const AnimationResidencySettings& settings) noexcept {
+    m_animation_residency = settings;
+    m_animation_residency.eviction_delay = std::max(m_animation_residency.eviction_delay, 0.0f);
+}
+
+const AnimationResidencySettings& Scene::getAnimationResidencySettings(void) const noexcept {
+    return m_animation_residency;
+}
+
+size_t Scene::getResidentAnimationsSize(void) const noexcept {
+    size_t size = 0;
+    for (const auto& resident : m_resident_animations) {
+        const auto animation = resident.lock();
+        if (animation && animation->isResident()) size += animation->getGPUSize();
+    }
+
+    for (const auto& resident : m_resident_baked_animations) {
+        const auto baked = resident.lock();
+        if (baked && baked->isResident()) size += baked->getSize();
+    }
+
+    return size;
+}
+
+void Scene::makeAnimationResident(const std::shared_ptr<Animation>& animation) noexcept {
+    if (!animation) return;
+
+    if (!animation->isResident()) {
+        animation->upload();
+        m_resident_animations.push_back(animation);
+    }
+
+    animation->markUsed(m_animation_clock);
+}
+
+std::shared_ptr<BakedAnimation> Scene::makeBakedAnimationResident(SceneElement& element) noexcept {
+    const auto name = element.getCurrentAnimationName();
+    const auto animation = element.getCurrentAnimation();
+    const auto skeleton = element.getSkeleton();
+    if ((!name.has_value()) || (!animation) || (!skeleton) || element.getAssetPath().empty()) return nullptr;
+
+    // the elements of an asset share the bake of a clip, as they share poses in the pose cache
+    const auto [entry, inserted] = m_baked_animations.try_emplace(std::make_pair(element.getAssetPath(), name.value()));
+    auto& cached = entry->second;
+
+    if (inserted) {
+        GLint max_texture_size = 0;
+        CHECK_GL_ERROR(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size));
+
+        // sampled on a worker: the elements stay on live evaluation until it is done
+        auto bake = std::make_shared<std::packaged_task<std::shared_ptr<BakedAnimation>()>>(
+            [skeleton, animation, max_texture_size]() {
+                return std::shared_ptr<BakedAnimation>(BakedAnimation::Bake(*skeleton, *animation, max_texture_size));
+            }
+        );
+        cached.pending = bake->get_future();
+        m_animation_evaluator->enqueue([bake]() { (*bake)(); });
+    }
+
+    if (cached.pending.valid()) {
+        if (cached.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return nullptr;
+
+        cached.baked = cached.pending.get();
+        if (cached.baked) {
+            std::cout << "Baked animation " << name.value() << " of '" << element.getAssetPath() << "' into " << cached.baked->getSize() << " bytes of palette textures." << std::endl;
+        }
+    }
+
+    // nullptr: the clip cannot be baked, and is not tried again
+    if (!cached.baked) return nullptr;
+
+    if (!cached.baked->isResident()) {
+        if (!cached.baked->upload()) return nullptr;
+        m_resident_baked_animations.push_back(cached.baked);
+    }
+
+    cached.baked->markUsed(m_animation_clock);
+    return cached.baked;
+}
+
+std::shared_ptr<BakedAnimation> Scene::findBakedAnimation(const SceneElement& element) const noexcept {
+    const auto name = element.getCurrentAnimationName();
+    if (!name.has_value()) return nullptr;
+
+    const auto entry = m_baked_animations.find(std::make_pair(element.getAssetPath(), name.value()));
+    if ((entry == m_baked_animations.end()) || (!entry->second.baked) || (!entry->second.baked->isResident())) return nullptr;
+
+    return entry->second.baked;
+}
+
+void Scene::evictAnimations(void) noexcept {
+    // forget the clips and baked palettes released with their element, or already evicted
+    std::erase_if(m_resident_animations, [](const std::weak_ptr<Animation>& resident) {
+        const auto animation = resident.lock();
+        return (!animation) || (!animation->isResident());
+    });
+    std::erase_if(m_resident_baked_animations, [](const std::weak_ptr<BakedAnimation>& resident) {
+        const auto baked = resident.lock();
+        return (!baked) || (!baked->isResident());
+    });
+
+    auto resident_size = getResidentAnimationsSize();
+    if (resident_size <= m_animation_residency.memory_budget) return;
+
+    // clips and baked palettes alike: one of the two is set
+    struct EvictionCandidate {
+        double last_use_time;
+
+        size_t size;
+
+        std::shared_ptr<Animation> animation;
+
+        std::shared_ptr<BakedAnimation> baked;
+    };
+
+    // least recently played first, among the ones not played within the delay
+    std::vector<EvictionCandidate> candidates;
+    for (const auto& resident : m_resident_animations) {
+        auto animation = resident.lock();
+        if ((m_animation_clock - animation->getLastUseTime()) > m_animation_residency.eviction_delay) {
+            candidates.push_back({ animation->getLastUseTime(), animation->getGPUSize(), std::move(animation), nullptr });
+        }
+    }
+
+    for (const auto& resident : m_resident_baked_animations) {
+        auto baked = resident.lock();
+        if ((m_animation_clock - baked->getLastUseTime()) > m_animation_residency.eviction_delay) {
+            candidates.push_back({ baked->getLastUseTime(), baked->getSize(), nullptr, std::move(baked) });
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) {
+        return a.last_use_time < b.last_use_time;
+    });
+
+    for (const auto& candidate : candidates) {
+        if (resident_size <= m_animation_residency.memory_budget) break;
+
+        resident_size -= candidate.size;
+        if (candidate.animation) {
+            candidate.animation->evict();
+        } else {
+            candidate.baked->evict();
+        }
+    }
+}
+
+std::optional<AnimationBackendsReport> Scene::compareAnimationBackends(
+    const SceneElementReference& element_ref,
+    const std::string& animation_name,
+    float tolerance,
+    uint32_t samples
+) noexcept {
+    const auto it = m_elements.find(element_ref);
+    if (it == m_elements.end()) {
+        std::cerr << "Scene element " << element_ref << " not found." << std::endl;
+        return std::nullopt;
+    }
+
+    const auto skeleton = it->second->getSkeleton();
+    const auto& animations = it->second->getAnimations();
+    const auto anim_it = animations.find(animation_name);
+    if ((!skeleton) || (skeleton->getBoneCount() == 0u) || (anim_it == animations.end()) || (!anim_it->second)) {
+        std::cerr << "Element " << element_ref << " has no skeleton or no animation named " << animation_name << "." << std::endl;
+        return std::nullopt;
+    }
+
+    // the compute shader path reads the clip from the GPU
+    makeAnimationResident(anim_it->second);
+
+    const auto& anim = *anim_it->second;
+    samples = std::max(samples, 2u);
+
+    AnimationBackendsReport report = {
+        .bones = skeleton->getBoneCount(),
+        .samples = samples,
+        .max_abs_error = 0.0f,
+        .within_tolerance = true,
+        .gpu_bones_per_second = 0.0,
+        .cpu_bones_per_second = 0.0,
+    };
+
+    // equivalence: sample the whole clip (both ends included) with both paths
+    std::vector<glm::mat4> gpu_palette, cpu_palette;
+    for (uint32_t s = 0; s < samples; ++s) {
+        const float time_in_ticks = static_cast<float>(anim.getDuration() * static_cast<double>(s) / static_cast<double>(samples - 1u));
+
+        dispatchAnimation(*skeleton, anim, time_in_ticks);
+        skeleton->downloadPalette(gpu_palette);
+
+        AnimationEvaluator::evaluate(*skeleton, &anim, time_in_ticks, cpu_palette);
+
+        // compare what the skinning reads: the CPU palette goes through the same palette format
+        std::vector<glm::vec4> encoded_palette;
+        SkeletonTree::EncodePalette(skeleton->getPaletteFormat(), cpu_palette, encoded_palette);
+        SkeletonTree::DecodePalette(skeleton->getPaletteFormat(), encoded_palette.data(), cpu_palette.size(), cpu_palette);
+
+        for (size_t b = 0; b < cpu_palette.size(); ++b) {
+            for (int c = 0; c < 4; ++c) {
+                for (int r = 0; r < 4; ++r) {
+                    const float error = std::abs(gpu_palette[b][c][r] - cpu_palette[b][c][r]);
+                    report.max_abs_error = std::max(report.max_abs_error, error);
+                }
+            }
+        }
+    }
+    report.within_tolerance = report.max_abs_error <= tolerance;
+
+    // throughput: the same set of samples, evaluated as a batch by each path
+    const uint32_t iterations = samples * 8u;
+    const double total_bones = static_cast<double>(iterations) * static_cast<double>(report.bones);
+    {
+        glFinish();
+        const auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < iterations; ++i) {
+            const float time_in_ticks = static_cast<float>(anim.getDuration() * static_cast<double>(i % samples) / static_cast<double>(samples - 1u));
+            dispatchAnimation(*skeleton, anim, time_in_ticks);
+        }
+        glFinish();
+        const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        report.gpu_bones_per_second = (elapsed.count() > 0.0) ? (total_bones / elapsed.count()) : 0.0;
+    }
+
+    {
+        std::vector<std::vector<glm::mat4>> palettes(iterations);
+        std::vector<AnimationEvaluatorJob> jobs;
+        jobs.reserve(iterations);
+        for (uint32_t i = 0; i < iterations; ++i) {
+            const float time_in_ticks = static_cast<float>(anim.getDuration() * static_cast<double>(i % samples) / static_cast<double>(samples - 1u));
+            jobs.push_back({ skeleton.get(), &anim, time_in_ticks, &palettes[i] });
+        }
+
+        const auto start = std::chrono::high_resolution_clock::now();
+        m_animation_evaluator->evaluate(jobs);
+        const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        report.cpu_bones_per_second = (elapsed.count() > 0.0) ? (total_bones / elapsed.count()) : 0.0;
+    }
+
+    // the per-frame buffer now holds whatever was sampled last
+    skeleton->markBindPoseDirty();
+
+    return report;
 }
 
 std::vector<SceneElementReference> Scene::listElements() const noexcept {
@@ -855,6 +1799,11 @@ bool Scene::startAnimation(
         return false;
     }
 
+    // the CPU backend evaluates from the CPU copy of the clip: nothing to upload
+    if (m_animation_backend == AnimationBackend::GPU) {
+        makeAnimationResident(element->getCurrentAnimation());
+    }
+
     return true;
 }
 
@@ -881,42 +1830,112 @@ std::optional<std::string> Scene::getAnimationName(
     return anim_it->first;
 }
 
-static std::string animation_shader_source_str(reinterpret_cast<const char*>(animate_comp_glsl), animate_comp_glsl_len);
+// the palette layout shared by the animation and skinning kernels
+static const std::vector<std::pair<std::string, std::string>> animation_shader_includes = {
+    {"palette.glsl", std::string(reinterpret_cast<const char*>(palette_glsl_glsl), palette_glsl_glsl_len)},
+};
+
+static std::string animation_shader_source_str = Shader::ResolveIncludes(
+    std::string(reinterpret_cast<const char*>(animate_comp_glsl), animate_comp_glsl_len).c_str(),
+    animation_shader_includes
+);
 static const GLchar *const animate_comp_shader_source = animation_shader_source_str.c_str();
 
-static std::string bindpose_shader_source_str(reinterpret_cast<const char*>(animate_bind_pose_comp_glsl), animate_bind_pose_comp_glsl_len);
+static std::string bindpose_shader_source_str = Shader::ResolveIncludes(
+    std::string(reinterpret_cast<const char*>(animate_bind_pose_comp_glsl), animate_bind_pose_comp_glsl_len).c_str(),
+    animation_shader_includes
+);
 static const GLchar *const animate_bind_pose_comp_shader_source = bindpose_shader_source_str.c_str();
 
-Scene* Scene::CreateScene() noexcept {
-    std::unique_ptr<ComputeShader> animation_compute_shader(
-        ComputeShader::CompileShader(
-            reinterpret_cast<const char*>(animate_comp_shader_source)
-        )
-    );
+static std::string skin_shader_source_str = Shader::ResolveIncludes(
+    std::string(reinterpret_cast<const char*>(skin_comp_glsl), skin_comp_glsl_len).c_str(),
+    animation_shader_includes
+);
+static const GLchar *const skin_comp_shader_source = skin_shader_source_str.c_str();
+
+static std::string bounds_shader_source_str = Shader::ResolveIncludes(
+    std::string(reinterpret_cast<const char*>(bounds_comp_glsl), bounds_comp_glsl_len).c_str(),
+    animation_shader_includes
+);
+static const GLchar *const bounds_comp_shader_source = bounds_shader_source_str.c_str();
+
+// the same compute shader compiled for every PaletteFormat
+static PaletteProgramVariants compile_palette_variants(
+    const char *const source,
+    const std::vector<std::string>& extra_defines = {}
+) noexcept {
+    PaletteProgramVariants programs;
+
+    for (size_t f = 0; f < PALETTE_FORMAT_COUNT; ++f) {
+        std::vector<std::string> defines(extra_defines);
+        switch (static_cast<PaletteFormat>(f)) {
+            case PaletteFormat::AFFINE_3X4:
+                defines.push_back("PALETTE_FORMAT_AFFINE_3X4");
+                break;
+            case PaletteFormat::DUAL_QUATERNION:
+                defines.push_back("PALETTE_FORMAT_DUAL_QUATERNION");
+                break;
+            case PaletteFormat::MAT4:
+            default:
+                break;
+        }
 
-    assert(animation_compute_shader != nullptr && "Failed to compile animation compute shader");
+        const auto variant_source = Shader::InjectDefines(source, defines);
+        std::unique_ptr<ComputeShader> compute_shader(
+            ComputeShader::CompileShader(variant_source.c_str())
+        );
+        if (!compute_shader) return PaletteProgramVariants();
 
-    std::unique_ptr<Program> animation_compute_program(
-        Program::LinkProgram(
-            animation_compute_shader.get()
-        )
-    );
+        programs[f] = std::unique_ptr<Program>(
+            Program::LinkProgram(
+                compute_shader.get()
+            )
+        );
+        if (!programs[f]) return PaletteProgramVariants();
+    }
 
-    assert(animation_compute_program != nullptr && "Failed to link animation compute shader program");
+    return programs;
+}
 
-    std::unique_ptr<ComputeShader> bindpose_compute_shader(
-        ComputeShader::CompileShader(
-            reinterpret_cast<const char*>(animate_bind_pose_comp_shader_source)
-        )
+Scene* Scene::CreateScene() noexcept {
+    auto animation_compute_programs = compile_palette_variants(animate_comp_shader_source);
+    assert(animation_compute_programs[0] != nullptr && "Failed to build animation compute shader programs");
+
+    auto bindpose_compute_programs = compile_palette_variants(animate_bind_pose_comp_shader_source);
+    assert(bindpose_compute_programs[0] != nullptr && "Failed to build bind-pose compute shader programs");
+
+    SkinningProgramVariants skinning_compute_programs;
+    const uint32_t influence_classes[SKINNING_INFLUENCE_CLASSES] = { 1u, 2u, MESH_MAX_BONE_INFLUENCES };
+    for (size_t c = 0; c < SKINNING_INFLUENCE_CLASSES; ++c) {
+        skinning_compute_programs[c] = compile_palette_variants(
+            skin_comp_shader_source,
+            { "SKINNING_INFLUENCES " + std::to_string(influence_classes[c]) }
+        );
+        assert(skinning_compute_programs[c][0] != nullptr && "Failed to build skinning compute shader programs");
+    }
+
+    auto bounds_compute_programs = compile_palette_variants(bounds_comp_shader_source);
+    assert(bounds_compute_programs[0] != nullptr && "Failed to build skinned bounds compute shader programs");
+
+    // animate.comp sampling every instance of a crowd at once (mat4 palettes only)
+    const auto crowd_animation_source = Shader::InjectDefines(animate_comp_shader_source, {"CROWD_INSTANCES"});
+    std::unique_ptr<ComputeShader> crowd_animation_compute_shader(
+        ComputeShader::CompileShader(crowd_animation_source.c_str())
     );
-    assert(bindpose_compute_shader != nullptr && "Failed to compile bind-pose compute shader");
+    assert(crowd_animation_compute_shader != nullptr && "Failed to compile crowd animation compute shader");
 
-    std::unique_ptr<Program> bindpose_compute_program(
+    std::unique_ptr<Program> crowd_animation_compute_program(
         Program::LinkProgram(
-            bindpose_compute_shader.get()
+            crowd_animation_compute_shader.get()
         )
     );
-    assert(bindpose_compute_program != nullptr && "Failed to link bind-pose compute shader program");
-
-    return new Scene(std::move(animation_compute_program), std::move(bindpose_compute_program));
+    assert(crowd_animation_compute_program != nullptr && "Failed to link crowd animation compute shader program");
+
+    return new Scene(
+        std::move(animation_compute_programs),
+        std::move(bindpose_compute_programs),
+        std::move(skinning_compute_programs),
+        std::move(bounds_compute_programs),
+        std::move(crowd_animation_compute_program)
+    );
 }
@@ -8,12 +8,18 @@
 #include "Mesh.hpp"
 #include "Animation.hpp"
 #include "Armature.hpp"
+#include "AnimationEvaluator.hpp"
+#include "BakedAnimation.hpp"
+#include "Crowd.hpp"
+#include "BVH.hpp"
 #include "Pipeline.hpp"
 
 #include "dds_loader/dds_header.hpp"
 
 #include <filesystem>
 #include <unordered_map>
+#include <map>
+#include <future>
 #include <memory>
 #include <vector>
 #include <optional>
@@ -51,6 +57,9 @@ private:
     float m_current_delta_time;
 };
 
+// saturation of SceneElement::getFramesSinceAnimationUpdate()
+#define ANIMATION_UPDATE_FRAMES_MAX 0xFFFFu
+
 class SceneElement {
 public:
     SceneElement(
@@ -60,7 +69,14 @@ public:
     ) noexcept :
         m_meshes(std::move(meshes)),
         m_skeleton(skeleton),
-        m_animations(animations)
+        m_animations(animations),
+        m_baked_playback(false),
+        m_bounding_sphere_center(0.0f),
+        m_bounding_sphere_radius(0.0f),
+        m_animation_update_interval(1u),
+        m_animation_update_phase(0u),
+        m_frames_since_animation_update(ANIMATION_UPDATE_FRAMES_MAX),
+        m_asset_path()
     {}
 
     ~SceneElement() = default;
@@ -70,6 +86,7 @@ public:
     SceneElement& operator=(const SceneElement&) = delete;
 
     void foreachMesh(std::function<void(const Mesh&)> fn) const noexcept;
+    const std::vector<std::shared_ptr<Mesh>>& getMeshes() const noexcept;
     void setModelMatrix(const glm::mat4& model) noexcept;
     void translateMeshes(const glm::vec3& translation) noexcept;
 
@@ -91,6 +108,42 @@ public:
 
     std::optional<double> getAnimationTime(void) const noexcept;
 
+    // world-space position of the element (translation of its first mesh)
+    glm::vec3 getPosition(void) const noexcept;
+
+    // while set, the running animation is played from its baked palettes (see BakedAnimation)
+    inline bool isBakedPlayback(void) const noexcept { return m_baked_playback; }
+
+    inline void setBakedPlayback(bool baked_playback) noexcept { m_baked_playback = baked_playback; }
+
+    // world-space bounding sphere of the bind pose: center (xyz) and radius (w)
+    glm::vec4 getBoundingSphere(void) const noexcept;
+
+    // model-space bounding sphere of the bind pose
+    void setBoundingSphere(const glm::vec3& center, float radius) noexcept;
+
+    // animation update-rate LOD: the palette is evaluated every getAnimationUpdateInterval() frames
+    inline uint32_t getAnimationUpdateInterval(void) const noexcept { return m_animation_update_interval; }
+
+    inline void setAnimationUpdateInterval(uint32_t interval) noexcept { m_animation_update_interval = interval; }
+
+    inline uint32_t getAnimationUpdatePhase(void) const noexcept { return m_animation_update_phase; }
+
+    inline void setAnimationUpdatePhase(uint32_t phase) noexcept { m_animation_update_phase = phase; }
+
+    inline uint32_t getFramesSinceAnimationUpdate(void) const noexcept { return m_frames_since_animation_update; }
+
+    inline void tickAnimationUpdate(void) noexcept {
+        if (m_frames_since_animation_update < ANIMATION_UPDATE_FRAMES_MAX) m_frames_since_animation_update++;
+    }
+
+    inline void markAnimationUpdated(void) noexcept { m_frames_since_animation_update = 0u; }
+
+    // file the element was loaded from: elements of the same asset have the same bones, in the same order
+    inline const std::string& getAssetPath(void) const noexcept { return m_asset_path; }
+
+    inline void setAssetPath(const std::string& asset_path) noexcept { m_asset_path = asset_path; }
+
 private:
     std::optional<SceneElementAnimationStatus> m_animation_status;
 
@@ -99,19 +152,115 @@ private:
     std::unordered_map<std::string, std::shared_ptr<Animation>> m_animations;
 
     std::shared_ptr<SkeletonTree> m_skeleton;
+
+    bool m_baked_playback;
+
+    glm::vec3 m_bounding_sphere_center;
+
+    float m_bounding_sphere_radius;
+
+    uint32_t m_animation_update_interval;
+
+    uint32_t m_animation_update_phase;
+
+    uint32_t m_frames_since_animation_update;
+
+    std::string m_asset_path;
 };
 
 typedef std::string SceneElementReference;
 
+// frames of bounds.comp results in flight (see Scene::skinMeshes): as many as the frames the GPU may lag behind
+#define SKINNED_BOUNDS_READBACK_FRAMES 3
+
+// bounds.comp results of one frame: read back once the GPU is done with them
+struct SkinnedBoundsReadback {
+    GLuint buffer;
+
+    // size of the buffer, in meshes
+    size_t capacity;
+
+    // signaled once the results are written (0 = nothing in flight)
+    GLsync fence;
+
+    // mesh of every slot of the buffer
+    std::vector<std::weak_ptr<Mesh>> meshes;
+};
+
+// A clip baked for the elements of an asset (see Scene::makeBakedAnimationResident)
+struct BakedAnimationCacheEntry {
+    // set once the bake is done: nullptr when the clip cannot be baked
+    std::shared_ptr<BakedAnimation> baked;
+
+    // bake running in the background on the animation evaluator workers
+    std::future<std::shared_ptr<BakedAnimation>> pending;
+};
+
+// GPU residency of the animation clips and of their baked palettes (see Scene::update)
+struct AnimationResidencySettings {
+    // bytes of clip data and baked palette textures the GPU can hold before the ones not played recently are released
+    size_t memory_budget;
+
+    // clips played less than this many seconds ago are never released
+    float eviction_delay;
+};
+
+// Elements of the same asset playing the same clip less than this apart (in seconds) share one palette
+#define POSE_CACHE_DEFAULT_TIME_STEP (1.0f / 120.0f)
+
+// Where skinning palettes are computed: animate.comp or AnimationEvaluator
+enum class AnimationBackend {
+    GPU,
+    CPU,
+};
+
+// Result of Scene::compareAnimationBackends
+struct AnimationBackendsReport {
+    uint32_t bones;
+
+    uint32_t samples;
+
+    // largest absolute difference between a GPU and a CPU palette element
+    float max_abs_error;
+
+    bool within_tolerance;
+
+    double gpu_bones_per_second;
+
+    double cpu_bones_per_second;
+};
+
+// one compute program per PaletteFormat (indexed by it), for the shaders that read or write palettes
+typedef std::array<std::unique_ptr<Program>, PALETTE_FORMAT_COUNT> PaletteProgramVariants;
+
+// skin.comp for every influence class (see Mesh::getInfluenceClass) and palette format
+typedef std::array<PaletteProgramVariants, SKINNING_INFLUENCE_CLASSES> SkinningProgramVariants;
+
+// Animation update-rate LOD (see Scene::update)
+struct AnimationLODSettings {
+    // elements covering at least this fraction of the screen height are evaluated every frame,
+    // below it the update interval doubles every time the coverage halves
+    float full_rate_coverage;
+
+    // longest update interval, in frames
+    uint32_t max_interval;
+
+    // palettes evaluated per frame at most, the most overdue first (0 = no limit)
+    uint32_t max_updates_per_frame;
+};
+
 class Scene {
 
 public:
     Scene(
-        std::unique_ptr<Program>&& animation_compute_program,
-        std::unique_ptr<Program>&& bind_pose_compute_program
+        PaletteProgramVariants&& animation_compute_programs,
+        PaletteProgramVariants&& bind_pose_compute_programs,
+        SkinningProgramVariants&& skinning_compute_programs,
+        PaletteProgramVariants&& bounds_compute_programs,
+        std::unique_ptr<Program>&& crowd_animation_compute_program
     ) noexcept;
 
-    ~Scene() = default;
+    ~Scene() noexcept;
 
     Scene(const Scene&) = delete;
 
@@ -131,8 +280,32 @@ public:
 
     std::shared_ptr<Camera> getCamera() const noexcept;
 
+    /**
+     * Every mesh drawn from its skinned (or static) vertices: skinned meshes of elements in baked
+     * playback are excluded, see foreachBakedMesh.
+     */
     void foreachMesh(std::function<void(const Mesh&)> fn) const noexcept;
 
+    /**
+     * Skinned meshes of the elements in baked playback, with the baked clip and the time (in seconds)
+     * to sample it at: these must be drawn with mesh.vert compiled with BAKED_PALETTE.
+     */
+    void foreachBakedMesh(
+        const std::function<void(const Mesh&, const BakedAnimation&, float)>& fn
+    ) const noexcept;
+
+    /**
+     * Bumped whenever the meshes drawn from their static vertices may have changed: an element was
+     * loaded, moved or removed. Shadow maps of static casters are cached against it.
+     */
+    inline uint64_t getStaticGeometryVersion(void) const noexcept { return m_static_geometry_version; }
+
+    /**
+     * Hierarchy over the world bounds of the meshes of every element (crowds excluded), built when
+     * elements are added or removed and refit as they move or their skinned bounds come back.
+     */
+    inline const MeshBVH& getMeshBVH(void) const noexcept { return m_mesh_bvh; }
+
     void setAmbientLight(const AmbientLight& ambient_light) noexcept;
 
     const AmbientLight* getAmbientLight() const noexcept;
@@ -176,8 +349,95 @@ public:
 
     void setElementTranslation(const SceneElementReference& element_ref, const glm::vec3& translation) noexcept;
 
+    void setElementModelMatrix(const SceneElementReference& element_ref, const glm::mat4& model) noexcept;
+
     std::vector<SceneElementReference> listElements() const noexcept;
 
+    /**
+     * Turn a loaded element into a crowd of instances of it (the element leaves the scene).
+     * CrowdInstance::clip indexes the element's animations in the order of getAnimationName.
+     */
+    bool createCrowd(
+        const std::string& name,
+        const SceneElementReference& element_ref,
+        const std::vector<CrowdInstance>& instances
+    ) noexcept;
+
+    Crowd* getCrowd(const std::string& name) noexcept;
+
+    void removeCrowd(const std::string& name) noexcept;
+
+    void foreachCrowd(const std::function<void(const Crowd&)>& fn) const noexcept;
+
+    void setAnimationBackend(AnimationBackend backend) noexcept;
+
+    AnimationBackend getAnimationBackend(void) const noexcept;
+
+    /**
+     * Key compression used by the animations of the assets loaded from now on.
+     */
+    void setAnimationCompressionSettings(const AnimationCompressionSettings& settings) noexcept;
+
+    const AnimationCompressionSettings& getAnimationCompressionSettings(void) const noexcept;
+
+    /**
+     * Palette layout of the skeletons of the assets loaded from now on.
+     */
+    void setPaletteFormat(PaletteFormat format) noexcept;
+
+    PaletteFormat getPaletteFormat(void) const noexcept;
+
+    /**
+     * Animated elements farther than this from the camera play their baked clips instead of
+     * being evaluated and skinned every frame. A clip is baked in the background once per asset,
+     * the first time one of its elements gets that far: until then they stay on live evaluation.
+     */
+    void setBakedAnimationDistance(float distance) noexcept;
+
+    float getBakedAnimationDistance(void) const noexcept;
+
+    /**
+     * How often animated elements are evaluated depending on their screen coverage, and how many
+     * palettes can be evaluated per frame. Between two updates an element keeps its last palette.
+     */
+    void setAnimationLODSettings(const AnimationLODSettings& settings) noexcept;
+
+    const AnimationLODSettings& getAnimationLODSettings(void) const noexcept;
+
+    /**
+     * Animation times are quantized to this step (in seconds) and the elements of the same asset
+     * that play the same clip at the same quantized time are evaluated once: the others are
+     * skinned from that palette. While they share a pose they follow the same update-rate LOD phase,
+     * so that they are due in the same frames. 0 disables the pose cache.
+     */
+    void setPoseCacheTimeStep(float time_step) noexcept;
+
+    float getPoseCacheTimeStep(void) const noexcept;
+
+    /**
+     * Clips are uploaded to the GPU when first played, and baked when first played from far
+     * away. Once the resident clips and baked textures exceed the budget, the least recently
+     * played are released (and uploaded again from memory if played later).
+     */
+    void setAnimationResidencySettings(const AnimationResidencySettings& settings) noexcept;
+
+    const AnimationResidencySettings& getAnimationResidencySettings(void) const noexcept;
+
+    // bytes of clip data and baked palettes currently on the GPU
+    size_t getResidentAnimationsSize(void) const noexcept;
+
+    /**
+     * Sample the given animation of an element with both the compute shader and the CPU
+     * evaluator, compare the palettes and measure the throughput of both paths.
+     * Meant as a diagnostic (e.g. under a software GL implementation): it stalls the GPU.
+     */
+    std::optional<AnimationBackendsReport> compareAnimationBackends(
+        const SceneElementReference& element_ref,
+        const std::string& animation_name,
+        float tolerance = 1e-3f,
+        uint32_t samples = 32u
+    ) noexcept;
+
 private:
     std::shared_ptr<Texture> assimp_load_texture(
         const std::filesystem::path& base_path,
@@ -187,6 +447,44 @@ private:
 
     static std::shared_ptr<Texture> load_texture(const std::filesystem::path& texture_path) noexcept;
 
+    void computeBindPose(SkeletonTree& skeleton) noexcept;
+
+    void dispatchAnimation(const SkeletonTree& skeleton, const Animation& animation, float time_in_ticks) noexcept;
+
+    // upload the clip if needed and mark it as used now
+    void makeAnimationResident(const std::shared_ptr<Animation>& animation) noexcept;
+
+    /**
+     * Baked palettes of the running clip of the element, uploaded if needed, and mark them as
+     * used now. The first call for a clip of an asset starts baking it in the background: nullptr
+     * until the bake is done, or when the clip cannot be baked.
+     */
+    std::shared_ptr<BakedAnimation> makeBakedAnimationResident(SceneElement& element) noexcept;
+
+    // baked palettes of the running clip of the element, if they are on the GPU
+    std::shared_ptr<BakedAnimation> findBakedAnimation(const SceneElement& element) const noexcept;
+
+    // release the least recently played clips and baked palettes while over the animation memory budget
+    void evictAnimations(void) noexcept;
+
+    /**
+     * Run skin.comp on the meshes whose palette changed since they were last skinned, and
+     * bounds.comp to get their bounding boxes, which are read back one frame or more later.
+     */
+    void skinMeshes(void) noexcept;
+
+    // update the bounds of the meshes of the readback if the GPU is done with it (never waits)
+    void readSkinnedBounds(SkinnedBoundsReadback& readback) noexcept;
+
+    // palettes of every instance of the crowd, in a single dispatch
+    void dispatchCrowd(const Crowd& crowd) noexcept;
+
+    // m_mesh_bvh over the meshes of the current elements
+    void rebuildMeshBVH(void) noexcept;
+
+    // refit m_mesh_bvh to the moved meshes of an element
+    void refitMeshBVH(const SceneElement& element) noexcept;
+
     std::unordered_map<std::string, std::shared_ptr<Texture>> m_texture_cache;
 
     std::unordered_map<SceneElementReference, std::unique_ptr<SceneElement>> m_elements;
@@ -197,8 +495,63 @@ private:
 
     std::unordered_map<std::string, ConeLight> m_cone_lights;
 
+    std::unordered_map<std::string, std::unique_ptr<Crowd>> m_crowds;
+
     std::shared_ptr<Camera> m_camera;
 
-    std::unique_ptr<Program> m_animation_compute_program;
-    std::unique_ptr<Program> m_bind_pose_compute_program;
+    PaletteProgramVariants m_animation_compute_programs;
+    PaletteProgramVariants m_bind_pose_compute_programs;
+    SkinningProgramVariants m_skinning_compute_programs;
+    PaletteProgramVariants m_bounds_compute_programs;
+    std::unique_ptr<Program> m_crowd_animation_compute_program;
+
+    AnimationBackend m_animation_backend;
+
+    std::unique_ptr<AnimationEvaluator> m_animation_evaluator;
+
+    // scratch palettes for the CPU backend, reused every frame
+    std::vector<std::vector<glm::mat4>> m_cpu_palettes;
+
+    AnimationCompressionSettings m_animation_compression;
+
+    float m_baked_animation_distance;
+
+    AnimationLODSettings m_animation_lod;
+
+    PaletteFormat m_palette_format;
+
+    float m_pose_cache_time_step;
+
+    AnimationResidencySettings m_animation_residency;
+
+    // clips uploaded to the GPU (expired when their element is removed)
+    std::vector<std::weak_ptr<Animation>> m_resident_animations;
+
+    // baked palettes on the GPU, counted in the same budget
+    std::vector<std::weak_ptr<BakedAnimation>> m_resident_baked_animations;
+
+    // clips baked once for all the elements of an asset: (asset path, clip name) -> bake
+    std::map<std::pair<std::string, std::string>, BakedAnimationCacheEntry> m_baked_animations;
+
+    // seconds of animation updates so far, the time base of the clips residency
+    double m_animation_clock;
+
+    // skeletons not evaluated this frame -> skeleton holding the (identical) palette they are skinned with
+    std::unordered_map<const SkeletonTree*, const SkeletonTree*> m_shared_palettes;
+
+    // frames updated so far, drives the staggering of the animation LOD
+    uint64_t m_frame_index;
+
+    std::array<SkinnedBoundsReadback, SKINNED_BOUNDS_READBACK_FRAMES> m_skinned_bounds;
+
+    // the readback written by the next skinMeshes
+    size_t m_skinned_bounds_frame;
+
+    // skinned meshes whose bounds were not computed yet because every readback was still in flight
+    std::vector<std::weak_ptr<Mesh>> m_skinned_bounds_pending;
+
+    // see getStaticGeometryVersion
+    uint64_t m_static_geometry_version;
+
+    MeshBVH m_mesh_bvh;
 };
@@ -1,5 +1,6 @@
 #include "Shader.hpp"
 
+#include <algorithm>
 #include <cstdio>
 
 static void printShaderLog(GLuint shader) {
@@ -37,3 +38,73 @@ GLuint Shader::CompileShader(GLenum type, const char *source) noexcept {
 
     return shader;
 }
+
+std::string Shader::InjectDefines(const char *source, const std::vector<std::string>& defines) noexcept {
+    std::string result(source);
+
+    // #version must stay the first directive: the defines go on the line below it
+    size_t insert_at = 0;
+    const auto version = result.find("#version");
+    if (version != std::string::npos) {
+        auto line_end = result.find('\n', version);
+        if (line_end == std::string::npos) {
+            result.push_back('\n');
+            line_end = result.size() - 1;
+        }
+        insert_at = line_end + 1;
+    }
+
+    std::string lines;
+    for (const auto& define : defines) {
+        lines += "#define " + define + "\n";
+    }
+
+    result.insert(insert_at, lines);
+    return result;
+}
+
+std::string Shader::ResolveIncludes(
+    const char *source,
+    const std::vector<std::pair<std::string, std::string>>& includes
+) noexcept {
+    std::string result;
+    std::string remaining(source);
+
+    size_t line_start = 0;
+    while (line_start < remaining.size()) {
+        auto line_end = remaining.find('\n', line_start);
+        if (line_end == std::string::npos) line_end = remaining.size();
+        const auto line = remaining.substr(line_start, line_end - line_start);
+        line_start = line_end + 1;
+
+        // only there for offline compilers (glslangValidator): drivers do not know it
+        if (line.starts_with("#extension GL_GOOGLE_include_directive")) {
+            result += "\n";
+            continue;
+        }
+
+        if (line.starts_with("#include")) {
+            const auto open = line.find('"');
+            const auto close = (open != std::string::npos) ? line.find('"', open + 1) : std::string::npos;
+            if (close != std::string::npos) {
+                const auto name = line.substr(open + 1, close - open - 1);
+                const auto include = std::find_if(includes.cbegin(), includes.cend(), [&name](const auto& entry) {
+                    return entry.first == name;
+                });
+
+                if (include != includes.cend()) {
+                    result += include->second;
+                    if (!include->second.ends_with('\n')) result += "\n";
+                    continue;
+                }
+
+                fprintf(stderr, "Shader include \"%s\" not found.\n", name.c_str());
+            }
+        }
+
+        result += line;
+        result += "\n";
+    }
+
+    return result;
+}
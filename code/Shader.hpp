@@ -2,6 +2,10 @@
 
 #include "OpenGL.hpp"
 
+#include <string>
+#include <utility>
+#include <vector>
+
 class Program;
 
 class Shader {
@@ -17,6 +21,21 @@ public:
 
     virtual ~Shader();
 
+    /**
+     * Copy of a shader source with a "#define <define>" line for each of the given defines,
+     * placed right after the #version directive: used to build variants of the same shader.
+     */
+    static std::string InjectDefines(const char *source, const std::vector<std::string>& defines) noexcept;
+
+    /**
+     * Copy of a shader source with each #include "<name>" line replaced by the matching
+     * (name, source) snippet: GLSL has no include of its own, the snippets are embedded too.
+     */
+    static std::string ResolveIncludes(
+        const char *source,
+        const std::vector<std::pair<std::string, std::string>>& includes
+    ) noexcept;
+
 protected:
     // Compile an individual shader. Returns shader object or 0 on failure.
     static GLuint CompileShader(GLenum type, const char *source) noexcept;
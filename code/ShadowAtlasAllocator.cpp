@@ -0,0 +1,86 @@
+#include "ShadowAtlasAllocator.hpp"
+
+#include <cassert>
+#include <bit>
+
+ShadowAtlasAllocator::ShadowAtlasAllocator(GLsizei atlas_size, GLsizei min_tile) noexcept :
+    m_atlas_size(atlas_size),
+    m_min_tile(min_tile),
+    m_free()
+{
+    assert(std::has_single_bit(static_cast<glm::uint32>(atlas_size)) && "The atlas side must be a power of two");
+    assert(std::has_single_bit(static_cast<glm::uint32>(min_tile)) && (min_tile <= atlas_size) && "The smallest tile must be a power of two");
+
+    m_free.resize(level(min_tile) + 1u);
+    clear();
+}
+
+size_t ShadowAtlasAllocator::level(GLsizei size) const noexcept {
+    return static_cast<size_t>(std::countr_zero(static_cast<glm::uint32>(m_atlas_size)) - std::countr_zero(static_cast<glm::uint32>(size)));
+}
+
+void ShadowAtlasAllocator::clear() noexcept {
+    for (auto& cells : m_free) cells.clear();
+    m_free[0].insert(std::make_pair(0, 0));
+}
+
+std::optional<glm::ivec4> ShadowAtlasAllocator::allocate(GLsizei size) noexcept {
+    if ((size < m_min_tile) || (size > m_atlas_size) || (!std::has_single_bit(static_cast<glm::uint32>(size)))) {
+        return std::nullopt;
+    }
+
+    const auto target = level(size);
+
+    // the smallest free cell at least as large
+    size_t from = target + 1u;
+    while ((from > 0u) && m_free[from - 1u].empty()) from--;
+    if (from == 0u) return std::nullopt;
+    from--;
+
+    auto cell = *m_free[from].begin();
+    m_free[from].erase(m_free[from].begin());
+
+    // split down to the requested side: the first child is kept, the three others are free
+    for (auto l = from; l < target; ++l) {
+        const GLint half = static_cast<GLint>(m_atlas_size >> (l + 1u));
+        m_free[l + 1u].insert(std::make_pair(cell.first + half, cell.second));
+        m_free[l + 1u].insert(std::make_pair(cell.first, cell.second + half));
+        m_free[l + 1u].insert(std::make_pair(cell.first + half, cell.second + half));
+    }
+
+    return glm::ivec4(cell.first, cell.second, size, size);
+}
+
+void ShadowAtlasAllocator::release(const glm::ivec4& tile) noexcept {
+    auto l = level(tile.z);
+    auto cell = std::make_pair(tile.x, tile.y);
+    assert((l < m_free.size()) && !m_free[l].contains(cell) && "Releasing a tile that is not allocated");
+
+    // merge with the siblings while all four of them are free
+    while (l > 0u) {
+        const GLint size = static_cast<GLint>(m_atlas_size >> l);
+        const auto parent = std::make_pair(cell.first - (cell.first % (2 * size)), cell.second - (cell.second % (2 * size)));
+
+        const std::pair<GLint, GLint> siblings[4] = {
+            parent,
+            std::make_pair(parent.first + size, parent.second),
+            std::make_pair(parent.first, parent.second + size),
+            std::make_pair(parent.first + size, parent.second + size),
+        };
+
+        bool all_free = true;
+        for (const auto& sibling : siblings) {
+            if ((sibling != cell) && !m_free[l].contains(sibling)) {
+                all_free = false;
+                break;
+            }
+        }
+        if (!all_free) break;
+
+        for (const auto& sibling : siblings) m_free[l].erase(sibling);
+        cell = parent;
+        l--;
+    }
+
+    m_free[l].insert(cell);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "OpenGL.hpp"
+
+#include <optional>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/**
+ * Square tiles of power of two sides in a square atlas, kept between frames: a quadtree buddy
+ * allocator, where a released tile merges back with its three siblings once they are all free.
+ *
+ * Tiles taken largest first always fit as long as their total area does not exceed the atlas;
+ * otherwise the free space may be split across too small cells (see ShadowedPipeline).
+ */
+class ShadowAtlasAllocator {
+
+public:
+    // atlas_size and min_tile are powers of two
+    ShadowAtlasAllocator(GLsizei atlas_size, GLsizei min_tile) noexcept;
+
+    // free the whole atlas
+    void clear() noexcept;
+
+    // x, y, width, height in texels of a free tile of the given side, or nothing when there is no room
+    std::optional<glm::ivec4> allocate(GLsizei size) noexcept;
+
+    // give back a tile returned by allocate
+    void release(const glm::ivec4& tile) noexcept;
+
+    inline GLsizei getAtlasSize() const noexcept { return m_atlas_size; }
+
+private:
+    // level of the cells of the given side: 0 is the whole atlas
+    size_t level(GLsizei size) const noexcept;
+
+    GLsizei m_atlas_size;
+
+    GLsizei m_min_tile;
+
+    // origins (x, y) of the free cells of every level
+    std::vector<std::set<std::pair<GLint, GLint>>> m_free;
+};
@@ -1,19 +1,28 @@
 #include "SkeletonTree.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#include <glm/gtc/quaternion.hpp>
 
 #define MAX_BONES 1024u
 
 SkeletonTree::SkeletonTree(
     std::shared_ptr<Armature>&& armature,
     GLuint original_buffer,
-    GLuint per_frame_buffer
+    GLuint per_frame_buffer,
+    PaletteFormat palette_format
 ) noexcept :
     m_armature(std::move(armature)),
     m_BonesOriginalBuffer(original_buffer),
     m_BonesPerFrameBuffer(per_frame_buffer),
     m_BonesCount(0),
-    m_BonesNameToIndex()
+    m_BonesNameToIndex(),
+    m_bones(),
+    m_bind_pose_dirty(true),
+    m_palette_revision(0),
+    m_palette_format(palette_format)
 {
 
 };
@@ -29,7 +38,8 @@ SkeletonTree::~SkeletonTree() {
 }
 
 SkeletonTree* SkeletonTree::CreateSkeletonTree(
-    std::shared_ptr<Armature> armature
+    std::shared_ptr<Armature> armature,
+    PaletteFormat palette_format
 ) noexcept {
     GLuint original_buffer = 0, per_frame_buffer = 0;
 
@@ -49,13 +59,13 @@ SkeletonTree* SkeletonTree::CreateSkeletonTree(
     CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, per_frame_buffer));
     CHECK_GL_ERROR(glBufferData(
         GL_SHADER_STORAGE_BUFFER,
-        static_cast<GLsizeiptr>(MAX_BONES * sizeof(glm::mat4)),
+        static_cast<GLsizeiptr>(MAX_BONES * GetPaletteVec4Count(palette_format) * sizeof(glm::vec4)),
         nullptr,
         GL_DYNAMIC_DRAW
     ));
     CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
 
-    return new SkeletonTree(std::move(armature), original_buffer, per_frame_buffer);
+    return new SkeletonTree(std::move(armature), original_buffer, per_frame_buffer, palette_format);
 }
 
 void SkeletonTree::bind(GLint bindingPoint) const noexcept {
@@ -99,9 +109,12 @@ bool SkeletonTree::addBone(
 
     // Store the bone name to index mapping.
     m_BonesNameToIndex[armature_node_ref] = m_BonesCount;
+    m_bones.push_back(bone_data);
 
     ++m_BonesCount;
 
+    m_bind_pose_dirty = true;
+
     return true;
 }
 
@@ -117,3 +130,117 @@ std::optional<uint32_t> SkeletonTree::getBoneIndex(const ArmatureNodeRef& armatu
 
     return std::nullopt;
 }
+
+uint32_t SkeletonTree::GetPaletteVec4Count(PaletteFormat format) noexcept {
+    switch (format) {
+        case PaletteFormat::AFFINE_3X4:
+            return 3u;
+        case PaletteFormat::DUAL_QUATERNION:
+            return 2u;
+        case PaletteFormat::MAT4:
+        default:
+            return 4u;
+    }
+}
+
+void SkeletonTree::EncodePalette(
+    PaletteFormat format,
+    const std::vector<glm::mat4>& palette,
+    std::vector<glm::vec4>& encoded
+) noexcept {
+    const auto stride = GetPaletteVec4Count(format);
+    encoded.resize(palette.size() * stride);
+
+    for (size_t b = 0; b < palette.size(); ++b) {
+        const auto& m = palette[b];
+        glm::vec4 *const out = &encoded[b * stride];
+
+        switch (format) {
+            case PaletteFormat::AFFINE_3X4:
+                for (int r = 0; r < 3; ++r) out[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+                break;
+            case PaletteFormat::DUAL_QUATERNION: {
+                const glm::mat3 rotation(
+                    glm::normalize(glm::vec3(m[0])),
+                    glm::normalize(glm::vec3(m[1])),
+                    glm::normalize(glm::vec3(m[2]))
+                );
+                const glm::quat real = glm::normalize(glm::quat_cast(rotation));
+                const glm::quat dual = (glm::quat(0.0f, m[3].x, m[3].y, m[3].z) * real) * 0.5f;
+                out[0] = glm::vec4(real.x, real.y, real.z, real.w);
+                out[1] = glm::vec4(dual.x, dual.y, dual.z, dual.w);
+                break;
+            }
+            case PaletteFormat::MAT4:
+            default:
+                for (int c = 0; c < 4; ++c) out[c] = m[c];
+                break;
+        }
+    }
+}
+
+void SkeletonTree::DecodePalette(
+    PaletteFormat format,
+    const glm::vec4* encoded,
+    size_t count,
+    std::vector<glm::mat4>& palette
+) noexcept {
+    const auto stride = GetPaletteVec4Count(format);
+    palette.resize(count);
+
+    for (size_t b = 0; b < count; ++b) {
+        const glm::vec4 *const in = &encoded[b * stride];
+        auto& m = palette[b];
+
+        switch (format) {
+            case PaletteFormat::AFFINE_3X4:
+                m = glm::transpose(glm::mat4(in[0], in[1], in[2], glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+                break;
+            case PaletteFormat::DUAL_QUATERNION: {
+                const glm::quat real(in[0].w, in[0].x, in[0].y, in[0].z);
+                const glm::quat dual(in[1].w, in[1].x, in[1].y, in[1].z);
+                const glm::quat translation = (dual * glm::conjugate(real)) * 2.0f;
+                m = glm::mat4_cast(real);
+                m[3] = glm::vec4(translation.x, translation.y, translation.z, 1.0f);
+                break;
+            }
+            case PaletteFormat::MAT4:
+            default:
+                m = glm::mat4(in[0], in[1], in[2], in[3]);
+                break;
+        }
+    }
+}
+
+void SkeletonTree::uploadPalette(const std::vector<glm::mat4>& palette) const noexcept {
+    const auto count = std::min(static_cast<size_t>(m_BonesCount), palette.size());
+    if (count == 0) return;
+
+    std::vector<glm::vec4> encoded;
+    EncodePalette(m_palette_format, palette, encoded);
+
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_BonesPerFrameBuffer));
+    CHECK_GL_ERROR(glBufferSubData(
+        GL_SHADER_STORAGE_BUFFER,
+        0,
+        static_cast<GLsizeiptr>(count * GetPaletteVec4Count(m_palette_format) * sizeof(glm::vec4)),
+        encoded.data()
+    ));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+void SkeletonTree::downloadPalette(std::vector<glm::mat4>& palette) const noexcept {
+    palette.resize(m_BonesCount);
+    if (m_BonesCount == 0) return;
+
+    const auto size = static_cast<GLsizeiptr>(m_BonesCount * GetPaletteVec4Count(m_palette_format) * sizeof(glm::vec4));
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_BonesPerFrameBuffer));
+    const void *const mapped = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (mapped) {
+        DecodePalette(m_palette_format, static_cast<const glm::vec4*>(mapped), m_BonesCount, palette);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    } else {
+        std::cerr << "Failed to map per-frame skeleton buffer for readback" << std::endl;
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
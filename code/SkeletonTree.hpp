@@ -11,6 +11,20 @@
 
 #define BONE_IS_ROOT 0xFFFFFFFFu
 
+// Layout of the per-frame palette (one entry per bone), shared by animate.comp, animate_bind_pose.comp and skin.comp
+enum class PaletteFormat {
+    // column-major mat4: 64 bytes per bone
+    MAT4 = 0,
+
+    // first 3 rows of the (affine) matrix: 48 bytes per bone, lossless
+    AFFINE_3X4,
+
+    // real and dual part of a unit dual quaternion: 32 bytes per bone, rigid transforms only (scale is dropped)
+    DUAL_QUATERNION,
+};
+
+#define PALETTE_FORMAT_COUNT 3
+
 struct SkeletonGPUElement {
     glm::mat4 offset_matrix;
 
@@ -33,7 +47,8 @@ public:
     SkeletonTree(
         std::shared_ptr<Armature>&& armature,
         GLuint original_buffer,
-        GLuint per_frame_buffer
+        GLuint per_frame_buffer,
+        PaletteFormat palette_format
     ) noexcept;
 
     ~SkeletonTree();
@@ -66,7 +81,8 @@ public:
     std::optional<uint32_t> getBoneIndex(const ArmatureNodeRef& armature_node_ref) const noexcept;
 
     static SkeletonTree* CreateSkeletonTree(
-        std::shared_ptr<Armature> armature
+        std::shared_ptr<Armature> armature,
+        PaletteFormat palette_format = PaletteFormat::MAT4
     ) noexcept;
 
     // Get the raw GL buffer id for the per-frame bones SSBO.
@@ -77,14 +93,78 @@ public:
 
     inline std::shared_ptr<Armature> getArmature(void) const noexcept { return m_armature; }
 
+    // CPU copy of the original bones buffer, indexed by bone index
+    inline const Skeleton& getBones(void) const noexcept { return m_bones; }
+
+    inline PaletteFormat getPaletteFormat(void) const noexcept { return m_palette_format; }
+
+    // vec4 elements per bone in a palette of the given format
+    static uint32_t GetPaletteVec4Count(PaletteFormat format) noexcept;
+
+    /**
+     * Convert matrices to the given palette layout (as written by animate.comp).
+     */
+    static void EncodePalette(
+        PaletteFormat format,
+        const std::vector<glm::mat4>& palette,
+        std::vector<glm::vec4>& encoded
+    ) noexcept;
+
+    /**
+     * Convert count bones of a palette in the given layout back to matrices.
+     */
+    static void DecodePalette(
+        PaletteFormat format,
+        const glm::vec4* encoded,
+        size_t count,
+        std::vector<glm::mat4>& palette
+    ) noexcept;
+
+    /**
+     * Overwrite the per-frame buffer with a palette computed on the CPU (one matrix per bone),
+     * encoded in the palette format of this skeleton.
+     */
+    void uploadPalette(const std::vector<glm::mat4>& palette) const noexcept;
+
+    /**
+     * Read back the per-frame buffer and decode it (one matrix per bone): slow, meant for diagnostics.
+     */
+    void downloadPalette(std::vector<glm::mat4>& palette) const noexcept;
+
+    /**
+     * The per-frame buffer does not hold the bind pose anymore (new bones were added or an
+     * animation wrote into it) and the bind-pose palette has to be computed again.
+     */
+    inline bool isBindPoseDirty(void) const noexcept { return m_bind_pose_dirty; }
+
+    inline void markBindPoseDirty(void) noexcept { m_bind_pose_dirty = true; }
+
+    inline void clearBindPoseDirty(void) noexcept { m_bind_pose_dirty = false; }
+
+    /**
+     * Incremented every time a new palette is written into the per-frame buffer, so that
+     * whatever is derived from the palette (e.g. skinned vertex buffers) is recomputed only then.
+     */
+    inline uint64_t getPaletteRevision(void) const noexcept { return m_palette_revision; }
+
+    inline void markPaletteChanged(void) noexcept { ++m_palette_revision; }
+
 private:
     std::shared_ptr<Armature> m_armature;
 
     ArmatureNodeRefToIndexMap m_BonesNameToIndex;
 
+    Skeleton m_bones;
+
     GLuint m_BonesOriginalBuffer;
 
     GLuint m_BonesPerFrameBuffer;
 
     GLuint m_BonesCount;
+
+    bool m_bind_pose_dirty;
+
+    uint64_t m_palette_revision;
+
+    PaletteFormat m_palette_format;
 };
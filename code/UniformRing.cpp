@@ -0,0 +1,189 @@
+#include "UniformRing.hpp"
+
+#include <iostream>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+// how long beginFrame waits for a region before giving up on the fence
+#define UNIFORM_RING_FENCE_TIMEOUT_NS 1000000000ull
+
+static size_t align_up(size_t size, size_t alignment) noexcept {
+    return ((size + alignment - 1u) / alignment) * alignment;
+}
+
+static GLuint create_uniform_buffer(size_t size) noexcept {
+    GLuint buffer = 0;
+
+    CHECK_GL_ERROR(glGenBuffers(1, &buffer));
+    assert(buffer != 0 && "Failed to generate uniform buffer");
+
+    CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, buffer));
+    CHECK_GL_ERROR(glBufferData(GL_UNIFORM_BUFFER, static_cast<GLsizeiptr>(size), nullptr, GL_DYNAMIC_DRAW));
+    CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+
+    return buffer;
+}
+
+static void wait_fence(GLsync& fence) noexcept {
+    if (!fence) return;
+
+    const GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UNIFORM_RING_FENCE_TIMEOUT_NS);
+    if ((result == GL_TIMEOUT_EXPIRED) || (result == GL_WAIT_FAILED)) {
+        std::cerr << "Timed out waiting for a uniform ring region" << std::endl;
+    }
+
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+UniformRing::UniformRing(GLuint buffer, size_t region_size, size_t alignment) noexcept :
+    m_buffer(buffer),
+    m_region_size(region_size),
+    m_alignment(alignment)
+{
+
+}
+
+UniformRing::~UniformRing() noexcept {
+    for (auto& fence : m_fences) {
+        if (fence) glDeleteSync(fence);
+    }
+
+    for (const auto& retired : m_retired) {
+        if (retired.fence) glDeleteSync(retired.fence);
+        CHECK_GL_ERROR(glDeleteBuffers(1, &retired.buffer));
+    }
+
+    if (m_buffer) {
+        CHECK_GL_ERROR(glDeleteBuffers(1, &m_buffer));
+    }
+}
+
+UniformRing* UniformRing::Create(size_t region_size) noexcept {
+    GLint alignment = 0;
+    CHECK_GL_ERROR(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment));
+    if (alignment <= 0) alignment = 256;
+
+    region_size = align_up(region_size, static_cast<size_t>(alignment));
+
+    const GLuint buffer = create_uniform_buffer(region_size * UNIFORM_RING_FRAMES);
+    if (buffer == 0) {
+        std::cerr << "Failed to create the uniform ring" << std::endl;
+        return nullptr;
+    }
+
+    return new UniformRing(buffer, region_size, static_cast<size_t>(alignment));
+}
+
+bool UniformRing::grow(size_t region_size) noexcept {
+    region_size = align_up(region_size, m_alignment);
+
+    const GLuint buffer = create_uniform_buffer(region_size * UNIFORM_RING_FRAMES);
+    if (buffer == 0) return false;
+
+    // the GPU may still read any region of the old buffer: it goes away with the fence of this frame,
+    // the last one to use it, and the new buffer has no region in use yet
+    m_retired.push_back({ m_buffer, nullptr });
+    for (auto& fence : m_fences) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    m_buffer = buffer;
+    m_region_size = region_size;
+    m_head = m_frame * m_region_size;
+
+    std::cout << "Uniform ring regions grown to " << m_region_size << " bytes" << std::endl;
+
+    return true;
+}
+
+void UniformRing::beginFrame() noexcept {
+    // buffers the GPU is done with: never waited for, they are checked again next frame
+    std::erase_if(m_retired, [](RetiredBuffer& retired) {
+        if (!retired.fence) return false;
+
+        const GLenum result = glClientWaitSync(retired.fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) return false;
+
+        glDeleteSync(retired.fence);
+        CHECK_GL_ERROR(glDeleteBuffers(1, &retired.buffer));
+        return true;
+    });
+
+    m_frame = (m_frame + 1u) % UNIFORM_RING_FRAMES;
+    m_head = m_frame * m_region_size;
+
+    wait_fence(m_fences[m_frame]);
+}
+
+void UniformRing::endFrame() noexcept {
+    assert(!m_fences[m_frame] && "The region of the frame is already fenced");
+
+    m_fences[m_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    for (auto& retired : m_retired) {
+        if (!retired.fence) retired.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+size_t UniformRing::alignedSize(size_t size) const noexcept {
+    return align_up(size, m_alignment);
+}
+
+void* UniformRing::map(size_t count, size_t stride, GLintptr& offset) noexcept {
+    assert((stride % m_alignment == 0) && "The stride of uniform allocations must be aligned");
+
+    const size_t size = count * stride;
+    if (size == 0) return nullptr;
+
+    if (getFrameUsage() + size > m_region_size) {
+        size_t region_size = m_region_size * 2u;
+        while (region_size < size) region_size *= 2u;
+
+        if (!grow(region_size)) {
+            std::cerr << "Failed to grow the uniform ring" << std::endl;
+            return nullptr;
+        }
+    }
+
+    offset = static_cast<GLintptr>(m_head);
+    m_head += size;
+
+    // the fence of the region was waited for: nothing the GPU still reads is overwritten
+    CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, m_buffer));
+    void* data = glMapBufferRange(
+        GL_UNIFORM_BUFFER,
+        offset,
+        static_cast<GLsizeiptr>(size),
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+    );
+    if (!data) {
+        std::cerr << "Failed to map the uniform ring" << std::endl;
+        CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+    }
+
+    return data;
+}
+
+void UniformRing::unmap() noexcept {
+    CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, m_buffer));
+    CHECK_GL_ERROR(glUnmapBuffer(GL_UNIFORM_BUFFER));
+    CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+}
+
+GLintptr UniformRing::upload(const void* data, size_t size) noexcept {
+    GLintptr offset = -1;
+    void* mapped = map(1, alignedSize(size), offset);
+    if (!mapped) return -1;
+
+    std::memcpy(mapped, data, size);
+    unmap();
+
+    return offset;
+}
+
+void UniformRing::bind(GLuint binding, GLintptr offset, size_t size) const noexcept {
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, m_buffer, offset, static_cast<GLsizeiptr>(size));
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "OpenGL.hpp"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Frames the GPU may lag behind: each one writes its own region of the ring
+#define UNIFORM_RING_FRAMES 3u
+
+/**
+ * Uniform buffer split in UNIFORM_RING_FRAMES regions, one per frame in flight, that uniform
+ * blocks (std140) are suballocated from and bound with glBindBufferRange.
+ *
+ * A frame writes its allocations through unsynchronized mappings of its own region: the fence
+ * placed at the end of the frame that last used the region is waited for (it is usually long
+ * signaled) before the region is written again. Allocations are aligned to
+ * GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+ *
+ * An allocation that does not fit in the region of the frame grows the ring right away: it moves
+ * to a new buffer with regions twice as large, and the full one is released once the GPU is done
+ * with the frame (the ranges already bound from it stay valid until then).
+ */
+class UniformRing {
+public:
+    UniformRing() = delete;
+
+    UniformRing(const UniformRing&) = delete;
+
+    UniformRing& operator=(const UniformRing&) = delete;
+
+    ~UniformRing() noexcept;
+
+    // ring with regions of (at least) region_size bytes
+    static UniformRing* Create(size_t region_size) noexcept;
+
+    // move to the region of the next frame, waiting for the GPU to be done with it
+    void beginFrame() noexcept;
+
+    // fence the region of the frame
+    void endFrame() noexcept;
+
+    // size rounded up to the offset alignment: the stride of an array of allocations
+    size_t alignedSize(size_t size) const noexcept;
+
+    /**
+     * Map count allocations of stride bytes (an alignedSize) for writing, contiguous in the
+     * region of the frame, growing the ring when the region is full. Returns nullptr only when
+     * the buffer cannot be grown or mapped; otherwise offset is the one of the first allocation,
+     * and unmap must be called before drawing.
+     */
+    void* map(size_t count, size_t stride, GLintptr& offset) noexcept;
+
+    void unmap() noexcept;
+
+    // map, copy and unmap a single allocation: returns its offset, or -1 when map fails
+    GLintptr upload(const void* data, size_t size) noexcept;
+
+    // bind size bytes at offset (of the current buffer) to a uniform block binding point
+    void bind(GLuint binding, GLintptr offset, size_t size) const noexcept;
+
+    inline GLuint getBuffer() const noexcept { return m_buffer; }
+
+    // bytes allocated by the current frame so far
+    inline size_t getFrameUsage() const noexcept { return m_head - m_frame * m_region_size; }
+
+private:
+    UniformRing(GLuint buffer, size_t region_size, size_t alignment) noexcept;
+
+    // move to a new buffer with regions of at least region_size bytes, retiring the current one
+    bool grow(size_t region_size) noexcept;
+
+    GLuint m_buffer;
+
+    size_t m_region_size;
+
+    size_t m_alignment;
+
+    // region of the current frame, and the next free byte in the buffer
+    size_t m_frame = 0;
+
+    size_t m_head = 0;
+
+    std::array<GLsync, UNIFORM_RING_FRAMES> m_fences = {};
+
+    // buffers replaced by grow, deleted once the fence of the last frame that used them is signaled
+    struct RetiredBuffer {
+        GLuint buffer;
+
+        // 0 until the end of the frame that retired the buffer
+        GLsync fence;
+    };
+
+    std::vector<RetiredBuffer> m_retired;
+};
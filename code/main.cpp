@@ -16,6 +16,7 @@
 #include "Pipeline.hpp"
 
 #include <sstream>
+#include <cmath>
 #include <iostream>
 #include <memory>
 #include <cstdio>
@@ -329,6 +330,33 @@ int main(int argc, char **argv)
             ImGui::TextUnformatted(oss.str().c_str());
         }
 
+        // Meshes drawn and culled by each view of the last frame, and the bindings their draws took
+        if (const auto shadowed_pipeline = std::dynamic_pointer_cast<ShadowedPipeline>(pipeline)) {
+            const auto& changes = shadowed_pipeline->getRenderStateChanges();
+            ImGui::Text(
+                "State changes: %zu programs, %zu texture sets, %zu materials, %zu VAOs, %zu uniform ranges for %zu draws",
+                changes.programs,
+                changes.texture_sets,
+                changes.materials,
+                changes.vertex_arrays,
+                changes.uniform_ranges,
+                changes.draws
+            );
+
+            if (ImGui::CollapsingHeader("Culling")) {
+                if (shadowed_pipeline->getIndirectDrawCount() > 0) {
+                    ImGui::Text("GPU-driven: %zu static meshes in %zu batches", shadowed_pipeline->getIndirectDrawCount(), shadowed_pipeline->getIndirectBatchCount());
+                }
+
+                for (const auto& stats : shadowed_pipeline->getCullingStats()) {
+                    ImGui::Text("%s: %zu drawn, %zu culled", stats.view.c_str(), stats.drawn, stats.culled);
+                }
+
+                const auto& overflow = shadowed_pipeline->getClusterOverflow();
+                ImGui::Text("Cone light clusters: %zu full, %zu lights dropped", overflow.clusters, overflow.lights);
+            }
+        }
+
         // Light toggles
         if (ImGui::CollapsingHeader("Lights", ImGuiTreeNodeFlags_DefaultOpen)) {
             ImGui::PushID("Lights");
@@ -648,6 +676,228 @@ int main(int argc, char **argv)
                                 imgui_console.push_back(line);
                             }
                         }
+                    } else if (tokens[0] == "animcheck" && (tokens.size() == 3 || tokens.size() == 4)) {
+                        // animcheck <asset_name> <animation_index> [tolerance] -> compare GPU and CPU palettes
+                        std::string name = tokens[1];
+                        try {
+                            const size_t idx = static_cast<size_t>(std::stoul(tokens[2]));
+                            const float tolerance = (tokens.size() == 4) ? std::stof(tokens[3]) : 1e-3f;
+                            const auto anim_name_opt = scene->getAnimationName(name, idx);
+                            const auto report = anim_name_opt.has_value() ?
+                                scene->compareAnimationBackends(name, anim_name_opt.value(), tolerance) :
+                                std::nullopt;
+                            if (!report.has_value()) {
+                                imgui_console.push_back("Animation check failed for asset: " + name);
+                            } else {
+                                std::ostringstream oss;
+                                oss << (report->within_tolerance ? "PASS" : "FAIL")
+                                    << " '" << anim_name_opt.value() << "': " << report->bones << " bones, "
+                                    << report->samples << " samples, max error " << report->max_abs_error
+                                    << " - GPU " << (report->gpu_bones_per_second / 1e6) << " Mbones/s"
+                                    << ", CPU " << (report->cpu_bones_per_second / 1e6) << " Mbones/s";
+                                imgui_console.push_back(oss.str());
+                            }
+                        } catch (...) {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "animbackend" && tokens.size() == 2) {
+                        // animbackend gpu|cpu -> where skinning palettes are computed
+                        if (tokens[1] == "gpu") {
+                            scene->setAnimationBackend(AnimationBackend::GPU);
+                            imgui_console.push_back("Animation backend: GPU");
+                        } else if (tokens[1] == "cpu") {
+                            scene->setAnimationBackend(AnimationBackend::CPU);
+                            imgui_console.push_back("Animation backend: CPU");
+                        } else {
+                            imgui_console.push_back(std::string("Unknown animation backend: ") + tokens[1]);
+                        }
+                    } else if (tokens[0] == "paletteformat" && tokens.size() == 2) {
+                        // paletteformat mat4|3x4|dq -> palette layout of the assets loaded from now on
+                        if (tokens[1] == "mat4") {
+                            scene->setPaletteFormat(PaletteFormat::MAT4);
+                            imgui_console.push_back("Palette format: mat4");
+                        } else if (tokens[1] == "3x4") {
+                            scene->setPaletteFormat(PaletteFormat::AFFINE_3X4);
+                            imgui_console.push_back("Palette format: 3x4");
+                        } else if (tokens[1] == "dq") {
+                            scene->setPaletteFormat(PaletteFormat::DUAL_QUATERNION);
+                            imgui_console.push_back("Palette format: dual quaternion");
+                        } else {
+                            imgui_console.push_back(std::string("Unknown palette format: ") + tokens[1]);
+                        }
+                    } else if (tokens[0] == "animlod" && tokens.size() == 4) {
+                        // animlod <full_rate_coverage> <max_interval> <max_updates_per_frame> -> animation update-rate LOD
+                        try {
+                            scene->setAnimationLODSettings(AnimationLODSettings {
+                                .full_rate_coverage = std::stof(tokens[1]),
+                                .max_interval = static_cast<uint32_t>(std::stoul(tokens[2])),
+                                .max_updates_per_frame = static_cast<uint32_t>(std::stoul(tokens[3])),
+                            });
+                            imgui_console.push_back("Animation LOD: full rate above " + tokens[1] + " coverage, every " + tokens[2] + " frames at most, " + tokens[3] + " updates per frame");
+                        } catch (...) {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "posecache" && tokens.size() == 2) {
+                        // posecache <seconds> -> elements of the same asset playing the same clip this close in time share a pose (0 = off)
+                        try {
+                            scene->setPoseCacheTimeStep(std::stof(tokens[1]));
+                            imgui_console.push_back("Pose cache time step: " + tokens[1] + " s");
+                        } catch (...) {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "animbudget" && tokens.size() == 3) {
+                        // animbudget <megabytes> <seconds> -> GPU memory for the animation clips, and how long a played clip is kept
+                        try {
+                            scene->setAnimationResidencySettings(AnimationResidencySettings {
+                                .memory_budget = static_cast<size_t>(std::stod(tokens[1]) * 1024.0 * 1024.0),
+                                .eviction_delay = std::stof(tokens[2]),
+                            });
+                            imgui_console.push_back("Animation budget: " + tokens[1] + " MB, clips kept " + tokens[2] + " s after use (" + std::to_string(scene->getResidentAnimationsSize()) + " bytes resident)");
+                        } catch (...) {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "bakedistance" && tokens.size() == 2) {
+                        // bakedistance <distance> -> animated elements farther than this play their baked clips
+                        try {
+                            scene->setBakedAnimationDistance(std::stof(tokens[1]));
+                            imgui_console.push_back("Baked animation distance: " + tokens[1]);
+                        } catch (...) {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "lightformat" && tokens.size() == 2) {
+                        // lightformat rgba16f|r11g11b10f -> format of the HDR target the lights are accumulated into
+                        const auto shadowed_pipeline = std::dynamic_pointer_cast<ShadowedPipeline>(pipeline);
+                        if (!shadowed_pipeline) {
+                            imgui_console.push_back("The current pipeline has no lightbuffer");
+                        } else if (tokens[1] == "rgba16f") {
+                            if (shadowed_pipeline->setLightbufferFormat(FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_RGBA16F)) {
+                                imgui_console.push_back("Lightbuffer format: RGBA16F");
+                            }
+                        } else if (tokens[1] == "r11g11b10f") {
+                            if (shadowed_pipeline->setLightbufferFormat(FramebufferColorFormat::FRAMEBUFFER_COLOR_FORMAT_R11F_G11F_B10F)) {
+                                imgui_console.push_back("Lightbuffer format: R11F_G11F_B10F");
+                            }
+                        } else {
+                            imgui_console.push_back(std::string("Unknown lightbuffer format: ") + tokens[1]);
+                        }
+                    } else if (tokens[0] == "shadowdepth" && tokens.size() == 2) {
+                        // shadowdepth 16|24 -> depth bits of the shadow atlas of the cone lights
+                        const auto shadowed_pipeline = std::dynamic_pointer_cast<ShadowedPipeline>(pipeline);
+                        if (!shadowed_pipeline) {
+                            imgui_console.push_back("The current pipeline has no shadow atlas");
+                        } else if (tokens[1] == "16") {
+                            if (shadowed_pipeline->setShadowAtlasDepthFormat(FramebufferDepthFormat::FRAMEBUFFER_DEPTH_FORMAT_DEPTH16)) {
+                                imgui_console.push_back("Shadow atlas depth: 16 bits");
+                            }
+                        } else if (tokens[1] == "24") {
+                            if (shadowed_pipeline->setShadowAtlasDepthFormat(FramebufferDepthFormat::FRAMEBUFFER_DEPTH_FORMAT_DEPTH24)) {
+                                imgui_console.push_back("Shadow atlas depth: 24 bits");
+                            }
+                        } else {
+                            imgui_console.push_back(std::string("Unknown shadow atlas depth: ") + tokens[1]);
+                        }
+                    } else if (tokens[0] == "clustered" && tokens.size() == 2) {
+                        // clustered on|off -> shade all the cone lights in one clustered pass, or one pass per light
+                        const auto shadowed_pipeline = std::dynamic_pointer_cast<ShadowedPipeline>(pipeline);
+                        if (!shadowed_pipeline) {
+                            imgui_console.push_back("The current pipeline has no clustered lighting");
+                        } else if ((tokens[1] == "on") || (tokens[1] == "off")) {
+                            shadowed_pipeline->setClusteredConeLights(tokens[1] == "on");
+                            imgui_console.push_back("Clustered cone lights: " + tokens[1]);
+                        } else {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "shadowcache" && tokens.size() == 2) {
+                        // shadowcache on|off -> keep the static casters of each shadow map between frames
+                        const auto shadowed_pipeline = std::dynamic_pointer_cast<ShadowedPipeline>(pipeline);
+                        if (!shadowed_pipeline) {
+                            imgui_console.push_back("The current pipeline has no shadow maps");
+                        } else if ((tokens[1] == "on") || (tokens[1] == "off")) {
+                            shadowed_pipeline->setShadowCaching(tokens[1] == "on");
+                            imgui_console.push_back("Static shadow caching: " + tokens[1]);
+                        } else {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "culling" && tokens.size() == 2) {
+                        // culling on|off -> test meshes against the frustum of every view before drawing them
+                        const auto shadowed_pipeline = std::dynamic_pointer_cast<ShadowedPipeline>(pipeline);
+                        if (!shadowed_pipeline) {
+                            imgui_console.push_back("The current pipeline does not cull");
+                        } else if ((tokens[1] == "on") || (tokens[1] == "off")) {
+                            shadowed_pipeline->setFrustumCulling(tokens[1] == "on");
+                            imgui_console.push_back("Frustum culling: " + tokens[1]);
+                        } else {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "gpudraw" && tokens.size() == 2) {
+                        // gpudraw on|off -> cull and draw the static meshes with indirect commands written on the GPU
+                        const auto shadowed_pipeline = std::dynamic_pointer_cast<ShadowedPipeline>(pipeline);
+                        if (!shadowed_pipeline) {
+                            imgui_console.push_back("The current pipeline has no GPU-driven draws");
+                        } else if (!IndirectDrawBuffer::IsSupported()) {
+                            imgui_console.push_back("Indirect multi-draws are not supported");
+                        } else if ((tokens[1] == "on") || (tokens[1] == "off")) {
+                            shadowed_pipeline->setGPUDrivenDraws(tokens[1] == "on");
+                            imgui_console.push_back("GPU-driven draws: " + tokens[1]);
+                        } else {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "occlusion" && tokens.size() == 2) {
+                        // occlusion on|off -> also cull the GPU-driven draws hidden behind the depth of the previous frame
+                        const auto shadowed_pipeline = std::dynamic_pointer_cast<ShadowedPipeline>(pipeline);
+                        if (!shadowed_pipeline) {
+                            imgui_console.push_back("The current pipeline has no occlusion culling");
+                        } else if ((tokens[1] == "on") || (tokens[1] == "off")) {
+                            shadowed_pipeline->setOcclusionCulling(tokens[1] == "on");
+                            imgui_console.push_back("Occlusion culling: " + tokens[1]);
+                        } else {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
+                    } else if (tokens[0] == "cascades" && tokens.size() == 2) {
+                        // cascades <count> -> split the directional shadows in 1 to SHADOW_CASCADE_COUNT cascades
+                        const auto shadowed_pipeline = std::dynamic_pointer_cast<ShadowedPipeline>(pipeline);
+                        if (!shadowed_pipeline) {
+                            imgui_console.push_back("The current pipeline has no shadow maps");
+                        } else {
+                            try {
+                                shadowed_pipeline->setShadowCascadeCount(static_cast<glm::uint32>(std::stoul(tokens[1])));
+                                imgui_console.push_back("Shadow cascades: " + std::to_string(shadowed_pipeline->getShadowCascadeCount()));
+                            } catch (...) {
+                                imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                            }
+                        }
+                    } else if (tokens[0] == "crowd" && (tokens.size() == 4 || tokens.size() == 5)) {
+                        // crowd <crowd_name> <asset_name> <count> [spacing] -> grid of instances cycling the asset's clips
+                        const std::string crowd_name = tokens[1];
+                        const std::string asset_name = tokens[2];
+                        try {
+                            const size_t count = static_cast<size_t>(std::stoul(tokens[3]));
+                            const float spacing = (tokens.size() == 5) ? std::stof(tokens[4]) : 2.0f;
+
+                            size_t clips = 0;
+                            while (scene->getAnimationName(asset_name, clips).has_value()) ++clips;
+
+                            const auto columns = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+                            std::vector<CrowdInstance> instances;
+                            instances.reserve(count);
+                            for (size_t i = 0; i < count; ++i) {
+                                const auto x = static_cast<float>(i % columns) * spacing;
+                                const auto z = static_cast<float>(i / columns) * spacing;
+                                instances.push_back(CrowdInstance {
+                                    .model = glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, z)),
+                                    .clip = static_cast<uint32_t>(clips > 0 ? i % clips : 0),
+                                    .time_offset = static_cast<float>(i % 17) * 0.137f,
+                                });
+                            }
+
+                            if (scene->createCrowd(crowd_name, asset_name, instances)) {
+                                imgui_console.push_back("Created crowd " + crowd_name + " of " + tokens[3] + " instances of " + asset_name);
+                            } else {
+                                imgui_console.push_back("Failed to create crowd " + crowd_name + " from " + asset_name);
+                            }
+                        } catch (...) {
+                            imgui_console.push_back(std::string("Invalid parameters for command: ") + cmd);
+                        }
                     } else if (tokens[0] == "lock") {
                         camera_locked = true;
                         imgui_console.push_back("Camera locked");
@@ -0,0 +1,177 @@
+#version 320 es
+
+precision highp float;
+
+#define SMOOTH_BIAS 1
+
+// Must match the CPU-side defines (see ShadowedPipeline.hpp)
+#ifndef CLUSTER_TILE_SIZE
+#define CLUSTER_TILE_SIZE 64u
+#endif
+
+#ifndef CLUSTER_DEPTH_SLICES
+#define CLUSTER_DEPTH_SLICES 16u
+#endif
+
+#ifndef CLUSTER_MAX_LIGHTS
+#define CLUSTER_MAX_LIGHTS 63u
+#endif
+
+layout(location = 0) in vec2 v_TexCoord;
+
+uniform sampler2D u_GDiffuse;
+uniform sampler2D u_GSpecular;
+uniform sampler2D u_GNormalTangentSpace;
+uniform sampler2D u_GNormal;
+uniform sampler2D u_GTangent;
+uniform sampler2D u_GDepth;
+
+// shadow maps of all the cone lights, one tile each (see ClusteredConeLight::shadow_rect)
+uniform sampler2D u_ShadowAtlas;
+
+// Must match CPU-side ClusteredConeLight
+struct ClusteredConeLight {
+    mat4 light_space_matrix;
+
+    vec4 position_range;
+
+    vec4 direction_cutoff;
+
+    vec4 color_outer_cutoff;
+
+    vec4 attenuation;
+
+    vec4 bounds;
+
+    vec4 shadow_rect;
+};
+
+layout(std430, binding = 0) readonly buffer ConeLightBuffer {
+    ClusteredConeLight lights[];
+} cone_lights;
+
+layout(std430, binding = 1) readonly buffer ClusterBuffer {
+    uint data[];
+} clusters;
+
+layout(location = 0) uniform mat4 u_InverseViewProjection;
+layout(location = 1) uniform mat4 u_ViewMatrix;
+layout(location = 2) uniform vec3 u_CameraPosition;
+layout(location = 3) uniform uint u_ClusterCountX;
+layout(location = 4) uniform uint u_ClusterCountY;
+layout(location = 5) uniform float u_ZNear;
+layout(location = 6) uniform float u_ZFar;
+
+layout(location = 0) out vec3 o_LightpassOutput;
+
+// Must match the encodings of mesh.frag
+#define GBUFFER_SHININESS_LOG2_RANGE 11.0
+
+vec3 oct_decode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-v.z, 0.0);
+    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+    return normalize(v);
+}
+
+void main() {
+    float depth = texture(u_GDepth, v_TexCoord).r;
+
+    // nothing was drawn here
+    if (depth >= 1.0) {
+        o_LightpassOutput = vec3(0.0);
+        return;
+    }
+
+    vec4 position = u_InverseViewProjection * vec4(vec3(v_TexCoord, depth) * 2.0 - 1.0, 1.0);
+    vec3 vPosition_worldspace = position.xyz / position.w;
+
+    // same slicing as cluster_cone_lights.comp
+    float view_depth = -(u_ViewMatrix * vec4(vPosition_worldspace, 1.0)).z;
+    float slice_f = log(max(view_depth, u_ZNear) / u_ZNear) / log(u_ZFar / u_ZNear) * float(CLUSTER_DEPTH_SLICES);
+    uint slice = min(uint(max(slice_f, 0.0)), CLUSTER_DEPTH_SLICES - 1u);
+
+    uvec2 tile = min(uvec2(gl_FragCoord.xy) / CLUSTER_TILE_SIZE, uvec2(u_ClusterCountX - 1u, u_ClusterCountY - 1u));
+    uint cluster = (slice * u_ClusterCountY + tile.y) * u_ClusterCountX + tile.x;
+    uint base = cluster * (CLUSTER_MAX_LIGHTS + 1u);
+    uint count = clusters.data[base];
+
+    vec3 result = vec3(0.0);
+    if (count == 0u) {
+        o_LightpassOutput = result;
+        return;
+    }
+
+    // the G-buffer is read once for all the lights of the cluster
+    vec3 vNormal_worldspace = oct_decode(texture(u_GNormal, v_TexCoord).rg);
+    vec3 vTangent_worldspace = oct_decode(texture(u_GTangent, v_TexCoord).rg);
+    vec3 vBitangent_worldspace = normalize(cross(vNormal_worldspace, vTangent_worldspace));
+    mat3 invTBN = transpose(mat3(vTangent_worldspace, vBitangent_worldspace, vNormal_worldspace));
+
+    vec3 vDiffuse = texture(u_GDiffuse, v_TexCoord).rgb;
+    vec4 specular = texture(u_GSpecular, v_TexCoord);
+    vec3 specColor = specular.rgb;
+    float shininess = exp2(specular.a * GBUFFER_SHININESS_LOG2_RANGE);
+    vec3 normal_tangentspace = normalize(texture(u_GNormalTangentSpace, v_TexCoord).rgb);
+    vec3 viewDir_tangentspace = normalize(invTBN * normalize(u_CameraPosition - vPosition_worldspace));
+
+    for (uint i = 0u; i < count; ++i) {
+        ClusteredConeLight light = cone_lights.lights[clusters.data[base + 1u + i]];
+
+        vec4 lightSpacePos = light.light_space_matrix * vec4(vPosition_worldspace, 1.0);
+        lightSpacePos /= lightSpacePos.w;
+        vec2 shadowTexCoord = lightSpacePos.xy * 0.5 + 0.5;
+        if (shadowTexCoord.x < 0.0 || shadowTexCoord.x > 1.0 || shadowTexCoord.y < 0.0 || shadowTexCoord.y > 1.0) {
+            continue;
+        }
+
+        float distanceFromCenter = length(shadowTexCoord - vec2(0.5));
+        if (distanceFromCenter > 0.5) {
+            continue;
+        }
+
+#if SMOOTH_BIAS
+        float bias = max(0.01 * distanceFromCenter, 0.0001);
+#else
+        const float bias = 0.0000001;
+#endif
+
+        // the tile of this light in the atlas
+        vec2 texelPos = light.shadow_rect.xy + shadowTexCoord * light.shadow_rect.zw;
+        ivec2 texel = min(ivec2(texelPos), ivec2(light.shadow_rect.xy + light.shadow_rect.zw) - 1);
+        float closestDepth = texelFetch(u_ShadowAtlas, texel, 0).r;
+
+        float currentDepth = lightSpacePos.z * 0.5 + 0.5;
+        float shadow = currentDepth - closestDepth > bias ? 0.0 : 1.0;
+
+        vec3 light_position = light.position_range.xyz;
+        vec3 vDir_tangentspace = normalize(invTBN * normalize(light_position - vPosition_worldspace));
+        vec3 vLightDir_tangentspace = normalize(invTBN * light.direction_cutoff.xyz);
+
+        float theta = dot(vLightDir_tangentspace, -vDir_tangentspace);
+        float epsilon = light.direction_cutoff.w - light.color_outer_cutoff.w;
+        float coneIntensity = 0.0;
+        if (epsilon > 0.0) coneIntensity = clamp((theta - light.color_outer_cutoff.w) / epsilon, 0.0, 1.0);
+
+        float distance = length(light_position - vPosition_worldspace);
+        float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
+
+        // same as cone_lighting.frag
+        if (attenuation < 0.001) {
+            attenuation = 1.0;
+        }
+
+        float NdotL = max(dot(normal_tangentspace, vDir_tangentspace), 0.0);
+        vec3 lightColor = light.color_outer_cutoff.rgb;
+
+        vec3 diffuseContrib = lightColor * vDiffuse * attenuation * coneIntensity * NdotL;
+
+        vec3 H = normalize(vDir_tangentspace + viewDir_tangentspace);
+        float specFactor = pow(max(dot(normal_tangentspace, H), 0.0), max(shininess, 1.0));
+        vec3 specularContrib = lightColor * specColor * specFactor * attenuation * coneIntensity;
+
+        result += shadow * (diffuseContrib + specularContrib);
+    }
+
+    o_LightpassOutput = result;
+}
@@ -8,14 +8,12 @@ layout(location = 0) in vec2 v_TexCoord;
 
 uniform sampler2D u_GDiffuse;
 uniform sampler2D u_GSpecular;
-uniform sampler2D u_GShininess;
 uniform sampler2D u_GNormalTangentSpace;
-uniform sampler2D u_GPosition;
 uniform sampler2D u_GNormal;
 uniform sampler2D u_GTangent;
+uniform sampler2D u_GDepth;
 
-uniform sampler2D u_LightpassInput;
-
+// shadow atlas of the cone lights: this light's map is in u_ShadowRect
 uniform sampler2D u_LDepthTexture;
 
 layout(location = 0) uniform mat4 u_LightSpaceMatrix;
@@ -29,23 +27,50 @@ layout(location = 6) uniform float u_LightConstant;
 layout(location = 7) uniform float u_LightLinear;
 layout(location = 8) uniform float u_LightQuadratic;
 layout(location = 9) uniform vec3 u_CameraPosition;
+layout(location = 10) uniform mat4 u_InverseViewProjection;
+
+// window-space depth range of the light volume: pixels outside it are not lit
+layout(location = 11) uniform float u_DepthBoundsMin;
+layout(location = 12) uniform float u_DepthBoundsMax;
+
+// tile of the shadow atlas, in texels: x, y, width, height
+layout(location = 13) uniform vec4 u_ShadowRect;
 
 layout(location = 0) out vec3 o_LightpassOutput;
 
+// Must match the encodings of mesh.frag
+#define GBUFFER_SHININESS_LOG2_RANGE 11.0
+
+vec3 oct_decode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-v.z, 0.0);
+    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+    return normalize(v);
+}
+
+vec3 reconstruct_position(vec2 uv, float depth) {
+    vec4 position = u_InverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
+
 void main() {
-    vec3 vNormal_worldspace = texture(u_GNormal, v_TexCoord).rgb;
-    vec3 vTangent_worldspace = texture(u_GTangent, v_TexCoord).rgb;
+    float depth = texture(u_GDepth, v_TexCoord).r;
+    if ((depth < u_DepthBoundsMin) || (depth > u_DepthBoundsMax)) {
+        o_LightpassOutput = vec3(0.0);
+        return;
+    }
+
+    vec3 vNormal_worldspace = oct_decode(texture(u_GNormal, v_TexCoord).rg);
+    vec3 vTangent_worldspace = oct_decode(texture(u_GTangent, v_TexCoord).rg);
     vec3 vBitangent_worldspace = normalize(cross(vNormal_worldspace, vTangent_worldspace));
     mat3 TBN = mat3(vTangent_worldspace, vBitangent_worldspace, vNormal_worldspace);
     mat3 invTBN = transpose(TBN);
 
     vec3 vDiffuse = texture(u_GDiffuse, v_TexCoord).rgb;
-    vec4 vPosition_worldspace = vec4(texture(u_GPosition, v_TexCoord).xyz, 1.0);
-
-    ivec2 shadowTextureDimensions = textureSize(u_LDepthTexture, 0);
+    vec4 vPosition_worldspace = vec4(reconstruct_position(v_TexCoord, depth), 1.0);
 
-    // load the input lightpass color: this is the light accumulated so far
-    vec3 result = texture(u_LightpassInput, v_TexCoord).rgb;
+    // only the contribution of this light: it is added to the lightbuffer by blending
+    vec3 result = vec3(0.0);
 
     vec4 lightSpacePos = u_LightSpaceMatrix * vPosition_worldspace;
     lightSpacePos /= lightSpacePos.w;
@@ -67,10 +92,10 @@ void main() {
     const float bias = 0.0000001;
 #endif
 
-    //vec2 texelSize = 1.0 / vec2(float(shadowTextureDimensions.x), float(shadowTextureDimensions.y));
-    vec2 texelPos = shadowTexCoord * vec2(float(shadowTextureDimensions.x), float(shadowTextureDimensions.y));
+    vec2 texelPos = u_ShadowRect.xy + shadowTexCoord * u_ShadowRect.zw;
+    ivec2 texel = min(ivec2(texelPos), ivec2(u_ShadowRect.xy + u_ShadowRect.zw) - 1);
 
-    float closestDepth = texelFetch(u_LDepthTexture, ivec2(texelPos), 0).r;
+    float closestDepth = texelFetch(u_LDepthTexture, texel, 0).r;
 
     float currentDepth = lightSpacePos.z * 0.5 + 0.5;
 
@@ -107,8 +132,9 @@ void main() {
     vec3 diffuseContrib = u_LightColor * vDiffuse * attenuation * coneIntensity * NdotL;
 
     // Specular (Blinn-Phong) using G-buffer specular color and shininess
-    vec3 specColor = texture(u_GSpecular, v_TexCoord).rgb;
-    float shininess = texture(u_GShininess, v_TexCoord).r;
+    vec4 specular = texture(u_GSpecular, v_TexCoord);
+    vec3 specColor = specular.rgb;
+    float shininess = exp2(specular.a * GBUFFER_SHININESS_LOG2_RANGE);
     vec3 viewDir_tangentspace = normalize(invTBN * normalize(u_CameraPosition - vPosition_worldspace.xyz));
     vec3 L = normalize(vDir_tangentspace); // toward light in tangent space
     vec3 H = normalize(L + viewDir_tangentspace);
@@ -10,30 +10,61 @@ layout(location = 0) in vec2 v_TexCoord;
 
 uniform sampler2D u_GDiffuse;
 uniform sampler2D u_GSpecular;
-uniform sampler2D u_GShininess;
 uniform sampler2D u_GNormalTangentSpace;
-uniform sampler2D u_GPosition;
 uniform sampler2D u_GNormal;
 uniform sampler2D u_GTangent;
+uniform sampler2D u_GDepth;
 
-uniform sampler2D u_LightpassInput;
+// Must match the CPU-side define (see ShadowedPipeline.hpp): the locations below depend on it
+#define SHADOW_CASCADE_COUNT 4
 
+// one tile per cascade (see u_CascadeRects)
 uniform sampler2D u_LDepthTexture;
 
-layout(location = 0) uniform mat4 u_LightSpaceMatrix;
+// picks the cascade from the view depth
+layout(location = 0) uniform mat4 u_ViewMatrix;
 
 layout(location = 1) uniform vec3 u_LightDir;
 layout(location = 2) uniform vec3 u_LightColor;
 layout(location = 3) uniform vec3 u_CameraPosition;
+layout(location = 4) uniform mat4 u_InverseViewProjection;
+
+layout(location = 5) uniform int u_CascadeCount;
+
+// far view depth of each cascade
+layout(location = 6) uniform vec4 u_CascadeSplits;
+
+layout(location = 7) uniform mat4 u_CascadeMatrices[SHADOW_CASCADE_COUNT];
+
+// tile of each cascade in u_LDepthTexture, in texels: x, y, width, height
+layout(location = 11) uniform vec4 u_CascadeRects[SHADOW_CASCADE_COUNT];
 
 layout(location = 0) out vec3 o_LightpassOutput;
 
+// Must match the encodings of mesh.frag
+#define GBUFFER_SHININESS_LOG2_RANGE 11.0
+
+vec3 oct_decode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-v.z, 0.0);
+    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+    return normalize(v);
+}
+
+vec3 reconstruct_position(vec2 uv) {
+    float depth = texture(u_GDepth, uv).r;
+    vec4 position = u_InverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
+
 #if USE_PCF_SHADOWS
-float pcf_shadow(float currentDepth, float bias, ivec2 center) {
+float pcf_shadow(float currentDepth, float bias, ivec2 center, ivec2 tile_min, ivec2 tile_max) {
     float shadow = 0.0;
     for(int x = -2; x <= 2; ++x) {
         for(int y = -2; y <= 2; ++y) {
-            float pcfDepth = texelFetch(u_LDepthTexture, center + ivec2(x, y), 0).r;
+            // never sample the tile of another cascade
+            ivec2 texel = clamp(center + ivec2(x, y), tile_min, tile_max);
+            float pcfDepth = texelFetch(u_LDepthTexture, texel, 0).r;
             shadow += currentDepth - bias < pcfDepth ? 1.0 : 0.0;
         }    
     }
@@ -43,24 +74,29 @@ float pcf_shadow(float currentDepth, float bias, ivec2 center) {
 #endif
 
 void main() {
-    vec3 vNormal_worldspace = texture(u_GNormal, v_TexCoord).rgb;
-    vec3 vTangent_worldspace = texture(u_GTangent, v_TexCoord).rgb;
+    vec3 vNormal_worldspace = oct_decode(texture(u_GNormal, v_TexCoord).rg);
+    vec3 vTangent_worldspace = oct_decode(texture(u_GTangent, v_TexCoord).rg);
     vec3 vBitangent_worldspace = normalize(cross(vNormal_worldspace, vTangent_worldspace));
     mat3 TBN = mat3(vTangent_worldspace, vBitangent_worldspace, vNormal_worldspace);
     mat3 invTBN = transpose(TBN);
 
     vec3 vDiffuse = texture(u_GDiffuse, v_TexCoord).rgb;
-    vec4 vPosition_worldspace = vec4(texture(u_GPosition, v_TexCoord).xyz, 1.0);
+    vec4 vPosition_worldspace = vec4(reconstruct_position(v_TexCoord), 1.0);
 
-    ivec2 shadowTextureDimensions = textureSize(u_LDepthTexture, 0);
-
-    // load the input lightpass color: this is the light accumulated so far
-    vec3 result = texture(u_LightpassInput, v_TexCoord).rgb;
+    // only the contribution of this light: it is added to the lightbuffer by blending
+    vec3 result = vec3(0.0);
 
     vec3 normal = normalize(texture(u_GNormalTangentSpace, v_TexCoord).xyz /* * 2.0 - 1.0 */);
     vec3 light_dir = normalize(invTBN * u_LightDir);
 
-    vec4 lightSpacePos = u_LightSpaceMatrix * vPosition_worldspace;
+    // the first cascade reaching the view depth of the pixel
+    float view_depth = -(u_ViewMatrix * vPosition_worldspace).z;
+    int cascade = 0;
+    for (int i = 0; i < u_CascadeCount - 1; ++i) {
+        if (view_depth > u_CascadeSplits[i]) cascade = i + 1;
+    }
+
+    vec4 lightSpacePos = u_CascadeMatrices[cascade] * vPosition_worldspace;
     lightSpacePos /= lightSpacePos.w;
     vec2 shadowTexCoord = lightSpacePos.xy * 0.5 + 0.5;
     if (shadowTexCoord.x < 0.0 || shadowTexCoord.x > 1.0 || shadowTexCoord.y < 0.0 || shadowTexCoord.y > 1.0) {
@@ -68,13 +104,16 @@ void main() {
         return;
     }
 
-    vec2 texelPos = shadowTexCoord * vec2(float(shadowTextureDimensions.x), float(shadowTextureDimensions.y));
+    vec4 rect = u_CascadeRects[cascade];
+    vec2 texelPos = rect.xy + shadowTexCoord * rect.zw;
+    ivec2 tile_min = ivec2(rect.xy);
+    ivec2 tile_max = ivec2(rect.xy + rect.zw) - 1;
 
     // accumulate the contribution of the current directional light
     float NdotL_neg = dot(normal, -light_dir);
     float NdotL = max(NdotL_neg, 0.0);
 
-    float closestDepth = texelFetch(u_LDepthTexture, ivec2(texelPos), 0).r;
+    float closestDepth = texelFetch(u_LDepthTexture, min(ivec2(texelPos), tile_max), 0).r;
 
     float currentDepth = lightSpacePos.z * 0.5 + 0.5;
 
@@ -85,7 +124,7 @@ void main() {
 #endif
 
 #if USE_PCF_SHADOWS
-    float shadow = pcf_shadow(currentDepth, bias, ivec2(texelPos));
+    float shadow = pcf_shadow(currentDepth, bias, min(ivec2(texelPos), tile_max), tile_min, tile_max);
 #else
     float shadow = (currentDepth - bias) > closestDepth ? 0.0 : 1.0;
 #endif
@@ -93,8 +132,9 @@ void main() {
     vec3 diffuseContrib = u_LightColor * vDiffuse * NdotL;
 
     // Specular (Blinn-Phong) using G-buffer specular color and shininess
-    vec3 specColor = texture(u_GSpecular, v_TexCoord).rgb;
-    float shininess = texture(u_GShininess, v_TexCoord).r;
+    vec4 specular = texture(u_GSpecular, v_TexCoord);
+    vec3 specColor = specular.rgb;
+    float shininess = exp2(specular.a * GBUFFER_SHININESS_LOG2_RANGE);
     vec3 viewDir_tangentspace = normalize(invTBN * normalize(u_CameraPosition - vPosition_worldspace.xyz));
     vec3 L = normalize(-light_dir); // toward light in tangent space
     vec3 H = normalize(L + viewDir_tangentspace);
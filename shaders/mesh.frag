@@ -4,6 +4,9 @@ precision highp float;
 
 #define RE_ORTHOGONIZE_TANGENT 1
 
+// shininess is stored as log2(shininess) / GBUFFER_SHININESS_LOG2_RANGE in the specular alpha
+#define GBUFFER_SHININESS_LOG2_RANGE 11.0
+
 layout(location = 0) in vec2 in_vTextureUV;
 layout(location = 1) in vec3 in_vPosition_worldspace;
 layout(location = 2) in vec3 in_vNormal_worldspace;
@@ -13,22 +16,56 @@ uniform sampler2D u_DiffuseTex;
 uniform sampler2D u_SpecularTex;
 uniform sampler2D u_DisplacementTex;
 
+#ifdef DRAW_UNIFORM_BLOCKS
+// matrices and material of the draw (see mesh.vert)
+layout(std140, binding = 1) uniform DrawUniforms {
+    mat4 u_ModelMatrix;
+    mat3 u_NormalMatrix;
+    vec4 u_DiffuseColorShininess;
+    vec3 u_SpecularColor;
+    highp uint u_material_flags;
+};
+#else
 layout(location = 0) uniform mat4 u_MVP;
 layout(location = 1) uniform mat4 u_ModelMatrix;
 layout(location = 2) uniform mat3 u_NormalMatrix;
+#endif
 
+#ifdef DRAW_UNIFORM_BLOCKS
+#define u_DiffuseColor u_DiffuseColorShininess.rgb
+#define u_Shininess u_DiffuseColorShininess.a
+#elif defined(INDIRECT_DRAW)
+// material of the draw (see mesh.vert)
+layout(location = 4) flat in vec4 in_vDiffuseColorShininess;
+layout(location = 5) flat in vec3 in_vSpecularColor;
+layout(location = 6) flat in uint in_vMaterialFlags;
+
+#define u_DiffuseColor in_vDiffuseColorShininess.rgb
+#define u_SpecularColor in_vSpecularColor
+#define u_material_flags in_vMaterialFlags
+#define u_Shininess in_vDiffuseColorShininess.a
+#else
 layout(location = 4) uniform vec3 u_DiffuseColor;
 layout(location = 7) uniform vec3 u_SpecularColor;
 layout(location = 5) uniform uint u_material_flags;
 layout(location = 6) uniform float u_Shininess;
+#endif
 
 layout(location = 0) out vec4 gDiffuse;
 layout(location = 1) out vec4 gSpecular;
 layout(location = 2) out vec4 gNormalTangentspace;
-layout(location = 3) out vec4 gPosition;
-layout(location = 4) out vec4 gNormal;
-layout(location = 5) out vec4 gTangent;
-layout(location = 6) out float gShininess;
+layout(location = 3) out vec2 gNormal;
+layout(location = 4) out vec2 gTangent;
+
+// Octahedral encoding of a unit vector: the world position is rebuilt from depth by the lighting passes
+vec2 oct_encode(vec3 v) {
+    v /= abs(v.x) + abs(v.y) + abs(v.z);
+    vec2 e = v.xy;
+    if (v.z < 0.0) {
+        e = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return e;
+}
 
 void main() {
     // diffuse texture available: using it
@@ -41,10 +78,11 @@ void main() {
         gDiffuse = vec4(u_DiffuseColor, 0.0);
     }
 
+    float encoded_shininess = clamp(log2(max(u_Shininess, 1.0)) / GBUFFER_SHININESS_LOG2_RANGE, 0.0, 1.0);
     if ((u_material_flags & 0x2u) != 0u) {
-        gSpecular = vec4(texture(u_SpecularTex, in_vTextureUV).xyz, 0.0);
+        gSpecular = vec4(texture(u_SpecularTex, in_vTextureUV).xyz, encoded_shininess);
     } else {
-        gSpecular = vec4(u_SpecularColor, 0.0);
+        gSpecular = vec4(u_SpecularColor, encoded_shininess);
     }
 
     vec4 normal_tspace = vec4(0.0, 0.0, 1.0, 0.0);
@@ -53,16 +91,14 @@ void main() {
     }
     gNormalTangentspace = normal_tspace;
 
-    gPosition = vec4(in_vPosition_worldspace, 1.0);
-
     // also store world-space normal so lighting passes can read it
-    gNormal = vec4(in_vNormal_worldspace, 0.0);
+    vec3 normal = normalize(in_vNormal_worldspace);
+    gNormal = oct_encode(normal);
 
 #if RE_ORTHOGONIZE_TANGENT
     // Gram-Schmidt orthogonalization
-    gTangent = vec4(normalize(in_vTangent_worldspace - dot(in_vNormal_worldspace, in_vTangent_worldspace) * in_vNormal_worldspace), 0.0);
+    gTangent = oct_encode(normalize(in_vTangent_worldspace - dot(normal, in_vTangent_worldspace) * normal));
 #else
-    gTangent = vec4(in_vTangent_worldspace, 0.0);
+    gTangent = oct_encode(normalize(in_vTangent_worldspace));
 #endif
-    gShininess = u_Shininess;
 }
@@ -2,14 +2,17 @@
 
 precision highp float;
 
-#define BONE_IS_ROOT 0xFFFFFFFFu
-
-#define MAX_BONES 128u
-
 layout(location = 0) in vec3 in_vPosition_modelspace;
 layout(location = 1) in vec2 in_vTextureUV;
 layout(location = 2) in vec3 in_vNormal_modelspace;
 
+#if defined(CROWD_INSTANCING) || defined(BAKED_PALETTE)
+#define VERTEX_SKINNING
+#endif
+
+#ifdef VERTEX_SKINNING
+#define BONE_IS_ROOT 0xFFFFFFFFu
+
 layout(location = 3) in uint in_vBone_index_0;
 layout(location = 4) in float in_vBone_weight_0;
 
@@ -21,21 +24,136 @@ layout(location = 8) in float in_vBone_weight_2;
 
 layout(location = 9) in uint in_vBone_index_3;
 layout(location = 10) in float in_vBone_weight_3;
+#endif
+
+#ifdef CROWD_INSTANCING
+// Must match CPU-side CrowdGPUInstance
+struct CrowdGPUInstance {
+    mat4 model;
+
+    mat4 normal_matrix;
+
+    uint clip_index;
+
+    float time_offset;
+
+    uint padding_1;
+
+    uint padding_2;
+};
+
+// palettes of all the instances, one after the other (written by animate.comp with CROWD_INSTANCES)
+layout(std430, binding = 0) readonly buffer CrowdPaletteBuffer {
+    mat4 palette[];
+} crowd_palette;
+
+layout(std430, binding = 1) readonly buffer CrowdInstanceBuffer {
+    CrowdGPUInstance instances[];
+} crowd_instances;
+
+layout(location = 8) uniform uint u_BoneCount;
+
+mat4 bone_matrix(uint bi) {
+    return crowd_palette.palette[uint(gl_InstanceID) * u_BoneCount + bi];
+}
+#endif
+
+#ifdef BAKED_PALETTE
+// palettes of a baked clip (see BakedAnimation): texel (3 * bone + row, frame) holds a row of the bone matrix
+uniform highp sampler2D u_BakedPalette;
+
+// the two frames to blend and the weight of the second one
+layout(location = 9) uniform int u_BakedFrame0;
+layout(location = 10) uniform int u_BakedFrame1;
+layout(location = 11) uniform float u_BakedFrameBlend;
+
+mat4 baked_bone_matrix(int bone, int frame) {
+    vec4 r0 = texelFetch(u_BakedPalette, ivec2(3 * bone + 0, frame), 0);
+    vec4 r1 = texelFetch(u_BakedPalette, ivec2(3 * bone + 1, frame), 0);
+    vec4 r2 = texelFetch(u_BakedPalette, ivec2(3 * bone + 2, frame), 0);
+    return transpose(mat4(r0, r1, r2, vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+mat4 bone_matrix(uint bi) {
+    mat4 a = baked_bone_matrix(int(bi), u_BakedFrame0);
+    mat4 b = baked_bone_matrix(int(bi), u_BakedFrame1);
+    return a * (1.0 - u_BakedFrameBlend) + b * u_BakedFrameBlend;
+}
+#endif
+
+#ifdef INDIRECT_DRAW
+// Must match CPU-side IndirectDrawRecord
+struct IndirectDrawRecord {
+    mat4 model;
+
+    mat4 normal_matrix;
+
+    vec4 bounds_center;
+
+    vec4 bounds_extent;
+
+    vec4 diffuse_color_shininess;
+
+    vec4 specular_color;
+
+    uint material_flags;
 
-layout(std430, binding = 0) buffer SkeletonBuffer {
-    mat4 offset_matrix[];
-} skeleton;
+    uint index_count;
 
+    uint first_index;
+
+    int base_vertex;
+
+    uint batch;
+
+    uint batch_first;
+
+    uint padding_1;
+
+    uint padding_2;
+};
+
+layout(std430, binding = 0) readonly buffer IndirectDrawBuffer {
+    IndirectDrawRecord draws[];
+} indirect_draws;
+
+// per instance: the baseInstance of the indirect command, that is the index of the draw
+layout(location = 11) in uint in_vDrawIndex;
+
+// material of the draw, for mesh.frag (through mesh.geom)
+layout(location = 4) flat out vec4 out_vDiffuseColorShininess;
+layout(location = 5) flat out vec3 out_vSpecularColor;
+layout(location = 6) flat out uint out_vMaterialFlags;
+#endif
+
+#ifdef DRAW_UNIFORM_BLOCKS
+// Constants of the view and of the draw, ranges of the uniform ring (see RenderQueue).
+// Must match CPU-side ViewUniforms and DrawUniforms
+layout(std140, binding = 0) uniform ViewUniforms {
+    mat4 u_ViewProjection;
+};
+
+layout(std140, binding = 1) uniform DrawUniforms {
+    mat4 u_ModelMatrix;
+    mat3 u_NormalMatrix;
+    vec4 u_DiffuseColorShininess;
+    vec3 u_SpecularColor;
+    highp uint u_material_flags;
+};
+#else
+// With CROWD_INSTANCING and INDIRECT_DRAW u_MVP does not include the model matrix: that comes from the instance
 layout(location = 0) uniform mat4 u_MVP;
 layout(location = 1) uniform mat4 u_ModelMatrix;
 layout(location = 2) uniform mat3 u_NormalMatrix;
 layout(location = 3) uniform mat4 u_CustomGLPositionMatrix;
+#endif
 
 layout(location = 0) out vec2 out_vTextureUV;
 layout(location = 1) out vec3 out_vNormal_worldspace;
 layout(location = 2) out vec3 out_vPosition_modelspace;
 layout(location = 3) out vec3 out_vPosition_worldspace;
 
+#ifdef VERTEX_SKINNING
 void main() {
     // Skinning: blend position and normal by up to 4 bones.
     vec4 skinnedPos = vec4(0.0);
@@ -51,7 +169,7 @@ void main() {
         float w = wts[i];
         if (w <= 0.0) continue;
         if (bi == BONE_IS_ROOT) continue;
-        mat4 bm = skeleton.offset_matrix[bi];
+        mat4 bm = bone_matrix(bi);
         skinnedPos += bm * vec4(in_vPosition_modelspace, 1.0) * w;
         skinnedNormal += mat3(bm) * in_vNormal_modelspace * w;
         anyWeight = true;
@@ -62,9 +180,54 @@ void main() {
         skinnedNormal = in_vNormal_modelspace;
     }
 
+#ifdef CROWD_INSTANCING
+    mat4 instanceModel = crowd_instances.instances[gl_InstanceID].model;
+    mat3 instanceNormal = mat3(crowd_instances.instances[gl_InstanceID].normal_matrix);
+
+    vec4 worldPos = instanceModel * (u_ModelMatrix * skinnedPos);
+
+    gl_Position = u_MVP * u_CustomGLPositionMatrix * worldPos;
+    out_vNormal_worldspace = instanceNormal * (u_NormalMatrix * skinnedNormal);
+    out_vPosition_worldspace = worldPos.xyz;
+#else
     gl_Position = u_MVP * u_CustomGLPositionMatrix * skinnedPos;
-    out_vTextureUV = in_vTextureUV;
     out_vNormal_worldspace = u_NormalMatrix * skinnedNormal;
-    out_vPosition_modelspace = skinnedPos.xyz;
     out_vPosition_worldspace = (u_ModelMatrix * skinnedPos).xyz;
+#endif
+    out_vTextureUV = in_vTextureUV;
+    out_vPosition_modelspace = skinnedPos.xyz;
+}
+#elif defined(INDIRECT_DRAW)
+// Static meshes of the indirect draw buffer: model and material come from the draw record
+void main() {
+    IndirectDrawRecord draw = indirect_draws.draws[in_vDrawIndex];
+
+    vec4 position = vec4(in_vPosition_modelspace, 1.0);
+    vec4 worldPos = draw.model * position;
+
+    gl_Position = u_MVP * u_CustomGLPositionMatrix * worldPos;
+    out_vTextureUV = in_vTextureUV;
+    out_vNormal_worldspace = mat3(draw.normal_matrix) * in_vNormal_modelspace;
+    out_vPosition_modelspace = position.xyz;
+    out_vPosition_worldspace = worldPos.xyz;
+
+    out_vDiffuseColorShininess = draw.diffuse_color_shininess;
+    out_vSpecularColor = draw.specular_color.rgb;
+    out_vMaterialFlags = draw.material_flags;
+}
+#else
+// Skinned meshes are drawn from the vertex buffer written by skin.comp: no skinning here.
+void main() {
+    vec4 position = vec4(in_vPosition_modelspace, 1.0);
+
+#ifdef DRAW_UNIFORM_BLOCKS
+    gl_Position = u_ViewProjection * (u_ModelMatrix * position);
+#else
+    gl_Position = u_MVP * u_CustomGLPositionMatrix * position;
+#endif
+    out_vTextureUV = in_vTextureUV;
+    out_vNormal_worldspace = u_NormalMatrix * in_vNormal_modelspace;
+    out_vPosition_modelspace = position.xyz;
+    out_vPosition_worldspace = (u_ModelMatrix * position).xyz;
 }
+#endif
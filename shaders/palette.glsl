@@ -0,0 +1,77 @@
+// Skinning palette layout, shared by the kernels that write palettes (animate.comp,
+// animate_bind_pose.comp) and the ones that read them (skin.comp, bounds.comp) through
+// #include "palette.glsl" (see Shader::ResolveIncludes). Must match SkeletonTree::EncodePalette.
+//
+// The layout is chosen per SkeletonTree (see PaletteFormat) by injecting one of
+// PALETTE_FORMAT_AFFINE_3X4 or PALETTE_FORMAT_DUAL_QUATERNION: a full mat4 otherwise.
+#if defined(PALETTE_FORMAT_AFFINE_3X4)
+#define PALETTE_VEC4S_PER_BONE 3u
+#elif defined(PALETTE_FORMAT_DUAL_QUATERNION)
+#define PALETTE_VEC4S_PER_BONE 2u
+#else
+#define PALETTE_VEC4S_PER_BONE 4u
+#endif
+
+#ifdef PALETTE_FORMAT_DUAL_QUATERNION
+vec4 palette_quat_mul(vec4 a, vec4 b) {
+    return vec4(a.w * b.xyz + b.w * a.xyz + cross(a.xyz, b.xyz), a.w * b.w - dot(a.xyz, b.xyz));
+}
+
+// rotation of an orthonormal basis (m[column][row])
+vec4 palette_quat_from_mat3(mat3 m) {
+    float trace = m[0][0] + m[1][1] + m[2][2];
+    vec4 q;
+    if (trace > 0.0) {
+        float s = sqrt(trace + 1.0) * 2.0;
+        q = vec4((m[1][2] - m[2][1]) / s, (m[2][0] - m[0][2]) / s, (m[0][1] - m[1][0]) / s, 0.25 * s);
+    } else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+        float s = sqrt(1.0 + m[0][0] - m[1][1] - m[2][2]) * 2.0;
+        q = vec4(0.25 * s, (m[1][0] + m[0][1]) / s, (m[2][0] + m[0][2]) / s, (m[1][2] - m[2][1]) / s);
+    } else if (m[1][1] > m[2][2]) {
+        float s = sqrt(1.0 + m[1][1] - m[0][0] - m[2][2]) * 2.0;
+        q = vec4((m[1][0] + m[0][1]) / s, 0.25 * s, (m[2][1] + m[1][2]) / s, (m[2][0] - m[0][2]) / s);
+    } else {
+        float s = sqrt(1.0 + m[2][2] - m[0][0] - m[1][1]) * 2.0;
+        q = vec4((m[2][0] + m[0][2]) / s, (m[2][1] + m[1][2]) / s, 0.25 * s, (m[0][1] - m[1][0]) / s);
+    }
+    return normalize(q);
+}
+#endif
+
+// The PALETTE_VEC4S_PER_BONE vec4s stored for a bone matrix: the first columns of the result
+mat4 encode_palette(mat4 m) {
+#if defined(PALETTE_FORMAT_AFFINE_3X4)
+    // rows of the matrix: the last one is always (0, 0, 0, 1)
+    return transpose(m);
+#elif defined(PALETTE_FORMAT_DUAL_QUATERNION)
+    // rigid transforms only: scale is dropped
+    vec4 real = palette_quat_from_mat3(mat3(normalize(m[0].xyz), normalize(m[1].xyz), normalize(m[2].xyz)));
+    vec4 dual = 0.5 * palette_quat_mul(vec4(m[3].xyz, 0.0), real);
+    return mat4(real, dual, vec4(0.0), vec4(0.0));
+#else
+    return m;
+#endif
+}
+
+// The bone matrix back from the vec4s of encode_palette
+mat4 decode_palette(mat4 encoded) {
+#if defined(PALETTE_FORMAT_AFFINE_3X4)
+    return transpose(mat4(encoded[0], encoded[1], encoded[2], vec4(0.0, 0.0, 0.0, 1.0)));
+#elif defined(PALETTE_FORMAT_DUAL_QUATERNION)
+    vec4 r = encoded[0];
+    vec4 d = encoded[1];
+    vec3 t = 2.0 * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz));
+
+    float xx = r.x * r.x, yy = r.y * r.y, zz = r.z * r.z;
+    float xy = r.x * r.y, xz = r.x * r.z, yz = r.y * r.z;
+    float wx = r.w * r.x, wy = r.w * r.y, wz = r.w * r.z;
+    return mat4(
+        vec4(1.0 - 2.0 * (yy + zz), 2.0 * (xy + wz), 2.0 * (xz - wy), 0.0),
+        vec4(2.0 * (xy - wz), 1.0 - 2.0 * (xx + zz), 2.0 * (yz + wx), 0.0),
+        vec4(2.0 * (xz + wy), 2.0 * (yz - wx), 1.0 - 2.0 * (xx + yy), 0.0),
+        vec4(t, 1.0)
+    );
+#else
+    return encoded;
+#endif
+}
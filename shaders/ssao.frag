@@ -11,7 +11,7 @@ layout(location = 0) in vec2 v_TexCoord;
 #if HEMISPHERE_SAMPLING
 uniform sampler2D u_GNormal;
 #endif
-uniform sampler2D u_GPosition;
+uniform sampler2D u_GDepth;
 uniform usampler2D u_NoiseTex;
 
 layout(location = 0) out float o_ssao;
@@ -30,6 +30,24 @@ layout (location = 3) uniform float u_radius;
 
 layout (location = 4) uniform uint u_noise_dimensions;
 
+layout (location = 5) uniform mat4 u_InverseViewProjection;
+
+// world-space position of the surface seen at uv, rebuilt from the G-buffer depth
+vec3 reconstruct_position(vec2 uv) {
+    float depth = texture(u_GDepth, uv).r;
+    vec4 position = u_InverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
+
+#if HEMISPHERE_SAMPLING
+vec3 oct_decode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-v.z, 0.0);
+    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+    return normalize(v);
+}
+#endif
+
 #ifndef _RANDOM_
 #define _RANDOM_
 
@@ -129,13 +147,13 @@ mat4 rotate(float angle, vec3 axis) {
 }
 
 void main() {
-    vec4 position = vec4(texture(u_GPosition, v_TexCoord).xyz, 1.0);
+    vec4 position = vec4(reconstruct_position(v_TexCoord), 1.0);
 
     vec2 noise_scale = vec2(1.0);
     uint noise_seed = 0u;
     if (u_noise_dimensions > 0u) {
         ivec2 noise_tex_size = ivec2(int(u_noise_dimensions), int(u_noise_dimensions));
-        ivec2 gbuffer_tex_size = textureSize(u_GPosition, 0);
+        ivec2 gbuffer_tex_size = textureSize(u_GDepth, 0);
         noise_scale = vec2(float(gbuffer_tex_size.x) / float(noise_tex_size.x),
                                 float(gbuffer_tex_size.y) / float(noise_tex_size.y));
 
@@ -170,7 +188,7 @@ void main() {
 
         vec3 corrected_samplePos = position.xyz + rotated_sample.xyz;
 #if HEMISPHERE_SAMPLING
-        vec3 n = normalize(texture(u_GNormal, v_TexCoord).rgb);
+        vec3 n = oct_decode(texture(u_GNormal, v_TexCoord).rg);
         if (is_point_below_horizon(position.xyz, n, rejectable_samplePos)) {
             corrected_samplePos = position.xyz + (-1.0 * rotated_sample.xyz);
         }
@@ -200,7 +218,7 @@ void main() {
         // fetch the world-space sample position from the gbuffer, then transform
         // both the current fragment position and the sampled position into
         // view-space so depth comparison is with respect to the camera.
-        vec3 sampleWorldPos = texture(u_GPosition, scaled_samplePos.xy).xyz;
+        vec3 sampleWorldPos = reconstruct_position(scaled_samplePos.xy);
         vec4 sampleViewPos = u_ViewMatrix * vec4(sampleWorldPos, 1.0);
         vec4 fragViewPos = u_ViewMatrix * position;
 
@@ -7,9 +7,6 @@ layout(location = 0) in vec2 v_TexCoord;
 uniform sampler2D u_GDiffuse;
 uniform sampler2D u_GSpecular;
 uniform sampler2D u_GNormal;
-uniform sampler2D u_GPosition;
-
-uniform sampler2D u_LightpassInput;
 
 struct DirectionalLight { vec4 dir; vec4 color; };
 
@@ -18,14 +15,20 @@ layout(location = 1) uniform vec3 u_LightColor;
 
 layout(location = 0) out vec3 o_LightpassOutput;
 
+// Must match the encoding of mesh.frag
+vec3 oct_decode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-v.z, 0.0);
+    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+    return normalize(v);
+}
+
 void main() {
-    vec3 n = normalize(texture(u_GNormal, v_TexCoord).rgb);
+    vec3 n = oct_decode(texture(u_GNormal, v_TexCoord).rg);
     vec3 albedo = texture(u_GDiffuse, v_TexCoord).rgb;
 
-    // position available if needed: vec3 pos = texture(u_GPosition, v_TexCoord).xyz;
-
-    // load the input lightpass color: this is the light accumulated so far
-    vec3 result = texture(u_LightpassInput, v_TexCoord).rgb;
+    // only the contribution of this light: it is added to the lightbuffer by blending
+    vec3 result = vec3(0.0);
 
     // accumulate the contribution of the current directional light
     vec3 ldir = normalize(u_LightDir);